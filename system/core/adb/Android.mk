@@ -17,6 +17,13 @@ ADB_COMMON_CFLAGS := \
     -Wvla \
     -DADB_REVISION='"$(adb_version)"' \
 
+# The fdevent loop uses epoll on Linux hosts and devices; build with
+# ADB_FDEVENT_BACKEND=poll for the portable poll() loop instead.
+ADB_FDEVENT_BACKEND ?= epoll
+ifeq ($(ADB_FDEVENT_BACKEND),poll)
+ADB_COMMON_CFLAGS += -DADB_FDEVENT_POLL=1
+endif
+
 ADB_COMMON_linux_CFLAGS := \
     -std=c++14 \
     -Wexit-time-destructors \
@@ -51,6 +58,7 @@ LIBADB_SRC_FILES := \
     adb_trace.cpp \
     adb_utils.cpp \
     fdevent.cpp \
+    packet_pool.cpp \
     sockets.cpp \
     transport.cpp \
     transport_local.cpp \
@@ -60,6 +68,7 @@ LIBADB_TEST_SRCS := \
     adb_io_test.cpp \
     adb_utils_test.cpp \
     fdevent_test.cpp \
+    packet_pool_test.cpp \
     socket_test.cpp \
     sysdeps_test.cpp \
     transport_test.cpp \
@@ -145,14 +154,20 @@ LOCAL_CFLAGS := -DADB_HOST=0 $(LIBADB_CFLAGS)
 LOCAL_SRC_FILES := \
     $(LIBADB_TEST_SRCS) \
     $(LIBADB_TEST_linux_SRCS) \
+    file_sync_client.cpp \
+    file_sync_deflate.cpp \
+    file_sync_delta.cpp \
+    file_sync_service.cpp \
+    file_sync_test.cpp \
+    line_printer.cpp \
     shell_service.cpp \
     shell_service_protocol.cpp \
     shell_service_protocol_test.cpp \
     shell_service_test.cpp \
 
 LOCAL_SANITIZE := $(adb_target_sanitize)
-LOCAL_STATIC_LIBRARIES := libadbd
-LOCAL_SHARED_LIBRARIES := liblog libbase libcutils
+LOCAL_STATIC_LIBRARIES := libadbd libz
+LOCAL_SHARED_LIBRARIES := liblog libbase libcutils libcrypto libselinux
 include $(BUILD_NATIVE_TEST)
 
 # libdiagnose_usb
@@ -180,6 +195,10 @@ LOCAL_CFLAGS_linux := $(LIBADB_linux_CFLAGS)
 LOCAL_CFLAGS_darwin := $(LIBADB_darwin_CFLAGS)
 LOCAL_SRC_FILES := \
     $(LIBADB_TEST_SRCS) \
+    file_sync_deflate.cpp \
+    file_sync_deflate_test.cpp \
+    file_sync_delta.cpp \
+    file_sync_delta_test.cpp \
     services.cpp \
     shell_service_protocol.cpp \
     shell_service_protocol_test.cpp \
@@ -194,6 +213,7 @@ LOCAL_STATIC_LIBRARIES := \
     libcrypto_static \
     libcutils \
     libdiagnose_usb \
+    libz \
 
 # Set entrypoint to wmain from sysdeps_win32.cpp instead of main
 LOCAL_LDFLAGS_windows := -municode
@@ -244,6 +264,8 @@ LOCAL_SRC_FILES := \
     console.cpp \
     commandline.cpp \
     file_sync_client.cpp \
+    file_sync_deflate.cpp \
+    file_sync_delta.cpp \
     line_printer.cpp \
     services.cpp \
     shell_service_protocol.cpp \
@@ -274,6 +296,7 @@ LOCAL_STATIC_LIBRARIES := \
     libcrypto_static \
     libdiagnose_usb \
     liblog \
+    libz \
 
 # Don't use libcutils on Windows.
 LOCAL_STATIC_LIBRARIES_darwin := libcutils
@@ -305,6 +328,8 @@ LOCAL_CLANG := true
 LOCAL_SRC_FILES := \
     daemon/main.cpp \
     services.cpp \
+    file_sync_deflate.cpp \
+    file_sync_delta.cpp \
     file_sync_service.cpp \
     framebuffer_service.cpp \
     remount_service.cpp \
@@ -361,6 +386,7 @@ LOCAL_STATIC_LIBRARIES := \
     libcutils \
     libbase \
     libcrypto_static \
-    libminijail
+    libminijail \
+    libz
 
 include $(BUILD_EXECUTABLE)
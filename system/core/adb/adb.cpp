@@ -82,22 +82,6 @@ void fatal_errno(const char* fmt, ...) {
     exit(-1);
 }
 
-apacket* get_apacket(void)
-{
-    apacket* p = reinterpret_cast<apacket*>(malloc(sizeof(apacket)));
-    if (p == nullptr) {
-      fatal("failed to allocate an apacket");
-    }
-
-    memset(p, 0, sizeof(apacket) - MAX_PAYLOAD);
-    return p;
-}
-
-void put_apacket(apacket *p)
-{
-    free(p);
-}
-
 void handle_online(atransport *t)
 {
     D("adb: online");
@@ -161,7 +145,7 @@ void print_packet(const char *label, apacket *p)
 static void send_ready(unsigned local, unsigned remote, atransport *t)
 {
     D("Calling send_ready");
-    apacket *p = get_apacket();
+    apacket *p = get_apacket(0);
     p->msg.command = A_OKAY;
     p->msg.arg0 = local;
     p->msg.arg1 = remote;
@@ -171,7 +155,7 @@ static void send_ready(unsigned local, unsigned remote, atransport *t)
 static void send_close(unsigned local, unsigned remote, atransport *t)
 {
     D("Calling send_close");
-    apacket *p = get_apacket();
+    apacket *p = get_apacket(0);
     p->msg.command = A_CLSE;
     p->msg.arg0 = local;
     p->msg.arg1 = remote;
@@ -206,7 +190,7 @@ std::string get_connection_string() {
 
 void send_connect(atransport* t) {
     D("Calling send_connect");
-    apacket* cp = get_apacket();
+    apacket* cp = get_apacket(MAX_PAYLOAD_V1);
     cp->msg.command = A_CNXN;
     cp->msg.arg0 = t->get_protocol_version();
     cp->msg.arg1 = t->get_max_payload();
@@ -368,6 +352,11 @@ void handle_packet(apacket *p, atransport *t)
 
     case A_OPEN: /* OPEN(local-id, 0, "destination") */
         if (t->online && p->msg.arg0 != 0 && p->msg.arg1 == 0) {
+            if (p->msg.data_length == 0) {
+                // No payload to hold a name, there is nothing to open
+                send_close(0, p->msg.arg0, t);
+                break;
+            }
             char *name = (char*) p->data;
             name[p->msg.data_length > 0 ? p->msg.data_length - 1 : 0] = 0;
             s = create_local_service_socket(name, t);
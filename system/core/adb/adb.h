@@ -50,7 +50,7 @@ constexpr size_t MAX_PAYLOAD = MAX_PAYLOAD_V2;
 std::string adb_version();
 
 // Increment this when we want to force users to start a new adb server.
-#define ADB_SERVER_VERSION 36
+#define ADB_SERVER_VERSION 37
 
 class atransport;
 struct usb_handle;
@@ -64,6 +64,8 @@ struct amessage {
     unsigned magic;         /* command ^ 0xffffffff             */
 };
 
+struct apayload;
+
 struct apacket
 {
     apacket *next;
@@ -72,7 +74,13 @@ struct apacket
     unsigned char *ptr;
 
     amessage msg;
-    unsigned char data[MAX_PAYLOAD];
+
+    /* capacity bytes in a pooled payload block, which packets made with
+    ** share_apacket() reference too and must then only read
+    */
+    unsigned char *data;
+    size_t capacity;
+    apayload *payload;
 };
 
 /* the adisconnect structure is used to record a callback that
@@ -183,10 +191,28 @@ void framebuffer_service(int fd, void *cookie);
 void set_verity_enabled_state_service(int fd, void* cookie);
 #endif
 
-/* packet allocator */
-apacket *get_apacket(void);
+/* packet allocator (packet_pool.cpp)
+**
+** The payload of a packet holds at least payload_size bytes, there is none
+** for 0. Packets and payloads are recycled by size class.
+*/
+apacket *get_apacket(size_t payload_size = MAX_PAYLOAD);
 void put_apacket(apacket *p);
 
+/* for packets read from a transport, which only learn their payload size
+** from the header: room for payload_size bytes, dropping what p held
+*/
+void reserve_apacket(apacket *p, size_t payload_size);
+
+/* a new packet referencing the payload of p rather than a copy of it */
+apacket *share_apacket(apacket *p);
+
+/* copies the header of p in front of its payload, to be written in one
+** piece of sizeof(amessage) + msg.data_length bytes from the returned
+** pointer; nullptr when the payload is shared or there is none
+*/
+const unsigned char *prepend_apacket_header(apacket *p);
+
 // Define it if you want to dump packets.
 #define DEBUG_PACKETS 0
 
@@ -0,0 +1,113 @@
+#!/usr/bin/env python
+#
+# Copyright (C) 2016 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+"""Throughput and memory use of adb push, pull and shell.
+
+Meant for the local TCP transport, where the link is not the bottleneck:
+an emulator, or a device after `adb tcpip` and `adb connect`. Reports the
+time taken and the resident memory of the adb server and of adbd after
+each run, as VmRSS and VmHWM from /proc/<pid>/status.
+
+    ANDROID_SERIAL=localhost:5555 ./benchmark_device.py --size 256
+"""
+from __future__ import print_function
+
+import argparse
+import os
+import subprocess
+import tempfile
+import time
+
+import adb
+
+
+REMOTE_FILE = '/data/local/tmp/adb_benchmark'
+
+
+def parse_status(status):
+    """VmRSS and VmHWM in kB from the contents of /proc/<pid>/status."""
+    memory = {}
+    for line in status.splitlines():
+        key, _, value = line.partition(':')
+        if key in ('VmRSS', 'VmHWM'):
+            memory[key] = int(value.split()[0])
+    return memory
+
+
+def server_memory():
+    pids = subprocess.check_output(['pgrep', '-f', 'adb.*fork-server'])
+    with open('/proc/{}/status'.format(pids.split()[0])) as status:
+        return parse_status(status.read())
+
+
+def adbd_memory(device):
+    pid = device.shell(['pidof', 'adbd'])[0].split()[0]
+    return parse_status(device.shell(['cat', '/proc/{}/status'.format(pid)])[0])
+
+
+def report(name, size, seconds, device):
+    print('{:<8} {:8.1f} MB/s  server {}  adbd {}'.format(
+        name, size / seconds / (1024 * 1024), server_memory(),
+        adbd_memory(device)))
+
+
+def timed(func):
+    start = time.time()
+    func()
+    return time.time() - start
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--size', type=int, default=128,
+                        help='MB pushed, pulled and cat')
+    parser.add_argument('--runs', type=int, default=3)
+    args = parser.parse_args()
+
+    device = adb.get_device()
+    size = args.size * 1024 * 1024
+    local = tempfile.NamedTemporaryFile()
+    local.write(os.urandom(size))
+    local.flush()
+    pulled = tempfile.mkdtemp()
+
+    try:
+        for _ in range(args.runs):
+            report('push', size, timed(
+                lambda: device.push(local=local.name, remote=REMOTE_FILE)),
+                   device)
+            report('pull', size, timed(
+                lambda: device.pull(remote=REMOTE_FILE, local=pulled)), device)
+
+            def cat():
+                with open(os.devnull, 'w') as null:
+                    subprocess.check_call(
+                        device.adb_cmd + ['shell', 'cat', REMOTE_FILE],
+                        stdout=null)
+            report('shell', size, timed(cat), device)
+
+            # Control traffic only: many small packets
+            count = 100
+            seconds = timed(lambda: [device.shell(['true'])
+                                     for _ in range(count)])
+            print('{:<8} {:8.1f} ms/command'.format('command', seconds * 1000 / count))
+    finally:
+        device.shell(['rm', '-f', REMOTE_FILE])
+        subprocess.call(['rm', '-rf', pulled])
+
+
+if __name__ == '__main__':
+    main()
@@ -108,11 +108,15 @@ static void help() {
         "                                 will disconnect from all connected TCP/IP devices.\n"
         "\n"
         "device commands:\n"
-        "  adb push <local>... <remote>\n"
+        "  adb push [-z <level>] [--sync-delta] <local>... <remote>\n"
         "                               - copy files/dirs to device\n"
-        "  adb pull [-a] <remote>... <local>\n"
+        "                                 (--sync-delta sends only the blocks that differ\n"
+        "                                  from the files already on the device)\n"
+        "  adb pull [-a] [-z <level>] <remote>... <local>\n"
         "                               - copy files/dirs from device\n"
         "                                 (-a preserves file timestamp and mode)\n"
+        "                                 (-z deflates file data if the device can, at\n"
+        "                                  level 1 (fastest) to 9 (smallest); default 0, off)\n"
         "  adb sync [ <directory> ]     - copy host->device only if changed\n"
         "                                 (-l means list but don't copy)\n"
         "  adb shell [-e escape] [-n] [-Tt] [-x] [command]\n"
@@ -1383,8 +1387,11 @@ static std::string find_product_out_path(const std::string& hint) {
 
 static void parse_push_pull_args(const char** arg, int narg,
                                  std::vector<const char*>* srcs,
-                                 const char** dst, bool* copy_attrs) {
+                                 const char** dst, bool* copy_attrs,
+                                 int* deflate_level, bool* sync_delta) {
     *copy_attrs = false;
+    *deflate_level = 0;
+    *sync_delta = false;
 
     srcs->clear();
     bool ignore_flags = false;
@@ -1396,6 +1403,18 @@ static void parse_push_pull_args(const char** arg, int narg,
                 // Silently ignore for backwards compatibility.
             } else if (!strcmp(*arg, "-a")) {
                 *copy_attrs = true;
+            } else if (!strcmp(*arg, "-z")) {
+                char* end;
+                long level = (narg > 1) ? strtol(arg[1], &end, 10) : -1;
+                if (narg < 2 || *end != '\0' || level < 0 || level > 9) {
+                    fprintf(stderr, "adb: -z takes a level from 0 to 9\n");
+                    exit(1);
+                }
+                *deflate_level = level;
+                ++arg;
+                --narg;
+            } else if (!strcmp(*arg, "--sync-delta")) {
+                *sync_delta = true;
             } else if (!strcmp(*arg, "--")) {
                 ignore_flags = true;
             } else {
@@ -1799,18 +1818,24 @@ int adb_commandline(int argc, const char **argv) {
         std::vector<const char*> srcs;
         const char* dst = nullptr;
 
-        parse_push_pull_args(&argv[1], argc - 1, &srcs, &dst, &copy_attrs);
+        int deflate_level;
+        bool sync_delta;
+        parse_push_pull_args(&argv[1], argc - 1, &srcs, &dst, &copy_attrs, &deflate_level,
+                             &sync_delta);
         if (srcs.empty() || !dst) return usage();
-        return do_sync_push(srcs, dst) ? 0 : 1;
+        return do_sync_push(srcs, dst, deflate_level, sync_delta) ? 0 : 1;
     }
     else if (!strcmp(argv[0], "pull")) {
         bool copy_attrs = false;
         std::vector<const char*> srcs;
         const char* dst = ".";
 
-        parse_push_pull_args(&argv[1], argc - 1, &srcs, &dst, &copy_attrs);
-        if (srcs.empty()) return usage();
-        return do_sync_pull(srcs, dst, copy_attrs) ? 0 : 1;
+        int deflate_level;
+        bool sync_delta;
+        parse_push_pull_args(&argv[1], argc - 1, &srcs, &dst, &copy_attrs, &deflate_level,
+                             &sync_delta);
+        if (srcs.empty() || sync_delta) return usage();
+        return do_sync_pull(srcs, dst, copy_attrs, nullptr, deflate_level) ? 0 : 1;
     }
     else if (!strcmp(argv[0], "install")) {
         if (argc < 2) return usage();
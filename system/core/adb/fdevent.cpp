@@ -37,6 +37,16 @@
 #include "adb_trace.h"
 #include "adb_utils.h"
 
+// On Linux the loop waits in epoll_wait(), so that a wakeup costs as much as
+// the fds that are ready rather than all of those installed. Building with
+// ADB_FDEVENT_POLL keeps the poll() loop used everywhere else.
+#if defined(__linux__) && !defined(ADB_FDEVENT_POLL)
+#define FDEVENT_EPOLL 1
+#include <sys/epoll.h>
+#else
+#define FDEVENT_EPOLL 0
+#endif
+
 #if !ADB_HOST
 // This socket is used when a subproc shell service exists.
 // It wakes up the fdevent_loop() and cause the correct handling
@@ -54,6 +64,8 @@ int SHELL_EXIT_NOTIFY_FD = -1;
 struct PollNode {
   fdevent* fde;
   adb_pollfd pollfd;
+  // Tells this install of the fd from earlier ones under the same number.
+  uint32_t serial = 0;
 
   PollNode(fdevent* fde) : fde(fde) {
       memset(&pollfd, 0, sizeof(pollfd));
@@ -72,6 +84,13 @@ struct PollNode {
 static auto& g_poll_node_map = *new std::unordered_map<int, PollNode>();
 static auto& g_pending_list = *new std::list<fdevent*>();
 static std::atomic<bool> terminate_loop(false);
+#if FDEVENT_EPOLL
+static int g_epoll_fd = -1;
+// Fds epoll_ctl() refused, with the errno it gave: polled by hand in
+// fdevent_process(), see fdevent_unpolled_events().
+static auto& g_unpolled_fds = *new std::unordered_map<int, int>();
+static uint32_t g_install_serial;
+#endif
 static bool main_thread_valid;
 static unsigned long main_thread_id;
 
@@ -86,6 +105,67 @@ static void set_main_thread() {
     main_thread_id = adb_thread_id();
 }
 
+#if FDEVENT_EPOLL
+static int epoll_fd() {
+    if (g_epoll_fd == -1) {
+        g_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (g_epoll_fd == -1) {
+            PLOG(FATAL) << "failed to create epoll fd";
+        }
+    }
+    return g_epoll_fd;
+}
+
+// Keeps the epoll set in line with node.pollfd.events.
+static void fdevent_epoll_ctl(int op, const PollNode& node) {
+    int fd = node.pollfd.fd;
+    if (g_unpolled_fds.count(fd)) {
+        if (op == EPOLL_CTL_DEL) {
+            g_unpolled_fds.erase(fd);
+        }
+        return;
+    }
+
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    // Level triggered, as poll() is: callbacks are free to leave data
+    // unread and expect to be called again.
+    ev.events = EPOLLRDHUP;
+    if (node.pollfd.events & POLLIN) {
+        ev.events |= EPOLLIN;
+    }
+    if (node.pollfd.events & POLLOUT) {
+        ev.events |= EPOLLOUT;
+    }
+    // The serial as well as the fd, so that events for a registration left
+    // behind by an earlier install can be told apart in fdevent_process().
+    ev.data.u64 = (static_cast<uint64_t>(node.serial) << 32) | static_cast<uint32_t>(fd);
+    if (epoll_ctl(epoll_fd(), op, fd, &ev) == -1) {
+        if (op == EPOLL_CTL_ADD && (errno == EBADF || errno == EPERM)) {
+            // Not an open fd, or one that is always ready like a regular
+            // file: poll() takes those, so we take them too.
+            D("epoll_ctl(ADD) refused fd %d: %s", fd, strerror(errno));
+            g_unpolled_fds.emplace(fd, errno);
+        } else if (op == EPOLL_CTL_DEL) {
+            // Closed before its fdevent was removed. If the file is still
+            // open elsewhere, say in a child, it stays in the set, and its
+            // events are dropped in fdevent_process().
+            PLOG(ERROR) << "epoll_ctl(DEL) failed for fd " << fd;
+        } else {
+            PLOG(ERROR) << "epoll_ctl(" << op << ") failed for fd " << fd;
+        }
+    }
+}
+
+// What poll() would report for a fd epoll refused.
+static unsigned fdevent_unpolled_events(const PollNode& node, int error) {
+    if (error == EBADF) {
+        return POLLNVAL;
+    }
+    return node.pollfd.events & (POLLIN | POLLOUT);
+}
+#endif
+
 static std::string dump_fde(const fdevent* fde) {
     std::string state;
     if (fde->state & FDE_ACTIVE) {
@@ -149,6 +229,10 @@ void fdevent_install(fdevent* fde, int fd, fd_func func, void* arg) {
     }
     auto pair = g_poll_node_map.emplace(fde->fd, PollNode(fde));
     CHECK(pair.second) << "install existing fd " << fd;
+#if FDEVENT_EPOLL
+    pair.first->second.serial = ++g_install_serial;
+    fdevent_epoll_ctl(EPOLL_CTL_ADD, pair.first->second);
+#endif
     D("fdevent_install %s", dump_fde(fde).c_str());
 }
 
@@ -156,6 +240,10 @@ void fdevent_remove(fdevent* fde) {
     check_main_thread();
     D("fdevent_remove %s", dump_fde(fde).c_str());
     if (fde->state & FDE_ACTIVE) {
+#if FDEVENT_EPOLL
+        // Before the fd is closed, or while it is still open elsewhere
+        fdevent_epoll_ctl(EPOLL_CTL_DEL, g_poll_node_map.at(fde->fd));
+#endif
         g_poll_node_map.erase(fde->fd);
         if (fde->state & FDE_PENDING) {
             g_pending_list.remove(fde);
@@ -184,6 +272,9 @@ static void fdevent_update(fdevent* fde, unsigned events) {
     } else {
         node.pollfd.events &= ~POLLOUT;
     }
+#if FDEVENT_EPOLL
+    fdevent_epoll_ctl(EPOLL_CTL_MOD, node);
+#endif
     fde->state = (fde->state & FDE_STATEMASK) | events;
 }
 
@@ -217,6 +308,99 @@ void fdevent_del(fdevent* fde, unsigned events) {
     fdevent_set(fde, (fde->state & FDE_EVENTMASK) & ~events);
 }
 
+static void fdevent_mark_pending(int fd, unsigned revents) {
+    if (revents != 0) {
+        D("for fd %d, revents = %x", fd, revents);
+    }
+    unsigned events = 0;
+    if (revents & POLLIN) {
+        events |= FDE_READ;
+    }
+    if (revents & POLLOUT) {
+        events |= FDE_WRITE;
+    }
+    if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+        // We fake a read, as the rest of the code assumes that errors will
+        // be detected at that point.
+        events |= FDE_READ | FDE_ERROR;
+    }
+#if defined(__linux__)
+    if (revents & POLLRDHUP) {
+        events |= FDE_READ | FDE_ERROR;
+    }
+#endif
+    if (events != 0) {
+        auto it = g_poll_node_map.find(fd);
+        if (it == g_poll_node_map.end()) {
+            D("dropping events %x for fd %d, not installed", events, fd);
+            return;
+        }
+        fdevent* fde = it->second.fde;
+        CHECK_EQ(fde->fd, fd);
+        fde->events |= events;
+        D("%s got events %x", dump_fde(fde).c_str(), events);
+        fde->state |= FDE_PENDING;
+        g_pending_list.push_back(fde);
+    }
+}
+
+#if FDEVENT_EPOLL
+
+static void fdevent_process() {
+    CHECK_GT(g_poll_node_map.size(), 0u);
+
+    // Anything epoll could not take that is ready now must not wait.
+    int timeout = -1;
+    for (const auto& pair : g_unpolled_fds) {
+        if (fdevent_unpolled_events(g_poll_node_map.at(pair.first), pair.second)) {
+            timeout = 0;
+            break;
+        }
+    }
+
+    epoll_event events[256];
+    D("epoll_wait(), %zu fds installed", g_poll_node_map.size());
+    int ret = epoll_wait(epoll_fd(), events, arraysize(events), timeout);
+    if (ret == -1) {
+        PLOG(ERROR) << "epoll_wait(), ret = " << ret;
+        return;
+    }
+    for (int i = 0; i < ret; ++i) {
+        unsigned revents = 0;
+        if (events[i].events & EPOLLIN) {
+            revents |= POLLIN;
+        }
+        if (events[i].events & EPOLLOUT) {
+            revents |= POLLOUT;
+        }
+        if (events[i].events & EPOLLERR) {
+            revents |= POLLERR;
+        }
+        if (events[i].events & EPOLLHUP) {
+            revents |= POLLHUP;
+        }
+        if (events[i].events & EPOLLRDHUP) {
+            revents |= POLLRDHUP;
+        }
+        int fd = static_cast<int>(events[i].data.u64 & 0xffffffff);
+        uint32_t serial = static_cast<uint32_t>(events[i].data.u64 >> 32);
+        auto it = g_poll_node_map.find(fd);
+        if (it != g_poll_node_map.end() && it->second.serial != serial) {
+            // From a file closed before its fdevent was removed, whose
+            // number has been reused since.
+            D("dropping events %x for an earlier install of fd %d", revents, fd);
+            continue;
+        }
+        fdevent_mark_pending(fd, revents);
+    }
+    for (const auto& pair : g_unpolled_fds) {
+        fdevent_mark_pending(pair.first,
+                             fdevent_unpolled_events(g_poll_node_map.at(pair.first), pair.second));
+    }
+}
+
+#else
+
 static std::string dump_pollfds(const std::vector<adb_pollfd>& pollfds) {
     std::string result;
     for (const auto& pollfd : pollfds) {
@@ -245,39 +429,12 @@ static void fdevent_process() {
         return;
     }
     for (const auto& pollfd : pollfds) {
-        if (pollfd.revents != 0) {
-            D("for fd %d, revents = %x", pollfd.fd, pollfd.revents);
-        }
-        unsigned events = 0;
-        if (pollfd.revents & POLLIN) {
-            events |= FDE_READ;
-        }
-        if (pollfd.revents & POLLOUT) {
-            events |= FDE_WRITE;
-        }
-        if (pollfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
-            // We fake a read, as the rest of the code assumes that errors will
-            // be detected at that point.
-            events |= FDE_READ | FDE_ERROR;
-        }
-#if defined(__linux__)
-        if (pollfd.revents & POLLRDHUP) {
-            events |= FDE_READ | FDE_ERROR;
-        }
-#endif
-        if (events != 0) {
-            auto it = g_poll_node_map.find(pollfd.fd);
-            CHECK(it != g_poll_node_map.end());
-            fdevent* fde = it->second.fde;
-            CHECK_EQ(fde->fd, pollfd.fd);
-            fde->events |= events;
-            D("%s got events %x", dump_fde(fde).c_str(), events);
-            fde->state |= FDE_PENDING;
-            g_pending_list.push_back(fde);
-        }
+        fdevent_mark_pending(pollfd.fd, pollfd.revents);
     }
 }
 
+#endif // FDEVENT_EPOLL
+
 static void fdevent_call_fdfunc(fdevent* fde)
 {
     unsigned events = fde->events;
@@ -391,6 +548,13 @@ size_t fdevent_installed_count() {
 }
 
 void fdevent_reset() {
+#if FDEVENT_EPOLL
+    if (g_epoll_fd != -1) {
+        adb_close(g_epoll_fd);
+        g_epoll_fd = -1;
+    }
+    g_unpolled_fds.clear();
+#endif
     g_poll_node_map.clear();
     g_pending_list.clear();
     main_thread_valid = false;
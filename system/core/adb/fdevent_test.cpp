@@ -18,9 +18,17 @@
 
 #include <gtest/gtest.h>
 
+#include <stdio.h>
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
 #include <limits>
 #include <queue>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "adb_io.h"
@@ -175,3 +183,186 @@ TEST_F(FdeventTest, invalid_fd) {
     ASSERT_TRUE(adb_thread_create(InvalidFdThreadFunc, nullptr, &thread));
     ASSERT_TRUE(adb_thread_join(thread));
 }
+
+#if !defined(_WIN32)
+struct ClosedFdArg {
+    // The read end of a socketpair, open elsewhere as well.
+    int closed_fd;
+    // Read ends of socketpairs, the second one to be moved to the number
+    // |closed_fd| had.
+    int trigger_fd;
+    int reused_fd;
+    fdevent closed_fde;
+    fdevent trigger_fde;
+    fdevent reused_fde;
+};
+
+static void ClosedFdEventCallback(int fd, unsigned events, void*) {
+    ADD_FAILURE() << "closed fd " << fd << " got events " << events;
+}
+
+static void ReusedFdEventCallback(int fd, unsigned events, void* userdata) {
+    ClosedFdArg* arg = reinterpret_cast<ClosedFdArg*>(userdata);
+    EXPECT_EQ(unsigned(FDE_READ), events);
+    char c;
+    ASSERT_EQ(1, adb_read(fd, &c, 1));
+    fdevent_remove(&arg->reused_fde);
+    fdevent_remove(&arg->trigger_fde);
+    fdevent_terminate_loop();
+}
+
+static void TriggerFdEventCallback(int fd, unsigned events, void* userdata) {
+    ClosedFdArg* arg = reinterpret_cast<ClosedFdArg*>(userdata);
+    char c;
+    ASSERT_EQ(1, adb_read(fd, &c, 1));
+    fdevent_del(&arg->trigger_fde, FDE_READ);
+    ASSERT_EQ(arg->closed_fd, dup2(arg->reused_fd, arg->closed_fd));
+    ASSERT_EQ(0, adb_close(arg->reused_fd));
+    fdevent_install(&arg->reused_fde, arg->closed_fd, ReusedFdEventCallback, arg);
+    fdevent_add(&arg->reused_fde, FDE_READ);
+}
+
+static void ClosedFdThreadFunc(ClosedFdArg* arg) {
+    // As jdwp_service.cpp once did: the fd is closed before its fdevent is
+    // removed, while the file stays open elsewhere and is ready to read.
+    fdevent_install(&arg->closed_fde, arg->closed_fd, ClosedFdEventCallback, nullptr);
+    fdevent_add(&arg->closed_fde, FDE_READ);
+    arg->closed_fde.state |= FDE_DONT_CLOSE;
+    ASSERT_EQ(0, adb_close(arg->closed_fd));
+    fdevent_remove(&arg->closed_fde);
+
+    fdevent_install(&arg->trigger_fde, arg->trigger_fd, TriggerFdEventCallback, arg);
+    fdevent_add(&arg->trigger_fde, FDE_READ);
+    fdevent_loop();
+}
+
+// The events of a registration left behind go neither to a fd no longer
+// installed, nor to one installed since under the same number.
+TEST_F(FdeventTest, closed_before_remove) {
+    int closed_fds[2];
+    int trigger_fds[2];
+    int reused_fds[2];
+    ASSERT_EQ(0, adb_socketpair(closed_fds));
+    ASSERT_EQ(0, adb_socketpair(trigger_fds));
+    ASSERT_EQ(0, adb_socketpair(reused_fds));
+    int elsewhere = dup(closed_fds[0]);
+    ASSERT_NE(-1, elsewhere);
+    ASSERT_TRUE(WriteFdExactly(closed_fds[1], "x", 1));
+
+    ClosedFdArg arg;
+    arg.closed_fd = closed_fds[0];
+    arg.trigger_fd = trigger_fds[0];
+    arg.reused_fd = reused_fds[0];
+    adb_thread_t thread;
+    ASSERT_TRUE(adb_thread_create(reinterpret_cast<void (*)(void*)>(ClosedFdThreadFunc), &arg,
+                                  &thread));
+
+    // Each write once the loop has had time to see the file closed ready.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    ASSERT_TRUE(WriteFdExactly(trigger_fds[1], "x", 1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    ASSERT_TRUE(WriteFdExactly(reused_fds[1], "x", 1));
+    ASSERT_TRUE(adb_thread_join(thread));
+
+    for (int fd : {closed_fds[1], trigger_fds[1], reused_fds[1], elsewhere}) {
+        ASSERT_EQ(0, adb_close(fd));
+    }
+}
+#endif
+
+struct IdleFdsArg {
+    ThreadArg chain;
+    std::vector<int> idle_fds;
+};
+
+static void IdleFdEventCallback(int fd, unsigned events, void* userdata) {
+    ADD_FAILURE() << "idle fd " << fd << " got events " << events;
+    fdevent_del(reinterpret_cast<fdevent*>(userdata), FDE_READ);
+}
+
+static void IdleFdsThreadFunc(IdleFdsArg* arg) {
+    std::vector<fdevent> idle_fdes(arg->idle_fds.size());
+    for (size_t i = 0; i < idle_fdes.size(); ++i) {
+        fdevent_install(&idle_fdes[i], arg->idle_fds[i], IdleFdEventCallback, &idle_fdes[i]);
+        fdevent_add(&idle_fdes[i], FDE_READ);
+    }
+    FdEventThreadFunc(&arg->chain);
+    for (fdevent& fde : idle_fdes) {
+        fdevent_remove(&fde);
+    }
+}
+
+// As many idle fds as the fd limit allows, up to |wanted|, with both ends open.
+static size_t IdleFdLimit(size_t wanted) {
+    const size_t reserved = 64;
+#if defined(_WIN32)
+    return wanted;
+#else
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        return 0;
+    }
+    if (limit.rlim_cur < 2 * wanted + reserved && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, 2 * wanted + reserved);
+        setrlimit(RLIMIT_NOFILE, &limit);
+        getrlimit(RLIMIT_NOFILE, &limit);
+    }
+    if (limit.rlim_cur < reserved) {
+        return 0;
+    }
+    return std::min<size_t>(wanted, (limit.rlim_cur - reserved) / 2);
+#endif
+}
+
+// Thousands of idle fds, as with many forwards, JDWP connections and shells,
+// and a few hot ones that carry all the traffic. Reports the time a message
+// takes to go through the hot ones, which should not grow with the idle count.
+TEST_F(FdeventTest, idle_fds_benchmark) {
+    const size_t PIPE_COUNT = 4;
+    const size_t MESSAGE_LOOP_COUNT = 1000;
+    const std::string MESSAGE = "fdevent_test";
+
+    IdleFdsArg arg;
+    std::vector<int> idle_peers;
+    const size_t idle_count = IdleFdLimit(5000);
+    for (size_t i = 0; i < idle_count; ++i) {
+        int fds[2];
+        ASSERT_EQ(0, adb_socketpair(fds));
+        arg.idle_fds.push_back(fds[0]);
+        idle_peers.push_back(fds[1]);
+    }
+
+    int fd_pair1[2];
+    int fd_pair2[2];
+    ASSERT_EQ(0, adb_socketpair(fd_pair1));
+    ASSERT_EQ(0, adb_socketpair(fd_pair2));
+    arg.chain.first_read_fd = fd_pair1[0];
+    arg.chain.last_write_fd = fd_pair2[1];
+    arg.chain.middle_pipe_count = PIPE_COUNT;
+    int writer = fd_pair1[1];
+    int reader = fd_pair2[0];
+
+    adb_thread_t thread;
+    PrepareThread();
+    ASSERT_TRUE(adb_thread_create(reinterpret_cast<void (*)(void*)>(IdleFdsThreadFunc), &arg,
+                                  &thread));
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < MESSAGE_LOOP_COUNT; ++i) {
+        std::string read_buffer = MESSAGE;
+        std::string write_buffer(MESSAGE.size(), 'a');
+        ASSERT_TRUE(WriteFdExactly(writer, read_buffer.c_str(), read_buffer.size()));
+        ASSERT_TRUE(ReadFdExactly(reader, &write_buffer[0], write_buffer.size()));
+        ASSERT_EQ(read_buffer, write_buffer);
+    }
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    printf("%zu idle fds: %.1f us per message through %zu hot fds\n", idle_count,
+           elapsed.count() / MESSAGE_LOOP_COUNT, 2 * (PIPE_COUNT + 1));
+
+    TerminateThread(thread);
+    ASSERT_EQ(0, adb_close(writer));
+    ASSERT_EQ(0, adb_close(reader));
+    for (int fd : idle_peers) {
+        ASSERT_EQ(0, adb_close(fd));
+    }
+}
@@ -28,8 +28,10 @@
 #include <unistd.h>
 #include <utime.h>
 
+#include <deque>
 #include <functional>
 #include <memory>
+#include <utility>
 #include <vector>
 
 #include "sysdeps.h"
@@ -38,18 +40,23 @@
 #include "adb_client.h"
 #include "adb_io.h"
 #include "adb_utils.h"
+#include "file_sync_deflate.h"
+#include "file_sync_delta.h"
 #include "file_sync_service.h"
 #include "line_printer.h"
+#include "services.h"
+#include "transport.h"
 
 #include <android-base/file.h>
 #include <android-base/strings.h>
 #include <android-base/stringprintf.h>
 
-struct syncsendbuf {
-    unsigned id;
-    unsigned size;
-    char data[SYNC_DATA_MAX];
-};
+// Requests in flight on a pipelining connection. Replies are small next to
+// what the socket buffers hold, so nothing blocks for want of reading them.
+static const size_t kSyncWindow = 64;
+
+// Enough for files of tens of GB, whatever the block size.
+static const size_t kMaxSignatures = 4 * 1024 * 1024;
 
 static void ensure_trailing_separators(std::string& local_path, std::string& remote_path) {
     if (!adb_is_separator(local_path.back())) {
@@ -96,16 +103,47 @@ struct copyinfo {
 
 class SyncConnection {
   public:
-    SyncConnection()
+    // |deflate_level| 0 for no compression, else as for SyncDeflater.
+    // |delta| for SendDeltaFile, where the device can.
+    explicit SyncConnection(int deflate_level = 0, bool delta = false)
             : total_bytes_(0),
+              wire_bytes_(0),
               start_time_ms_(CurrentTimeMs()),
               expected_total_bytes_(0),
               expect_multiple_files_(false),
-              expect_done_(false) {
-        max = SYNC_DATA_MAX; // TODO: decide at runtime.
-
+              expect_done_(0),
+              delta_(false) {
+        FeatureSet features;
         std::string error;
-        fd = adb_connect("sync:", &error);
+        // If this fails, so will the connect below, and say why.
+        bool have_features = adb_get_feature_set(&features, &error);
+        pipeline_ = have_features && CanUseFeature(features, kFeatureSyncPipeline);
+        max = pipeline_ ? SYNC_DATA_MAX_PIPELINE : SYNC_DATA_MAX;
+        window = pipeline_ ? kSyncWindow : 1;
+        buffer.resize(sizeof(SyncRequest) + max);
+
+        std::string service = "sync";
+        if (pipeline_) {
+            service += android::base::StringPrintf(",%s", kSyncServiceArgPipeline);
+        }
+        if (deflate_level > 0 && have_features && CanUseFeature(features, kFeatureSyncDeflate)) {
+            // The device sends with the same level as we do.
+            service += android::base::StringPrintf(",%s%d", kSyncServiceArgDeflate,
+                                                   deflate_level);
+            deflater_.reset(new SyncDeflater(deflate_level));
+            inflater_.reset(new SyncInflater());
+            zbuffer_.resize(sizeof(SyncRequest) + max);
+        }
+        if (delta && have_features) {
+            if (CanUseFeature(features, kFeatureSyncDelta)) {
+                service += android::base::StringPrintf(",%s", kSyncServiceArgDelta);
+                delta_ = true;
+            } else {
+                Warning("device does not support delta pushes; sending whole files");
+            }
+        }
+        service += ":";
+        fd = adb_connect(service, &error);
         if (fd < 0) {
             Error("connect failed: %s", error.c_str());
         }
@@ -161,11 +199,13 @@ class SyncConnection {
     }
 
     // Sending header, payload, and footer in a single write makes a huge
-    // difference to "adb sync" performance.
+    // difference to "adb sync" performance. A symlink's target goes this
+    // way too, but never deflated.
     bool SendSmallFile(const char* path_and_mode,
                        const char* lpath, const char* rpath,
                        unsigned mtime,
-                       const char* data, size_t data_length) {
+                       const char* data, size_t data_length,
+                       bool is_link = false) {
         size_t path_length = strlen(path_and_mode);
         if (path_length > 1024) {
             Error("SendSmallFile failed: path too long: %zu", path_length);
@@ -173,8 +213,19 @@ class SyncConnection {
             return false;
         }
 
+        unsigned data_id = ID_DATA;
+        size_t wire_length = data_length;
+        if (deflater_ && !is_link) {
+            size_t deflated = deflater_->Deflate(data, data_length, &zbuffer_[0]);
+            if (deflated != 0) {
+                data_id = ID_ZDAT;
+                wire_length = deflated;
+                data = &zbuffer_[0];
+            }
+        }
+
         std::vector<char> buf(sizeof(SyncRequest) + path_length +
-                              sizeof(SyncRequest) + data_length +
+                              sizeof(SyncRequest) + wire_length +
                               sizeof(SyncRequest));
         char* p = &buf[0];
 
@@ -186,11 +237,11 @@ class SyncConnection {
         p += path_length;
 
         SyncRequest* req_data = reinterpret_cast<SyncRequest*>(p);
-        req_data->id = ID_DATA;
-        req_data->path_length = data_length;
+        req_data->id = data_id;
+        req_data->path_length = wire_length;
         p += sizeof(SyncRequest);
-        memcpy(p, data, data_length);
-        p += data_length;
+        memcpy(p, data, wire_length);
+        p += wire_length;
 
         SyncRequest* req_done = reinterpret_cast<SyncRequest*>(p);
         req_done->id = ID_DONE;
@@ -198,8 +249,9 @@ class SyncConnection {
         p += sizeof(SyncRequest);
 
         WriteOrDie(lpath, rpath, &buf[0], (p - &buf[0]));
-        expect_done_ = true;
+        ++expect_done_;
         total_bytes_ += data_length;
+        wire_bytes_ += wire_length;
         ReportProgress(rpath, data_length, data_length);
         return true;
     }
@@ -207,6 +259,11 @@ class SyncConnection {
     bool SendLargeFile(const char* path_and_mode,
                        const char* lpath, const char* rpath,
                        unsigned mtime) {
+        // Replies to earlier files would pass for an early ID_FAIL below.
+        if (!FinishCopies()) {
+            return false;
+        }
+
         if (!SendRequest(ID_SEND, path_and_mode)) {
             Error("failed to send ID_SEND message '%s': %s", path_and_mode, strerror(errno));
             return false;
@@ -227,10 +284,9 @@ class SyncConnection {
             return false;
         }
 
-        syncsendbuf sbuf;
-        sbuf.id = ID_DATA;
+        char* data = &buffer[sizeof(SyncRequest)];
         while (true) {
-            int bytes_read = adb_read(lfd, sbuf.data, max);
+            int bytes_read = adb_read(lfd, data, max);
             if (bytes_read == -1) {
                 Error("reading '%s' locally failed: %s", lpath, strerror(errno));
                 adb_close(lfd);
@@ -239,8 +295,7 @@ class SyncConnection {
                 break;
             }
 
-            sbuf.size = bytes_read;
-            WriteOrDie(lpath, rpath, &sbuf, sizeof(SyncRequest) + bytes_read);
+            SendChunk(lpath, rpath, data, bytes_read);
 
             total_bytes_ += bytes_read;
             bytes_copied += bytes_read;
@@ -258,10 +313,175 @@ class SyncConnection {
         syncmsg msg;
         msg.data.id = ID_DONE;
         msg.data.size = mtime;
-        expect_done_ = true;
+        ++expect_done_;
         return WriteOrDie(lpath, rpath, &msg.data, sizeof(msg.data));
     }
 
+    bool IsDelta() { return delta_; }
+
+    // As SendLargeFile, but the parts of the file that are in a block of the
+    // one already at |rpath| are sent as ID_COPYs of that block.
+    bool SendDeltaFile(const char* path_and_mode,
+                       const char* lpath, const char* rpath,
+                       unsigned mtime) {
+        if (!FinishCopies()) {
+            return false;
+        }
+
+        std::unique_ptr<DeltaIndex> index;
+        if (!ReadSignatures(rpath, &index)) {
+            return false;
+        }
+        if (!index) {
+            return SendLargeFile(path_and_mode, lpath, rpath, mtime);
+        }
+
+        if (!SendRequest(ID_SEND, path_and_mode)) {
+            Error("failed to send ID_SEND message '%s': %s", path_and_mode, strerror(errno));
+            return false;
+        }
+
+        struct stat st;
+        if (stat(lpath, &st) == -1) {
+            Error("cannot stat '%s': %s", lpath, strerror(errno));
+            return false;
+        }
+
+        int lfd = adb_open(lpath, O_RDONLY);
+        if (lfd < 0) {
+            Error("opening '%s' locally failed: %s", lpath, strerror(errno));
+            return false;
+        }
+
+        // A block is looked for at each offset in turn, in a window onto the
+        // file of what has not been sent yet, [start, pos), the block at pos,
+        // and room to read as much again.
+        const size_t block = index->block_size();
+        std::vector<char> window(2 * max + block);
+        uint64_t window_offset = 0;
+        size_t start = 0;
+        size_t pos = 0;
+        size_t end = 0;
+        bool eof = false;
+        RollingChecksum weak;
+        bool weak_valid = false;
+        // Runs of blocks go as one ID_COPY, and a block is likely to be
+        // followed by the one that followed it before.
+        SyncCopyRange copy = { 0, 0 };
+        ssize_t next_block = 0;
+        uint64_t bytes_copied = 0;
+        // Of all that was read, for the device to check the copies against.
+        FileChecksum checksum;
+        bool copied = false;
+
+        auto send_copy = [&]() {
+            if (copy.length == 0) return;
+            struct __attribute__((packed)) {
+                SyncRequest req;
+                SyncCopyRange range;
+            } msg = { { ID_COPY, sizeof(SyncCopyRange) }, copy };
+            WriteOrDie(lpath, rpath, &msg, sizeof(msg));
+            wire_bytes_ += sizeof(SyncCopyRange);
+            copy.length = 0;
+            copied = true;
+        };
+        auto send_literal = [&](size_t length) {
+            send_copy();
+            SendChunk(lpath, rpath, &window[start], length);
+            start += length;
+        };
+        auto add_copy = [&](uint64_t offset, uint64_t length) {
+            if (pos > start) send_literal(pos - start);
+            if (copy.length == 0 || copy.offset + copy.length != offset) {
+                send_copy();
+                copy.offset = offset;
+            }
+            copy.length += length;
+            pos += length;
+            start = pos;
+        };
+
+        while (true) {
+            if (end - pos < block && !eof) {
+                uint64_t sent = window_offset + start;
+                total_bytes_ += sent - bytes_copied;
+                bytes_copied = sent;
+                if (ReceivedError(lpath, rpath)) {
+                    break;
+                }
+                ReportProgress(rpath, bytes_copied, st.st_size);
+
+                memmove(&window[0], &window[start], end - start);
+                window_offset += start;
+                pos -= start;
+                end -= start;
+                start = 0;
+                int bytes_read = adb_read(lfd, &window[end], window.size() - end);
+                if (bytes_read == -1) {
+                    Error("reading '%s' locally failed: %s", lpath, strerror(errno));
+                    adb_close(lfd);
+                    return false;
+                }
+                eof = (bytes_read == 0);
+                checksum.Update(&window[end], bytes_read);
+                end += bytes_read;
+                continue;
+            }
+
+            if (end - pos < block) {
+                // All that is left: the device's last block, or not.
+                ssize_t tail = index->FindTail(&window[pos], end - pos);
+                if (tail >= 0) {
+                    add_copy(tail * block, end - pos);
+                }
+                while (start < end) {
+                    send_literal(std::min(end - start, max));
+                }
+                send_copy();
+                total_bytes_ += window_offset + end - bytes_copied;
+                bytes_copied = window_offset + end;
+                ReportProgress(rpath, bytes_copied, st.st_size);
+                break;
+            }
+
+            if (!weak_valid) {
+                weak.Reset(&window[pos], block);
+                weak_valid = true;
+            }
+            ssize_t found = index->Find(weak.Value(), &window[pos], next_block);
+            if (found >= 0) {
+                add_copy(found * block, block);
+                next_block = found + 1;
+                weak_valid = false;
+                continue;
+            }
+
+            if (pos + block < end) {
+                weak.Roll(window[pos], window[pos + block]);
+            } else {
+                weak_valid = false;
+            }
+            ++pos;
+            if (pos - start == max) {
+                send_literal(max);
+            }
+        }
+
+        adb_close(lfd);
+
+        struct __attribute__((packed)) {
+            SyncRequest req;
+            uint8_t checksum[kStrongChecksumSize];
+        } done = { { ID_DONE, mtime }, {} };
+        size_t done_length = sizeof(done.req);
+        if (copied) {
+            checksum.Final(done.checksum);
+            done_length = sizeof(done);
+        }
+        ++expect_done_;
+        return WriteOrDie(lpath, rpath, &done, done_length);
+    }
+
     bool CopyDone(const char* from, const char* to) {
         syncmsg msg;
         if (!ReadFdExactly(fd, &msg.status, sizeof(msg.status))) {
@@ -270,7 +490,7 @@ class SyncConnection {
         }
         if (msg.status.id == ID_OKAY) {
             if (expect_done_) {
-                expect_done_ = false;
+                --expect_done_;
                 return true;
             } else {
                 Error("failed to copy '%s' to '%s': received premature success", from, to);
@@ -284,6 +504,33 @@ class SyncConnection {
         return ReportCopyFailure(from, to, msg);
     }
 
+    // Called once a file is sent: waits for the result, or when pipelining
+    // only once |window| files are waiting.
+    bool FinishCopy(const char* from, const char* to) {
+        pending_copies_.emplace_back(from, to);
+        return FinishCopies(window - 1);
+    }
+
+    // Reads results until no more than |max_pending| copies are left waiting.
+    bool FinishCopies(size_t max_pending = 0) {
+        bool success = true;
+        while (pending_copies_.size() > max_pending) {
+            std::pair<std::string, std::string> copy = std::move(pending_copies_.front());
+            pending_copies_.pop_front();
+            ClearCopyFailure();
+            if (!CopyDone(copy.first.c_str(), copy.second.c_str())) {
+                success = false;
+                // Past an ID_FAIL the daemon goes on with the next file, and
+                // we read its result. Otherwise there is no going on.
+                if (!CopyFailureIsRecoverable()) {
+                    pending_copies_.clear();
+                    break;
+                }
+            }
+        }
+        return success;
+    }
+
     bool ReportCopyFailure(const char* from, const char* to, const syncmsg& msg) {
         std::vector<char> buf(msg.status.msglen + 1);
         if (!ReadFdExactly(fd, &buf[0], msg.status.msglen)) {
@@ -293,17 +540,67 @@ class SyncConnection {
         }
         buf[msg.status.msglen] = 0;
         Error("failed to copy '%s' to '%s': %s", from, to, &buf[0]);
+        copy_failed_ = true;
         return false;
     }
 
+    // Reads and drops the rest of the reply to an ID_RECV of |from| once it
+    // can't be written to |to|, so that the replies after it can be read.
+    void SkipRecv(const char* from, const char* to) {
+        while (true) {
+            syncmsg msg;
+            if (!ReadFdExactly(fd, &msg.data, sizeof(msg.data))) return;
+
+            if (msg.data.id == ID_DONE) {
+                copy_failed_ = true;
+                return;
+            }
+            if (msg.data.id != ID_DATA && msg.data.id != ID_ZDAT) {
+                ReportCopyFailure(from, to, msg);
+                return;
+            }
+            if (msg.data.size > max || !ReadFdExactly(fd, &buffer[0], msg.data.size)) return;
+        }
+    }
+
+    void ClearCopyFailure() { copy_failed_ = false; }
+
+    // Whether the daemon goes on with the next request after the copy that
+    // just failed, its reply having been read whole, so that the replies
+    // in flight behind it can still be read.
+    bool CopyFailureIsRecoverable() { return pipeline_ && copy_failed_; }
+
     std::string TransferRate() {
         uint64_t ms = CurrentTimeMs() - start_time_ms_;
         if (total_bytes_ == 0 || ms == 0) return "";
 
         double s = static_cast<double>(ms) / 1000LL;
         double rate = (static_cast<double>(total_bytes_) / s) / (1024*1024);
-        return android::base::StringPrintf(" %.1f MB/s (%" PRId64 " bytes in %.3fs)",
-                                           rate, total_bytes_, s);
+        return android::base::StringPrintf(" %.1f MB/s (%" PRId64 " bytes in %.3fs)%s",
+                                           rate, total_bytes_, s, WireRate().c_str());
+    }
+
+    // When compressing or sending deltas, what went over the wire for the
+    // |total_bytes_| of file data, so it can be told apart from the
+    // effective rate.
+    std::string WireRate() {
+        uint64_t ms = CurrentTimeMs() - start_time_ms_;
+        if ((!deflater_ && !delta_) || total_bytes_ == 0 || ms == 0) return "";
+
+        double s = static_cast<double>(ms) / 1000LL;
+        double rate = (static_cast<double>(wire_bytes_) / s) / (1024*1024);
+        return android::base::StringPrintf(" [wire %.1f MB/s, %" PRId64 " bytes, %.0f%%]",
+                                           rate, wire_bytes_,
+                                           wire_bytes_ * 100.0 / total_bytes_);
+    }
+
+    // Inflates an ID_ZDAT chunk of |length| bytes at |data|. Returns where
+    // the data went, in a buffer of our own, or nullptr if the chunk is
+    // corrupt or we never asked for compression.
+    const char* Inflate(const char* data, size_t length, size_t* inflated_length) {
+        if (!inflater_) return nullptr;
+        *inflated_length = inflater_->Inflate(data, length, &zbuffer_[0], max);
+        return *inflated_length ? &zbuffer_[0] : nullptr;
     }
 
     void ReportProgress(const char* file, uint64_t file_copied_bytes, uint64_t file_total_bytes) {
@@ -328,9 +625,10 @@ class SyncConnection {
             // file we are, as well as the overall percentage.
             if (expect_multiple_files_) {
                 int file_percentage = static_cast<int>(file_copied_bytes * 100 / file_total_bytes);
-                Printf("[%4s] %s: %d%%", overall_percentage_str, file, file_percentage);
+                Printf("[%4s] %s: %d%%%s", overall_percentage_str, file, file_percentage,
+                       WireRate().c_str());
             } else {
-                Printf("[%4s] %s", overall_percentage_str, file);
+                Printf("[%4s] %s%s", overall_percentage_str, file, WireRate().c_str());
             }
         }
     }
@@ -384,17 +682,36 @@ class SyncConnection {
     }
 
     uint64_t total_bytes_;
+    // As |total_bytes_|, but as sent, deflated or not.
+    uint64_t wire_bytes_;
 
-    // TODO: add a char[max] buffer here, to replace syncsendbuf...
     int fd;
+    // The largest ID_DATA chunk, and room for one with its header.
     size_t max;
+    std::vector<char> buffer;
+    // How many requests may be sent ahead of the replies.
+    size_t window;
 
   private:
     uint64_t start_time_ms_;
 
     uint64_t expected_total_bytes_;
     bool expect_multiple_files_;
-    bool expect_done_;
+    size_t expect_done_;
+
+    bool pipeline_;
+    std::deque<std::pair<std::string, std::string>> pending_copies_;
+    // Whether the reply to the last failed copy was read whole, be it an
+    // ID_FAIL or data SkipRecv() dropped.
+    bool copy_failed_ = false;
+
+    // Set if the device takes ID_ZDAT; then |zbuffer_| has room for a chunk
+    // deflated or inflated, after a SyncRequest.
+    std::unique_ptr<SyncDeflater> deflater_;
+    std::unique_ptr<SyncInflater> inflater_;
+    std::vector<char> zbuffer_;
+
+    bool delta_;
 
     LinePrinter line_printer_;
 
@@ -402,6 +719,68 @@ class SyncConnection {
         return SendRequest(ID_QUIT, ""); // TODO: add a SendResponse?
     }
 
+    // Sends |length| bytes of file data, at most |max|, as ID_DATA or ID_ZDAT
+    // in a single write. |data| may be in |buffer|, just after room for the
+    // header.
+    void SendChunk(const char* lpath, const char* rpath, const char* data, size_t length) {
+        SyncRequest* req = nullptr;
+        if (deflater_) {
+            SyncRequest* zreq = reinterpret_cast<SyncRequest*>(&zbuffer_[0]);
+            size_t deflated = deflater_->Deflate(data, length, reinterpret_cast<char*>(zreq + 1));
+            if (deflated != 0) {
+                zreq->id = ID_ZDAT;
+                zreq->path_length = deflated;
+                req = zreq;
+            }
+        }
+        if (req == nullptr) {
+            req = reinterpret_cast<SyncRequest*>(&buffer[0]);
+            if (data != reinterpret_cast<char*>(req + 1)) {
+                memcpy(req + 1, data, length);
+            }
+            req->id = ID_DATA;
+            req->path_length = length;
+        }
+        WriteOrDie(lpath, rpath, req, sizeof(SyncRequest) + req->path_length);
+        wire_bytes_ += req->path_length;
+    }
+
+    // Reads the reply to an ID_SIGS for |rpath|, leaving |index| empty if
+    // there is nothing there to send a delta against.
+    bool ReadSignatures(const char* rpath, std::unique_ptr<DeltaIndex>* index) {
+        if (!SendRequest(ID_SIGS, rpath)) {
+            Error("failed to send ID_SIGS message '%s': %s", rpath, strerror(errno));
+            return false;
+        }
+
+        syncmsg msg;
+        if (!ReadFdExactly(fd, &msg.sigs, sizeof(msg.sigs))) {
+            Error("failed to read signatures of '%s': %s", rpath, strerror(errno));
+            return false;
+        }
+        if (msg.sigs.id != ID_SIGS) {
+            Error("failed to read signatures of '%s': unexpected reply %d", rpath, msg.sigs.id);
+            return false;
+        }
+        if (msg.sigs.count == 0) {
+            return true;
+        }
+        if (msg.sigs.block_size == 0 || msg.sigs.block_size > max ||
+            msg.sigs.tail == 0 || msg.sigs.tail > msg.sigs.block_size ||
+            msg.sigs.count > kMaxSignatures) {
+            Error("failed to read signatures of '%s': bad header", rpath);
+            return false;
+        }
+
+        std::vector<SyncBlockSignature> signatures(msg.sigs.count);
+        if (!ReadFdExactly(fd, &signatures[0], signatures.size() * sizeof(signatures[0]))) {
+            Error("failed to read signatures of '%s': %s", rpath, strerror(errno));
+            return false;
+        }
+        index->reset(new DeltaIndex(msg.sigs.block_size, msg.sigs.tail, std::move(signatures)));
+        return true;
+    }
+
     bool WriteOrDie(const char* from, const char* to, const void* data, size_t data_length) {
         if (!WriteFdExactly(fd, data, data_length)) {
             if (errno == ECONNRESET) {
@@ -432,10 +811,23 @@ class SyncConnection {
 
 typedef void (sync_ls_cb)(unsigned mode, unsigned size, unsigned time, const char* name);
 
-static bool sync_ls(SyncConnection& sc, const char* path,
-                    std::function<sync_ls_cb> func) {
-    if (!sc.SendRequest(ID_LIST, path)) return false;
+// Sends the requests for items [0, count) with |send| and reads the replies
+// in order with |finish|, keeping up to |window| requests ahead of them.
+// Either may do nothing for an item that needs no request.
+static bool sync_pipeline(size_t count, size_t window,
+                          const std::function<bool(size_t)>& send,
+                          const std::function<bool(size_t)>& finish) {
+    size_t sent = 0;
+    for (size_t i = 0; i < count; ++i) {
+        while (sent < count && sent < i + window) {
+            if (!send(sent++)) return false;
+        }
+        if (!finish(i)) return false;
+    }
+    return true;
+}
 
+static bool sync_finish_ls(SyncConnection& sc, std::function<sync_ls_cb> func) {
     while (true) {
         syncmsg msg;
         if (!ReadFdExactly(sc.fd, &msg.dent, sizeof(msg.dent))) return false;
@@ -454,6 +846,11 @@ static bool sync_ls(SyncConnection& sc, const char* path,
     }
 }
 
+static bool sync_ls(SyncConnection& sc, const char* path,
+                    std::function<sync_ls_cb> func) {
+    return sc.SendRequest(ID_LIST, path) && sync_finish_ls(sc, func);
+}
+
 static bool sync_finish_stat(SyncConnection& sc, unsigned int* timestamp,
                              unsigned int* mode, unsigned int* size) {
     syncmsg msg;
@@ -488,10 +885,11 @@ static bool sync_send(SyncConnection& sc, const char* lpath, const char* rpath,
         }
         buf[data_length++] = '\0';
 
-        if (!sc.SendSmallFile(path_and_mode.c_str(), lpath, rpath, mtime, buf, data_length)) {
+        if (!sc.SendSmallFile(path_and_mode.c_str(), lpath, rpath, mtime, buf, data_length,
+                              true)) {
             return false;
         }
-        return sc.CopyDone(lpath, rpath);
+        return sc.FinishCopy(lpath, rpath);
 #endif
     }
 
@@ -500,7 +898,7 @@ static bool sync_send(SyncConnection& sc, const char* lpath, const char* rpath,
         sc.Error("failed to stat local file '%s': %s", lpath, strerror(errno));
         return false;
     }
-    if (st.st_size < SYNC_DATA_MAX) {
+    if (static_cast<uint64_t>(st.st_size) < sc.max) {
         std::string data;
         if (!android::base::ReadFileToString(lpath, &data)) {
             sc.Error("failed to read all of '%s': %s", lpath, strerror(errno));
@@ -511,24 +909,26 @@ static bool sync_send(SyncConnection& sc, const char* lpath, const char* rpath,
             return false;
         }
     } else {
-        if (!sc.SendLargeFile(path_and_mode.c_str(), lpath, rpath, mtime)) {
+        if (sc.IsDelta()) {
+            if (!sc.SendDeltaFile(path_and_mode.c_str(), lpath, rpath, mtime)) {
+                return false;
+            }
+        } else if (!sc.SendLargeFile(path_and_mode.c_str(), lpath, rpath, mtime)) {
             return false;
         }
     }
-    return sc.CopyDone(lpath, rpath);
+    return sc.FinishCopy(lpath, rpath);
 }
 
-static bool sync_recv(SyncConnection& sc, const char* rpath, const char* lpath,
-                      const char* name=nullptr) {
-    unsigned size = 0;
-    if (!sync_stat(sc, rpath, nullptr, nullptr, &size)) return false;
-
-    if (!sc.SendRequest(ID_RECV, rpath)) return false;
-
+// Reads the reply to an ID_RECV for |rpath|, of |size| bytes as far as we know.
+static bool sync_finish_recv(SyncConnection& sc, const char* rpath, const char* lpath,
+                             const char* name, uint64_t size) {
+    sc.ClearCopyFailure();
     adb_unlink(lpath);
     int lfd = adb_creat(lpath, 0644);
     if (lfd < 0) {
         sc.Error("cannot create '%s': %s", lpath, strerror(errno));
+        sc.SkipRecv(rpath, lpath);
         return false;
     }
 
@@ -543,7 +943,7 @@ static bool sync_recv(SyncConnection& sc, const char* rpath, const char* lpath,
 
         if (msg.data.id == ID_DONE) break;
 
-        if (msg.data.id != ID_DATA) {
+        if (msg.data.id != ID_DATA && msg.data.id != ID_ZDAT) {
             adb_close(lfd);
             adb_unlink(lpath);
             sc.ReportCopyFailure(rpath, lpath, msg);
@@ -557,23 +957,36 @@ static bool sync_recv(SyncConnection& sc, const char* rpath, const char* lpath,
             return false;
         }
 
-        char buffer[SYNC_DATA_MAX];
-        if (!ReadFdExactly(sc.fd, buffer, msg.data.size)) {
+        const char* buffer = &sc.buffer[0];
+        if (!ReadFdExactly(sc.fd, &sc.buffer[0], msg.data.size)) {
             adb_close(lfd);
             adb_unlink(lpath);
             return false;
         }
 
-        if (!WriteFdExactly(lfd, buffer, msg.data.size)) {
+        size_t length = msg.data.size;
+        if (msg.data.id == ID_ZDAT) {
+            buffer = sc.Inflate(buffer, msg.data.size, &length);
+            if (buffer == nullptr) {
+                sc.Error("failed to copy '%s' to '%s': invalid deflated data", rpath, lpath);
+                adb_close(lfd);
+                adb_unlink(lpath);
+                return false;
+            }
+        }
+
+        if (!WriteFdExactly(lfd, buffer, length)) {
             sc.Error("cannot write '%s': %s", lpath, strerror(errno));
             adb_close(lfd);
             adb_unlink(lpath);
+            sc.SkipRecv(rpath, lpath);
             return false;
         }
 
-        sc.total_bytes_ += msg.data.size;
+        sc.total_bytes_ += length;
+        sc.wire_bytes_ += msg.data.size;
 
-        bytes_copied += msg.data.size;
+        bytes_copied += length;
 
         sc.ReportProgress(name != nullptr ? name : rpath, bytes_copied, size);
     }
@@ -582,6 +995,11 @@ static bool sync_recv(SyncConnection& sc, const char* rpath, const char* lpath,
     return true;
 }
 
+static bool sync_recv(SyncConnection& sc, const char* rpath, const char* lpath,
+                      const char* name, uint64_t size) {
+    return sc.SendRequest(ID_RECV, rpath) && sync_finish_recv(sc, rpath, lpath, name, size);
+}
+
 bool do_sync_ls(const char* path) {
     SyncConnection sc;
     if (!sc.IsValid()) return false;
@@ -675,12 +1093,11 @@ static bool copy_local_dir_remote(SyncConnection& sc, std::string lpath,
     }
 
     if (check_timestamps) {
-        for (const copyinfo& ci : file_list) {
-            if (!sc.SendRequest(ID_STAT, ci.rpath.c_str())) {
-                return false;
-            }
-        }
-        for (copyinfo& ci : file_list) {
+        auto stat = [&](size_t i) {
+            return sc.SendRequest(ID_STAT, file_list[i].rpath.c_str());
+        };
+        auto finish_stat = [&](size_t i) {
+            copyinfo& ci = file_list[i];
             unsigned int timestamp, mode, size;
             if (!sync_finish_stat(sc, &timestamp, &mode, &size)) {
                 return false;
@@ -692,6 +1109,11 @@ static bool copy_local_dir_remote(SyncConnection& sc, std::string lpath,
                     ci.skip = true;
                 }
             }
+            return true;
+        };
+        // Any daemon takes requests ahead of the replies
+        if (!sync_pipeline(file_list.size(), kSyncWindow, stat, finish_stat)) {
+            return false;
         }
     }
 
@@ -711,6 +1133,9 @@ static bool copy_local_dir_remote(SyncConnection& sc, std::string lpath,
             skipped++;
         }
     }
+    if (!sc.FinishCopies()) {
+        return false;
+    }
 
     sc.Printf("%s: %d file%s pushed. %d file%s skipped.%s", rpath.c_str(),
               pushed, (pushed == 1) ? "" : "s", skipped,
@@ -718,8 +1143,9 @@ static bool copy_local_dir_remote(SyncConnection& sc, std::string lpath,
     return true;
 }
 
-bool do_sync_push(const std::vector<const char*>& srcs, const char* dst) {
-    SyncConnection sc;
+bool do_sync_push(const std::vector<const char*>& srcs, const char* dst, int deflate_level,
+                  bool sync_delta) {
+    SyncConnection sc(deflate_level, sync_delta);
     if (!sc.IsValid()) return false;
 
     bool success = true;
@@ -793,6 +1219,7 @@ bool do_sync_push(const std::vector<const char*>& srcs, const char* dst) {
         sc.SetExpectedTotalBytes(st.st_size);
         success &= sync_send(sc, src_path, dst_path, st.st_mtime, st.st_mode);
     }
+    success &= sc.FinishCopies();
 
     return success;
 }
@@ -810,54 +1237,77 @@ static bool remote_symlink_isdir(SyncConnection& sc, const std::string& rpath) {
 
 static bool remote_build_list(SyncConnection& sc, std::vector<copyinfo>* file_list,
                               const std::string& rpath, const std::string& lpath) {
-    std::vector<copyinfo> dirlist;
-    std::vector<copyinfo> linklist;
+    // Directories are listed a level at a time, with the LISTs for a level,
+    // then the STATs for its symlinks, sent ahead of the replies.
+    std::vector<std::pair<std::string, std::string>> dirs{{rpath, lpath}};
+    while (!dirs.empty()) {
+        std::vector<copyinfo> dirlist;
+        std::vector<copyinfo> linklist;
+
+        auto list = [&](size_t i) { return sc.SendRequest(ID_LIST, dirs[i].first.c_str()); };
+        auto finish_list = [&](size_t i) {
+            const std::string& dir_rpath = dirs[i].first;
+            const std::string& dir_lpath = dirs[i].second;
+
+            // Add an entry for the directory to ensure it gets created before pulling its
+            // contents.
+            copyinfo ci(adb_dirname(dir_lpath), adb_dirname(dir_rpath), adb_basename(dir_lpath),
+                        S_IFDIR);
+            file_list->push_back(ci);
 
-    // Add an entry for the current directory to ensure it gets created before pulling its contents.
-    copyinfo ci(adb_dirname(lpath), adb_dirname(rpath), adb_basename(lpath), S_IFDIR);
-    file_list->push_back(ci);
+            // Put the files/dirs in the directory on the lists.
+            auto callback = [&](unsigned mode, unsigned size, unsigned time, const char* name) {
+                if (IsDotOrDotDot(name)) {
+                    return;
+                }
 
-    // Put the files/dirs in rpath on the lists.
-    auto callback = [&](unsigned mode, unsigned size, unsigned time, const char* name) {
-        if (IsDotOrDotDot(name)) {
-            return;
+                copyinfo ci(dir_lpath, dir_rpath, name, mode);
+                if (S_ISDIR(mode)) {
+                    dirlist.push_back(ci);
+                } else if (S_ISLNK(mode)) {
+                    linklist.push_back(ci);
+                } else {
+                    if (!should_pull_file(ci.mode)) {
+                        sc.Warning("skipping special file '%s' (mode = 0o%o)", ci.rpath.c_str(),
+                                   ci.mode);
+                        ci.skip = true;
+                    }
+                    ci.time = time;
+                    ci.size = size;
+                    file_list->push_back(ci);
+                }
+            };
+            return sync_finish_ls(sc, callback);
+        };
+        if (!sync_pipeline(dirs.size(), kSyncWindow, list, finish_list)) {
+            return false;
         }
 
-        copyinfo ci(lpath, rpath, name, mode);
-        if (S_ISDIR(mode)) {
-            dirlist.push_back(ci);
-        } else if (S_ISLNK(mode)) {
-            linklist.push_back(ci);
-        } else {
-            if (!should_pull_file(ci.mode)) {
-                sc.Warning("skipping special file '%s' (mode = 0o%o)", ci.rpath.c_str(), ci.mode);
-                ci.skip = true;
+        // Check each symlink we found to see whether it's a file or directory.
+        auto stat_link = [&](size_t i) {
+            return sc.SendRequest(ID_STAT, (linklist[i].rpath + "/").c_str());
+        };
+        auto finish_stat_link = [&](size_t i) {
+            unsigned mode;
+            if (!sync_finish_stat(sc, nullptr, &mode, nullptr)) {
+                sc.Error("failed to stat remote symlink '%s/'", linklist[i].rpath.c_str());
+                return false;
             }
-            ci.time = time;
-            ci.size = size;
-            file_list->push_back(ci);
-        }
-    };
-
-    if (!sync_ls(sc, rpath.c_str(), callback)) {
-        return false;
-    }
-
-    // Check each symlink we found to see whether it's a file or directory.
-    for (copyinfo& link_ci : linklist) {
-        if (remote_symlink_isdir(sc, link_ci.rpath)) {
-            dirlist.emplace_back(std::move(link_ci));
-        } else {
-            file_list->emplace_back(std::move(link_ci));
+            if (S_ISDIR(mode)) {
+                dirlist.emplace_back(std::move(linklist[i]));
+            } else {
+                file_list->emplace_back(std::move(linklist[i]));
+            }
+            return true;
+        };
+        if (!sync_pipeline(linklist.size(), kSyncWindow, stat_link, finish_stat_link)) {
+            return false;
         }
-    }
 
-    // Recurse into each directory we found.
-    while (!dirlist.empty()) {
-        copyinfo current = dirlist.back();
-        dirlist.pop_back();
-        if (!remote_build_list(sc, file_list, current.rpath, current.lpath)) {
-            return false;
+        // Then the directories we found.
+        dirs.clear();
+        for (const copyinfo& dir : dirlist) {
+            dirs.emplace_back(dir.rpath, dir.lpath);
         }
     }
 
@@ -892,9 +1342,18 @@ static bool copy_remote_dir_local(SyncConnection& sc, std::string rpath,
 
     sc.ComputeExpectedTotalBytes(file_list);
 
+    bool success = true;
     int pulled = 0;
     int skipped = 0;
-    for (const copyinfo &ci : file_list) {
+    auto recv = [&](size_t i) {
+        const copyinfo& ci = file_list[i];
+        if (ci.skip || S_ISDIR(ci.mode)) {
+            return true;
+        }
+        return sc.SendRequest(ID_RECV, ci.rpath.c_str());
+    };
+    auto finish_recv = [&](size_t i) {
+        const copyinfo& ci = file_list[i];
         if (!ci.skip) {
             if (S_ISDIR(ci.mode)) {
                 // Entry is for an empty directory, create it and continue.
@@ -902,23 +1361,32 @@ static bool copy_remote_dir_local(SyncConnection& sc, std::string rpath,
                 if (!mkdirs(ci.lpath))  {
                     sc.Error("failed to create directory '%s': %s",
                              ci.lpath.c_str(), strerror(errno));
-                    return false;
+                    success = false;
+                    return true;
                 }
                 pulled++;
-                continue;
+                return true;
             }
 
-            if (!sync_recv(sc, ci.rpath.c_str(), ci.lpath.c_str())) {
-                return false;
+            // As with FinishCopies(), a file that failed doesn't stop the
+            // rest as long as the replies in flight behind it can be read.
+            if (!sync_finish_recv(sc, ci.rpath.c_str(), ci.lpath.c_str(), nullptr, ci.size)) {
+                success = false;
+                return sc.CopyFailureIsRecoverable();
             }
 
             if (copy_attrs && set_time_and_mode(ci.lpath, ci.time, ci.mode)) {
-                return false;
+                success = false;
+                return true;
             }
             pulled++;
         } else {
             skipped++;
         }
+        return true;
+    };
+    if (!sync_pipeline(file_list.size(), sc.window, recv, finish_recv) || !success) {
+        return false;
     }
 
     sc.Printf("%s: %d file%s pulled. %d file%s skipped.%s", rpath.c_str(),
@@ -928,8 +1396,8 @@ static bool copy_remote_dir_local(SyncConnection& sc, std::string rpath,
 }
 
 bool do_sync_pull(const std::vector<const char*>& srcs, const char* dst,
-                  bool copy_attrs, const char* name) {
-    SyncConnection sc;
+                  bool copy_attrs, const char* name, int deflate_level) {
+    SyncConnection sc(deflate_level);
     if (!sc.IsValid()) return false;
 
     bool success = true;
@@ -1023,7 +1491,7 @@ bool do_sync_pull(const std::vector<const char*>& srcs, const char* dst,
         }
 
         sc.SetExpectedTotalBytes(src_size);
-        if (!sync_recv(sc, src_path, dst_path, name)) {
+        if (!sync_recv(sc, src_path, dst_path, name, src_size)) {
             success = false;
             continue;
         }
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TRACE_TAG SYNC
+
+#include "file_sync_deflate.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "adb_trace.h"
+
+// Raw deflate, without the zlib header and adler32: the chunks are framed
+// by the sync protocol already.
+static const int kWindowBits = -15;
+static const int kMemLevel = 8;
+
+// A chunk has to shrink by at least this fraction to be worth inflating.
+static const size_t kMinSavingDivisor = 16;
+
+static const size_t kMaxSkip = 64;
+
+SyncDeflater::SyncDeflater(int level) : skip_(0), next_skip_(1) {
+    memset(&stream_, 0, sizeof(stream_));
+    valid_ = deflateInit2(&stream_, level, Z_DEFLATED, kWindowBits, kMemLevel,
+                          Z_DEFAULT_STRATEGY) == Z_OK;
+    if (!valid_) {
+        D("deflateInit2 failed for level %d", level);
+    }
+}
+
+SyncDeflater::~SyncDeflater() {
+    if (valid_) {
+        deflateEnd(&stream_);
+    }
+}
+
+size_t SyncDeflater::Deflate(const char* data, size_t length, char* out) {
+    if (!valid_ || length == 0) {
+        return 0;
+    }
+    if (skip_ > 0) {
+        --skip_;
+        return 0;
+    }
+
+    size_t limit = length - length / kMinSavingDivisor;
+    deflateReset(&stream_);
+    stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream_.avail_in = length;
+    stream_.next_out = reinterpret_cast<Bytef*>(out);
+    stream_.avail_out = limit;
+    if (deflate(&stream_, Z_FINISH) != Z_STREAM_END) {
+        // Out of room: it did not compress.
+        skip_ = next_skip_;
+        next_skip_ = std::min(next_skip_ * 2, kMaxSkip);
+        return 0;
+    }
+
+    next_skip_ = 1;
+    return limit - stream_.avail_out;
+}
+
+SyncInflater::SyncInflater() {
+    memset(&stream_, 0, sizeof(stream_));
+    valid_ = inflateInit2(&stream_, kWindowBits) == Z_OK;
+}
+
+SyncInflater::~SyncInflater() {
+    if (valid_) {
+        inflateEnd(&stream_);
+    }
+}
+
+size_t SyncInflater::Inflate(const char* data, size_t length, char* out, size_t capacity) {
+    if (!valid_) {
+        return 0;
+    }
+
+    inflateReset(&stream_);
+    stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream_.avail_in = length;
+    stream_.next_out = reinterpret_cast<Bytef*>(out);
+    stream_.avail_out = capacity;
+    int rc = inflate(&stream_, Z_FINISH);
+    if (rc != Z_STREAM_END || stream_.avail_in != 0) {
+        D("inflate failed: %d (%s)", rc, stream_.msg ? stream_.msg : "no message");
+        return 0;
+    }
+    return capacity - stream_.avail_out;
+}
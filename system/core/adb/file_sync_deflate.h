@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FILE_SYNC_DEFLATE_H_
+#define _FILE_SYNC_DEFLATE_H_
+
+#include <stddef.h>
+
+#include <zlib.h>
+
+#include <android-base/macros.h>
+
+// ID_ZDAT chunks: each one a raw deflate stream of its own, so that any
+// chunk can go as ID_DATA instead when it does not compress.
+
+class SyncDeflater {
+  public:
+    // |level| as for zlib, 1 (fastest) to 9 (smallest).
+    explicit SyncDeflater(int level);
+    ~SyncDeflater();
+
+    // Deflates the |length| bytes at |data| into |out|, which has room for
+    // as many. Returns the deflated size, or 0 if the chunk is better sent
+    // as it is: because it did not compress, or because the last few did not
+    // and we are not trying again just yet.
+    size_t Deflate(const char* data, size_t length, char* out);
+
+  private:
+    z_stream stream_;
+    bool valid_;
+    // Incompressible data tends to come in runs, as with a zip inside an
+    // apk. After a chunk that did not compress we skip trying the next ones,
+    // twice as many each time up to 64.
+    size_t skip_;
+    size_t next_skip_;
+
+    DISALLOW_COPY_AND_ASSIGN(SyncDeflater);
+};
+
+class SyncInflater {
+  public:
+    SyncInflater();
+    ~SyncInflater();
+
+    // Inflates the ID_ZDAT chunk of |length| bytes at |data| into |out|,
+    // which has room for |capacity| bytes. Returns the inflated size, or 0
+    // if the chunk is corrupt or does not fit.
+    size_t Inflate(const char* data, size_t length, char* out, size_t capacity);
+
+  private:
+    z_stream stream_;
+    bool valid_;
+
+    DISALLOW_COPY_AND_ASSIGN(SyncInflater);
+};
+
+#endif
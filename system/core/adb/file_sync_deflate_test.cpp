@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "file_sync_deflate.h"
+
+#include <gtest/gtest.h>
+
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include "file_sync_service.h"
+
+static std::string text_chunk(size_t size) {
+    std::string s;
+    while (s.size() < size) {
+        s += "/system/lib/libfoo.so: ELF 32-bit LSB shared object, ARM, EABI5\n";
+    }
+    s.resize(size);
+    return s;
+}
+
+static std::string random_chunk(size_t size) {
+    std::string s(size, '\0');
+    for (char& c : s) {
+        c = rand();
+    }
+    return s;
+}
+
+TEST(file_sync_deflate, round_trip) {
+    for (int level : { 1, 6, 9 }) {
+        SyncDeflater deflater(level);
+        SyncInflater inflater;
+        for (size_t size : { size_t(1000), size_t(SYNC_DATA_MAX), size_t(SYNC_DATA_MAX_PIPELINE) }) {
+            std::string in = text_chunk(size);
+            std::vector<char> deflated(size);
+            size_t deflated_size = deflater.Deflate(in.data(), in.size(), &deflated[0]);
+            ASSERT_NE(0u, deflated_size);
+            EXPECT_LT(deflated_size, size / 4);
+
+            std::vector<char> out(size);
+            ASSERT_EQ(size, inflater.Inflate(&deflated[0], deflated_size, &out[0], out.size()));
+            EXPECT_EQ(in, std::string(out.begin(), out.end()));
+        }
+    }
+}
+
+TEST(file_sync_deflate, incompressible) {
+    SyncDeflater deflater(1);
+    std::string text = text_chunk(SYNC_DATA_MAX);
+    std::string noise = random_chunk(SYNC_DATA_MAX);
+    std::vector<char> out(SYNC_DATA_MAX);
+
+    EXPECT_EQ(0u, deflater.Deflate(noise.data(), noise.size(), &out[0]));
+    // The next chunk goes as it is without being tried, compressible or not
+    EXPECT_EQ(0u, deflater.Deflate(text.data(), text.size(), &out[0]));
+    EXPECT_NE(0u, deflater.Deflate(text.data(), text.size(), &out[0]));
+
+    // Then twice as many after each miss in a row...
+    EXPECT_EQ(0u, deflater.Deflate(noise.data(), noise.size(), &out[0]));
+    EXPECT_EQ(0u, deflater.Deflate(text.data(), text.size(), &out[0]));
+    EXPECT_EQ(0u, deflater.Deflate(noise.data(), noise.size(), &out[0]));
+    EXPECT_EQ(0u, deflater.Deflate(text.data(), text.size(), &out[0]));
+    EXPECT_EQ(0u, deflater.Deflate(text.data(), text.size(), &out[0]));
+    // ...and back to one after a hit
+    EXPECT_NE(0u, deflater.Deflate(text.data(), text.size(), &out[0]));
+    EXPECT_EQ(0u, deflater.Deflate(noise.data(), noise.size(), &out[0]));
+    EXPECT_EQ(0u, deflater.Deflate(text.data(), text.size(), &out[0]));
+    EXPECT_NE(0u, deflater.Deflate(text.data(), text.size(), &out[0]));
+
+    EXPECT_EQ(0u, deflater.Deflate(text.data(), 0, &out[0]));
+}
+
+TEST(file_sync_deflate, corrupt) {
+    SyncDeflater deflater(1);
+    SyncInflater inflater;
+    std::string in = text_chunk(SYNC_DATA_MAX);
+    std::vector<char> deflated(in.size());
+    size_t deflated_size = deflater.Deflate(in.data(), in.size(), &deflated[0]);
+    ASSERT_NE(0u, deflated_size);
+
+    std::vector<char> out(in.size());
+    // Cut short, with trailing garbage, or too big for the buffer
+    EXPECT_EQ(0u, inflater.Inflate(&deflated[0], deflated_size / 2, &out[0], out.size()));
+    deflated.push_back('x');
+    EXPECT_EQ(0u, inflater.Inflate(&deflated[0], deflated_size + 1, &out[0], out.size()));
+    EXPECT_EQ(0u, inflater.Inflate(&deflated[0], deflated_size, &out[0], out.size() - 1));
+
+    // None of which stops the next good one
+    EXPECT_EQ(in.size(), inflater.Inflate(&deflated[0], deflated_size, &out[0], out.size()));
+
+    std::string noise = random_chunk(1000);
+    EXPECT_EQ(0u, inflater.Inflate(noise.data(), noise.size(), &out[0], out.size()));
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "file_sync_delta.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <utility>
+
+#include <openssl/md5.h>
+
+static const size_t kMinBlockSize = 2 * 1024;
+static const size_t kMaxBlockSize = 64 * 1024;
+
+size_t DeltaBlockSize(uint64_t file_size) {
+    size_t size = static_cast<size_t>(sqrt(static_cast<double>(file_size)));
+    size = (size + 1023) & ~static_cast<size_t>(1023);
+    return std::min(std::max(size, kMinBlockSize), kMaxBlockSize);
+}
+
+void StrongChecksum(const char* data, size_t length, uint8_t* out) {
+    MD5(reinterpret_cast<const uint8_t*>(data), length, out);
+}
+
+void RollingChecksum::Reset(const char* data, size_t length) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    uint32_t a = 0;
+    uint32_t b = 0;
+    for (size_t i = 0; i < length; ++i) {
+        a += p[i];
+        b += a;
+    }
+    a_ = a & 0xffff;
+    b_ = b & 0xffff;
+    length_ = length;
+}
+
+SyncBlockSignature BlockSignature(const char* data, size_t length) {
+    SyncBlockSignature signature;
+    RollingChecksum weak;
+    weak.Reset(data, length);
+    signature.weak = weak.Value();
+    StrongChecksum(data, length, signature.strong);
+    return signature;
+}
+
+DeltaIndex::DeltaIndex(size_t block_size, size_t tail,
+                       std::vector<SyncBlockSignature> signatures)
+        : block_size_(block_size), tail_(tail), signatures_(std::move(signatures)) {
+    size_t full_blocks = signatures_.size();
+    if (full_blocks > 0 && tail_ < block_size_) {
+        --full_blocks;
+    }
+    blocks_.reserve(full_blocks);
+    for (size_t i = 0; i < full_blocks; ++i) {
+        blocks_[signatures_[i].weak].push_back(i);
+    }
+}
+
+ssize_t DeltaIndex::Find(uint32_t weak, const char* data, ssize_t hint) const {
+    auto it = blocks_.find(weak);
+    if (it == blocks_.end()) {
+        return -1;
+    }
+
+    uint8_t strong[kStrongChecksumSize];
+    StrongChecksum(data, block_size_, strong);
+    ssize_t found = -1;
+    for (uint32_t block : it->second) {
+        if (memcmp(signatures_[block].strong, strong, sizeof(strong)) == 0) {
+            if (static_cast<ssize_t>(block) == hint) {
+                return hint;
+            }
+            if (found == -1) {
+                found = block;
+            }
+        }
+    }
+    return found;
+}
+
+ssize_t DeltaIndex::FindTail(const char* data, size_t length) const {
+    if (signatures_.empty() || tail_ == block_size_ || length != tail_) {
+        return -1;
+    }
+    SyncBlockSignature signature = BlockSignature(data, length);
+    const SyncBlockSignature& last = signatures_.back();
+    if (signature.weak != last.weak ||
+        memcmp(signature.strong, last.strong, sizeof(last.strong)) != 0) {
+        return -1;
+    }
+    return signatures_.size() - 1;
+}
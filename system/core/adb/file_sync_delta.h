@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FILE_SYNC_DELTA_H_
+#define _FILE_SYNC_DELTA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include <android-base/macros.h>
+#include <openssl/md5.h>
+
+// Delta pushes, as rsync does them: the device sends a signature for each
+// block of the file already there, and we send only what is not in one of
+// those blocks. See ID_SIGS and ID_COPY in file_sync_service.h.
+
+// The MD5 of a block, which decides whether a weak checksum match is real.
+static const size_t kStrongChecksumSize = 16;
+
+struct __attribute__((packed)) SyncBlockSignature {
+    uint32_t weak;
+    uint8_t strong[kStrongChecksumSize];
+};
+
+// The block size the device uses for a file of |file_size| bytes: about its
+// square root, which keeps both the signatures and what a change costs
+// small, within bounds.
+size_t DeltaBlockSize(uint64_t file_size);
+
+void StrongChecksum(const char* data, size_t length, uint8_t* out);
+
+// As StrongChecksum, of a whole file given a piece at a time. A push that
+// copied blocks ends with this, so the device can tell whether they were
+// still the ones it sent signatures for.
+class FileChecksum {
+  public:
+    FileChecksum() { MD5_Init(&ctx_); }
+
+    void Update(const char* data, size_t length) { MD5_Update(&ctx_, data, length); }
+
+    // Writes kStrongChecksumSize bytes to |out|. No more can be added after.
+    void Final(uint8_t* out) { MD5_Final(out, &ctx_); }
+
+  private:
+    MD5_CTX ctx_;
+
+    DISALLOW_COPY_AND_ASSIGN(FileChecksum);
+};
+
+// The rsync checksum of a window of bytes, which can be moved along a byte
+// at a time.
+class RollingChecksum {
+  public:
+    RollingChecksum() : a_(0), b_(0), length_(0) {}
+
+    void Reset(const char* data, size_t length);
+
+    // Drops |out| from the start of the window and adds |in| at its end.
+    void Roll(uint8_t out, uint8_t in) {
+        a_ = (a_ - out + in) & 0xffff;
+        b_ = (b_ - length_ * out + a_) & 0xffff;
+    }
+
+    uint32_t Value() const { return a_ | (b_ << 16); }
+
+  private:
+    uint32_t a_;
+    uint32_t b_;
+    uint32_t length_;
+};
+
+SyncBlockSignature BlockSignature(const char* data, size_t length);
+
+// The signatures of the file on the device, looked up by what we have.
+class DeltaIndex {
+  public:
+    // |tail| is the length of the last block, at most |block_size|.
+    DeltaIndex(size_t block_size, size_t tail, std::vector<SyncBlockSignature> signatures);
+
+    size_t block_size() const { return block_size_; }
+
+    // Which block the |block_size| bytes at |data|, with checksum |weak|,
+    // are, or -1. Of several that match, |hint| if it is one of them.
+    ssize_t Find(uint32_t weak, const char* data, ssize_t hint) const;
+
+    // Whether the |length| bytes at |data| are the last, short, block.
+    ssize_t FindTail(const char* data, size_t length) const;
+
+  private:
+    size_t block_size_;
+    size_t tail_;
+    std::vector<SyncBlockSignature> signatures_;
+    // Full blocks by weak checksum
+    std::unordered_map<uint32_t, std::vector<uint32_t>> blocks_;
+
+    DISALLOW_COPY_AND_ASSIGN(DeltaIndex);
+};
+
+#endif
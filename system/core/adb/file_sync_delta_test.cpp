@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "file_sync_delta.h"
+
+#include <gtest/gtest.h>
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+static std::string random_data(size_t size) {
+    std::string s(size, '\0');
+    for (char& c : s) {
+        c = rand();
+    }
+    return s;
+}
+
+TEST(file_sync_delta, block_size) {
+    EXPECT_EQ(2048u, DeltaBlockSize(0));
+    EXPECT_EQ(2048u, DeltaBlockSize(100000));
+    EXPECT_EQ(15u * 1024, DeltaBlockSize(200 * 1024 * 1024));
+    EXPECT_EQ(64u * 1024, DeltaBlockSize(100ULL * 1024 * 1024 * 1024));
+}
+
+TEST(file_sync_delta, rolling_checksum) {
+    const size_t kWindow = 1000;
+    std::string data = random_data(5000);
+    RollingChecksum rolling;
+    rolling.Reset(&data[0], kWindow);
+    for (size_t i = 0; i + kWindow < data.size(); ++i) {
+        rolling.Roll(data[i], data[i + kWindow]);
+
+        RollingChecksum fresh;
+        fresh.Reset(&data[i + 1], kWindow);
+        ASSERT_EQ(fresh.Value(), rolling.Value()) << i;
+    }
+}
+
+TEST(file_sync_delta, index) {
+    const size_t kBlock = 2048;
+    std::string file = random_data(4 * kBlock + 100);
+    // Block 3 again in place of block 1
+    file.replace(kBlock, kBlock, file, 3 * kBlock, kBlock);
+
+    std::vector<SyncBlockSignature> signatures;
+    for (size_t offset = 0; offset < file.size(); offset += kBlock) {
+        size_t length = std::min(kBlock, file.size() - offset);
+        signatures.push_back(BlockSignature(&file[offset], length));
+    }
+    DeltaIndex index(kBlock, 100, signatures);
+
+    auto find = [&](const char* data, ssize_t hint) {
+        return index.Find(BlockSignature(data, kBlock).weak, data, hint);
+    };
+    EXPECT_EQ(0, find(&file[0], -1));
+    EXPECT_EQ(2, find(&file[2 * kBlock], -1));
+    // Either of the two that match, preferring the hint
+    EXPECT_EQ(1, find(&file[3 * kBlock], 1));
+    EXPECT_EQ(3, find(&file[3 * kBlock], 3));
+
+    std::string other = random_data(kBlock);
+    EXPECT_EQ(-1, find(&other[0], -1));
+    // A weak checksum that matches is not enough
+    EXPECT_EQ(-1, index.Find(signatures[0].weak, &other[0], -1));
+
+    // The short last block only at the end
+    EXPECT_EQ(4, index.FindTail(&file[4 * kBlock], 100));
+    EXPECT_EQ(-1, index.FindTail(&file[4 * kBlock], 99));
+    EXPECT_EQ(-1, index.FindTail(&other[0], 100));
+}
+
+TEST(file_sync_delta, index_without_tail) {
+    const size_t kBlock = 2048;
+    std::string file = random_data(2 * kBlock);
+    std::vector<SyncBlockSignature> signatures = {
+        BlockSignature(&file[0], kBlock),
+        BlockSignature(&file[kBlock], kBlock),
+    };
+    DeltaIndex index(kBlock, kBlock, signatures);
+    EXPECT_EQ(1, index.Find(signatures[1].weak, &file[kBlock], -1));
+    EXPECT_EQ(-1, index.FindTail(&file[kBlock], kBlock));
+}
@@ -31,15 +31,59 @@
 #include <unistd.h>
 #include <utime.h>
 
+#include <algorithm>
+#include <memory>
+
 #include "adb.h"
 #include "adb_io.h"
 #include "adb_utils.h"
+#include "file_sync_deflate.h"
+#include "file_sync_delta.h"
 #include "private/android_filesystem_config.h"
 #include "security_log_tags.h"
+#include "services.h"
 
+#include <android-base/file.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 
+// What the client asked for with "sync[,arg1,...]:", and what goes with it.
+struct SyncSession {
+    bool pipeline = false;
+
+    // With kSyncServiceArgDeflate, ID_ZDAT is taken as well as ID_DATA, and
+    // what we send is deflated when |deflater| is set.
+    bool deflate = false;
+    std::unique_ptr<SyncDeflater> deflater;
+    std::unique_ptr<SyncInflater> inflater;
+    // Room for a chunk deflated or inflated
+    std::vector<char> zbuffer;
+
+    // With kSyncServiceArgDelta, ID_SIGS is answered, and during an ID_SEND
+    // ID_COPY reads from |base_fd|: the file being replaced, if there was one.
+    bool delta = false;
+    int base_fd = -1;
+};
+
+static void parse_sync_service_args(SyncSession* session, const std::string& service) {
+    for (const std::string& arg : android::base::Split(service.substr(0, service.find(':')), ",")) {
+        if (arg == kSyncServiceArgPipeline) {
+            session->pipeline = true;
+        } else if (arg == kSyncServiceArgDelta) {
+            session->delta = true;
+        } else if (android::base::StartsWith(arg, kSyncServiceArgDeflate)) {
+            // "deflate=<level>", the level to send with, if any
+            session->deflate = true;
+            int level = atoi(arg.c_str() + strlen(kSyncServiceArgDeflate));
+            if (level >= Z_BEST_SPEED && level <= Z_BEST_COMPRESSION) {
+                session->deflater.reset(new SyncDeflater(level));
+            }
+        } else if (!arg.empty()) {
+            D("sync: ignoring unknown service argument '%s'", arg.c_str());
+        }
+    }
+}
+
 static bool should_use_fs_config(const std::string& path) {
     // TODO: use fs_config to configure permissions on /data.
     return android::base::StartsWith(path, "/system/") ||
@@ -146,10 +190,43 @@ static bool SendSyncFailErrno(int fd, const std::string& reason) {
     return SendSyncFail(fd, android::base::StringPrintf("%s: %s", reason.c_str(), strerror(errno)));
 }
 
+// Whether |id| is file data within an ID_SEND, given what the client asked for.
+static bool is_send_data(const SyncSession& session, uint32_t id) {
+    return id == ID_DATA || (session.deflate && id == ID_ZDAT) ||
+           (session.delta && id == ID_COPY);
+}
+
+// Copies |range| of the file a delta push replaces to |fd|, adding what it
+// copies to |checksum|.
+static bool copy_range(int base_fd, int fd, const SyncCopyRange& range,
+                       std::vector<char>& buffer, FileChecksum* checksum) {
+    uint64_t offset = range.offset;
+    uint64_t left = range.length;
+    while (left > 0) {
+        size_t length = std::min<uint64_t>(left, buffer.size());
+        ssize_t r = TEMP_FAILURE_RETRY(pread64(base_fd, &buffer[0], length, offset));
+        if (r <= 0) {
+            // Shorter than when its signatures were sent
+            if (r == 0) errno = ERANGE;
+            return false;
+        }
+        if (!WriteFdExactly(fd, &buffer[0], r)) return false;
+        checksum->Update(&buffer[0], r);
+        offset += r;
+        left -= r;
+    }
+    return true;
+}
+
 static bool handle_send_file(int s, const char* path, uid_t uid,
-                             gid_t gid, mode_t mode, std::vector<char>& buffer, bool do_unlink) {
+                             gid_t gid, mode_t mode, std::vector<char>& buffer, bool do_unlink,
+                             SyncSession& session) {
     syncmsg msg;
     unsigned int timestamp = 0;
+    bool reached_done = false;
+    // What was written, if there may be ID_COPYs, and whether there were.
+    FileChecksum checksum;
+    bool copied = false;
 
     __android_log_security_bswrite(SEC_TAG_ADB_SEND_FILE, path);
 
@@ -185,9 +262,43 @@ static bool handle_send_file(int s, const char* path, uid_t uid,
     while (true) {
         if (!ReadFdExactly(s, &msg.data, sizeof(msg.data))) goto fail;
 
-        if (msg.data.id != ID_DATA) {
+        if (session.delta && msg.data.id == ID_COPY) {
+            SyncCopyRange range;
+            if (msg.data.size != sizeof(range)) {
+                SendSyncFail(s, "invalid copy message");
+                goto abort;
+            }
+            if (!ReadFdExactly(s, &range, sizeof(range))) goto abort;
+
+            if (session.base_fd < 0) {
+                SendSyncFail(s, "no file to copy from");
+                goto fail;
+            }
+            copied = true;
+            if (!copy_range(session.base_fd, fd, range, buffer, &checksum)) {
+                SendSyncFailErrno(s, "copy from replaced file failed");
+                goto fail;
+            }
+            continue;
+        }
+
+        bool deflated = session.deflate && msg.data.id == ID_ZDAT;
+        if (msg.data.id != ID_DATA && !deflated) {
             if (msg.data.id == ID_DONE) {
                 timestamp = msg.data.size;
+                if (copied) {
+                    // The copies were of the file as it was at ID_SIGS. If it
+                    // changed since, what we wrote is not what was sent.
+                    uint8_t expected[kStrongChecksumSize];
+                    uint8_t actual[kStrongChecksumSize];
+                    if (!ReadFdExactly(s, expected, sizeof(expected))) goto abort;
+                    checksum.Final(actual);
+                    if (memcmp(expected, actual, sizeof(actual)) != 0) {
+                        SendSyncFail(s, "file changed during delta push");
+                        reached_done = true;
+                        goto abort;
+                    }
+                }
                 break;
             }
             SendSyncFail(s, "invalid data message");
@@ -201,10 +312,25 @@ static bool handle_send_file(int s, const char* path, uid_t uid,
 
         if (!ReadFdExactly(s, &buffer[0], msg.data.size)) goto abort;
 
-        if (!WriteFdExactly(fd, &buffer[0], msg.data.size)) {
+        const char* data = &buffer[0];
+        size_t length = msg.data.size;
+        if (deflated) {
+            length = session.inflater->Inflate(data, length, &session.zbuffer[0],
+                                               session.zbuffer.size());
+            if (length == 0) {
+                SendSyncFail(s, "invalid deflated data message");
+                goto abort;
+            }
+            data = &session.zbuffer[0];
+        }
+
+        if (!WriteFdExactly(fd, data, length)) {
             SendSyncFailErrno(s, "write failed");
             goto fail;
         }
+        if (session.delta) {
+            checksum.Update(data, length);
+        }
     }
 
     adb_close(fd);
@@ -229,8 +355,11 @@ fail:
         if (!ReadFdExactly(s, &msg.data, sizeof(msg.data))) goto fail;
 
         if (msg.data.id == ID_DONE) {
+            // An ID_DONE after ID_COPYs has the file's checksum after it.
+            if (copied && !ReadFdExactly(s, &buffer[0], kStrongChecksumSize)) goto abort;
+            reached_done = true;
             goto abort;
-        } else if (msg.data.id != ID_DATA) {
+        } else if (!is_send_data(session, msg.data.id)) {
             char id[5];
             memcpy(id, &msg.data.id, sizeof(msg.data.id));
             id[4] = '\0';
@@ -245,12 +374,14 @@ fail:
         }
 
         if (!ReadFdExactly(s, &buffer[0], msg.data.size)) goto abort;
+        copied = copied || msg.data.id == ID_COPY;
     }
 
 abort:
     if (fd >= 0) adb_close(fd);
     if (do_unlink) adb_unlink(path);
-    return false;
+    // A pipelining client has its next request queued up behind this one.
+    return reached_done && session.pipeline;
 }
 
 #if defined(_WIN32)
@@ -303,7 +434,8 @@ static bool handle_send_link(int s, const std::string& path, std::vector<char>&
 }
 #endif
 
-static bool do_send(int s, const std::string& spec, std::vector<char>& buffer) {
+static bool do_send(int s, const std::string& spec, std::vector<char>& buffer,
+                    SyncSession& session) {
     // 'spec' is of the form "/some/path,0755". Break it up.
     size_t comma = spec.find_last_of(',');
     if (comma == std::string::npos) {
@@ -320,8 +452,14 @@ static bool do_send(int s, const std::string& spec, std::vector<char>& buffer) {
         return false;
     }
 
-    // Don't delete files before copying if they are not "regular" or symlinks.
+    // A delta push copies from the file it replaces: unlinked, but still open.
     struct stat st;
+    if (session.delta && !S_ISLNK(mode) && stat(path.c_str(), &st) == 0 &&
+            S_ISREG(st.st_mode)) {
+        session.base_fd = adb_open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+
+    // Don't delete files before copying if they are not "regular" or symlinks.
     bool do_unlink = (lstat(path.c_str(), &st) == -1) || S_ISREG(st.st_mode) || S_ISLNK(st.st_mode);
     if (do_unlink) {
         adb_unlink(path.c_str());
@@ -344,30 +482,46 @@ static bool do_send(int s, const std::string& spec, std::vector<char>& buffer) {
         fs_config(path.c_str(), 0, nullptr, &uid, &gid, &broken_api_hack, &cap);
         mode = broken_api_hack;
     }
-    return handle_send_file(s, path.c_str(), uid, gid, mode, buffer, do_unlink);
+    bool result = handle_send_file(s, path.c_str(), uid, gid, mode, buffer, do_unlink, session);
+    if (session.base_fd >= 0) {
+        adb_close(session.base_fd);
+        session.base_fd = -1;
+    }
+    return result;
 }
 
-static bool do_recv(int s, const char* path, std::vector<char>& buffer) {
+static bool do_recv(int s, const char* path, std::vector<char>& buffer,
+                    SyncSession& session) {
     __android_log_security_bswrite(SEC_TAG_ADB_RECV_FILE, path);
 
     int fd = adb_open(path, O_RDONLY | O_CLOEXEC);
     if (fd < 0) {
-        SendSyncFailErrno(s, "open failed");
-        return false;
+        return SendSyncFailErrno(s, "open failed") && session.pipeline;
     }
 
     syncmsg msg;
-    msg.data.id = ID_DATA;
     while (true) {
         int r = adb_read(fd, &buffer[0], buffer.size());
         if (r <= 0) {
             if (r == 0) break;
-            SendSyncFailErrno(s, "read failed");
+            bool sent = SendSyncFailErrno(s, "read failed");
             adb_close(fd);
-            return false;
+            return sent && session.pipeline;
         }
+
+        const char* data = &buffer[0];
+        msg.data.id = ID_DATA;
         msg.data.size = r;
-        if (!WriteFdExactly(s, &msg.data, sizeof(msg.data)) || !WriteFdExactly(s, &buffer[0], r)) {
+        if (session.deflater) {
+            size_t deflated = session.deflater->Deflate(data, r, &session.zbuffer[0]);
+            if (deflated != 0) {
+                data = &session.zbuffer[0];
+                msg.data.id = ID_ZDAT;
+                msg.data.size = deflated;
+            }
+        }
+        if (!WriteFdExactly(s, &msg.data, sizeof(msg.data)) ||
+                !WriteFdExactly(s, data, msg.data.size)) {
             adb_close(fd);
             return false;
         }
@@ -380,7 +534,64 @@ static bool do_recv(int s, const char* path, std::vector<char>& buffer) {
     return WriteFdExactly(s, &msg.data, sizeof(msg.data));
 }
 
-static bool handle_sync_command(int fd, std::vector<char>& buffer) {
+// Signatures are sent this many at a time.
+static const size_t kSignatureBatch = 1024;
+
+static bool do_sigs(int s, const char* path, std::vector<char>& buffer) {
+    syncmsg msg;
+    msg.sigs.id = ID_SIGS;
+    msg.sigs.block_size = 0;
+    msg.sigs.count = 0;
+    msg.sigs.tail = 0;
+
+    // Anything but a regular file is as good as none: all of it is sent.
+    struct stat st;
+    int fd = -1;
+    if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        fd = adb_open(path, O_RDONLY | O_CLOEXEC);
+    }
+    if (fd < 0) {
+        return WriteFdExactly(s, &msg.sigs, sizeof(msg.sigs));
+    }
+
+    size_t block_size = DeltaBlockSize(st.st_size);
+    uint64_t count = (st.st_size + block_size - 1) / block_size;
+    msg.sigs.block_size = block_size;
+    msg.sigs.count = count;
+    msg.sigs.tail = st.st_size - (count - 1) * block_size;
+    if (!WriteFdExactly(s, &msg.sigs, sizeof(msg.sigs))) {
+        adb_close(fd);
+        return false;
+    }
+
+    std::vector<SyncBlockSignature> signatures;
+    signatures.reserve(kSignatureBatch);
+    bool readable = true;
+    for (uint64_t i = 0; i < count; ++i) {
+        size_t length = (i == count - 1) ? msg.sigs.tail : block_size;
+        readable = readable && android::base::ReadFully(fd, &buffer[0], length);
+        if (readable) {
+            signatures.push_back(BlockSignature(&buffer[0], length));
+        } else {
+            // Cut short since the stat: a signature that matches nothing
+            signatures.push_back(SyncBlockSignature{});
+        }
+
+        if (signatures.size() == kSignatureBatch || i == count - 1) {
+            if (!WriteFdExactly(s, &signatures[0],
+                                signatures.size() * sizeof(SyncBlockSignature))) {
+                adb_close(fd);
+                return false;
+            }
+            signatures.clear();
+        }
+    }
+
+    adb_close(fd);
+    return true;
+}
+
+static bool handle_sync_command(int fd, std::vector<char>& buffer, SyncSession& session) {
     D("sync: waiting for request");
 
     SyncRequest request;
@@ -411,10 +622,17 @@ static bool handle_sync_command(int fd, std::vector<char>& buffer) {
         if (!do_list(fd, name)) return false;
         break;
       case ID_SEND:
-        if (!do_send(fd, name, buffer)) return false;
+        if (!do_send(fd, name, buffer, session)) return false;
         break;
       case ID_RECV:
-        if (!do_recv(fd, name, buffer)) return false;
+        if (!do_recv(fd, name, buffer, session)) return false;
+        break;
+      case ID_SIGS:
+        if (!session.delta) {
+            SendSyncFail(fd, "ID_SIGS without delta");
+            return false;
+        }
+        if (!do_sigs(fd, name, buffer)) return false;
         break;
       case ID_QUIT:
         return false;
@@ -428,9 +646,19 @@ static bool handle_sync_command(int fd, std::vector<char>& buffer) {
 }
 
 void file_sync_service(int fd, void* cookie) {
-    std::vector<char> buffer(SYNC_DATA_MAX);
+    // The service name after "sync", from services.cpp
+    SyncSession session;
+    parse_sync_service_args(&session, reinterpret_cast<char*>(cookie));
+    free(cookie);
+
+    // Larger chunks both ways, and so a larger buffer for what we read
+    std::vector<char> buffer(session.pipeline ? SYNC_DATA_MAX_PIPELINE : SYNC_DATA_MAX);
+    if (session.deflate) {
+        session.inflater.reset(new SyncInflater());
+        session.zbuffer.resize(buffer.size());
+    }
 
-    while (handle_sync_command(fd, buffer)) {
+    while (handle_sync_command(fd, buffer, session)) {
     }
 
     D("sync: done");
@@ -29,10 +29,37 @@
 #define ID_DENT MKID('D','E','N','T')
 #define ID_DONE MKID('D','O','N','E')
 #define ID_DATA MKID('D','A','T','A')
+#define ID_ZDAT MKID('Z','D','A','T')
+#define ID_SIGS MKID('S','I','G','S')
+#define ID_COPY MKID('C','O','P','Y')
 #define ID_OKAY MKID('O','K','A','Y')
 #define ID_FAIL MKID('F','A','I','L')
 #define ID_QUIT MKID('Q','U','I','T')
 
+// The service is "sync:", or "sync,pipeline:" when the device has
+// kFeatureSyncPipeline. With pipelining:
+//  - ID_DATA chunks may be up to SYNC_DATA_MAX_PIPELINE bytes, both ways.
+//  - Several requests may be sent before reading the replies, which come
+//    back in order.
+//  - An ID_FAIL for one ID_SEND or ID_RECV ends that transfer only; the
+//    next request is still read.
+//
+// With kFeatureSyncDeflate the client may add "deflate=<level>": then file
+// data may come as ID_ZDAT as well as ID_DATA, both ways. ID_ZDAT is laid
+// out as ID_DATA, but holds the chunk deflated, see file_sync_deflate.h. The
+// level, 1 to 9, is what the device deflates with when sending; 0 for not
+// at all.
+//
+// With kFeatureSyncDelta the client may add "delta", for pushes that send
+// only what changed, see file_sync_delta.h:
+//  - ID_SIGS with a path is answered with syncmsg.sigs, then |count|
+//    SyncBlockSignatures of the regular file there: blocks of |block_size|
+//    bytes, the last one |tail|. A count of 0 if there is no such file.
+//  - In an ID_SEND, ID_COPY is laid out as ID_DATA with a SyncCopyRange for
+//    data, and stands for that range of the file being replaced.
+//  - An ID_DONE for an ID_SEND with any ID_COPY is followed by the MD5 of
+//    the whole file, kStrongChecksumSize bytes. If what the device wrote
+//    differs, because the file changed since its ID_SIGS, the push fails.
 struct SyncRequest {
     uint32_t id;  // ID_STAT, et cetera.
     uint32_t path_length;  // <= 1024
@@ -61,16 +88,31 @@ union syncmsg {
         uint32_t id;
         uint32_t msglen;
     } status;
+    struct __attribute__((packed)) {
+        uint32_t id;
+        uint32_t block_size;
+        uint32_t count;
+        uint32_t tail;
+    } sigs;
 };
 
+struct SyncCopyRange {
+    uint64_t offset;
+    uint64_t length;
+} __attribute__((packed));
+
 void file_sync_service(int fd, void* cookie);
 bool do_sync_ls(const char* path);
-bool do_sync_push(const std::vector<const char*>& srcs, const char* dst);
+// |deflate_level| 1 to 9 compresses file data when the device can, see ID_ZDAT.
+// |sync_delta| sends only what differs from the files already there.
+bool do_sync_push(const std::vector<const char*>& srcs, const char* dst,
+                  int deflate_level=0, bool sync_delta=false);
 bool do_sync_pull(const std::vector<const char*>& srcs, const char* dst,
-                  bool copy_attrs, const char* name=nullptr);
+                  bool copy_attrs, const char* name=nullptr, int deflate_level=0);
 
 bool do_sync_sync(const std::string& lpath, const std::string& rpath, bool list_only);
 
 #define SYNC_DATA_MAX (64*1024)
+#define SYNC_DATA_MAX_PIPELINE (256*1024)
 
 #endif
@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "file_sync_service.h"
+
+#include <gtest/gtest.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <android-base/test_utils.h>
+
+#include "adb_client.h"
+#include "adb_io.h"
+#include "file_sync_delta.h"
+#include "sysdeps.h"
+#include "transport.h"
+
+// The client in file_sync_client.cpp talks to file_sync_service over a
+// socketpair here, in place of a connection through the adb server.
+
+int adb_connect(const std::string& service, std::string* error) {
+    int fds[2];
+    if (adb_socketpair(fds) != 0) {
+        *error = strerror(errno);
+        return -1;
+    }
+    // As services.cpp does: what follows "sync".
+    void* arg = strdup(service.c_str() + 4);
+    std::thread(file_sync_service, fds[1], arg).detach();
+    return fds[0];
+}
+
+bool adb_get_feature_set(FeatureSet* feature_set, std::string* error) {
+    *feature_set = { kFeatureSyncPipeline, kFeatureSyncDeflate, kFeatureSyncDelta };
+    return true;
+}
+
+class FileSyncTest : public ::testing::Test {
+  public:
+    static void SetUpTestCase() {
+        // This is normally done in main.cpp. The service writes to the
+        // connection after the client closes it.
+        saved_sigpipe_handler_ = signal(SIGPIPE, SIG_IGN);
+    }
+
+    static void TearDownTestCase() {
+        signal(SIGPIPE, saved_sigpipe_handler_);
+    }
+
+    static sighandler_t saved_sigpipe_handler_;
+};
+
+sighandler_t FileSyncTest::saved_sigpipe_handler_ = nullptr;
+
+static std::string random_data(size_t size) {
+    std::string s(size, '\0');
+    for (char& c : s) {
+        c = rand();
+    }
+    return s;
+}
+
+static void expect_file(const std::string& expected, const std::string& path) {
+    std::string actual;
+    ASSERT_TRUE(android::base::ReadFileToString(path, &actual));
+    ASSERT_EQ(expected.size(), actual.size());
+    EXPECT_TRUE(expected == actual);
+}
+
+TEST_F(FileSyncTest, delta_push) {
+    TemporaryDir dir;
+    std::string local = std::string(dir.path) + "/local";
+    std::string remote = std::string(dir.path) + "/remote";
+
+    for (int deflate_level : {0, 1}) {
+        adb_unlink(remote.c_str());
+        std::string data = random_data(3 * 1024 * 1024 + 123);
+        std::vector<std::string> versions = { data, data };
+        // Insertions, a change, a deletion and a new tail
+        data.insert(1000, "inserted");
+        data[1000000] ^= 1;
+        data.erase(2000000, 50000);
+        data += "more at the end";
+        versions.push_back(data);
+        data.resize(1000000);
+        versions.push_back(data);
+
+        // The first goes whole, there being nothing there yet.
+        for (const std::string& version : versions) {
+            ASSERT_TRUE(android::base::WriteStringToFile(version, local));
+            ASSERT_TRUE(do_sync_push({local.c_str()}, remote.c_str(), deflate_level, true));
+            expect_file(version, remote);
+        }
+    }
+}
+
+// Sends an ID_SEND of the file at |path| to itself made of a single ID_COPY
+// of its first |length| bytes, claiming they are |expected|, and returns the
+// reply. The file is changed by |change| between ID_SIGS and ID_SEND.
+static uint32_t copy_push(const std::string& path, size_t length, const std::string& expected,
+                          const std::function<void()>& change) {
+    std::string error;
+    int fd = adb_connect("sync,delta:", &error);
+    EXPECT_LE(0, fd) << error;
+
+    SyncRequest req;
+    req.id = ID_SIGS;
+    req.path_length = path.size();
+    EXPECT_TRUE(WriteFdExactly(fd, &req, sizeof(req)) && WriteFdExactly(fd, path));
+    syncmsg msg;
+    EXPECT_TRUE(ReadFdExactly(fd, &msg.sigs, sizeof(msg.sigs)));
+    EXPECT_EQ(static_cast<uint32_t>(ID_SIGS), msg.sigs.id);
+    std::vector<SyncBlockSignature> signatures(msg.sigs.count);
+    EXPECT_TRUE(ReadFdExactly(fd, &signatures[0], signatures.size() * sizeof(signatures[0])));
+
+    change();
+
+    std::string spec = android::base::StringPrintf("%s,%d", path.c_str(), 0644);
+    req.id = ID_SEND;
+    req.path_length = spec.size();
+    EXPECT_TRUE(WriteFdExactly(fd, &req, sizeof(req)) && WriteFdExactly(fd, spec));
+    SyncCopyRange range = { 0, length };
+    msg.data.id = ID_COPY;
+    msg.data.size = sizeof(range);
+    EXPECT_TRUE(WriteFdExactly(fd, &msg.data, sizeof(msg.data)) &&
+                WriteFdExactly(fd, &range, sizeof(range)));
+    uint8_t checksum[kStrongChecksumSize];
+    StrongChecksum(expected.data(), expected.size(), checksum);
+    msg.data.id = ID_DONE;
+    msg.data.size = 0;
+    EXPECT_TRUE(WriteFdExactly(fd, &msg.data, sizeof(msg.data)) &&
+                WriteFdExactly(fd, checksum, sizeof(checksum)));
+
+    msg.status.id = 0;
+    EXPECT_TRUE(ReadFdExactly(fd, &msg.status, sizeof(msg.status)));
+    if (msg.status.id == ID_FAIL) {
+        std::string reason(msg.status.msglen, '\0');
+        EXPECT_TRUE(ReadFdExactly(fd, &reason[0], reason.size()));
+    }
+
+    // As SyncConnection does, so that the service is done with the file.
+    req.id = ID_QUIT;
+    req.path_length = 0;
+    WriteFdExactly(fd, &req, sizeof(req));
+    ReadOrderlyShutdown(fd);
+    adb_close(fd);
+    return msg.status.id;
+}
+
+TEST_F(FileSyncTest, delta_push_file_changed) {
+    TemporaryDir dir;
+    std::string path = std::string(dir.path) + "/file";
+    std::string data = random_data(100000);
+    ASSERT_TRUE(android::base::WriteStringToFile(data, path));
+
+    // Copied as it was
+    EXPECT_EQ(static_cast<uint32_t>(ID_OKAY), copy_push(path, data.size(), data, []() {}));
+    expect_file(data, path);
+
+    // Changed since its signatures were sent: what was copied is not what
+    // the client has, and the push fails.
+    std::string changed = data;
+    changed[50000] ^= 1;
+    EXPECT_EQ(static_cast<uint32_t>(ID_FAIL), copy_push(path, data.size(), data, [&]() {
+        ASSERT_TRUE(android::base::WriteStringToFile(changed, path));
+    }));
+    EXPECT_EQ(-1, access(path.c_str(), F_OK));
+}
+
+TEST_F(FileSyncTest, pull_dir_with_failures) {
+    TemporaryDir remote_dir;
+    TemporaryDir local_dir;
+    std::string remote = std::string(remote_dir.path) + "/dir";
+    std::string local = std::string(local_dir.path) + "/dir";
+    ASSERT_EQ(0, adb_mkdir(remote, 0755));
+
+    std::vector<std::string> files;
+    for (int i = 0; i < 10; ++i) {
+        files.push_back(random_data(1000 + i));
+        std::string path = android::base::StringPrintf("%s/file%d", remote.c_str(), i);
+        ASSERT_TRUE(android::base::WriteStringToFile(files.back(), path));
+    }
+    // One the daemon can't read, a link to nowhere, and one we can't write,
+    // with a directory in the way.
+    ASSERT_EQ(0, symlink("/nonexistent", (remote + "/unreadable").c_str()));
+    ASSERT_EQ(0, adb_mkdir(local, 0755));
+    ASSERT_EQ(0, adb_mkdir(local + "/file5", 0755));
+
+    std::string second = std::string(remote_dir.path) + "/second";
+    std::string second_data = random_data(2000);
+    ASSERT_TRUE(android::base::WriteStringToFile(second_data, second));
+
+    // The replies for the files after those that failed are all read, and
+    // the second source after them.
+    EXPECT_FALSE(do_sync_pull({remote.c_str(), second.c_str()}, local_dir.path, false, nullptr,
+                              0));
+    for (int i = 0; i < 10; ++i) {
+        if (i != 5) {
+            expect_file(files[i],
+                        android::base::StringPrintf("%s/file%d", local.c_str(), i));
+        }
+    }
+    expect_file(second_data, std::string(local_dir.path) + "/second");
+}
@@ -185,16 +185,18 @@ jdwp_process_free( JdwpProcess*  proc )
         proc->prev->next = proc->next;
         proc->next->prev = proc->prev;
 
+        /* the fdevent must go before the socket is closed, as it doesn't
+         * close it itself */
+        if (proc->fde != NULL) {
+            fdevent_destroy(proc->fde);
+            proc->fde = NULL;
+        }
+
         if (proc->socket >= 0) {
             adb_shutdown(proc->socket);
             adb_close(proc->socket);
             proc->socket = -1;
         }
-
-        if (proc->fde != NULL) {
-            fdevent_destroy(proc->fde);
-            proc->fde = NULL;
-        }
         proc->pid = -1;
 
         for (n = 0; n < proc->out_count; n++) {
@@ -547,6 +549,9 @@ jdwp_control_event( int  s, unsigned  events, void*  _control )
         }
         while (s < 0);
 
+        /* don't let it outlive us in the shells we fork */
+        close_on_exec(s);
+
         proc = jdwp_process_alloc( s );
         if (proc == NULL)
             return;
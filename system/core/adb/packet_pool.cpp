@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TRACE_TAG ADB
+
+#include "sysdeps.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <mutex>
+#include <new>
+
+#include <android-base/logging.h>
+#include <android-base/macros.h>
+
+#include "adb.h"
+#include "sysdeps/mutex.h"
+
+// A payload block: this, room for the packet header, then the data.
+struct apayload {
+    std::atomic<int> refs;
+    size_t size_class;
+    apayload* next;
+};
+
+struct SizeClass {
+    size_t size;
+    size_t max_free;
+};
+
+// Enough for connect, auth and most shell traffic; a sync data chunk; the
+// most a transport takes. Blocks are kept for reuse up to max_free of each,
+// rather than going back to malloc, which for the larger ones means a mmap
+// and page faults for every packet.
+static const SizeClass kSizeClasses[] = {
+    { MAX_PAYLOAD_V1, 64 },
+    { 64 * 1024, 16 },
+    { MAX_PAYLOAD_V2, 8 },
+};
+
+static const size_t kMaxFreePackets = 256;
+
+static std::mutex& pool_lock = *new std::mutex();
+static apacket* free_packets;
+static size_t free_packet_count;
+static apayload* free_payloads[arraysize(kSizeClasses)];
+static size_t free_payload_count[arraysize(kSizeClasses)];
+
+static unsigned char* payload_header(apayload* payload) {
+    return reinterpret_cast<unsigned char*>(payload + 1);
+}
+
+static void put_payload(apayload* payload) {
+    if (payload->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pool_lock);
+        const size_t c = payload->size_class;
+        if (free_payload_count[c] < kSizeClasses[c].max_free) {
+            payload->next = free_payloads[c];
+            free_payloads[c] = payload;
+            ++free_payload_count[c];
+            return;
+        }
+    }
+
+    payload->~apayload();
+    free(payload);
+}
+
+static void attach_payload(apacket* p, size_t payload_size) {
+    p->payload = nullptr;
+    p->data = nullptr;
+    p->capacity = 0;
+    if (payload_size == 0) {
+        return;
+    }
+
+    CHECK_LE(payload_size, MAX_PAYLOAD);
+    size_t c = 0;
+    while (kSizeClasses[c].size < payload_size) {
+        ++c;
+    }
+
+    apayload* payload = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(pool_lock);
+        payload = free_payloads[c];
+        if (payload) {
+            free_payloads[c] = payload->next;
+            --free_payload_count[c];
+        }
+    }
+
+    if (payload == nullptr) {
+        void* block = malloc(sizeof(apayload) + sizeof(amessage) + kSizeClasses[c].size);
+        if (block == nullptr) {
+            fatal("failed to allocate an apacket payload");
+        }
+        payload = new (block) apayload();
+        payload->size_class = c;
+    }
+    payload->refs.store(1, std::memory_order_relaxed);
+    payload->next = nullptr;
+
+    p->payload = payload;
+    p->data = payload_header(payload) + sizeof(amessage);
+    p->capacity = kSizeClasses[c].size;
+}
+
+apacket* get_apacket(size_t payload_size)
+{
+    apacket* p = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(pool_lock);
+        p = free_packets;
+        if (p) {
+            free_packets = p->next;
+            --free_packet_count;
+        }
+    }
+
+    if (p == nullptr) {
+        p = reinterpret_cast<apacket*>(malloc(sizeof(apacket)));
+        if (p == nullptr) {
+            fatal("failed to allocate an apacket");
+        }
+    }
+
+    memset(p, 0, sizeof(apacket));
+    attach_payload(p, payload_size);
+    return p;
+}
+
+void put_apacket(apacket *p)
+{
+    if (p->payload) {
+        put_payload(p->payload);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pool_lock);
+        if (free_packet_count < kMaxFreePackets) {
+            p->next = free_packets;
+            free_packets = p;
+            ++free_packet_count;
+            return;
+        }
+    }
+
+    free(p);
+}
+
+void reserve_apacket(apacket* p, size_t payload_size) {
+    if (p->capacity >= payload_size &&
+        (p->payload == nullptr || p->payload->refs.load(std::memory_order_acquire) == 1)) {
+        return;
+    }
+
+    if (p->payload) {
+        put_payload(p->payload);
+    }
+    attach_payload(p, payload_size);
+}
+
+apacket* share_apacket(apacket* p) {
+    apacket* shared = get_apacket(0);
+    shared->len = p->len;
+    shared->ptr = p->ptr;
+    shared->msg = p->msg;
+    shared->data = p->data;
+    shared->capacity = p->capacity;
+    shared->payload = p->payload;
+    if (p->payload) {
+        p->payload->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    return shared;
+}
+
+const unsigned char* prepend_apacket_header(apacket* p) {
+    // Whoever shares the payload may be writing a header of their own there
+    if (p->payload == nullptr || p->payload->refs.load(std::memory_order_acquire) != 1) {
+        return nullptr;
+    }
+
+    unsigned char* header = payload_header(p->payload);
+    memcpy(header, &p->msg, sizeof(amessage));
+    return header;
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "adb.h"
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include <vector>
+
+#include "sysdeps.h"
+
+TEST(packet_pool, size_classes) {
+    apacket* p = get_apacket(0);
+    EXPECT_EQ(nullptr, p->data);
+    EXPECT_EQ(0u, p->capacity);
+    put_apacket(p);
+
+    for (size_t size : { size_t(1), MAX_PAYLOAD_V1, MAX_PAYLOAD_V1 + 1, MAX_PAYLOAD }) {
+        p = get_apacket(size);
+        ASSERT_NE(nullptr, p->data);
+        EXPECT_LE(size, p->capacity);
+        EXPECT_GE(MAX_PAYLOAD, p->capacity);
+        memset(p->data, 'x', p->capacity);
+        put_apacket(p);
+    }
+
+    // The old default
+    p = get_apacket();
+    EXPECT_EQ(MAX_PAYLOAD, p->capacity);
+    put_apacket(p);
+}
+
+TEST(packet_pool, reuse) {
+    apacket* p = get_apacket(MAX_PAYLOAD);
+    unsigned char* data = p->data;
+    put_apacket(p);
+
+    // A packet comes back with its header zeroed, whatever it held
+    p = get_apacket(MAX_PAYLOAD);
+    EXPECT_EQ(data, p->data);
+    EXPECT_EQ(0u, p->len);
+    EXPECT_EQ(0u, p->msg.command);
+    put_apacket(p);
+}
+
+TEST(packet_pool, reserve) {
+    apacket* p = get_apacket(0);
+    reserve_apacket(p, 100);
+    ASSERT_NE(nullptr, p->data);
+    EXPECT_LE(100u, p->capacity);
+
+    unsigned char* data = p->data;
+    reserve_apacket(p, 50);
+    EXPECT_EQ(data, p->data);
+
+    reserve_apacket(p, MAX_PAYLOAD);
+    EXPECT_EQ(MAX_PAYLOAD, p->capacity);
+    put_apacket(p);
+}
+
+TEST(packet_pool, share) {
+    apacket* p = get_apacket(16);
+    memcpy(p->data, "0004abcd", 8);
+    p->len = 8;
+
+    apacket* shared = share_apacket(p);
+    EXPECT_EQ(p->data, shared->data);
+    EXPECT_EQ(8u, shared->len);
+
+    // The payload outlives the packet it came with
+    put_apacket(p);
+    EXPECT_EQ(0, memcmp(shared->data, "0004abcd", 8));
+
+    // Nor is it handed out again while shared
+    apacket* other = get_apacket(16);
+    EXPECT_NE(shared->data, other->data);
+    put_apacket(other);
+
+    // Shared payloads are not to be written to, not even a header
+    apacket* third = share_apacket(shared);
+    EXPECT_EQ(nullptr, prepend_apacket_header(shared));
+    put_apacket(third);
+    put_apacket(shared);
+}
+
+TEST(packet_pool, prepend_header) {
+    apacket* p = get_apacket(0);
+    p->msg.command = A_OKAY;
+    EXPECT_EQ(nullptr, prepend_apacket_header(p));
+    put_apacket(p);
+
+    p = get_apacket(4);
+    p->msg.command = A_WRTE;
+    p->msg.data_length = 4;
+    memcpy(p->data, "data", 4);
+    const unsigned char* wire = prepend_apacket_header(p);
+    ASSERT_NE(nullptr, wire);
+    EXPECT_EQ(0, memcmp(wire, &p->msg, sizeof(amessage)));
+    EXPECT_EQ(0, memcmp(wire + sizeof(amessage), "data", 4));
+    put_apacket(p);
+}
+
+static void get_and_put_packets(void* arg) {
+    const size_t seed = reinterpret_cast<size_t>(arg);
+    for (size_t n = 0; n < 10000; ++n) {
+        apacket* p = get_apacket((n * 4099 + seed) % MAX_PAYLOAD);
+        apacket* shared = share_apacket(p);
+        if (p->capacity) {
+            p->data[0] = seed;
+        }
+        put_apacket(p);
+        put_apacket(shared);
+    }
+}
+
+TEST(packet_pool, threads) {
+    // As between the transport threads and the main thread
+    std::vector<adb_thread_t> threads(4);
+    for (size_t i = 0; i < threads.size(); ++i) {
+        ASSERT_TRUE(adb_thread_create(get_and_put_packets, reinterpret_cast<void*>(i),
+                                      &threads[i]));
+    }
+    for (adb_thread_t thread : threads) {
+        ASSERT_TRUE(adb_thread_join(thread));
+    }
+}
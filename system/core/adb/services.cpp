@@ -319,8 +319,10 @@ int service_to_fd(const char* name, const atransport* transport) {
         ret = ShellService(name + 5, transport);
     } else if(!strncmp(name, "exec:", 5)) {
         ret = StartSubprocess(name + 5, nullptr, SubprocessType::kRaw, SubprocessProtocol::kNone);
-    } else if(!strncmp(name, "sync:", 5)) {
-        ret = create_service_thread(file_sync_service, NULL);
+    } else if (!strncmp(name, "sync", 4) && (name[4] == ':' || name[4] == ',')) {
+        void* arg = strdup(name + 4);
+        if (arg == NULL) return -1;
+        ret = create_service_thread(file_sync_service, arg);
     } else if(!strncmp(name, "remount:", 8)) {
         ret = create_service_thread(remount_service, NULL);
     } else if(!strncmp(name, "reboot:", 7)) {
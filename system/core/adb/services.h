@@ -21,4 +21,8 @@ constexpr char kShellServiceArgRaw[] = "raw";
 constexpr char kShellServiceArgPty[] = "pty";
 constexpr char kShellServiceArgShellProtocol[] = "v2";
 
+constexpr char kSyncServiceArgPipeline[] = "pipeline";
+constexpr char kSyncServiceArgDeflate[] = "deflate=";
+constexpr char kSyncServiceArgDelta[] = "delta";
+
 #endif  // SERVICES_H_
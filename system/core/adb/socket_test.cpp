@@ -115,7 +115,7 @@ static void CloseWithPacketThreadFunc(CloseWithPacketArg* arg) {
     arg->bytes_written = 0;
     while (true) {
         apacket* p = get_apacket();
-        p->len = sizeof(p->data);
+        p->len = p->capacity;
         arg->bytes_written += p->len;
         int ret = s->enqueue(s, p);
         if (ret == 1) {
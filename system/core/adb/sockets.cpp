@@ -305,9 +305,9 @@ static void local_socket_event_func(int fd, unsigned ev, void* _s) {
     }
 
     if (ev & FDE_READ) {
-        apacket* p = get_apacket();
-        unsigned char* x = p->data;
         const size_t max_payload = s->get_max_payload();
+        apacket* p = get_apacket(max_payload);
+        unsigned char* x = p->data;
         size_t avail = max_payload;
         int r = 0;
         int is_eof = 0;
@@ -461,7 +461,7 @@ static int remote_socket_enqueue(asocket* s, apacket* p) {
 
 static void remote_socket_ready(asocket* s) {
     D("entered remote_socket_ready RS(%d) OKAY fd=%d peer.fd=%d", s->id, s->fd, s->peer->fd);
-    apacket* p = get_apacket();
+    apacket* p = get_apacket(0);
     p->msg.command = A_OKAY;
     p->msg.arg0 = s->peer->id;
     p->msg.arg1 = s->id;
@@ -471,7 +471,7 @@ static void remote_socket_ready(asocket* s) {
 static void remote_socket_shutdown(asocket* s) {
     D("entered remote_socket_shutdown RS(%d) CLOSE fd=%d peer->fd=%d", s->id, s->fd,
       s->peer ? s->peer->fd : -1);
-    apacket* p = get_apacket();
+    apacket* p = get_apacket(0);
     p->msg.command = A_CLSE;
     if (s->peer) {
         p->msg.arg0 = s->peer->id;
@@ -518,12 +518,12 @@ asocket* create_remote_socket(unsigned id, atransport* t) {
 
 void connect_to_remote(asocket* s, const char* destination) {
     D("Connect_to_remote call RS(%d) fd=%d", s->id, s->fd);
-    apacket* p = get_apacket();
     size_t len = strlen(destination) + 1;
 
     if (len > (s->get_max_payload() - 1)) {
         fatal("destination oversized");
     }
+    apacket* p = get_apacket(len);
 
     D("LS(%d): connect('%s')", s->id, destination);
     p->msg.command = A_OPEN;
@@ -680,7 +680,8 @@ static int smart_socket_enqueue(asocket* s, apacket* p) {
     }
 
     len = unhex(p->data, 4);
-    if ((len < 1) || (len > MAX_PAYLOAD_V1)) {
+    // with room for the terminator
+    if ((len < 1) || (len > MAX_PAYLOAD_V1) || (len + 4 >= p->capacity)) {
         D("SS(%d): bad size (%d)", s->id, len);
         goto fail;
     }
@@ -47,6 +47,9 @@ ADB_MUTEX_DEFINE( transport_lock );
 
 const char* const kFeatureShell2 = "shell_v2";
 const char* const kFeatureCmd = "cmd";
+const char* const kFeatureSyncPipeline = "sync_pipeline";
+const char* const kFeatureSyncDeflate = "sync_deflate";
+const char* const kFeatureSyncDelta = "sync_delta";
 
 static std::string dump_packet(const char* name, const char* func, apacket* p) {
     unsigned  command = p->msg.command;
@@ -199,7 +202,7 @@ static void read_transport_thread(void* _t) {
                                                    (t->serial != nullptr ? t->serial : "transport")));
     D("%s: starting read_transport thread on fd %d, SYNC online (%d)",
        t->serial, t->fd, t->sync_token + 1);
-    p = get_apacket();
+    p = get_apacket(0);
     p->msg.command = A_SYNC;
     p->msg.arg0 = 1;
     p->msg.arg1 = ++(t->sync_token);
@@ -212,7 +215,8 @@ static void read_transport_thread(void* _t) {
 
     D("%s: data pump started", t->serial);
     for(;;) {
-        p = get_apacket();
+        // read_from_remote() makes room for the payload once it knows the size
+        p = get_apacket(0);
 
         if(t->read_from_remote(p, t) == 0){
             D("%s: received remote packet, sending to transport",
@@ -230,7 +234,7 @@ static void read_transport_thread(void* _t) {
     }
 
     D("%s: SYNC offline for transport", t->serial);
-    p = get_apacket();
+    p = get_apacket(0);
     p->msg.command = A_SYNC;
     p->msg.arg0 = 0;
     p->msg.arg1 = 0;
@@ -368,13 +372,16 @@ device_tracker_enqueue( asocket*  socket, apacket*  p )
     return -1;
 }
 
-static int device_tracker_send(device_tracker* tracker, const std::string& string) {
-    apacket* p = get_apacket();
-    asocket* peer = tracker->socket.peer;
-
+static apacket* device_tracker_packet(const std::string& string) {
+    apacket* p = get_apacket(4 + string.size());
     snprintf(reinterpret_cast<char*>(p->data), 5, "%04x", static_cast<int>(string.size()));
     memcpy(&p->data[4], string.data(), string.size());
     p->len = 4 + string.size();
+    return p;
+}
+
+static int device_tracker_send(device_tracker* tracker, apacket* p) {
+    asocket* peer = tracker->socket.peer;
     return peer->enqueue(peer, p);
 }
 
@@ -387,7 +394,7 @@ static void device_tracker_ready(asocket* socket) {
         tracker->update_needed = 0;
 
         std::string transports = list_transports(false);
-        device_tracker_send(tracker, transports);
+        device_tracker_send(tracker, device_tracker_packet(transports));
     }
 }
 
@@ -413,15 +420,17 @@ create_device_tracker(void)
 
 // Call this function each time the transport list has changed.
 void update_transports() {
-    std::string transports = list_transports(false);
+    // One payload for all of the trackers
+    apacket* p = device_tracker_packet(list_transports(false));
 
     device_tracker* tracker = device_tracker_list;
     while (tracker != nullptr) {
         device_tracker* next = tracker->next;
         // This may destroy the tracker if the connection is closed.
-        device_tracker_send(tracker, transports);
+        device_tracker_send(tracker, share_apacket(p));
         tracker = next;
     }
+    put_apacket(p);
 }
 
 #else
@@ -784,7 +793,10 @@ const FeatureSet& supported_features() {
     // Local static allocation to avoid global non-POD variables.
     static const FeatureSet* features = new FeatureSet{
         kFeatureShell2,
-        kFeatureCmd
+        kFeatureCmd,
+        kFeatureSyncPipeline,
+        kFeatureSyncDeflate,
+        kFeatureSyncDelta,
         // Increment ADB_SERVER_VERSION whenever the feature list changes to
         // make sure that the adb client and server features stay in sync
         // (http://b/24370690).
@@ -41,6 +41,12 @@ bool CanUseFeature(const FeatureSet& feature_set, const std::string& feature);
 extern const char* const kFeatureShell2;
 // The 'cmd' command is available
 extern const char* const kFeatureCmd;
+// The sync service takes "sync,pipeline:", see file_sync_service.h.
+extern const char* const kFeatureSyncPipeline;
+// The sync service takes "deflate=<level>", see file_sync_service.h.
+extern const char* const kFeatureSyncDeflate;
+// The sync service takes "delta", see file_sync_service.h.
+extern const char* const kFeatureSyncDelta;
 
 class atransport {
 public:
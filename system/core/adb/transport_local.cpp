@@ -65,6 +65,7 @@ static int remote_read(apacket *p, atransport *t)
         return -1;
     }
 
+    reserve_apacket(p, p->msg.data_length);
     if(!ReadFdExactly(t->sfd, p->data, p->msg.data_length)){
         D("remote local: terminated (data)");
         return -1;
@@ -82,7 +83,19 @@ static int remote_write(apacket *p, atransport *t)
 {
     int   length = p->msg.data_length;
 
-    if(!WriteFdExactly(t->sfd, &p->msg, sizeof(amessage) + length)) {
+    // One write for the header and payload where the payload leaves room,
+    // without copying either into a buffer of their own.
+    const unsigned char* wire = prepend_apacket_header(p);
+    if (wire != nullptr) {
+        if(!WriteFdExactly(t->sfd, wire, sizeof(amessage) + length)) {
+            D("remote local: write terminated");
+            return -1;
+        }
+        return 0;
+    }
+
+    if(!WriteFdExactly(t->sfd, &p->msg, sizeof(amessage)) ||
+       (length && !WriteFdExactly(t->sfd, p->data, length))) {
         D("remote local: write terminated");
         return -1;
     }
@@ -38,6 +38,7 @@ static int remote_read(apacket *p, atransport *t)
     }
 
     if(p->msg.data_length) {
+        reserve_apacket(p, p->msg.data_length);
         if(usb_read(t->usb, p->data, p->msg.data_length)){
             D("remote usb: terminated (data)");
             return -1;
@@ -61,7 +62,7 @@ static int remote_write(apacket *p, atransport *t)
         return -1;
     }
     if(p->msg.data_length == 0) return 0;
-    if(usb_write(t->usb, &p->data, size)) {
+    if(usb_write(t->usb, p->data, size)) {
         D("remote usb: 2 - write terminated");
         return -1;
     }
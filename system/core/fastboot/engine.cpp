@@ -46,6 +46,7 @@
 #define OP_NOTICE     4
 #define OP_DOWNLOAD_SPARSE 5
 #define OP_WAIT_FOR_DISCONNECT 6
+#define OP_DOWNLOAD_SPARSE_STREAM 7
 
 typedef struct Action Action;
 
@@ -170,6 +171,20 @@ void fb_queue_flash_sparse(const char* ptn, struct sparse_file* s, unsigned sz,
     a->msg = mkmsg("writing '%s' %zu/%zu", ptn, current, total);
 }
 
+void fb_queue_flash_sparse_stream(const char* ptn, const sparse_piece* piece, size_t current,
+                                  size_t total) {
+    Action *a;
+
+    a = queue_action(OP_DOWNLOAD_SPARSE_STREAM, "");
+    a->data = const_cast<sparse_piece*>(piece);
+    a->size = 0;
+    a->msg = mkmsg("sending sparse '%s' %zu/%zu (%d KB)", ptn, current, total,
+                   static_cast<int>(piece->sz / 1024));
+
+    a = queue_action(OP_COMMAND, "flash:%s", ptn);
+    a->msg = mkmsg("writing '%s' %zu/%zu", ptn, current, total);
+}
+
 static int match(const char* str, const char** value, unsigned count) {
     unsigned n;
 
@@ -367,6 +382,11 @@ int fb_execute_queue(Transport* transport)
             status = fb_download_data_sparse(transport, reinterpret_cast<sparse_file*>(a->data));
             status = a->func(a, status, status ? fb_get_error() : "");
             if (status) break;
+        } else if (a->op == OP_DOWNLOAD_SPARSE_STREAM) {
+            status = fb_download_data_sparse_stream(transport,
+                                                    reinterpret_cast<sparse_piece*>(a->data));
+            status = a->func(a, status, status ? fb_get_error() : "");
+            if (status) break;
         } else if (a->op == OP_WAIT_FOR_DISCONNECT) {
             transport->WaitForDisconnect();
         } else {
@@ -90,6 +90,7 @@ static const std::string convert_fbe_marker_filename("convert_fbe");
 enum fb_buffer_type {
     FB_BUFFER,
     FB_BUFFER_SPARSE,
+    FB_BUFFER_SPARSE_STREAM,
 };
 
 struct fastboot_buffer {
@@ -698,13 +699,8 @@ static void queue_info_dump() {
     fb_queue_notice("--------------------------------------------");
 }
 
-static struct sparse_file **load_sparse_files(int fd, int max_size)
+static struct sparse_file **load_sparse_files(struct sparse_file* s, int max_size)
 {
-    struct sparse_file* s = sparse_file_import_auto(fd, false, true);
-    if (!s) {
-        die("cannot sparse read file\n");
-    }
-
     int files = sparse_file_resparse(s, max_size, nullptr, 0);
     if (files < 0) {
         die("Failed to resparse\n");
@@ -723,6 +719,59 @@ static struct sparse_file **load_sparse_files(int fd, int max_size)
     return out_s;
 }
 
+// Splits a normal image bigger than |max_size| into pieces that each fit in
+// |max_size| as a sparse file, by reading it through once. The sparse files
+// are made again from the image as each piece is sent, so that however big
+// it is only a few megabytes of it are ever in memory.
+static std::vector<sparse_piece>* load_sparse_stream(int fd, int64_t len, int64_t max_size) {
+    const unsigned int block_size = 4096;
+    // How much is added before checking whether the piece is full.
+    int64_t step = std::min<int64_t>(1024 * 1024, max_size / 4) / block_size * block_size;
+    step = std::max<int64_t>(step, block_size);
+
+    sparse_stream* st = sparse_stream_new(block_size, len, 0, false, nullptr, nullptr);
+    if (st == nullptr) {
+        die("cannot sparse read file\n");
+    }
+
+    auto pieces = new std::vector<sparse_piece>;
+    sparse_piece piece = { fd, len, block_size, 0, 0, 0, 0 };
+    for (int64_t offset = 0; offset < len; offset += step) {
+        int64_t to_add = std::min(step, len - offset);
+        unsigned int block = offset / block_size;
+        if (sparse_stream_add_fd(st, fd, to_add, block) < 0) {
+            die("cannot sparse read file\n");
+        }
+
+        if (sparse_stream_len(st) > max_size) {
+            if (piece.end_block == piece.start_block) {
+                die("cannot fit part of image in %" PRId64 " bytes\n", max_size);
+            }
+            pieces->push_back(piece);
+            sparse_stream_close(st);
+
+            // What did not fit starts the next one.
+            piece.start_block = piece.end_block;
+            st = sparse_stream_new(block_size, len, 0, false, nullptr, nullptr);
+            if (st == nullptr || lseek64(fd, offset, SEEK_SET) != offset ||
+                    sparse_stream_add_fd(st, fd, to_add, block) < 0) {
+                die("cannot sparse read file\n");
+            }
+            if (sparse_stream_len(st) > max_size) {
+                die("cannot fit part of image in %" PRId64 " bytes\n", max_size);
+            }
+        }
+
+        piece.end_block = (offset + to_add + block_size - 1) / block_size;
+        piece.chunks = sparse_stream_chunks(st);
+        piece.sz = sparse_stream_len(st);
+    }
+    pieces->push_back(piece);
+    sparse_stream_close(st);
+
+    return pieces;
+}
+
 static int64_t get_target_sparse_limit(Transport* transport) {
     std::string max_download_size;
     if (!fb_getvar(transport, "max-download-size", &max_download_size) ||
@@ -781,6 +830,16 @@ static bool needs_erase(Transport* transport, const char* partition) {
     return partition_type == "ext4";
 }
 
+// The magic at the start of a sparse image, SPARSE_HEADER_MAGIC in libsparse.
+static const uint32_t kSparseHeaderMagic = 0xed26ff3a;
+
+static bool is_sparse_file(int fd) {
+    uint32_t magic = 0;
+    bool sparse = read(fd, &magic, sizeof(magic)) == sizeof(magic) && magic == kSparseHeaderMagic;
+    lseek64(fd, 0, SEEK_SET);
+    return sparse;
+}
+
 static int load_buf_fd(Transport* transport, int fd, struct fastboot_buffer* buf) {
     int64_t sz = get_file_size(fd);
     if (sz == -1) {
@@ -790,12 +849,26 @@ static int load_buf_fd(Transport* transport, int fd, struct fastboot_buffer* buf
     lseek64(fd, 0, SEEK_SET);
     int64_t limit = get_sparse_limit(transport, sz);
     if (limit) {
-        sparse_file** s = load_sparse_files(fd, limit);
+        if (!is_sparse_file(fd)) {
+            // Not a sparse file already, so there is no need to read it all in.
+            buf->type = FB_BUFFER_SPARSE_STREAM;
+            buf->data = load_sparse_stream(fd, sz, limit);
+            return 0;
+        }
+
+        // A corrupt sparse image must not be flashed as it is, so it fails
+        // here, saying why.
+        sparse_file* s = sparse_file_import(fd, true, false);
         if (s == nullptr) {
             return -1;
         }
+
+        sparse_file** s_array = load_sparse_files(s, limit);
+        if (s_array == nullptr) {
+            return -1;
+        }
         buf->type = FB_BUFFER_SPARSE;
-        buf->data = s;
+        buf->data = s_array;
     } else {
         void* data = load_fd(fd, &sz);
         if (data == nullptr) return -1;
@@ -840,6 +913,14 @@ static void flash_buf(const char *pname, struct fastboot_buffer *buf)
             break;
         }
 
+        case FB_BUFFER_SPARSE_STREAM: {
+            auto pieces = reinterpret_cast<std::vector<sparse_piece>*>(buf->data);
+            for (size_t i = 0; i < pieces->size(); ++i) {
+                fb_queue_flash_sparse_stream(pname, &(*pieces)[i], i + 1, pieces->size());
+            }
+            break;
+        }
+
         case FB_BUFFER:
             fb_queue_flash(pname, buf->data, buf->sz);
             break;
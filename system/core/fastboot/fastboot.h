@@ -38,11 +38,24 @@
 
 struct sparse_file;
 
+/* Part of a normal image too big to send in one go, sent as a sparse file
+ * made from it as it is read. */
+struct sparse_piece {
+    int fd;
+    int64_t len;
+    unsigned int block_size;
+    unsigned int start_block;
+    unsigned int end_block;
+    unsigned int chunks;
+    int64_t sz;
+};
+
 /* protocol.c - fastboot protocol */
 int fb_command(Transport* transport, const char* cmd);
 int fb_command_response(Transport* transport, const char* cmd, char* response);
 int fb_download_data(Transport* transport, const void* data, uint32_t size);
 int fb_download_data_sparse(Transport* transport, struct sparse_file* s);
+int fb_download_data_sparse_stream(Transport* transport, const sparse_piece* piece);
 char *fb_get_error(void);
 
 #define FB_COMMAND_SZ 64
@@ -53,6 +66,8 @@ bool fb_getvar(Transport* transport, const std::string& key, std::string* value)
 void fb_queue_flash(const char *ptn, void *data, uint32_t sz);
 void fb_queue_flash_sparse(const char* ptn, struct sparse_file* s, uint32_t sz, size_t current,
                            size_t total);
+void fb_queue_flash_sparse_stream(const char* ptn, const sparse_piece* piece, size_t current,
+                                  size_t total);
 void fb_queue_erase(const char *ptn);
 void fb_queue_format(const char *ptn, int skip_if_not_supported, int32_t max_chunk_sz);
 void fb_queue_require(const char *prod, const char *var, bool invert,
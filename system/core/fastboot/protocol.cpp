@@ -33,6 +33,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include <algorithm>
 
@@ -275,3 +276,46 @@ int fb_download_data_sparse(Transport* transport, struct sparse_file* s) {
 
     return _command_end(transport);
 }
+
+int fb_download_data_sparse_stream(Transport* transport, const sparse_piece* piece) {
+    char cmd[64];
+    sprintf(cmd, "download:%08x", static_cast<uint32_t>(piece->sz));
+    int r = _command_start(transport, cmd, piece->sz, 0);
+    if (r < 0) {
+        return -1;
+    }
+
+    sparse_stream* st = sparse_stream_new(piece->block_size, piece->len, piece->chunks, false,
+                                          fb_download_data_sparse_write, transport);
+    if (st == nullptr) {
+        sprintf(ERROR, "cannot start sparse file");
+        return -1;
+    }
+
+    int64_t start = static_cast<int64_t>(piece->start_block) * piece->block_size;
+    int64_t end = std::min(static_cast<int64_t>(piece->end_block) * piece->block_size, piece->len);
+    if (lseek64(piece->fd, start, SEEK_SET) != start) {
+        sprintf(ERROR, "seek failed (%s)", strerror(errno));
+        r = -1;
+    } else {
+        r = sparse_stream_add_fd(st, piece->fd, end - start, piece->start_block);
+        if (r < 0) {
+            sprintf(ERROR, "sparse read failed (%s)", strerror(-r));
+        } else if (sparse_stream_len(st) != piece->sz) {
+            // The download size has been sent already.
+            sprintf(ERROR, "image changed while being sent");
+            r = -1;
+        }
+    }
+
+    if (sparse_stream_close(st) < 0 || r < 0) {
+        return -1;
+    }
+
+    r = fb_download_data_sparse_flush(transport);
+    if (r < 0) {
+        return -1;
+    }
+
+    return _command_end(transport);
+}
@@ -41,6 +41,24 @@ typedef struct Hashmap Hashmap;
 Hashmap* hashmapCreate(size_t initialCapacity,
         int (*hash)(void* key), bool (*equals)(void* keyA, void* keyB));
 
+/**
+ * Creates a new hash map which hashmapGet() and hashmapContainsKey() can
+ * read without locking it, while one other thread at a time changes it
+ * (under hashmapLock() if there are several writers). Returns NULL if
+ * memory allocation fails.
+ *
+ * Readers may still compare against keys and return values that were just
+ * removed or replaced, so those must not be freed while readers are about.
+ * The memory of outgrown internal tables is only released by hashmapFree(),
+ * which suits maps that are mostly read.
+ *
+ * @param initialCapacity number of expected entries
+ * @param hash function which hashes keys
+ * @param equals function which compares keys for equality
+ */
+Hashmap* hashmapCreateConcurrent(size_t initialCapacity,
+        int (*hash)(void* key), bool (*equals)(void* keyA, void* keyB));
+
 /**
  * Frees the hash map. Does not free the keys or values themselves.
  */
@@ -683,6 +683,18 @@ int __android_log_is_loggable(int prio, const char *tag, int default_prio);
 
 int __android_log_security(); /* Device Owner is present */
 
+/*
+ * Opt this process in to batched delivery to logd. Log calls then queue
+ * their record and return, a background thread passes them on to logd in
+ * batches no later than latency_ms after they were logged. FATAL messages,
+ * abort, crashes and exit send anything still queued first. A latency_ms
+ * of zero flushes and returns to writing each message directly.
+ * Returns 0, or a negative errno on failure.
+ */
+int __android_log_batch(unsigned latency_ms);
+/* Send any batched messages on to logd now */
+void __android_log_batch_flush();
+
 int __android_log_error_write(int tag, const char *subTag, int32_t uid, const char *data,
                               uint32_t dataLen);
 
@@ -187,6 +187,17 @@ struct logger_list *android_logger_list_alloc_time(int mode,
                                                    log_time start,
                                                    pid_t pid);
 void android_logger_list_free(struct logger_list *logger_list);
+/*
+ * Ask logd to drop entries the reader would filter out anyway. tags is a
+ * list of space separated <tag>[:<priority>] filterspecs (priority letter
+ * as for logcat, default V), NULL for all tags; prio the minimum priority
+ * of all entries; substring and regex (POSIX extended) are matched against
+ * the message. Any may be NULL or zero. Only a hint, the reader should
+ * still filter what it gets. Sent to logd on the first read.
+ */
+int android_logger_list_set_filter(struct logger_list *logger_list,
+                                   const char *tags, int prio,
+                                   const char *substring, const char *regex);
 /* In the purest sense, the following two are orthogonal interfaces */
 int android_logger_list_read(struct logger_list *logger_list,
                              struct log_msg *log_msg);
@@ -21,6 +21,7 @@
 
 /* Android private interfaces */
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <sys/types.h>
 
@@ -44,6 +45,29 @@ typedef struct __attribute__((__packed__)) {
     log_time realtime;
 } android_log_header_t;
 
+/*
+ * Several records from one client in a single datagram to logd. The
+ * leading header has id LOG_ID_BATCH, tid the record count and a zero
+ * realtime. Each record follows as a little endian uint16_t length, then
+ * its own android_log_header_t and payload.
+ */
+#define LOG_ID_BATCH 0xFF
+#define LOGGER_ENTRY_MAX_BATCH (16 * 1024)
+
+/*
+ * Longest reader command accepted on the logdr socket. Besides the lids=,
+ * tail=, start=, timeout= and pid= keys a reader may ask logd to filter
+ * for it with:
+ *   prio=<n>                 minimum android_LogPriority
+ *   tags=<tag>:<n>[,...]     only these tags, each at minimum priority <n>
+ *   grep=<string>            message contains this literal string
+ *   regex=<expression>       message matches this POSIX extended regex
+ * Tags, string and expression are %XX hex escaped so that they hold no
+ * space, comma or colon. Binary entries are only filtered on tag and
+ * priority (tags by name, all at ANDROID_LOG_INFO).
+ */
+#define LOGD_READER_COMMAND_MAX 1024
+
 /* Event Header Structure to logd */
 typedef struct __attribute__((__packed__)) {
     int32_t tag;  // Little Endian Order
@@ -98,6 +122,107 @@ typedef struct __attribute__((__packed__)) {
     char data[];
 } android_log_event_string_t;
 
+/*
+ * Persistent log store written by logd (persist.logd.logpersistd=logd).
+ *
+ * Segment files LOGPERSIST_DIR/logd.seg.<number> hold, in order:
+ *   android_logpersist_header_t
+ *   records, each a struct logger_entry_v4 followed by its payload, as
+ *     sent to a privileged reader, so a record is a valid struct log_msg
+ *   android_logpersist_index_t[index_count], one for each
+ *     LOGPERSIST_INDEX_STRIDE of records with the latest time seen in it
+ *   bloom filter of bloom_size bytes over tags and UIDs in the segment
+ *   android_logpersist_trailer_t
+ * The segment being written has no index, filter or trailer yet, nor has
+ * one cut short by a reboot, readers fall back to a scan of those.
+ */
+#define LOGPERSIST_DIR            "/data/misc/logd"
+#define LOGPERSIST_PREFIX         "logd.seg."
+#define LOGPERSIST_MAGIC          "LOGDSEG1"
+#define LOGPERSIST_TRAILER_MAGIC  "LOGDIDX1"
+#define LOGPERSIST_SEGMENT_SIZE   (1024 * 1024)
+#define LOGPERSIST_INDEX_STRIDE   (16 * 1024)
+#define LOGPERSIST_BLOOM_SIZE     2048 /* bytes */
+#define LOGPERSIST_BLOOM_HASHES   4
+
+typedef struct __attribute__((__packed__)) {
+    char magic[8];          // LOGPERSIST_MAGIC
+    uint32_t hdr_size;      // sizeof(android_logpersist_header_t)
+    uint32_t segment;       // sequence number, matches the file name
+} android_logpersist_header_t;
+
+typedef struct __attribute__((__packed__)) {
+    uint32_t offset;        // of the first record in the stride
+    uint32_t sec;           // latest time in the stride
+    uint32_t nsec;
+} android_logpersist_index_t;
+
+typedef struct __attribute__((__packed__)) {
+    uint32_t records_end;   // offset of the index
+    uint32_t index_count;
+    uint32_t bloom_size;
+    uint32_t lid_mask;      // 1 << log id of every record present
+    uint32_t min_sec;       // time range of all records
+    uint32_t min_nsec;
+    uint32_t max_sec;
+    uint32_t max_nsec;
+    char magic[8];          // LOGPERSIST_TRAILER_MAGIC
+} android_logpersist_trailer_t;
+
+/* bloom filter keys, a tag (events by name and number) or a uid */
+#define LOGPERSIST_KEY_TAG 'T'
+#define LOGPERSIST_KEY_UID 'U'
+
+static inline uint32_t android_logpersist_hash(uint32_t hash,
+                                               const char *key, size_t len) {
+    /* FNV-1a */
+    while (len--) {
+        hash ^= (uint8_t)*key++;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+static inline void android_logpersist_bloom_bits(char type,
+                                                 const char *key, size_t len,
+                                                 uint32_t bits[LOGPERSIST_BLOOM_HASHES]) {
+    uint32_t h1 = android_logpersist_hash(
+        android_logpersist_hash(2166136261U, &type, 1), key, len);
+    uint32_t h2 = android_logpersist_hash(h1, &type, 1) | 1;
+    size_t i;
+
+    for (i = 0; i < LOGPERSIST_BLOOM_HASHES; ++i) {
+        bits[i] = (h1 + i * h2) % (LOGPERSIST_BLOOM_SIZE * 8);
+    }
+}
+
+static inline void android_logpersist_bloom_add(uint8_t *bloom, char type,
+                                                const char *key, size_t len) {
+    uint32_t bits[LOGPERSIST_BLOOM_HASHES];
+    size_t i;
+
+    android_logpersist_bloom_bits(type, key, len, bits);
+    for (i = 0; i < LOGPERSIST_BLOOM_HASHES; ++i) {
+        bloom[bits[i] / 8] |= 1 << (bits[i] % 8);
+    }
+}
+
+/* false means definitely absent */
+static inline bool android_logpersist_bloom_test(const uint8_t *bloom,
+                                                 char type,
+                                                 const char *key, size_t len) {
+    uint32_t bits[LOGPERSIST_BLOOM_HASHES];
+    size_t i;
+
+    android_logpersist_bloom_bits(type, key, len, bits);
+    for (i = 0; i < LOGPERSIST_BLOOM_HASHES; ++i) {
+        if (!(bloom[bits[i] / 8] & (1 << (bits[i] % 8)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
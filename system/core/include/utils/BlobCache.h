@@ -18,10 +18,14 @@
 #define ANDROID_BLOB_CACHE_H
 
 #include <stddef.h>
+#include <stdint.h>
+
+#include <list>
+#include <unordered_map>
 
 #include <utils/Flattenable.h>
 #include <utils/RefBase.h>
-#include <utils/SortedVector.h>
+#include <utils/TypeHelpers.h>
 #include <utils/threads.h>
 
 namespace android {
@@ -37,11 +41,24 @@ class BlobCache : public RefBase {
 
 public:
 
+    // An EvictionPolicy decides which entries make room for a new one when
+    // the cache is full.
+    enum EvictionPolicy {
+        // Randomly chosen entries are evicted until the cache is at most half
+        // full.
+        EVICT_RANDOM_HALF,
+
+        // The least recently used entries are evicted, just enough of them
+        // for the new one to fit.  Both get and set count as a use.
+        EVICT_LRU,
+    };
+
     // Create an empty blob cache. The blob cache will cache key/value pairs
     // with key and value sizes less than or equal to maxKeySize and
     // maxValueSize, respectively. The total combined size of ALL cache entries
     // (key sizes plus value sizes) will not exceed maxTotalSize.
-    BlobCache(size_t maxKeySize, size_t maxValueSize, size_t maxTotalSize);
+    BlobCache(size_t maxKeySize, size_t maxValueSize, size_t maxTotalSize,
+            EvictionPolicy policy = EVICT_RANDOM_HALF);
 
     // set inserts a new binary value into the cache and associates it with the
     // given binary key.  If the key or value are too large for the cache then
@@ -87,7 +104,8 @@ public:
     // flatten serializes the current contents of the cache into the memory
     // pointed to by 'buffer'.  The serialized cache contents can later be
     // loaded into a BlobCache object using the unflatten method.  The contents
-    // of the BlobCache object will not be modified.
+    // of the BlobCache object will not be modified.  Entries are written
+    // least recently used first, so that unflattening keeps their order.
     //
     // Preconditions:
     //   size >= this.getFlattenedSize()
@@ -101,6 +119,15 @@ public:
     //
     status_t unflatten(void const* buffer, size_t size);
 
+    // unflattenInPlace is like unflatten, except that the cache entries refer
+    // to the keys and values in 'buffer' rather than to copies of them, so
+    // that loading a cache file that has been mmap'd costs no more than
+    // indexing it.  The memory pointed to by 'buffer' must stay valid and
+    // unmodified until the BlobCache is destroyed or unflatten or
+    // unflattenInPlace is called again.  Entries set afterwards are copied as
+    // usual.
+    status_t unflattenInPlace(void const* buffer, size_t size);
+
 private:
     // Copying is disallowed.
     BlobCache(const BlobCache&);
@@ -109,22 +136,34 @@ private:
     // A random function helper to get around MinGW not having nrand48()
     long int blob_random();
 
-    // clean evicts a randomly chosen set of entries from the cache such that
-    // the total size of all remaining entries is less than mMaxTotalSize/2.
+    // clean evicts entries from the cache according to mEvictionPolicy:
+    // either a randomly chosen set of entries such that the total size of all
+    // remaining entries is less than mMaxTotalSize/2, or the least recently
+    // used entry.
     void clean();
 
     // isCleanable returns true if the cache is full enough for the clean method
     // to have some effect, and false otherwise.
     bool isCleanable() const;
 
+    // insert does the work of set once the key and value sizes have been
+    // checked.  The key and value are copied if copyData is true, otherwise the
+    // cache entry refers to the memory they are in.
+    void insert(const void* key, size_t keySize, const void* value,
+            size_t valueSize, bool copyData);
+
+    // unflattenEntries does the work of unflatten and unflattenInPlace.
+    status_t unflattenEntries(void const* buffer, size_t size, bool copyData);
+
+    // clearEntries removes all the entries from the cache.
+    void clearEntries();
+
     // A Blob is an immutable sized unstructured data blob.
     class Blob : public RefBase {
     public:
         Blob(const void* data, size_t size, bool copyData);
         ~Blob();
 
-        bool operator<(const Blob& rhs) const;
-
         const void* getData() const;
         size_t getSize() const;
 
@@ -151,11 +190,10 @@ private:
         CacheEntry(const sp<Blob>& key, const sp<Blob>& value);
         CacheEntry(const CacheEntry& ce);
 
-        bool operator<(const CacheEntry& rhs) const;
         const CacheEntry& operator=(const CacheEntry&);
 
-        sp<Blob> getKey() const;
-        sp<Blob> getValue() const;
+        const sp<Blob>& getKey() const;
+        const sp<Blob>& getValue() const;
 
         void setValue(const sp<Blob>& value);
 
@@ -168,8 +206,34 @@ private:
         sp<Blob> mValue;
     };
 
+    // A KeyRef identifies a cache entry by its key data, which it does not
+    // own.  The entry's key Blob holds that data for as long as the entry
+    // is in the cache.
+    struct KeyRef {
+        KeyRef(const void* data, size_t size);
+
+        bool operator==(const KeyRef& rhs) const;
+
+        const void* mData;
+        size_t mSize;
+        hash_t mHash;
+    };
+
+    struct KeyRefHash {
+        size_t operator()(const KeyRef& key) const {
+            return key.mHash;
+        }
+    };
+
+    typedef std::list<CacheEntry> CacheEntryList;
+
+    // removeEntry evicts a single entry from the cache.
+    void removeEntry(CacheEntryList::iterator entry);
+
     // A Header is the header for the entire BlobCache serialization format. No
-    // need to make this portable, so we simply write the struct out.
+    // need to make this portable, so we simply write the struct out.  All its
+    // fields are fixed size and 4-byte aligned, so that the entries can be
+    // used where they are by unflattenInPlace on 32 and 64 bit processes alike.
     struct Header {
         // mMagicNumber is the magic number that identifies the data as
         // serialized BlobCache contents.  It must always contain 'Blb$'.
@@ -184,12 +248,12 @@ private:
 
         // mNumEntries is number of cache entries following the header in the
         // data.
-        size_t mNumEntries;
+        uint32_t mNumEntries;
 
         // mBuildId is the build id of the device when the cache was created.
         // When an update to the build happens (via an OTA or other update) this
         // is used to invalidate the cache.
-        int mBuildIdLength;
+        int32_t mBuildIdLength;
         char mBuildId[];
     };
 
@@ -204,10 +268,10 @@ private:
     //
     struct EntryHeader {
         // mKeySize is the size of the entry key in bytes.
-        size_t mKeySize;
+        uint32_t mKeySize;
 
         // mValueSize is the size of the entry value in bytes.
-        size_t mValueSize;
+        uint32_t mValueSize;
 
         // mData contains both the key and value data for the cache entry.  The
         // key comes first followed immediately by the value.
@@ -231,6 +295,9 @@ private:
     // will be evicted from the cache to make room for the new entry.
     const size_t mMaxTotalSize;
 
+    // mEvictionPolicy decides which entries clean evicts.
+    const EvictionPolicy mEvictionPolicy;
+
     // mTotalSize is the total combined size of all keys and values currently in
     // the cache.
     size_t mTotalSize;
@@ -240,8 +307,12 @@ private:
     unsigned short mRandState[3];
 
     // mCacheEntries stores all the cache entries that are resident in memory.
-    // Cache entries are added to it by the 'set' method.
-    SortedVector<CacheEntry> mCacheEntries;
+    // Cache entries are added to it by the 'set' method.  It is ordered from
+    // the least to the most recently used entry.
+    CacheEntryList mCacheEntries;
+
+    // mIndex maps the key of every entry in mCacheEntries to that entry.
+    std::unordered_map<KeyRef, CacheEntryList::iterator, KeyRefHash> mIndex;
 };
 
 }
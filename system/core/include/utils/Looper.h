@@ -24,6 +24,8 @@
 
 #include <sys/epoll.h>
 
+#include <vector>
+
 namespace android {
 
 /*
@@ -369,6 +371,30 @@ public:
     void sendMessageAtTime(nsecs_t uptime, const sp<MessageHandler>& handler,
             const Message& message);
 
+    /**
+     * Enqueues several messages to be processed by the specified handler, in order,
+     * after all pending messages.
+     *
+     * Equivalent to calling sendMessage() for each of them, but takes the lock
+     * and wakes the poll loop only once.
+     * The handler must not be null.
+     * This method can be called on any thread.
+     */
+    void sendMessages(const sp<MessageHandler>& handler, const Message* messages, size_t count);
+
+    /**
+     * Enqueues several messages to be processed by the specified handler, in order,
+     * after all pending messages at the specified time.
+     *
+     * Equivalent to calling sendMessageAtTime() for each of them, but takes the lock
+     * and wakes the poll loop only once.
+     * The time is specified in uptime nanoseconds.
+     * The handler must not be null.
+     * This method can be called on any thread.
+     */
+    void sendMessagesAtTime(nsecs_t uptime, const sp<MessageHandler>& handler,
+            const Message* messages, size_t count);
+
     /**
      * Removes all messages for the specified handler from the queue.
      *
@@ -434,24 +460,40 @@ private:
     };
 
     struct MessageEnvelope {
-        MessageEnvelope() : uptime(0) { }
+        MessageEnvelope() : uptime(0), seq(0) { }
+
+        MessageEnvelope(nsecs_t uptime, uint64_t seq, const sp<MessageHandler> handler,
+                const Message& message) : uptime(uptime), seq(seq), handler(handler),
+                message(message) {
+        }
 
-        MessageEnvelope(nsecs_t uptime, const sp<MessageHandler> handler,
-                const Message& message) : uptime(uptime), handler(handler), message(message) {
+        // Orders the heap so that the earliest message, and the first sent of those
+        // due at the same time, is at the top.
+        bool operator<(const MessageEnvelope& other) const {
+            return uptime > other.uptime || (uptime == other.uptime && seq > other.seq);
         }
 
         nsecs_t uptime;
+        uint64_t seq;
         sp<MessageHandler> handler;
         Message message;
     };
 
+    // Maximum number of file descriptors for which to retrieve poll events each iteration.
+    enum { EPOLL_MAX_EVENTS = 16 };
+
     const bool mAllowNonCallbacks; // immutable
 
     int mWakeEventFd;  // immutable
+    int mTimerFd;  // immutable
     Mutex mLock;
 
-    Vector<MessageEnvelope> mMessageEnvelopes; // guarded by mLock
+    // Binary heap of pending messages, see MessageEnvelope::operator<.
+    std::vector<MessageEnvelope> mMessageEnvelopes; // guarded by mLock
+    uint64_t mNextMessageSeq; // guarded by mLock
     bool mSendingMessage; // guarded by mLock
+    // When mTimerFd is set to go off, LLONG_MAX when it is not.
+    nsecs_t mTimerUptime; // guarded by mLock
 
     // Whether we are currently waiting for work.  Not protected by a lock,
     // any use of it is racy anyway.
@@ -465,15 +507,18 @@ private:
     int mNextRequestSeq;
 
     // This state is only used privately by pollOnce and does not require a lock since
-    // it runs on a single thread.
-    Vector<Response> mResponses;
+    // it runs on a single thread.  Each poll yields at most one response per event.
+    Response mResponses[EPOLL_MAX_EVENTS];
+    size_t mResponseCount;
     size_t mResponseIndex;
-    nsecs_t mNextMessageUptime; // set to LLONG_MAX when none
 
     int pollInner(int timeoutMillis);
     int removeFd(int fd, int seq);
     void awoken();
     void pushResponse(int events, const Request& request);
+    void enqueueMessagesLocked(nsecs_t uptime, const sp<MessageHandler>& handler,
+            const Message* messages, size_t count);
+    void setTimerLocked(nsecs_t uptime);
     void rebuildEpollLocked();
     void scheduleEpollRebuildLocked();
 
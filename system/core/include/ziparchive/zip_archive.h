@@ -131,6 +131,21 @@ int32_t OpenArchive(const char* fileName, ZipArchiveHandle* handle);
 int32_t OpenArchiveFd(const int fd, const char* debugFileName,
                       ZipArchiveHandle *handle, bool assume_ownership = true);
 
+/*
+ * Like OpenArchive, but with the table of entries kept in the file
+ * |indexFileName| between opens. The index is a perfect hash of the entry
+ * names, mapped as is instead of scanning the central directory, and is
+ * only used while the archive keeps the size, mtime and ctime it was built
+ * for. Otherwise the archive is scanned as usual and the index (re)written,
+ * which may fail without failing the open.
+ *
+ * Same as OpenArchive on Windows.
+ *
+ * Returns 0 on success, and negative values on failure.
+ */
+int32_t OpenArchiveWithIndex(const char* fileName, const char* indexFileName,
+                             ZipArchiveHandle* handle);
+
 /*
  * Close archive, releasing resources associated with it. This will
  * unmap the central directory of the zipfile and free all internal
@@ -211,6 +226,33 @@ int32_t ExtractEntryToFile(ZipArchiveHandle handle, ZipEntry* entry, int fd);
 int32_t ExtractToMemory(ZipArchiveHandle handle, ZipEntry* entry,
                         uint8_t* begin, uint32_t size);
 
+/*
+ * Called by ExtractEntries for each entry it is about to uncompress, from
+ * any of its threads. Returns a file descriptor the entry is written to,
+ * as with ExtractEntryToFile, which ExtractEntries closes once done; or a
+ * negative value to fail the extraction.
+ */
+typedef int (*ExtractEntryOpenFn)(const ZipString& name,
+                                  const ZipEntry& entry, void* cookie);
+
+/*
+ * Uncompress several entries, spread over |num_threads| threads (<= 0 to
+ * pick one per CPU, up to 8) that read the archive with pread. Memory use
+ * is bounded by the number of threads, not by the size of the entries.
+ *
+ * The entries are the |num_names| named in |names|, or when |names| is
+ * NULL every entry whose name starts with |optional_prefix| (every entry
+ * if that is NULL too), directories excepted. Each one is written to the
+ * file descriptor returned by |open_fn|.
+ *
+ * Returns 0 on success, otherwise the first error encountered after which
+ * no further entries are started. Extraction is serial on Windows.
+ */
+int32_t ExtractEntries(ZipArchiveHandle handle, const ZipString* names,
+                       size_t num_names, const ZipString* optional_prefix,
+                       ExtractEntryOpenFn open_fn, void* cookie,
+                       int num_threads = 0);
+
 int GetFileDescriptor(const ZipArchiveHandle handle);
 
 const char* ErrorCodeString(int32_t error_code);
@@ -18,62 +18,185 @@
 #include <assert.h>
 #include <errno.h>
 #include <cutils/threads.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <sys/types.h>
 
-typedef struct Entry Entry;
-struct Entry {
-    void* key;
-    int hash;
-    void* value;
-    Entry* next;
+/*
+ * Entries live in a single array of slots, found by probing from the slot
+ * their hash points at in ever larger steps, which keeps entries that collide
+ * from piling up into long runs. The hashes are kept in an array of their own
+ * next to it, which also says whether each slot is in use, so that a probe
+ * mostly reads a few bytes of that array, only looks at the slots whose hash
+ * matches, and calls equals() for keys that very likely match.
+ *
+ * Removed entries leave a tombstone behind rather than moving later ones
+ * back, so that hashmapForEach() callbacks can remove the entry they are
+ * given, as str_parms does. Tombstones go away when the array is rebuilt.
+ *
+ * The hashes and slots are atomic so that a concurrent map can be read
+ * while another thread writes to it: the hash of a new entry is published
+ * last, and a reader checks that the slot still holds the key it matched
+ * after loading the value, since the slot may have been removed and given
+ * to another key in the meantime. The key of a reused slot is stored before
+ * its value for that check to work; a NULL value read meanwhile means the
+ * key was removed.
+ */
+
+/* Hashes with a meaning of their own, which entries never have. */
+#define HASH_EMPTY 0
+#define HASH_REMOVED 1
+
+typedef struct Slot {
+    _Atomic(void*) key;
+    _Atomic(void*) value;
+} Slot;
+
+typedef struct Table Table;
+struct Table {
+    size_t capacity;
+    /* Tables replaced while readers may still be using them. */
+    Table* retired;
+    /* Follows the hashes in the same allocation. */
+    Slot* slots;
+    _Atomic(int) hashes[];
 };
 
 struct Hashmap {
-    Entry** buckets;
-    size_t bucketCount;
+    _Atomic(Table*) table;
     int (*hash)(void* key);
     bool (*equals)(void* keyA, void* keyB);
-    mutex_t lock; 
+    mutex_t lock;
     size_t size;
+    /* Slots holding a tombstone. */
+    size_t removed;
+    bool concurrent;
 };
 
-Hashmap* hashmapCreate(size_t initialCapacity,
-        int (*hash)(void* key), bool (*equals)(void* keyA, void* keyB)) {
+static inline int loadHash(Table* table, size_t index) {
+    return atomic_load_explicit(&table->hashes[index], memory_order_acquire);
+}
+
+static inline void storeHash(Table* table, size_t index, int hash) {
+    atomic_store_explicit(&table->hashes[index], hash, memory_order_release);
+}
+
+static inline void* loadKey(Slot* slot) {
+    return atomic_load_explicit(&slot->key, memory_order_acquire);
+}
+
+static inline void* loadValue(Slot* slot) {
+    return atomic_load_explicit(&slot->value, memory_order_acquire);
+}
+
+static inline void storeValue(Slot* slot, void* value) {
+    atomic_store_explicit(&slot->value, value, memory_order_release);
+}
+
+/*
+ * Fills a free slot, the hash last so that readers only find whole entries.
+ *
+ * A tombstone may still be read as the entry it was: its value is cleared
+ * first and the key goes before the value, so that a reader that sees the
+ * new key sees NULL or the new value, and a reader of the old key that sees
+ * the new value also sees the new key and looks again.
+ */
+static inline void fillSlot(Table* table, size_t index, void* key, int hash,
+        void* value) {
+    Slot* slot = &table->slots[index];
+    if (loadHash(table, index) == HASH_REMOVED) {
+        storeValue(slot, NULL);
+    }
+    atomic_store_explicit(&slot->key, key, memory_order_release);
+    storeValue(slot, value);
+    storeHash(table, index, hash);
+}
+
+static inline Table* loadTable(Hashmap* map) {
+    return atomic_load_explicit(&map->table, memory_order_acquire);
+}
+
+/**
+ * Creates a table of the given capacity, which must be a power of 2 and at
+ * least 2, with all of its slots empty.
+ */
+static Table* createTable(size_t capacity) {
+    size_t hashesSize = capacity * sizeof(_Atomic(int));
+    Table* table = calloc(1,
+            sizeof(Table) + hashesSize + capacity * sizeof(Slot));
+    if (table == NULL) {
+        return NULL;
+    }
+    table->capacity = capacity;
+    table->slots = (Slot*) ((char*) table->hashes + hashesSize);
+    return table;
+}
+
+static void freeTables(Table* table) {
+    while (table != NULL) {
+        Table* retired = table->retired;
+        free(table);
+        table = retired;
+    }
+}
+
+/**
+ * Gets the number of slots needed to hold the given number of entries.
+ */
+static size_t capacityFor(size_t entries) {
+    // 0.75 load factor.
+    size_t minimumCapacity = entries * 4 / 3;
+    // Keeps the slots that follow the hashes aligned.
+    size_t capacity = 2;
+    while (capacity <= minimumCapacity) {
+        // Capacity must be power of 2.
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+static Hashmap* createMap(size_t initialCapacity,
+        int (*hash)(void* key), bool (*equals)(void* keyA, void* keyB),
+        bool concurrent) {
     assert(hash != NULL);
     assert(equals != NULL);
-    
+
     Hashmap* map = malloc(sizeof(Hashmap));
     if (map == NULL) {
         return NULL;
     }
-    
-    // 0.75 load factor.
-    size_t minimumBucketCount = initialCapacity * 4 / 3;
-    map->bucketCount = 1;
-    while (map->bucketCount <= minimumBucketCount) {
-        // Bucket count must be power of 2.
-        map->bucketCount <<= 1; 
-    }
 
-    map->buckets = calloc(map->bucketCount, sizeof(Entry*));
-    if (map->buckets == NULL) {
+    Table* table = createTable(capacityFor(initialCapacity));
+    if (table == NULL) {
         free(map);
         return NULL;
     }
-    
+    atomic_init(&map->table, table);
+
     map->size = 0;
+    map->removed = 0;
+    map->concurrent = concurrent;
 
     map->hash = hash;
     map->equals = equals;
-    
+
     mutex_init(&map->lock);
-    
+
     return map;
 }
 
+Hashmap* hashmapCreate(size_t initialCapacity,
+        int (*hash)(void* key), bool (*equals)(void* keyA, void* keyB)) {
+    return createMap(initialCapacity, hash, equals, false);
+}
+
+Hashmap* hashmapCreateConcurrent(size_t initialCapacity,
+        int (*hash)(void* key), bool (*equals)(void* keyA, void* keyB)) {
+    return createMap(initialCapacity, hash, equals, true);
+}
+
 /**
  * Hashes the given key.
  */
@@ -89,7 +212,10 @@ static inline int hashKey(Hashmap* map, void* key) {
     h ^= (((unsigned int) h) >> 14);
     h += (h << 4);
     h ^= (((unsigned int) h) >> 10);
-       
+
+    if (h == HASH_EMPTY || h == HASH_REMOVED) {
+        h += 2;
+    }
     return h;
 }
 
@@ -97,39 +223,70 @@ size_t hashmapSize(Hashmap* map) {
     return map->size;
 }
 
-static inline size_t calculateIndex(size_t bucketCount, int hash) {
-    return ((size_t) hash) & (bucketCount - 1);
+static inline size_t calculateIndex(size_t capacity, int hash) {
+    return ((size_t) hash) & (capacity - 1);
 }
 
-static void expandIfNecessary(Hashmap* map) {
-    // If the load factor exceeds 0.75...
-    if (map->size > (map->bucketCount * 3 / 4)) {
-        // Start off with a 0.33 load factor.
-        size_t newBucketCount = map->bucketCount << 1;
-        Entry** newBuckets = calloc(newBucketCount, sizeof(Entry*));
-        if (newBuckets == NULL) {
-            // Abort expansion.
-            return;
+/**
+ * Moves the entries into a new table with room for half as many again, which
+ * also drops the tombstones. Returns false if that cannot be allocated.
+ */
+static bool rebuild(Hashmap* map) {
+    Table* table = loadTable(map);
+    size_t capacity = capacityFor((map->size + 1) * 3 / 2);
+    if (capacity < table->capacity) {
+        // Don't shrink, the entries tend to come back.
+        capacity = table->capacity;
+    }
+    Table* newTable = createTable(capacity);
+    if (newTable == NULL) {
+        return false;
+    }
+
+    // Move over existing entries.
+    size_t i;
+    for (i = 0; i < table->capacity; i++) {
+        int hash = loadHash(table, i);
+        if (hash == HASH_EMPTY || hash == HASH_REMOVED) {
+            continue;
         }
-        
-        // Move over existing entries.
-        size_t i;
-        for (i = 0; i < map->bucketCount; i++) {
-            Entry* entry = map->buckets[i];
-            while (entry != NULL) {
-                Entry* next = entry->next;
-                size_t index = calculateIndex(newBucketCount, entry->hash);
-                entry->next = newBuckets[index];
-                newBuckets[index] = entry;
-                entry = next;
-            }
+        size_t index = calculateIndex(capacity, hash);
+        size_t step = 0;
+        while (loadHash(newTable, index) != HASH_EMPTY) {
+            index = (index + ++step) & (capacity - 1);
         }
+        Slot* slot = &table->slots[i];
+        fillSlot(newTable, index, loadKey(slot), hash, loadValue(slot));
+    }
 
-        // Copy over internals.
-        free(map->buckets);
-        map->buckets = newBuckets;
-        map->bucketCount = newBucketCount;
+    if (map->concurrent) {
+        // Readers may still be looking at the old table. There is no telling
+        // when they are done, so it is kept until the map is freed.
+        newTable->retired = table;
+    } else {
+        free(table);
     }
+    atomic_store_explicit(&map->table, newTable, memory_order_release);
+    map->removed = 0;
+    return true;
+}
+
+/**
+ * Makes sure there is an empty slot for one more entry, keeping the load
+ * factor, tombstones included, below 0.75 if memory allows. Returns false
+ * if there is no room at all.
+ */
+static bool reserveSlot(Hashmap* map) {
+    Table* table = loadTable(map);
+    size_t used = map->size + map->removed + 1;
+    if (used <= table->capacity * 3 / 4) {
+        return true;
+    }
+    if (rebuild(map)) {
+        return true;
+    }
+    // Carry on while at least one slot stays empty for probes to stop at.
+    return used < table->capacity;
 }
 
 void hashmapLock(Hashmap* map) {
@@ -141,16 +298,7 @@ void hashmapUnlock(Hashmap* map) {
 }
 
 void hashmapFree(Hashmap* map) {
-    size_t i;
-    for (i = 0; i < map->bucketCount; i++) {
-        Entry* entry = map->buckets[i];
-        while (entry != NULL) {
-            Entry* next = entry->next;
-            free(entry);
-            entry = next;
-        }
-    }
-    free(map->buckets);
+    freeTables(loadTable(map));
     mutex_destroy(&map->lock);
     free(map);
 }
@@ -170,177 +318,212 @@ int hashmapHash(void* key, size_t keySize) {
     return h;
 }
 
-static Entry* createEntry(void* key, int hash, void* value) {
-    Entry* entry = malloc(sizeof(Entry));
-    if (entry == NULL) {
-        return NULL;
-    }
-    entry->key = key;
-    entry->hash = hash;
-    entry->value = value;
-    entry->next = NULL;
-    return entry;
-}
-
-static inline bool equalKeys(void* keyA, int hashA, void* keyB, int hashB,
+static inline bool equalKeys(void* keyA, void* keyB,
         bool (*equals)(void*, void*)) {
-    if (keyA == keyB) {
-        return true;
-    }
-    if (hashA != hashB) {
-        return false;
-    }
-    return equals(keyA, keyB);
+    return keyA == keyB || equals(keyA, keyB);
 }
 
-void* hashmapPut(Hashmap* map, void* key, void* value) {
-    int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
-
-    Entry** p = &(map->buckets[index]);
+/**
+ * Finds the slot holding the given key, or NULL if there is none. If
+ * slotKey is not NULL, sets it to the key found in the slot.
+ */
+static inline Slot* findSlot(Hashmap* map, void* key, int hash,
+        void** slotKey) {
+    Table* table = loadTable(map);
+    size_t mask = table->capacity - 1;
+    size_t index = calculateIndex(table->capacity, hash);
+    size_t step = 0;
     while (true) {
-        Entry* current = *p;
-
-        // Add a new entry.
-        if (current == NULL) {
-            *p = createEntry(key, hash, value);
-            if (*p == NULL) {
-                errno = ENOMEM;
-                return NULL;
+        int current = loadHash(table, index);
+        if (current == hash) {
+            Slot* slot = &table->slots[index];
+            void* candidate = loadKey(slot);
+            if (equalKeys(candidate, key, map->equals)) {
+                if (slotKey != NULL) {
+                    *slotKey = candidate;
+                }
+                return slot;
             }
-            map->size++;
-            expandIfNecessary(map);
+        } else if (current == HASH_EMPTY) {
             return NULL;
         }
+        index = (index + ++step) & mask;
+    }
+}
 
-        // Replace existing entry.
-        if (equalKeys(current->key, current->hash, key, hash, map->equals)) {
-            void* oldValue = current->value;
-            current->value = value;
-            return oldValue;
+/**
+ * Finds the index of the slot holding the given key, or else of the slot a
+ * new entry for it should go to. Sets *found accordingly. There must be an
+ * empty slot.
+ */
+static inline size_t findIndexForPut(Hashmap* map, void* key, int hash,
+        bool* found) {
+    Table* table = loadTable(map);
+    size_t mask = table->capacity - 1;
+    size_t index = calculateIndex(table->capacity, hash);
+    size_t step = 0;
+    bool sawRemoved = false;
+    size_t firstRemoved = 0;
+    while (true) {
+        int current = loadHash(table, index);
+        if (current == HASH_EMPTY) {
+            *found = false;
+            // Reuse a tombstone on the way.
+            if (sawRemoved) {
+                map->removed--;
+                return firstRemoved;
+            }
+            return index;
         }
-
-        // Move to next entry.
-        p = &current->next;
+        if (current == HASH_REMOVED) {
+            if (!sawRemoved) {
+                sawRemoved = true;
+                firstRemoved = index;
+            }
+        } else if (current == hash &&
+                equalKeys(loadKey(&table->slots[index]), key, map->equals)) {
+            *found = true;
+            return index;
+        }
+        index = (index + ++step) & mask;
     }
 }
 
-void* hashmapGet(Hashmap* map, void* key) {
+void* hashmapPut(Hashmap* map, void* key, void* value) {
     int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
 
-    Entry* entry = map->buckets[index];
-    while (entry != NULL) {
-        if (equalKeys(entry->key, entry->hash, key, hash, map->equals)) {
-            return entry->value;
+    if (!reserveSlot(map)) {
+        // An existing entry can still be replaced.
+        Slot* slot = findSlot(map, key, hash, NULL);
+        if (slot == NULL) {
+            errno = ENOMEM;
+            return NULL;
         }
-        entry = entry->next;
+        void* oldValue = loadValue(slot);
+        storeValue(slot, value);
+        return oldValue;
     }
 
+    bool found;
+    Table* table = loadTable(map);
+    size_t index = findIndexForPut(map, key, hash, &found);
+    if (found) {
+        // Replace existing entry.
+        Slot* slot = &table->slots[index];
+        void* oldValue = loadValue(slot);
+        storeValue(slot, value);
+        return oldValue;
+    }
+
+    // Add a new entry.
+    fillSlot(table, index, key, hash, value);
+    map->size++;
     return NULL;
 }
 
-bool hashmapContainsKey(Hashmap* map, void* key) {
+void* hashmapGet(Hashmap* map, void* key) {
     int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
 
-    Entry* entry = map->buckets[index];
-    while (entry != NULL) {
-        if (equalKeys(entry->key, entry->hash, key, hash, map->equals)) {
-            return true;
+    Slot* slot;
+    void* slotKey;
+    void* value;
+    do {
+        slot = findSlot(map, key, hash, &slotKey);
+        if (slot == NULL) {
+            return NULL;
         }
-        entry = entry->next;
-    }
+        value = loadValue(slot);
+        // A writer may have removed the entry and given its slot to another
+        // key since it was found; look again if so.
+    } while (map->concurrent && loadKey(slot) != slotKey);
+    return value;
+}
 
-    return false;
+bool hashmapContainsKey(Hashmap* map, void* key) {
+    int hash = hashKey(map, key);
+    return findSlot(map, key, hash, NULL) != NULL;
 }
 
-void* hashmapMemoize(Hashmap* map, void* key, 
+void* hashmapMemoize(Hashmap* map, void* key,
         void* (*initialValue)(void* key, void* context), void* context) {
     int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
-
-    Entry** p = &(map->buckets[index]);
-    while (true) {
-        Entry* current = *p;
-
-        // Add a new entry.
-        if (current == NULL) {
-            *p = createEntry(key, hash, NULL);
-            if (*p == NULL) {
-                errno = ENOMEM;
-                return NULL;
-            }
-            void* value = initialValue(key, context);
-            (*p)->value = value;
-            map->size++;
-            expandIfNecessary(map);
-            return value;
-        }
 
+    Slot* slot = findSlot(map, key, hash, NULL);
+    if (slot != NULL) {
         // Return existing value.
-        if (equalKeys(current->key, current->hash, key, hash, map->equals)) {
-            return current->value;
-        }
+        return loadValue(slot);
+    }
 
-        // Move to next entry.
-        p = &current->next;
+    // Add a new entry.
+    if (!reserveSlot(map)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    void* value = initialValue(key, context);
+    // The callback may have used the map, so look again.
+    if (!reserveSlot(map)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    bool found;
+    Table* table = loadTable(map);
+    size_t index = findIndexForPut(map, key, hash, &found);
+    if (found) {
+        storeValue(&table->slots[index], value);
+    } else {
+        fillSlot(table, index, key, hash, value);
+        map->size++;
     }
+    return value;
 }
 
 void* hashmapRemove(Hashmap* map, void* key) {
     int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
-
-    // Pointer to the current entry.
-    Entry** p = &(map->buckets[index]);
-    Entry* current;
-    while ((current = *p) != NULL) {
-        if (equalKeys(current->key, current->hash, key, hash, map->equals)) {
-            void* value = current->value;
-            *p = current->next;
-            free(current);
-            map->size--;
-            return value;
-        }
 
-        p = &current->next;
+    Slot* slot = findSlot(map, key, hash, NULL);
+    if (slot == NULL) {
+        return NULL;
     }
-
-    return NULL;
+    Table* table = loadTable(map);
+    void* value = loadValue(slot);
+    storeHash(table, slot - table->slots, HASH_REMOVED);
+    map->size--;
+    map->removed++;
+    return value;
 }
 
-void hashmapForEach(Hashmap* map, 
+void hashmapForEach(Hashmap* map,
         bool (*callback)(void* key, void* value, void* context),
         void* context) {
     size_t i;
-    for (i = 0; i < map->bucketCount; i++) {
-        Entry* entry = map->buckets[i];
-        while (entry != NULL) {
-            Entry *next = entry->next;
-            if (!callback(entry->key, entry->value, context)) {
-                return;
-            }
-            entry = next;
+    // Look the table up every time, in case the callback adds entries.
+    for (i = 0; i < loadTable(map)->capacity; i++) {
+        Table* table = loadTable(map);
+        int hash = loadHash(table, i);
+        if (hash == HASH_EMPTY || hash == HASH_REMOVED) {
+            continue;
+        }
+        Slot* slot = &table->slots[i];
+        if (!callback(loadKey(slot), loadValue(slot), context)) {
+            return;
         }
     }
 }
 
 size_t hashmapCurrentCapacity(Hashmap* map) {
-    size_t bucketCount = map->bucketCount;
-    return bucketCount * 3 / 4;
+    size_t capacity = loadTable(map)->capacity;
+    return capacity * 3 / 4;
 }
 
 size_t hashmapCountCollisions(Hashmap* map) {
+    Table* table = loadTable(map);
     size_t collisions = 0;
     size_t i;
-    for (i = 0; i < map->bucketCount; i++) {
-        Entry* entry = map->buckets[i];
-        while (entry != NULL) {
-            if (entry->next != NULL) {
-                collisions++;
-            }
-            entry = entry->next;
+    for (i = 0; i < table->capacity; i++) {
+        int hash = loadHash(table, i);
+        if (hash != HASH_EMPTY && hash != HASH_REMOVED &&
+                calculateIndex(table->capacity, hash) != i) {
+            collisions++;
         }
     }
     return collisions;
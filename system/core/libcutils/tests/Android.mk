@@ -15,6 +15,7 @@
 LOCAL_PATH := $(call my-dir)
 
 test_src_files := \
+    hashmap_test.cpp \
     sockets_test.cpp \
 
 test_src_files_nonwindows := \
@@ -79,3 +80,14 @@ LOCAL_MODULE_STEM_32 := $(LOCAL_MODULE)32
 LOCAL_MODULE_STEM_64 := $(LOCAL_MODULE)64
 LOCAL_MODULE_HOST_OS := darwin linux windows
 include $(BUILD_HOST_NATIVE_TEST)
+
+
+#
+# Benchmarks.
+#
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := libcutils_benchmarks
+LOCAL_SRC_FILES := hashmap_benchmark.cpp
+LOCAL_SHARED_LIBRARIES := libcutils liblog
+include $(BUILD_NATIVE_BENCHMARK)
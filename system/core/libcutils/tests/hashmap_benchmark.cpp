@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark_api.h>
+#include <cutils/hashmap.h>
+
+// The same string keys str_parms uses
+static int StrHash(void* key) {
+    return hashmapHash(key, strlen(static_cast<char*>(key)));
+}
+
+static bool StrEquals(void* keyA, void* keyB) {
+    return strcmp(static_cast<char*>(keyA), static_cast<char*>(keyB)) == 0;
+}
+
+static std::vector<std::string> MakeStrings(size_t count) {
+    std::vector<std::string> strings;
+    char buf[32];
+    for (size_t i = 0; i < count; i++) {
+        snprintf(buf, sizeof(buf), "audio_param_%zu", i);
+        strings.push_back(buf);
+    }
+    return strings;
+}
+
+static std::vector<int> MakeInts(size_t count) {
+    std::vector<int> ints;
+    for (size_t i = 0; i < count; i++) {
+        ints.push_back(i * 2654435761U);
+    }
+    return ints;
+}
+
+// Lookups come with their own copies of the keys, in no particular order
+template <typename T>
+static std::vector<T> Shuffled(const std::vector<T>& keys) {
+    std::vector<T> lookups = keys;
+    std::shuffle(lookups.begin(), lookups.end(), std::mt19937(0));
+    return lookups;
+}
+
+// Builds and throws away a small map of string keys, as parsing does
+static void BM_StrPut(benchmark::State& state) {
+    std::vector<std::string> keys = MakeStrings(state.range_x());
+
+    while (state.KeepRunning()) {
+        Hashmap* map = hashmapCreate(5, StrHash, StrEquals);
+        for (std::string& key : keys) {
+            hashmapPut(map, &key[0], &key[0]);
+        }
+        hashmapFree(map);
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK(BM_StrPut)->Arg(8)->Arg(64);
+
+static void BM_StrGet(benchmark::State& state) {
+    std::vector<std::string> keys = MakeStrings(state.range_x());
+    std::vector<std::string> lookups = Shuffled(keys);
+    Hashmap* map = hashmapCreate(5, StrHash, StrEquals);
+    for (std::string& key : keys) {
+        hashmapPut(map, &key[0], &key[0]);
+    }
+
+    while (state.KeepRunning()) {
+        for (std::string& key : lookups) {
+            benchmark::DoNotOptimize(hashmapGet(map, &key[0]));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * lookups.size());
+    hashmapFree(map);
+}
+BENCHMARK(BM_StrGet)->Arg(8)->Arg(64);
+
+static void BM_IntPut(benchmark::State& state) {
+    std::vector<int> keys = MakeInts(state.range_x());
+
+    while (state.KeepRunning()) {
+        Hashmap* map = hashmapCreate(0, hashmapIntHash, hashmapIntEquals);
+        for (int& key : keys) {
+            hashmapPut(map, &key, &key);
+        }
+        hashmapFree(map);
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK(BM_IntPut)->Arg(1024)->Arg(65536);
+
+// Half of the lookups find nothing
+static void BM_IntGet(benchmark::State& state) {
+    std::vector<int> keys = MakeInts(state.range_x() * 2);
+    std::vector<int> lookups = Shuffled(keys);
+    Hashmap* map = hashmapCreate(0, hashmapIntHash, hashmapIntEquals);
+    for (size_t i = 0; i < keys.size(); i += 2) {
+        hashmapPut(map, &keys[i], &keys[i]);
+    }
+
+    while (state.KeepRunning()) {
+        for (int& key : lookups) {
+            benchmark::DoNotOptimize(hashmapGet(map, &key));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * lookups.size());
+    hashmapFree(map);
+}
+BENCHMARK(BM_IntGet)->Arg(1024)->Arg(65536);
+
+// Keeps the map at the same size while its keys change
+static void BM_IntChurn(benchmark::State& state) {
+    const size_t live = state.range_x();
+    std::vector<int> keys = MakeInts(live * 16);
+    Hashmap* map = hashmapCreate(live, hashmapIntHash, hashmapIntEquals);
+    for (size_t i = 0; i < live; i++) {
+        hashmapPut(map, &keys[i], &keys[i]);
+    }
+
+    size_t next = live;
+    while (state.KeepRunning()) {
+        size_t old = (next + keys.size() - live) % keys.size();
+        hashmapRemove(map, &keys[old]);
+        hashmapPut(map, &keys[next], &keys[next]);
+        next = (next + 1) % keys.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+    hashmapFree(map);
+}
+BENCHMARK(BM_IntChurn)->Arg(1024)->Arg(65536);
+
+static bool CountEntry(void*, void*, void* context) {
+    (*static_cast<size_t*>(context))++;
+    return true;
+}
+
+static void BM_ForEach(benchmark::State& state) {
+    std::vector<int> keys = MakeInts(state.range_x());
+    Hashmap* map = hashmapCreate(0, hashmapIntHash, hashmapIntEquals);
+    for (int& key : keys) {
+        hashmapPut(map, &key, &key);
+    }
+
+    size_t count = 0;
+    while (state.KeepRunning()) {
+        hashmapForEach(map, CountEntry, &count);
+    }
+    state.SetItemsProcessed(count);
+    hashmapFree(map);
+}
+BENCHMARK(BM_ForEach)->Arg(1024)->Arg(65536);
+
+// Lookups from several threads at once, which hashmapCreateConcurrent()
+// maps answer without taking the lock
+static Hashmap* gSharedMap;
+static std::vector<int> gSharedKeys;
+static std::vector<int> gSharedLookups;
+
+static void BM_SharedGet(benchmark::State& state) {
+    if (state.thread_index == 0) {
+        gSharedKeys = MakeInts(4096);
+        gSharedLookups = Shuffled(gSharedKeys);
+        if (state.range_x()) {
+            gSharedMap = hashmapCreateConcurrent(0, hashmapIntHash, hashmapIntEquals);
+        } else {
+            gSharedMap = hashmapCreate(0, hashmapIntHash, hashmapIntEquals);
+        }
+        for (int& key : gSharedKeys) {
+            hashmapPut(gSharedMap, &key, &key);
+        }
+    }
+
+    while (state.KeepRunning()) {
+        for (int& key : gSharedLookups) {
+            benchmark::DoNotOptimize(hashmapGet(gSharedMap, &key));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * gSharedLookups.size());
+
+    if (state.thread_index == 0) {
+        hashmapFree(gSharedMap);
+    }
+}
+BENCHMARK(BM_SharedGet)->Arg(0)->Arg(1)->Threads(1)->Threads(4);
+
+BENCHMARK_MAIN()
@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/hashmap.h>
+#include <gtest/gtest.h>
+
+#include <stdint.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+static void* IntValue(int i) {
+    return reinterpret_cast<void*>(static_cast<intptr_t>(i));
+}
+
+// Keys that all hash the same, so that every entry collides
+static int ConstantHash(void*) {
+    return 42;
+}
+
+TEST(hashmap, put_get_remove) {
+    std::vector<int> keys(10000);
+    Hashmap* map = hashmapCreate(0, hashmapIntHash, hashmapIntEquals);
+    ASSERT_TRUE(map != NULL);
+
+    for (size_t i = 0; i < keys.size(); i++) {
+        keys[i] = i * 7;
+        ASSERT_EQ(NULL, hashmapPut(map, &keys[i], IntValue(i + 1)));
+    }
+    ASSERT_EQ(keys.size(), hashmapSize(map));
+    ASSERT_GE(hashmapCurrentCapacity(map), keys.size());
+
+    for (size_t i = 0; i < keys.size(); i++) {
+        int key = i * 7;
+        ASSERT_EQ(IntValue(i + 1), hashmapGet(map, &key));
+        key += 1;
+        ASSERT_FALSE(hashmapContainsKey(map, &key));
+    }
+
+    int key = 7;
+    ASSERT_EQ(IntValue(2), hashmapPut(map, &key, IntValue(-1)));
+    ASSERT_EQ(IntValue(-1), hashmapGet(map, &keys[1]));
+    ASSERT_EQ(keys.size(), hashmapSize(map));
+
+    for (size_t i = 0; i < keys.size(); i += 2) {
+        ASSERT_EQ(IntValue(i + 1), hashmapRemove(map, &keys[i]));
+    }
+    ASSERT_EQ(keys.size() / 2, hashmapSize(map));
+    for (size_t i = 0; i < keys.size(); i++) {
+        ASSERT_EQ(i % 2 != 0, hashmapContainsKey(map, &keys[i])) << i;
+    }
+    ASSERT_EQ(NULL, hashmapRemove(map, &keys[0]));
+
+    hashmapFree(map);
+}
+
+TEST(hashmap, collisions) {
+    std::vector<int> keys(100);
+    Hashmap* map = hashmapCreate(0, ConstantHash, hashmapIntEquals);
+    for (size_t i = 0; i < keys.size(); i++) {
+        keys[i] = i;
+        hashmapPut(map, &keys[i], IntValue(i));
+    }
+    ASSERT_EQ(keys.size() - 1, hashmapCountCollisions(map));
+
+    // Removing one in the middle must not hide the ones after it.
+    ASSERT_EQ(IntValue(50), hashmapRemove(map, &keys[50]));
+    for (size_t i = 0; i < keys.size(); i++) {
+        ASSERT_EQ(i != 50, hashmapContainsKey(map, &keys[i])) << i;
+    }
+
+    // Then the ones at the end, and the one put back in between.
+    for (size_t i = 99; i > 50; i--) {
+        ASSERT_EQ(IntValue(i), hashmapRemove(map, &keys[i]));
+    }
+    hashmapPut(map, &keys[50], IntValue(50));
+    ASSERT_EQ(IntValue(50), hashmapRemove(map, &keys[50]));
+    for (size_t i = 0; i < keys.size(); i++) {
+        ASSERT_EQ(i < 50, hashmapContainsKey(map, &keys[i])) << i;
+    }
+    ASSERT_EQ(50u, hashmapSize(map));
+
+    hashmapFree(map);
+}
+
+TEST(hashmap, churn_reuses_slots) {
+    int keys[16];
+    Hashmap* map = hashmapCreate(16, hashmapIntHash, hashmapIntEquals);
+    for (int round = 0; round < 1000; round++) {
+        for (int i = 0; i < 16; i++) {
+            keys[i] = round * 16 + i;
+            hashmapPut(map, &keys[i], IntValue(i));
+        }
+        for (int i = 0; i < 16; i++) {
+            ASSERT_EQ(IntValue(i), hashmapRemove(map, &keys[i]));
+        }
+    }
+    ASSERT_EQ(0u, hashmapSize(map));
+    // It doesn't grow with all the keys that went through it.
+    ASSERT_LE(hashmapCurrentCapacity(map), 64u);
+    hashmapFree(map);
+}
+
+static bool RemoveEntry(void* key, void*, void* context) {
+    Hashmap* map = static_cast<Hashmap*>(context);
+    hashmapRemove(map, key);
+    return true;
+}
+
+static bool CountEntry(void*, void*, void* context) {
+    (*static_cast<size_t*>(context))++;
+    return true;
+}
+
+TEST(hashmap, remove_during_for_each) {
+    std::vector<int> keys(1000);
+    Hashmap* map = hashmapCreate(0, hashmapIntHash, hashmapIntEquals);
+    for (size_t i = 0; i < keys.size(); i++) {
+        keys[i] = i;
+        hashmapPut(map, &keys[i], IntValue(i));
+    }
+
+    size_t count = 0;
+    hashmapForEach(map, CountEntry, &count);
+    ASSERT_EQ(keys.size(), count);
+
+    hashmapForEach(map, RemoveEntry, map);
+    ASSERT_EQ(0u, hashmapSize(map));
+    count = 0;
+    hashmapForEach(map, CountEntry, &count);
+    ASSERT_EQ(0u, count);
+
+    hashmapFree(map);
+}
+
+static void* InitialValue(void* key, void* context) {
+    (*static_cast<int*>(context))++;
+    return IntValue(*static_cast<int*>(key) * 2);
+}
+
+TEST(hashmap, memoize) {
+    int key = 21;
+    int calls = 0;
+    Hashmap* map = hashmapCreate(0, hashmapIntHash, hashmapIntEquals);
+    ASSERT_EQ(IntValue(42), hashmapMemoize(map, &key, InitialValue, &calls));
+    ASSERT_EQ(IntValue(42), hashmapMemoize(map, &key, InitialValue, &calls));
+    ASSERT_EQ(1, calls);
+    ASSERT_EQ(1u, hashmapSize(map));
+    hashmapFree(map);
+}
+
+TEST(hashmap, concurrent_reads) {
+    const int kKeys = 4096;
+    std::vector<int> keys(kKeys);
+    for (int i = 0; i < kKeys; i++) {
+        keys[i] = i;
+    }
+    Hashmap* map = hashmapCreateConcurrent(0, hashmapIntHash, hashmapIntEquals);
+    // The even keys are always there, the odd ones come and go.
+    for (int i = 0; i < kKeys; i += 2) {
+        hashmapPut(map, &keys[i], IntValue(i + 1));
+    }
+
+    std::atomic<bool> done(false);
+    std::atomic<int> errors(0);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; t++) {
+        readers.emplace_back([&]() {
+            while (!done.load()) {
+                for (int i = 0; i < kKeys; i++) {
+                    void* value = hashmapGet(map, &keys[i]);
+                    if ((i % 2 == 0 && value != IntValue(i + 1)) ||
+                            (value != NULL && value != IntValue(i + 1))) {
+                        errors++;
+                    }
+                }
+            }
+        });
+    }
+
+    for (int round = 0; round < 50; round++) {
+        for (int i = 1; i < kKeys; i += 2) {
+            hashmapPut(map, &keys[i], IntValue(i + 1));
+        }
+        for (int i = 1; i < kKeys; i += 2) {
+            hashmapRemove(map, &keys[i]);
+        }
+    }
+    done = true;
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+
+    ASSERT_EQ(0, errors.load());
+    ASSERT_EQ(static_cast<size_t>(kKeys / 2), hashmapSize(map));
+    hashmapFree(map);
+}
+
+TEST(hashmap, concurrent_remove_put_get) {
+    const int kKeys = 8;
+    std::vector<int> keys(kKeys);
+    for (int i = 0; i < kKeys; i++) {
+        keys[i] = i;
+    }
+    // All the keys collide, and only one is in the map at a time, so each put
+    // takes over the slot the previous key was just removed from while the
+    // readers may still be looking that key up.
+    Hashmap* map = hashmapCreateConcurrent(kKeys, ConstantHash,
+            hashmapIntEquals);
+
+    // Each value says which key it was put for.
+    std::atomic<bool> done(false);
+    std::atomic<int> started(0);
+    std::atomic<int> errors(0);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; t++) {
+        readers.emplace_back([&]() {
+            started++;
+            while (!done.load()) {
+                for (int i = 0; i < kKeys; i++) {
+                    void* value = hashmapGet(map, &keys[i]);
+                    if (value != NULL &&
+                            reinterpret_cast<intptr_t>(value) / 1024 != i) {
+                        errors++;
+                    }
+                }
+            }
+        });
+    }
+
+    hashmapPut(map, &keys[0], IntValue(1));
+    while (started.load() < 4) {
+        std::this_thread::yield();
+    }
+    for (int round = 1; round < 10000; round++) {
+        int in = round % kKeys;
+        hashmapRemove(map, &keys[(round - 1) % kKeys]);
+        hashmapPut(map, &keys[in], IntValue(in * 1024 + round % 1000 + 1));
+        // Let the readers find the new key before it goes again.
+        std::this_thread::yield();
+    }
+    done = true;
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+
+    ASSERT_EQ(0, errors.load());
+    ASSERT_EQ(1U, hashmapSize(map));
+    hashmapFree(map);
+}
@@ -32,7 +32,7 @@ liblog_host_sources += fake_writer.c
 liblog_target_sources := $(liblog_sources) event_tag_map.c
 liblog_target_sources += config_read.c log_time.cpp log_is_loggable.c logprint.c
 liblog_target_sources += pmsg_reader.c pmsg_writer.c
-liblog_target_sources += logd_reader.c logd_writer.c logger_read.c
+liblog_target_sources += logd_reader.c logd_writer.c logd_batch.c logger_read.c
 
 # Shared and static library for host
 # ========================================================
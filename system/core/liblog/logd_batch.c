@@ -0,0 +1,446 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Opt-in batched delivery to logd.
+ *
+ * Writers reserve space in a process wide ring with a single compare and
+ * swap, copy their record in and mark it committed; there is no lock and
+ * no syscall on the fast path. A flusher thread sends the committed
+ * records on to logd, several to a datagram, at most latency_ms after the
+ * first of them was queued, or sooner once the ring is half full.
+ *
+ * Ring layout: each record is a 32 bit state word followed by its wire
+ * form (little endian uint16_t length, android_log_header_t, payload),
+ * padded to 8 bytes. A record never wraps, the remainder of the ring is
+ * skipped with a pad record instead. The flusher zeroes what it consumed
+ * before handing it back, so a state word reads zero until committed.
+ *
+ * If the ring is full the writer falls back to a direct write, so records
+ * are never lost to batching; logd orders them by timestamp regardless.
+ * A batch logd does not take counts as dropped, as a direct write would.
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <log/logger.h>
+#include <private/android_logger.h>
+
+#include "log_portability.h"
+#include "logger.h"
+
+#define BATCH_RING_SIZE      (64 * 1024) /* power of two */
+#define BATCH_ALIGN          8
+#define BATCH_MAX_RECORDS    64
+#define BATCH_FLUSH_SPINS    1000
+
+#define RECORD_COMMITTED     0x80000000U
+#define RECORD_PAD           0x40000000U
+#define RECORD_SIZE_MASK     0x00FFFFFFU
+
+static char *ring;
+static atomic_uint_fast64_t head; /* next byte handed out to writers */
+static atomic_uint_fast64_t tail; /* next byte to be sent by the flusher */
+static atomic_uint latency;       /* ms, zero when batching is off */
+static atomic_flag draining = ATOMIC_FLAG_INIT;
+static atomic_bool kicked;
+static int wakeFd = -1;
+static bool running;    /* a flusher thread serves the ring */
+static bool registered; /* fork, exit and crash handlers are in place */
+
+static const int crashSignals[] = {
+    SIGABRT, SIGBUS, SIGFPE, SIGILL, SIGSEGV, SIGTRAP
+};
+static struct sigaction oldActions[NSIG];
+
+static inline atomic_uint_least32_t *stateAt(uint64_t pos)
+{
+    return (atomic_uint_least32_t *)(ring + (pos & (BATCH_RING_SIZE - 1)));
+}
+
+static void kick()
+{
+    if (!atomic_exchange_explicit(&kicked, true, memory_order_relaxed)) {
+        uint64_t one = 1;
+        TEMP_FAILURE_RETRY(write(wakeFd, &one, sizeof(one)));
+    }
+}
+
+/*
+ * bounded callers, among them the crash signal handler, only reconnect if
+ * the lock is free, whoever holds it may be what we interrupted.
+ */
+static ssize_t sendBatch(struct iovec *vec, size_t nr, int bounded)
+{
+    extern struct android_log_transport_write logdLoggerWrite;
+    ssize_t ret;
+
+    ret = TEMP_FAILURE_RETRY(writev(logdLoggerWrite.context.sock, vec, nr));
+    if ((ret < 0) && (errno == ENOTCONN)) {
+        if (bounded) {
+            if (__android_log_trylock()) {
+                return ret;
+            }
+        } else {
+            __android_log_lock();
+        }
+        (*logdLoggerWrite.close)();
+        ret = (*logdLoggerWrite.open)();
+        __android_log_unlock();
+        if (ret >= 0) {
+            ret = TEMP_FAILURE_RETRY(writev(logdLoggerWrite.context.sock,
+                                            vec, nr));
+        }
+    }
+    return ret;
+}
+
+/*
+ * Send everything committed so far. Caller holds draining. Async signal
+ * safe when bounded, this is also what runs on the way down from a crash.
+ */
+static void drain(int bounded)
+{
+    uint64_t pos = atomic_load_explicit(&tail, memory_order_relaxed);
+
+    for (;;) {
+        android_log_header_t batch;
+        struct iovec vec[1 + BATCH_MAX_RECORDS];
+        uint64_t start = pos;
+        size_t count = 0;
+        size_t total = sizeof(batch);
+
+        while (count < BATCH_MAX_RECORDS) {
+            uint32_t state = atomic_load_explicit(stateAt(pos),
+                                                  memory_order_acquire);
+            if (!(state & RECORD_COMMITTED)) {
+                break;
+            }
+            if (state & RECORD_PAD) {
+                pos += state & RECORD_SIZE_MASK;
+                continue;
+            }
+
+            char *wire = (char *)stateAt(pos) + sizeof(uint32_t);
+            uint16_t len;
+            memcpy(&len, wire, sizeof(len));
+            len = le16toh(len);
+            if ((total + sizeof(len) + len) > LOGGER_ENTRY_MAX_BATCH) {
+                break;
+            }
+
+            ++count;
+            vec[count].iov_base = wire;
+            vec[count].iov_len = sizeof(len) + len;
+            total += vec[count].iov_len;
+            pos += state & RECORD_SIZE_MASK;
+        }
+
+        if (pos == start) {
+            return;
+        }
+
+        if (count == 1) {
+            /* plain datagram, drop the record length */
+            vec[1].iov_base = (char *)vec[1].iov_base + sizeof(uint16_t);
+            vec[1].iov_len -= sizeof(uint16_t);
+            if (sendBatch(&vec[1], 1, bounded) < 0) {
+                __android_log_logd_dropped(count);
+            }
+        } else if (count) {
+            memset(&batch, 0, sizeof(batch));
+            batch.id = LOG_ID_BATCH;
+            batch.tid = count;
+            vec[0].iov_base = &batch;
+            vec[0].iov_len = sizeof(batch);
+            if (sendBatch(vec, count + 1, bounded) < 0) {
+                __android_log_logd_dropped(count);
+            }
+        }
+
+        /* hand the space back zeroed, it may span the end of the ring */
+        while (start < pos) {
+            size_t offset = start & (BATCH_RING_SIZE - 1);
+            size_t len = BATCH_RING_SIZE - offset;
+            if (len > (pos - start)) {
+                len = pos - start;
+            }
+            memset(ring + offset, 0, len);
+            start += len;
+        }
+        /* ordered against the empty check in flusher() and in writers */
+        atomic_store(&tail, pos);
+    }
+}
+
+/*
+ * Drain from a thread other than the flusher. bounded for callers that
+ * can not wait for ever, a crashing flusher would never let go.
+ */
+static void flush(int bounded)
+{
+    int spins = 0;
+
+    while (atomic_flag_test_and_set_explicit(&draining,
+                                             memory_order_acquire)) {
+        if (bounded && (++spins > BATCH_FLUSH_SPINS)) {
+            return;
+        }
+        sched_yield();
+    }
+    drain(bounded);
+    atomic_flag_clear_explicit(&draining, memory_order_release);
+}
+
+static void *flusher(void *obj __unused)
+{
+    prctl(PR_SET_NAME, "liblog.batch");
+
+    for (;;) {
+        struct pollfd pfd = { .fd = wakeFd, .events = POLLIN, .revents = 0 };
+        unsigned ms = atomic_load_explicit(&latency, memory_order_relaxed);
+        int empty = atomic_load(&head) == atomic_load(&tail);
+
+        /*
+         * Idle until the first record of a burst arrives, then give the
+         * burst latency ms to build up unless the ring gets crowded.
+         */
+        if (TEMP_FAILURE_RETRY(poll(&pfd, 1, (empty || !ms) ? -1 : (int)ms)) > 0) {
+            uint64_t count;
+            TEMP_FAILURE_RETRY(read(wakeFd, &count, sizeof(count)));
+            atomic_store_explicit(&kicked, false, memory_order_relaxed);
+            if (empty && ms) {
+                continue;
+            }
+        }
+
+        flush(0);
+    }
+    return NULL;
+}
+
+static void crashed(int sig, siginfo_t *info, void *ucontext)
+{
+    struct sigaction *old = &oldActions[sig];
+    struct sigaction chained = *old;
+
+    flush(1);
+
+    /*
+     * Pass it on, staying in place: a handler before us may recover, as
+     * the runtime does from its implicit null checks, and the next crash
+     * should flush too. Only SA_RESETHAND makes it a one off.
+     */
+    if (old->sa_flags & SA_RESETHAND) {
+        old->sa_handler = SIG_DFL;
+        old->sa_flags &= ~(SA_SIGINFO | SA_RESETHAND);
+    }
+    if (chained.sa_flags & SA_SIGINFO) {
+        (*chained.sa_sigaction)(sig, info, ucontext);
+    } else if ((chained.sa_handler != SIG_DFL)
+            && (chained.sa_handler != SIG_IGN)) {
+        (*chained.sa_handler)(sig);
+    } else {
+        /* as if we had never been here, a fault recurs on return */
+        sigaction(sig, &chained, NULL);
+        if (info->si_code <= 0) {
+            /* sent rather than faulted, will not recur on return */
+            raise(sig);
+        }
+    }
+}
+
+static void flushAtExit()
+{
+    flush(1);
+}
+
+static void forkChild()
+{
+    /*
+     * No flusher in the child, what is queued is the parent's to send.
+     * Write directly until the child opts in again and starts its own.
+     */
+    atomic_store(&latency, 0);
+    atomic_store(&head, 0);
+    atomic_store(&tail, 0);
+    atomic_store(&kicked, false);
+    atomic_flag_clear(&draining);
+    memset(ring, 0, BATCH_RING_SIZE);
+    if (wakeFd >= 0) {
+        close(wakeFd);
+        wakeFd = -1;
+    }
+    running = false;
+}
+
+/* log_init_lock assumed */
+static int start()
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+    size_t i;
+    int ret;
+
+    /* the ring is kept from a parent process, zeroed */
+    if (!ring) {
+        ring = calloc(1, BATCH_RING_SIZE);
+        if (!ring) {
+            return -ENOMEM;
+        }
+    }
+    wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wakeFd < 0) {
+        return -errno;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    ret = -pthread_create(&thread, &attr, flusher, NULL);
+    pthread_attr_destroy(&attr);
+    if (ret < 0) {
+        close(wakeFd);
+        wakeFd = -1;
+        return ret;
+    }
+    running = true;
+
+    if (registered) {
+        return 0;
+    }
+    registered = true;
+    pthread_atfork(NULL, NULL, forkChild);
+    atexit(flushAtExit);
+    for (i = 0; i < sizeof(crashSignals) / sizeof(crashSignals[0]); ++i) {
+        struct sigaction action;
+
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = crashed;
+        action.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(crashSignals[i], &action, &oldActions[crashSignals[i]]);
+    }
+    return 0;
+}
+
+LIBLOG_HIDDEN int __android_log_batch_start(unsigned latency_ms)
+{
+    int ret = 0;
+
+    __android_log_lock();
+    if (latency_ms && !running) {
+        ret = start();
+    }
+    if (ret >= 0) {
+        atomic_store(&latency, latency_ms);
+    }
+    __android_log_unlock();
+
+    if (!latency_ms && ring) {
+        flush(0);
+    }
+    return ret;
+}
+
+LIBLOG_HIDDEN void __android_log_batch_drain()
+{
+    if (ring) {
+        flush(1);
+    }
+}
+
+/*
+ * Queue one record for logd, header and vec as they would have gone out
+ * in a datagram. Returns the payload length queued, or -EAGAIN if not
+ * batching or the ring is full and the caller should write it directly.
+ */
+LIBLOG_HIDDEN ssize_t __android_log_batch_queue(
+        const android_log_header_t *header, struct iovec *vec, size_t nr)
+{
+    uint64_t pos, start, used, pad;
+    size_t i, len, size, offset;
+    uint16_t wireLen;
+    char *p;
+
+    if (!atomic_load_explicit(&latency, memory_order_relaxed)) {
+        return -EAGAIN;
+    }
+
+    for (len = 0, i = 0; i < nr; ++i) {
+        len += vec[i].iov_len;
+    }
+    size = (sizeof(uint32_t) + sizeof(wireLen) + sizeof(*header) + len
+                + BATCH_ALIGN - 1) & ~(BATCH_ALIGN - 1);
+
+    pos = atomic_load_explicit(&head, memory_order_relaxed);
+    do {
+        offset = pos & (BATCH_RING_SIZE - 1);
+        pad = ((offset + size) > BATCH_RING_SIZE) ? BATCH_RING_SIZE - offset : 0;
+        used = pos - atomic_load_explicit(&tail, memory_order_acquire);
+        if ((used + pad + size) > BATCH_RING_SIZE) {
+            kick();
+            return -EAGAIN;
+        }
+    } while (!atomic_compare_exchange_weak(&head, &pos, pos + pad + size));
+
+    start = pos;
+    if (pad) {
+        atomic_store_explicit(stateAt(pos),
+                              RECORD_COMMITTED | RECORD_PAD | pad,
+                              memory_order_release);
+        pos += pad;
+    }
+
+    p = (char *)stateAt(pos) + sizeof(uint32_t);
+    wireLen = htole16(sizeof(*header) + len);
+    memcpy(p, &wireLen, sizeof(wireLen));
+    p += sizeof(wireLen);
+    memcpy(p, header, sizeof(*header));
+    p += sizeof(*header);
+    for (i = 0; i < nr; ++i) {
+        memcpy(p, vec[i].iov_base, vec[i].iov_len);
+        p += vec[i].iov_len;
+    }
+    atomic_store_explicit(stateAt(pos), RECORD_COMMITTED | size,
+                          memory_order_release);
+
+    /*
+     * The first record of a burst starts the clock, a crowded ring goes
+     * out now. Checked against tail after the reservation, so either the
+     * flusher saw our head or we see that it has caught up to us.
+     */
+    if ((atomic_load(&tail) == start)
+            || ((used + pad + size) > (BATCH_RING_SIZE / 2))) {
+        kick();
+    }
+
+    return len;
+}
@@ -482,7 +482,7 @@ static int logdOpen(struct android_log_logger_list *logger_list,
     struct sigaction ignore;
     struct sigaction old_sigaction;
     unsigned int old_alarm = 0;
-    char buffer[256], *cp, c;
+    char buffer[LOGD_READER_COMMAND_MAX], *cp, c;
     int e, ret, remaining;
 
     int sock = transp->context.sock;
@@ -555,9 +555,17 @@ static int logdOpen(struct android_log_logger_list *logger_list,
     if (logger_list->pid) {
         ret = snprintf(cp, remaining, " pid=%u", logger_list->pid);
         ret = min(ret, remaining);
+        remaining -= ret;
         cp += ret;
     }
 
+    /* all or nothing, a truncated filter would ask for something else */
+    if (logger_list->filter &&
+            ((int)strlen(logger_list->filter) < remaining)) {
+        strcpy(cp, logger_list->filter);
+        cp += strlen(cp);
+    }
+
     if (logger_list->mode & ANDROID_LOG_NONBLOCK) {
         /* Deal with an unresponsive logd */
         memset(&ignore, 0, sizeof(ignore));
@@ -152,6 +152,14 @@ static int logdAvailable(log_id_t logId)
     return 1;
 }
 
+/* Records logd could not take, reported to it with the next write */
+static atomic_int_fast32_t dropped;
+
+LIBLOG_HIDDEN void __android_log_logd_dropped(size_t count)
+{
+    atomic_fetch_add_explicit(&dropped, count, memory_order_relaxed);
+}
+
 static int logdWrite(log_id_t logId, struct timespec *ts,
                      struct iovec *vec, size_t nr)
 {
@@ -160,7 +168,6 @@ static int logdWrite(log_id_t logId, struct timespec *ts,
     struct iovec newVec[nr + headerLength];
     android_log_header_t header;
     size_t i, payloadSize;
-    static atomic_int_fast32_t dropped;
     static atomic_int_fast32_t droppedSecurity;
 
     if (logdLoggerWrite.context.sock < 0) {
@@ -259,6 +266,15 @@ static int logdWrite(log_id_t logId, struct timespec *ts,
         }
     }
 
+    /* opted in to batching, security records always go out directly */
+    if (logId != LOG_ID_SECURITY) {
+        ret = __android_log_batch_queue(&header, &newVec[headerLength],
+                                        i - headerLength);
+        if (ret != -EAGAIN) {
+            return ret;
+        }
+    }
+
     /*
      * The write below could be lost, but will never block.
      *
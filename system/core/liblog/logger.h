@@ -24,6 +24,7 @@
 #include <log/log.h>
 #include <log/log_read.h>
 #include <log/logger.h>
+#include <private/android_logger.h>
 
 #include "log_portability.h"
 
@@ -102,6 +103,7 @@ struct android_log_logger_list {
   unsigned int tail;
   log_time start;
   pid_t pid;
+  char *filter; /* logdr command keys, see android_logger_list_set_filter */
 };
 
 struct android_log_logger {
@@ -156,6 +158,14 @@ LIBLOG_HIDDEN int __android_log_trylock();
 LIBLOG_HIDDEN void __android_log_unlock();
 LIBLOG_HIDDEN int __android_log_is_debuggable();
 
+/* Batched delivery to logd, target only, see logd_batch.c */
+LIBLOG_HIDDEN int __android_log_batch_start(unsigned latency_ms);
+LIBLOG_HIDDEN void __android_log_batch_drain();
+LIBLOG_HIDDEN ssize_t __android_log_batch_queue(
+        const android_log_header_t *header, struct iovec *vec, size_t nr);
+/* Count records lost on the way to logd, see logd_writer.c */
+LIBLOG_HIDDEN void __android_log_logd_dropped(size_t count);
+
 __END_DECLS
 
 #endif /* _LIBLOG_LOGGER_H__ */
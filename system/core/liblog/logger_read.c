@@ -14,11 +14,13 @@
 ** limitations under the License.
 */
 
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
 #include <sched.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -271,6 +273,137 @@ LIBLOG_ABI_PUBLIC struct logger_list *android_logger_list_alloc_time(
     return (struct logger_list *)logger_list;
 }
 
+/* %XX anything that would end a key or a list element on the logdr wire */
+static char *filter_escape(char *cp, const char *s, size_t len)
+{
+    static const char hex[] = "0123456789ABCDEF";
+
+    while (len--) {
+        unsigned char c = *s++;
+        if ((c <= ' ') || (c >= 0x7F) || (c == '%') || (c == ',') || (c == ':')) {
+            *cp++ = '%';
+            *cp++ = hex[c >> 4];
+            *cp++ = hex[c & 0xF];
+        } else {
+            *cp++ = c;
+        }
+    }
+    return cp;
+}
+
+/* filterspec priority letter, as in logprint.c */
+static int filter_priority(char c)
+{
+    static const char letters[] = "vdiwefs";
+    const char *p;
+
+    if ((c >= '0') && (c <= ('0' + ANDROID_LOG_SILENT))) {
+        return c - '0';
+    }
+    p = c ? strchr(letters, tolower(c)) : NULL;
+    return p ? (ANDROID_LOG_VERBOSE + (p - letters)) : -1;
+}
+
+LIBLOG_ABI_PUBLIC int android_logger_list_set_filter(
+        struct logger_list *logger_list,
+        const char *tags,
+        int prio,
+        const char *substring,
+        const char *regex)
+{
+    struct android_log_logger_list *logger_list_internal =
+            (struct android_log_logger_list *)logger_list;
+    size_t len;
+    char *filter, *cp;
+
+    if (!logger_list_internal || (prio < 0) || (prio > ANDROID_LOG_SILENT)) {
+        return -EINVAL;
+    }
+
+    /* worst case, every character escaped and every tag one long */
+    len = sizeof(" prio=NN tags= grep= regex=")
+        + (tags ? 6 * strlen(tags) : 0)
+        + (substring ? 3 * strlen(substring) : 0)
+        + (regex ? 3 * strlen(regex) : 0);
+    filter = cp = malloc(len);
+    if (!filter) {
+        return -ENOMEM;
+    }
+
+    if (prio > ANDROID_LOG_VERBOSE) {
+        cp += sprintf(cp, " prio=%d", prio);
+    }
+
+    if (tags) {
+        const char *spec = tags;
+        char c = '=';
+
+        strcpy(cp, " tags");
+        cp += 5;
+        for (;;) {
+            size_t specLen, tagLen;
+            int tagPrio = ANDROID_LOG_VERBOSE;
+
+            spec += strspn(spec, " \t\n");
+            if (!*spec) {
+                break;
+            }
+            specLen = strcspn(spec, " \t\n");
+            tagLen = strcspn(spec, ":");
+            if (tagLen < specLen) {
+                tagPrio = filter_priority(spec[tagLen + 1]);
+                if ((specLen != (tagLen + 2)) || (tagPrio < 0)) {
+                    free(filter);
+                    return -EINVAL;
+                }
+            } else {
+                tagLen = specLen;
+            }
+            if (!tagLen || ((tagLen == 1) && (*spec == '*'))) {
+                free(filter);
+                return -EINVAL;
+            }
+            if (tagPrio < ANDROID_LOG_SILENT) {
+                *cp++ = c;
+                cp = filter_escape(cp, spec, tagLen);
+                cp += sprintf(cp, ":%d", tagPrio);
+                c = ',';
+            }
+            spec += specLen;
+        }
+        if (c == '=') {
+            /* every tag silenced */
+            *cp++ = c;
+        }
+    }
+
+    if (substring && *substring) {
+        strcpy(cp, " grep=");
+        cp = filter_escape(cp + 6, substring, strlen(substring));
+    }
+
+    if (regex && *regex) {
+        strcpy(cp, " regex=");
+        cp = filter_escape(cp + 7, regex, strlen(regex));
+    }
+    *cp = '\0';
+
+    /* leave room for the lids=, tail=, start=, timeout= and pid= keys */
+    if ((size_t)(cp - filter) > (LOGD_READER_COMMAND_MAX / 2)) {
+        free(filter);
+        return -E2BIG;
+    }
+
+    free(logger_list_internal->filter);
+    logger_list_internal->filter = NULL;
+    if (cp != filter) {
+        logger_list_internal->filter = filter;
+    } else {
+        free(filter);
+    }
+    return 0;
+}
+
 /* android_logger_list_register unimplemented, no use case */
 /* android_logger_list_unregister unimplemented, no use case */
 
@@ -475,5 +608,6 @@ LIBLOG_ABI_PUBLIC void android_logger_list_free(struct logger_list *logger_list)
         android_logger_free((struct logger *)logger);
     }
 
+    free(logger_list_internal->filter);
     free(logger_list_internal);
 }
@@ -379,6 +379,22 @@ static int __write_to_log_init(log_id_t log_id, struct iovec *vec, size_t nr)
     return write_to_log(log_id, vec, nr);
 }
 
+LIBLOG_ABI_PUBLIC int __android_log_batch(unsigned latency_ms)
+{
+#if (FAKE_LOG_DEVICE == 0)
+    return __android_log_batch_start(latency_ms);
+#else
+    return latency_ms ? -ENODEV : 0;
+#endif
+}
+
+LIBLOG_ABI_PUBLIC void __android_log_batch_flush()
+{
+#if (FAKE_LOG_DEVICE == 0)
+    __android_log_batch_drain();
+#endif
+}
+
 LIBLOG_ABI_PUBLIC int __android_log_write(int prio, const char *tag,
                                           const char *msg)
 {
@@ -390,6 +406,7 @@ LIBLOG_ABI_PUBLIC int __android_log_buf_write(int bufID, int prio,
 {
     struct iovec vec[3];
     char tmp_tag[32];
+    int ret;
 
     if (!tag)
         tag = "";
@@ -424,7 +441,14 @@ LIBLOG_ABI_PUBLIC int __android_log_buf_write(int bufID, int prio,
     vec[2].iov_base = (void *)msg;
     vec[2].iov_len  = strlen(msg) + 1;
 
-    return write_to_log(bufID, vec, 3);
+    ret = write_to_log(bufID, vec, 3);
+
+    /* about to abort, do not leave anything batched behind */
+    if (prio == ANDROID_LOG_FATAL) {
+        __android_log_batch_flush();
+    }
+
+    return ret;
 }
 
 LIBLOG_ABI_PUBLIC int __android_log_vprint(int prio, const char *tag,
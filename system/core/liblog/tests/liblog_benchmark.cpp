@@ -15,11 +15,15 @@
  */
 
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/endian.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <vector>
+
 #include <cutils/sockets.h>
 #include <log/log.h>
 #include <log/logger.h>
@@ -77,6 +81,108 @@ static void BM_log_maximum(int iters) {
 }
 BENCHMARK(BM_log_maximum);
 
+static const unsigned batch_latency_ms = 10;
+
+/*
+ *	Same as BM_log_maximum with the process opted in to batched delivery.
+ * Expect this to be a small fraction of BM_log_maximum, the call only
+ * formats and copies the message into the batching ring.
+ */
+static void BM_log_batch_maximum(int iters) {
+    __android_log_batch(batch_latency_ms);
+
+    StartBenchmarkTiming();
+
+    for (int i = 0; i < iters; ++i) {
+        __android_log_print(ANDROID_LOG_INFO, "BM_log_batch_maximum", "%d", i);
+    }
+
+    StopBenchmarkTiming();
+
+    __android_log_batch(0);
+}
+BENCHMARK(BM_log_batch_maximum);
+
+static const int writer_threads = 4;
+
+static void *log_writer(void *obj) {
+    int iters = *reinterpret_cast<int *>(obj);
+
+    for (int i = 0; i < iters; ++i) {
+        __android_log_print(ANDROID_LOG_INFO, "BM_log_threads", "%d", i);
+    }
+    return NULL;
+}
+
+static void log_threads(int iters) {
+    pthread_t threads[writer_threads];
+    int each = (iters + writer_threads - 1) / writer_threads;
+
+    StartBenchmarkTiming();
+
+    for (int i = 0; i < writer_threads; ++i) {
+        pthread_create(&threads[i], NULL, log_writer, &each);
+    }
+    for (int i = 0; i < writer_threads; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    StopBenchmarkTiming();
+}
+
+/*
+ *	Measure the aggregate rate of several threads logging at once, direct
+ * and batched. The batched writers contend only on the ring reservation.
+ */
+static void BM_log_threads(int iters) {
+    log_threads(iters);
+}
+BENCHMARK(BM_log_threads);
+
+static void BM_log_batch_threads(int iters) {
+    __android_log_batch(batch_latency_ms);
+    log_threads(iters);
+    __android_log_batch(0);
+}
+BENCHMARK(BM_log_batch_threads);
+
+static void log_p99(int iters, const char *tag) {
+    std::vector<uint64_t> latency(iters);
+
+    for (int i = 0; i < iters; ++i) {
+        struct timespec begin, end;
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        __android_log_print(ANDROID_LOG_INFO, tag, "%d", i);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        latency[i] = (end.tv_sec - begin.tv_sec) * 1000000000ULL
+                   + end.tv_nsec - begin.tv_nsec;
+    }
+
+    std::sort(latency.begin(), latency.end());
+
+    // report the 99th percentile call latency in place of the mean
+    uint64_t p99 = latency[(iters * 99ULL) / 100];
+    StartBenchmarkTiming(1);
+    StopBenchmarkTiming(1 + (p99 * iters));
+}
+
+/*
+ *	Measure the 99th percentile latency of a log call under full load,
+ * direct and batched. The direct tail is set by logd's socket backing up,
+ * the batched tail by falling back to a direct write when the ring fills.
+ */
+static void BM_log_p99(int iters) {
+    log_p99(iters, "BM_log_p99");
+}
+BENCHMARK(BM_log_p99);
+
+static void BM_log_batch_p99(int iters) {
+    __android_log_batch(batch_latency_ms);
+    log_p99(iters, "BM_log_batch_p99");
+    __android_log_batch(0);
+}
+BENCHMARK(BM_log_batch_p99);
+
 /*
  *	Measure the time it takes to submit the android logging call using
  * discrete acquisition under light load. Expect this to be a pair of
@@ -20,6 +20,7 @@
 #include <signal.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include <cutils/properties.h>
@@ -177,6 +178,63 @@ TEST(liblog, __android_log_btwrite__android_logger_list_read) {
     android_logger_list_close(logger_list);
 }
 
+// A child forked while its parent batches has no flusher thread of its own,
+// it writes directly until it opts in, and then gets a flusher.
+TEST(liblog, __android_log_batch__fork) {
+    static const unsigned latency_ms = 10;
+
+    ASSERT_EQ(0, __android_log_batch(latency_ms));
+    log_time ts(CLOCK_MONOTONIC);
+    ASSERT_LT(0, __android_log_btwrite(0, EVENT_TYPE_LONG, &ts, sizeof(ts)));
+
+    pid_t pid = fork();
+    ASSERT_LE(0, pid);
+    if (!pid) {
+        int ret = 0;
+        log_time ts1(CLOCK_MONOTONIC);
+        if (__android_log_btwrite(0, EVENT_TYPE_LONG, &ts1, sizeof(ts1)) <= 0) {
+            ret = 1;
+        }
+        if (__android_log_batch(latency_ms)) {
+            ret = 2;
+        }
+        log_time ts2(CLOCK_MONOTONIC);
+        if (__android_log_btwrite(0, EVENT_TYPE_LONG, &ts2, sizeof(ts2)) <= 0) {
+            ret = 3;
+        }
+        // leave without the exit time flush, it is up to the flusher
+        usleep(20 * latency_ms * 1000);
+        _exit(ret);
+    }
+
+    int status;
+    ASSERT_EQ(pid, TEMP_FAILURE_RETRY(waitpid(pid, &status, 0)));
+    ASSERT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(0, WEXITSTATUS(status));
+    __android_log_batch(0);
+
+    struct logger_list *logger_list;
+    ASSERT_TRUE(NULL != (logger_list = android_logger_list_open(
+        LOG_ID_EVENTS, ANDROID_LOG_RDONLY | ANDROID_LOG_NONBLOCK, 1000, pid)));
+
+    int count = 0;
+    for (;;) {
+        log_msg log_msg;
+        if (android_logger_list_read(logger_list, &log_msg) <= 0) {
+            break;
+        }
+        if ((log_msg.entry.pid == pid)
+                && (log_msg.entry.len == (4 + 1 + 8))
+                && (log_msg.msg()[4] == EVENT_TYPE_LONG)) {
+            ++count;
+        }
+    }
+
+    EXPECT_EQ(2, count);
+
+    android_logger_list_close(logger_list);
+}
+
 static inline int32_t get4LE(const char* src)
 {
     return src[0] | (src[1] << 8) | (src[2] << 16) | (src[3] << 24);
@@ -13,7 +13,9 @@ libsparse_src_files := \
         sparse.c \
         sparse_crc32.c \
         sparse_err.c \
-        sparse_read.c
+        sparse_parallel.c \
+        sparse_read.c \
+        sparse_stream.c
 
 
 include $(CLEAR_VARS)
@@ -58,6 +60,8 @@ LOCAL_MODULE_STEM := simg2img
 LOCAL_STATIC_LIBRARIES := \
     libsparse_host \
     libz
+LOCAL_LDLIBS_darwin := -lpthread
+LOCAL_LDLIBS_linux := -lpthread
 LOCAL_CFLAGS := -Werror
 include $(BUILD_HOST_EXECUTABLE)
 
@@ -81,6 +85,8 @@ LOCAL_MODULE_STEM := img2simg
 LOCAL_STATIC_LIBRARIES := \
     libsparse_host \
     libz
+LOCAL_LDLIBS_darwin := -lpthread
+LOCAL_LDLIBS_linux := -lpthread
 LOCAL_CFLAGS := -Werror
 include $(BUILD_HOST_EXECUTABLE)
 
@@ -103,6 +109,8 @@ LOCAL_MODULE := append2simg
 LOCAL_STATIC_LIBRARIES := \
     libsparse_host \
     libz
+LOCAL_LDLIBS_darwin := -lpthread
+LOCAL_LDLIBS_linux := -lpthread
 LOCAL_CFLAGS := -Werror
 include $(BUILD_HOST_EXECUTABLE)
 
@@ -260,6 +260,96 @@ struct sparse_file *sparse_file_import_auto(int fd, bool crc, bool verbose);
 int sparse_file_resparse(struct sparse_file *in_s, unsigned int max_len,
 		struct sparse_file **out_s, int out_s_count);
 
+struct sparse_stream;
+
+/**
+ * sparse_stream_new - start writing a sparse file as its blocks are added
+ * @block_size - minimum size of a chunk
+ * @len - size of the expanded sparse file
+ * @chunks - number of chunks the file will have, see below
+ * @crc - append a crc chunk
+ * @write - function to call with the sparse file as it is written, or NULL
+ * @priv - value that will be passed as the first argument to write
+ * Unlike a sparse_file cookie, a sparse stream does not keep what is added to
+ * it: each chunk is written with the callback as soon as the blocks after it
+ * show where it ends, so memory use is the same however large the file is.
+ * Blocks must be added in order, and adjacent blocks of the same kind are
+ * merged into one chunk up to a few megabytes long.
+ * The sparse file header is written first and holds the number of chunks, so
+ * the blocks are normally added twice: once to a stream with a NULL write,
+ * which only counts, to find out the chunks and length with
+ * sparse_stream_chunks and sparse_stream_len, then again to one that writes.
+ * Returns the sparse stream, or NULL on error.
+ */
+struct sparse_stream *sparse_stream_new(unsigned int block_size, int64_t len,
+		unsigned int chunks, bool crc,
+		int (*write)(void *priv, const void *data, int len), void *priv);
+
+/**
+ * sparse_stream_add_data - add a data chunk to a sparse stream
+ * @st - sparse stream
+ * @data - pointer to data block
+ * @len - length of the data block
+ * @block - offset in blocks into the sparse file to place the data chunk
+ * As sparse_file_add_data, except that block must not be before the end of
+ * what was added last, and the data is copied or written before returning.
+ * Returns 0 on success, negative errno on error.
+ */
+int sparse_stream_add_data(struct sparse_stream *st,
+		const void *data, unsigned int len, unsigned int block);
+
+/**
+ * sparse_stream_add_fill - add a fill chunk to a sparse stream
+ * @st - sparse stream
+ * @fill_val - 32 bit fill data
+ * @len - length of the fill block
+ * @block - offset in blocks into the sparse file to place the fill chunk
+ * As sparse_file_add_fill, except that block must not be before the end of
+ * what was added last.
+ * Returns 0 on success, negative errno on error.
+ */
+int sparse_stream_add_fill(struct sparse_stream *st,
+		uint32_t fill_val, unsigned int len, unsigned int block);
+
+/**
+ * sparse_stream_add_fd - add part of a normal file to a sparse stream
+ * @st - sparse stream
+ * @fd - file descriptor to read from
+ * @len - number of bytes to read
+ * @block - offset in blocks into the sparse file to place the data
+ * Reads len bytes from the current position of fd and adds them to the
+ * sparse stream, as fill chunks where whole blocks are one 32 bit value and
+ * as data chunks elsewhere, the same as sparse_file_read does.
+ * Returns 0 on success, negative errno on error.
+ */
+int sparse_stream_add_fd(struct sparse_stream *st,
+		int fd, int64_t len, unsigned int block);
+
+/**
+ * sparse_stream_chunks - number of chunks in a sparse stream
+ * @st - sparse stream
+ * Returns the number of chunks the sparse file would have if the stream were
+ * closed now, not counting a crc chunk, as passed to sparse_stream_new.
+ */
+unsigned int sparse_stream_chunks(struct sparse_stream *st);
+
+/**
+ * sparse_stream_len - length of a sparse stream
+ * @st - sparse stream
+ * Returns the number of bytes the sparse file would be if the stream were
+ * closed now.
+ */
+int64_t sparse_stream_len(struct sparse_stream *st);
+
+/**
+ * sparse_stream_close - finish writing a sparse stream
+ * @st - sparse stream
+ * Writes what is left of the sparse file, a don't care chunk up to its
+ * length and a crc chunk if asked for, and frees the stream.
+ * Returns 0 on success, negative errno if anything failed to be written.
+ */
+int sparse_stream_close(struct sparse_stream *st);
+
 /**
  * sparse_file_verbose - set a sparse file cookie to print verbose errors
  *
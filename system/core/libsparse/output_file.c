@@ -38,6 +38,7 @@
 #include "output_file.h"
 #include "sparse_crc32.h"
 #include "sparse_format.h"
+#include "sparse_parallel.h"
 
 #ifndef USE_MINGW
 #include <sys/mman.h>
@@ -433,7 +434,7 @@ static int write_sparse_data_chunk(struct output_file *out, unsigned int len,
 	}
 
 	if (out->use_crc) {
-		out->crc32 = sparse_crc32(out->crc32, data, len);
+		out->crc32 = sparse_parallel_crc32(out->crc32, data, len);
 		if (zero_len)
 			out->crc32 = sparse_crc32(out->crc32, out->zero_buf, zero_len);
 	}
@@ -720,6 +721,22 @@ int write_fill_chunk(struct output_file *out, unsigned int len,
     }
 }
 
+/* How many bytes write_data_chunk() writes to a sparse file */
+int64_t data_chunk_len(struct output_file *out, unsigned int len)
+{
+	return CHUNK_HEADER_LEN + ALIGN((int64_t)len, out->block_size);
+}
+
+/* How many bytes write_fill_chunk() writes to a sparse file */
+int64_t fill_chunk_len(struct output_file *out, unsigned int len,
+		uint32_t fill_val)
+{
+	if (fill_val == 0) {
+		return CHUNK_HEADER_LEN;
+	}
+	return data_chunk_len(out, len);
+}
+
 int write_fd_chunk(struct output_file *out, unsigned int len,
 		int fd, int64_t offset)
 {
@@ -34,6 +34,9 @@ int write_file_chunk(struct output_file *out, unsigned int len,
 int write_fd_chunk(struct output_file *out, unsigned int len,
 		int fd, int64_t offset);
 int write_skip_chunk(struct output_file *out, int64_t len);
+int64_t data_chunk_len(struct output_file *out, unsigned int len);
+int64_t fill_chunk_len(struct output_file *out, unsigned int len,
+		uint32_t fill_val);
 void output_file_close(struct output_file *out);
 
 int read_all(int fd, void *buf, size_t len);
@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE64_SOURCE 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#ifndef USE_MINGW
+#include <pthread.h>
+#endif
+
+#include "sparse_crc32.h"
+#include "sparse_defs.h"
+#include "sparse_parallel.h"
+
+#define MAX_THREADS 8
+
+/* Anything smaller is not worth a thread of its own */
+#define CRC_PIECE_MIN (512U*1024U)
+#define FILL_SCAN_TASK_BLOCKS 64
+
+#define min(a, b) \
+	({ typeof(a) _a = (a); typeof(b) _b = (b); (_a < _b) ? _a : _b; })
+
+#define max(a, b) \
+	({ typeof(a) _a = (a); typeof(b) _b = (b); (_a > _b) ? _a : _b; })
+
+struct parallel_job {
+	unsigned int count;
+	unsigned int next;
+	void (*fn)(void *arg, unsigned int i);
+	void *arg;
+};
+
+static void *parallel_worker(void *priv)
+{
+	struct parallel_job *job = priv;
+	unsigned int i;
+
+	while ((i = __sync_fetch_and_add(&job->next, 1)) < job->count) {
+		job->fn(job->arg, i);
+	}
+
+	return NULL;
+}
+
+static unsigned int thread_count(void)
+{
+#ifdef USE_MINGW
+	return 1;
+#else
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (cpus < 1) {
+		return 1;
+	}
+	return min(cpus, MAX_THREADS);
+#endif
+}
+
+void sparse_parallel_for(unsigned int count,
+		void (*fn)(void *arg, unsigned int i), void *arg)
+{
+	struct parallel_job job = {
+		.count = count,
+		.next = 0,
+		.fn = fn,
+		.arg = arg,
+	};
+#ifndef USE_MINGW
+	pthread_t threads[MAX_THREADS];
+	unsigned int wanted = min(thread_count(), count);
+	unsigned int started;
+
+	/* The calling thread is one of them */
+	for (started = 0; started + 1 < wanted; started++) {
+		/* If we can't have more, the ones we have do the rest */
+		if (pthread_create(&threads[started], NULL, parallel_worker, &job)) {
+			break;
+		}
+	}
+#endif
+
+	parallel_worker(&job);
+
+#ifndef USE_MINGW
+	while (started--) {
+		pthread_join(threads[started], NULL);
+	}
+#endif
+}
+
+struct crc_job {
+	const uint8_t *buf;
+	size_t size;
+	size_t piece;
+	uint32_t crcs[MAX_THREADS];
+};
+
+static void crc_piece(void *arg, unsigned int i)
+{
+	struct crc_job *job = arg;
+	size_t offset = i * job->piece;
+
+	job->crcs[i] = sparse_crc32(0, job->buf + offset,
+			min(job->piece, job->size - offset));
+}
+
+uint32_t sparse_parallel_crc32(uint32_t crc, const void *buf, size_t size)
+{
+	struct crc_job job;
+	unsigned int threads = thread_count();
+	unsigned int pieces;
+	unsigned int i;
+
+	if (threads == 1 || size < 2 * CRC_PIECE_MIN) {
+		return sparse_crc32(crc, buf, size);
+	}
+
+	job.buf = buf;
+	job.size = size;
+	job.piece = max(DIV_ROUND_UP(size, threads), (size_t)CRC_PIECE_MIN);
+	pieces = DIV_ROUND_UP(size, job.piece);
+	sparse_parallel_for(pieces, crc_piece, &job);
+
+	/* What sparse_crc32() would have made of them one after another */
+	for (i = 0; i < pieces; i++) {
+		crc = crc32_combine(crc, job.crcs[i],
+				min(job.piece, size - i * job.piece));
+	}
+
+	return crc;
+}
+
+struct fill_scan {
+	const uint32_t *buf;
+	unsigned int block_size;
+	unsigned int blocks;
+	bool *is_fill;
+};
+
+static void fill_scan_task(void *arg, unsigned int task)
+{
+	struct fill_scan *scan = arg;
+	unsigned int words = scan->block_size / sizeof(uint32_t);
+	unsigned int block = task * FILL_SCAN_TASK_BLOCKS;
+	unsigned int end = min(block + FILL_SCAN_TASK_BLOCKS, scan->blocks);
+	const uint32_t *buf;
+
+	for (; block < end; block++) {
+		buf = scan->buf + block * words;
+		/* Equal to itself a word along only if every word is the same */
+		scan->is_fill[block] = memcmp(buf, buf + 1,
+				scan->block_size - sizeof(uint32_t)) == 0;
+	}
+}
+
+void sparse_find_fill_blocks(const uint32_t *buf, unsigned int block_size,
+		unsigned int blocks, bool *is_fill)
+{
+	struct fill_scan scan = {
+		.buf = buf,
+		.block_size = block_size,
+		.blocks = blocks,
+		.is_fill = is_fill,
+	};
+
+	sparse_parallel_for(DIV_ROUND_UP(blocks, FILL_SCAN_TASK_BLOCKS),
+			fill_scan_task, &scan);
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LIBSPARSE_SPARSE_PARALLEL_H_
+#define _LIBSPARSE_SPARSE_PARALLEL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Calls fn(arg, i) for every i below count, spread over one thread per
+ * online CPU, and returns once all of them have. The calls must not depend
+ * on each other. Runs them in order on the calling thread on Windows, or
+ * when there is only one CPU.
+ */
+void sparse_parallel_for(unsigned int count,
+		void (*fn)(void *arg, unsigned int i), void *arg);
+
+/*
+ * sparse_crc32() of a large buffer, computed a piece per thread and the
+ * pieces combined after.
+ */
+uint32_t sparse_parallel_crc32(uint32_t crc, const void *buf, size_t size);
+
+/*
+ * Sets is_fill[i] for each of the blocks at buf to whether it is one 32 bit
+ * value over and over, and so can be a fill chunk.
+ */
+void sparse_find_fill_blocks(const uint32_t *buf, unsigned int block_size,
+		unsigned int blocks, bool *is_fill);
+
+#endif
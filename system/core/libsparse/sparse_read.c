@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <zlib.h>
 
 #include <sparse/sparse.h>
 
@@ -35,6 +36,7 @@
 #include "sparse_crc32.h"
 #include "sparse_file.h"
 #include "sparse_format.h"
+#include "sparse_parallel.h"
 
 #if defined(__APPLE__) && defined(__MACH__)
 #define lseek64 lseek
@@ -48,6 +50,9 @@
 #define COPY_BUF_SIZE (1024U*1024U)
 static char *copybuf;
 
+/* How much of a normal file is read at once to look for fill blocks */
+#define READ_RANGE_SIZE (8U*1024U*1024U)
+
 #define min(a, b) \
 	({ typeof(a) _a = (a); typeof(b) _b = (b); (_a < _b) ? _a : _b; })
 
@@ -98,6 +103,32 @@ static void verbose_error(bool verbose, int err, const char *fmt, ...)
 	}
 }
 
+/*
+ * The CRC of len bytes of fill_val over and over. Every full copybuf of it
+ * has the same CRC, so that is worked out once and combined in as many
+ * times as it takes, rather than run over the same bytes again.
+ */
+static uint32_t crc32_fill(uint32_t crc, uint32_t fill_val, int64_t len)
+{
+	uint32_t *fillbuf = (uint32_t *)copybuf;
+	uint32_t copybuf_crc;
+	unsigned int i;
+
+	for (i = 0; i < (COPY_BUF_SIZE / sizeof(fill_val)); i++) {
+		fillbuf[i] = fill_val;
+	}
+
+	if (len >= COPY_BUF_SIZE) {
+		copybuf_crc = sparse_crc32(0, copybuf, COPY_BUF_SIZE);
+		while (len >= COPY_BUF_SIZE) {
+			crc = crc32_combine(crc, copybuf_crc, COPY_BUF_SIZE);
+			len -= COPY_BUF_SIZE;
+		}
+	}
+
+	return sparse_crc32(crc, copybuf, len);
+}
+
 static int process_raw_chunk(struct sparse_file *s, unsigned int chunk_size,
 		int fd, int64_t offset, unsigned int blocks, unsigned int block,
 		uint32_t *crc32)
@@ -126,7 +157,7 @@ static int process_raw_chunk(struct sparse_file *s, unsigned int chunk_size,
 			if (ret < 0) {
 				return ret;
 			}
-			*crc32 = sparse_crc32(*crc32, copybuf, chunk);
+			*crc32 = sparse_parallel_crc32(*crc32, copybuf, chunk);
 			len -= chunk;
 		}
 	} else {
@@ -140,11 +171,8 @@ static int process_fill_chunk(struct sparse_file *s, unsigned int chunk_size,
 		int fd, unsigned int blocks, unsigned int block, uint32_t *crc32)
 {
 	int ret;
-	int chunk;
 	int64_t len = (int64_t)blocks * s->block_size;
 	uint32_t fill_val;
-	uint32_t *fillbuf;
-	unsigned int i;
 
 	if (chunk_size != sizeof(fill_val)) {
 		return -EINVAL;
@@ -161,17 +189,7 @@ static int process_fill_chunk(struct sparse_file *s, unsigned int chunk_size,
 	}
 
 	if (crc32) {
-		/* Fill copy_buf with the fill value */
-		fillbuf = (uint32_t *)copybuf;
-		for (i = 0; i < (COPY_BUF_SIZE / sizeof(fill_val)); i++) {
-			fillbuf[i] = fill_val;
-		}
-
-		while (len) {
-			chunk = min(len, COPY_BUF_SIZE);
-			*crc32 = sparse_crc32(*crc32, copybuf, chunk);
-			len -= chunk;
-		}
+		*crc32 = crc32_fill(*crc32, fill_val, len);
 	}
 
 	return 0;
@@ -186,14 +204,7 @@ static int process_skip_chunk(struct sparse_file *s, unsigned int chunk_size,
 	}
 
 	if (crc32) {
-	        int64_t len = (int64_t)blocks * s->block_size;
-		memset(copybuf, 0, COPY_BUF_SIZE);
-
-		while (len) {
-			int chunk = min(len, COPY_BUF_SIZE);
-			*crc32 = sparse_crc32(*crc32, copybuf, chunk);
-			len -= chunk;
-		}
+		*crc32 = crc32_fill(*crc32, 0, (int64_t)blocks * s->block_size);
 	}
 
 	return 0;
@@ -357,52 +368,62 @@ static int sparse_file_read_sparse(struct sparse_file *s, int fd, bool crc)
 static int sparse_file_read_normal(struct sparse_file *s, int fd)
 {
 	int ret;
-	uint32_t *buf = malloc(s->block_size);
+	unsigned int range_blocks = READ_RANGE_SIZE / s->block_size;
+	uint32_t *buf;
+	bool *is_fill;
 	unsigned int block = 0;
 	int64_t remain = s->len;
 	int64_t offset = 0;
 	unsigned int to_read;
+	unsigned int len;
 	unsigned int i;
-	bool sparse_block;
 
-	if (!buf) {
+	if (range_blocks == 0) {
+		range_blocks = 1;
+	}
+
+	buf = malloc((size_t)range_blocks * s->block_size);
+	is_fill = malloc(range_blocks * sizeof(bool));
+	if (!buf || !is_fill) {
+		free(buf);
+		free(is_fill);
 		return -ENOMEM;
 	}
 
 	while (remain > 0) {
-		to_read = min(remain, s->block_size);
+		to_read = min(remain, (int64_t)range_blocks * s->block_size);
 		ret = read_all(fd, buf, to_read);
 		if (ret < 0) {
 			error("failed to read sparse file");
 			free(buf);
+			free(is_fill);
 			return ret;
 		}
 
-		if (to_read == s->block_size) {
-			sparse_block = true;
-			for (i = 1; i < s->block_size / sizeof(uint32_t); i++) {
-				if (buf[0] != buf[i]) {
-					sparse_block = false;
-					break;
-				}
+		/* Only whole blocks can be fill blocks */
+		sparse_find_fill_blocks(buf, s->block_size,
+				to_read / s->block_size, is_fill);
+
+		/* Then added in order, the same as one at a time */
+		for (i = 0; i * s->block_size < to_read; i++) {
+			len = min(to_read - i * s->block_size, s->block_size);
+			if (len == s->block_size && is_fill[i]) {
+				/* TODO: add flag to use skip instead of fill for buf[0] == 0 */
+				sparse_file_add_fill(s, buf[i * (s->block_size / sizeof(uint32_t))],
+						len, block);
+			} else {
+				sparse_file_add_fd(s, fd, offset, len, block);
 			}
-		} else {
-			sparse_block = false;
-		}
 
-		if (sparse_block) {
-			/* TODO: add flag to use skip instead of fill for buf[0] == 0 */
-			sparse_file_add_fill(s, buf[0], to_read, block);
-		} else {
-			sparse_file_add_fd(s, fd, offset, to_read, block);
+			offset += len;
+			block++;
 		}
 
 		remain -= to_read;
-		offset += to_read;
-		block++;
 	}
 
 	free(buf);
+	free(is_fill);
 	return 0;
 }
 
@@ -0,0 +1,378 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE64_SOURCE 1
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sparse/sparse.h>
+
+#include "defs.h"
+#include "output_file.h"
+#include "sparse_defs.h"
+#include "sparse_format.h"
+#include "sparse_parallel.h"
+
+/*
+ * The most data one chunk holds, which is what the stream has to keep
+ * until the chunk can be written, and how much of a file is read at once.
+ */
+#define STREAM_BUF_SIZE (4U*1024U*1024U)
+
+#define min(a, b) \
+	({ typeof(a) _a = (a); typeof(b) _b = (b); (_a < _b) ? _a : _b; })
+
+enum pending_type {
+	PENDING_NONE,
+	PENDING_DATA,
+	PENDING_FILL,
+};
+
+struct sparse_stream {
+	struct output_file *out;
+	unsigned int block_size;
+	int64_t len;
+	bool crc;
+	int (*write)(void *priv, const void *data, int len);
+	void *priv;
+	int error;
+
+	/* What has been written so far */
+	int64_t written;
+	unsigned int chunks;
+	/* The block after the last one added */
+	unsigned int next_block;
+
+	/* The chunk that ends at next_block, still to be written */
+	enum pending_type pending;
+	unsigned int pending_len;
+	uint32_t pending_fill;
+
+	unsigned int buf_size;
+	char *buf;
+	uint32_t *read_buf;
+	bool *is_fill;
+};
+
+static int stream_write(void *priv, const void *data, int len)
+{
+	struct sparse_stream *st = priv;
+	int ret;
+
+	if (st->write) {
+		ret = st->write(st->priv, data, len);
+		if (ret < 0) {
+			st->error = ret;
+			return ret;
+		}
+	}
+	st->written += len;
+
+	return 0;
+}
+
+struct sparse_stream *sparse_stream_new(unsigned int block_size, int64_t len,
+		unsigned int chunks, bool crc,
+		int (*write)(void *priv, const void *data, int len), void *priv)
+{
+	struct sparse_stream *st;
+
+	if (block_size == 0 || block_size % sizeof(uint32_t)) {
+		return NULL;
+	}
+
+	st = calloc(1, sizeof(struct sparse_stream));
+	if (!st) {
+		return NULL;
+	}
+
+	st->block_size = block_size;
+	st->len = len;
+	st->crc = crc;
+	st->write = write;
+	st->priv = priv;
+	st->buf_size = ALIGN_DOWN(STREAM_BUF_SIZE, block_size);
+	if (st->buf_size == 0) {
+		st->buf_size = block_size;
+	}
+
+	st->buf = malloc(st->buf_size);
+	if (!st->buf) {
+		goto err;
+	}
+
+	st->out = output_file_open_callback(stream_write, st, block_size, len,
+			false, true, chunks, crc);
+	if (!st->out || st->error) {
+		goto err;
+	}
+
+	return st;
+
+err:
+	if (st->out) {
+		output_file_close(st->out);
+	}
+	free(st->buf);
+	free(st);
+	return NULL;
+}
+
+static int stream_flush(struct sparse_stream *st)
+{
+	int ret;
+
+	switch (st->pending) {
+	case PENDING_DATA:
+		ret = write_data_chunk(st->out, st->pending_len, st->buf);
+		break;
+	case PENDING_FILL:
+		ret = write_fill_chunk(st->out, st->pending_len, st->pending_fill);
+		break;
+	default:
+		return 0;
+	}
+
+	if (ret < 0 || st->error) {
+		return st->error ? st->error : ret;
+	}
+
+	st->chunks++;
+	st->pending = PENDING_NONE;
+	st->pending_len = 0;
+
+	return 0;
+}
+
+/* Ends the pending chunk if what comes next is not at the end of it */
+static int stream_seek(struct sparse_stream *st, unsigned int block)
+{
+	int ret;
+
+	if (st->error) {
+		return st->error;
+	}
+
+	if (block < st->next_block) {
+		return -EINVAL;
+	}
+
+	if (block > st->next_block) {
+		ret = stream_flush(st);
+		if (ret < 0) {
+			return ret;
+		}
+		ret = write_skip_chunk(st->out,
+				(int64_t)(block - st->next_block) * st->block_size);
+		if (ret < 0 || st->error) {
+			return st->error ? st->error : ret;
+		}
+		st->chunks++;
+		st->next_block = block;
+	}
+
+	return 0;
+}
+
+int sparse_stream_add_data(struct sparse_stream *st,
+		const void *data, unsigned int len, unsigned int block)
+{
+	const char *ptr = data;
+	unsigned int to_copy;
+	int ret;
+
+	ret = stream_seek(st, block);
+	if (ret < 0) {
+		return ret;
+	}
+
+	while (len) {
+		/* A chunk that is not a whole number of blocks is finished */
+		if (st->pending != PENDING_DATA || st->pending_len == st->buf_size ||
+				st->pending_len % st->block_size) {
+			ret = stream_flush(st);
+			if (ret < 0) {
+				return ret;
+			}
+			st->pending = PENDING_DATA;
+		}
+
+		to_copy = min(len, st->buf_size - st->pending_len);
+		memcpy(st->buf + st->pending_len, ptr, to_copy);
+		st->pending_len += to_copy;
+		st->next_block += DIV_ROUND_UP(to_copy, st->block_size);
+		ptr += to_copy;
+		len -= to_copy;
+	}
+
+	return 0;
+}
+
+int sparse_stream_add_fill(struct sparse_stream *st,
+		uint32_t fill_val, unsigned int len, unsigned int block)
+{
+	unsigned int max_len;
+	unsigned int to_add;
+	int ret;
+
+	ret = stream_seek(st, block);
+	if (ret < 0) {
+		return ret;
+	}
+
+	/* write_fill_chunk() writes anything but zeroes out in full */
+	if (fill_val == 0) {
+		max_len = ALIGN_DOWN(UINT_MAX, st->block_size);
+	} else {
+		max_len = st->buf_size;
+	}
+
+	while (len) {
+		if (st->pending != PENDING_FILL || st->pending_fill != fill_val ||
+				st->pending_len == max_len ||
+				st->pending_len % st->block_size) {
+			ret = stream_flush(st);
+			if (ret < 0) {
+				return ret;
+			}
+			st->pending = PENDING_FILL;
+			st->pending_fill = fill_val;
+		}
+
+		to_add = min(len, max_len - st->pending_len);
+		st->pending_len += to_add;
+		st->next_block += DIV_ROUND_UP(to_add, st->block_size);
+		len -= to_add;
+	}
+
+	return 0;
+}
+
+int sparse_stream_add_fd(struct sparse_stream *st,
+		int fd, int64_t len, unsigned int block)
+{
+	unsigned int words = st->block_size / sizeof(uint32_t);
+	unsigned int to_read;
+	unsigned int blocks;
+	unsigned int i;
+	int ret;
+
+	if (!st->read_buf) {
+		st->read_buf = malloc(st->buf_size);
+		st->is_fill = malloc(st->buf_size / st->block_size * sizeof(bool));
+		if (!st->read_buf || !st->is_fill) {
+			return -ENOMEM;
+		}
+	}
+
+	while (len > 0) {
+		to_read = min(len, (int64_t)st->buf_size);
+		ret = read_all(fd, st->read_buf, to_read);
+		if (ret < 0) {
+			return ret;
+		}
+
+		/* Only whole blocks can be fill blocks */
+		blocks = to_read / st->block_size;
+		sparse_find_fill_blocks(st->read_buf, st->block_size, blocks,
+				st->is_fill);
+
+		for (i = 0; i * st->block_size < to_read; i++) {
+			unsigned int block_len = min(to_read - i * st->block_size,
+					st->block_size);
+			uint32_t *data = st->read_buf + i * words;
+
+			if (i < blocks && st->is_fill[i]) {
+				ret = sparse_stream_add_fill(st, data[0], block_len, block);
+			} else {
+				ret = sparse_stream_add_data(st, data, block_len, block);
+			}
+			if (ret < 0) {
+				return ret;
+			}
+			block++;
+		}
+
+		len -= to_read;
+	}
+
+	return 0;
+}
+
+static int64_t stream_pad_len(struct sparse_stream *st)
+{
+	return st->len - (int64_t)st->next_block * st->block_size;
+}
+
+unsigned int sparse_stream_chunks(struct sparse_stream *st)
+{
+	unsigned int chunks = st->chunks;
+
+	if (st->pending != PENDING_NONE) {
+		chunks++;
+	}
+	if (stream_pad_len(st) > 0) {
+		chunks++;
+	}
+
+	return chunks;
+}
+
+int64_t sparse_stream_len(struct sparse_stream *st)
+{
+	int64_t len = st->written;
+
+	if (st->pending == PENDING_DATA) {
+		len += data_chunk_len(st->out, st->pending_len);
+	} else if (st->pending == PENDING_FILL) {
+		len += fill_chunk_len(st->out, st->pending_len, st->pending_fill);
+	}
+	if (stream_pad_len(st) > 0) {
+		len += sizeof(chunk_header_t);
+	}
+	if (st->crc) {
+		len += sizeof(chunk_header_t) + sizeof(uint32_t);
+	}
+
+	return len;
+}
+
+int sparse_stream_close(struct sparse_stream *st)
+{
+	int ret;
+
+	ret = stream_flush(st);
+	if (ret == 0 && stream_pad_len(st) > 0) {
+		ret = write_skip_chunk(st->out, stream_pad_len(st));
+	}
+
+	output_file_close(st->out);
+	if (ret == 0 && st->error) {
+		ret = st->error;
+	}
+
+	free(st->buf);
+	free(st->read_buf);
+	free(st->is_fill);
+	free(st);
+
+	return ret < 0 ? ret : 0;
+}
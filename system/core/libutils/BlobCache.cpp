@@ -21,8 +21,11 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <vector>
+
 #include <utils/BlobCache.h>
 #include <utils/Errors.h>
+#include <utils/JenkinsHash.h>
 #include <utils/Log.h>
 
 #include <cutils/properties.h>
@@ -33,15 +36,17 @@ namespace android {
 static const uint32_t blobCacheMagic = ('_' << 24) + ('B' << 16) + ('b' << 8) + '$';
 
 // BlobCache::Header::mBlobCacheVersion value
-static const uint32_t blobCacheVersion = 3;
+static const uint32_t blobCacheVersion = 4;
 
 // BlobCache::Header::mDeviceVersion value
 static const uint32_t blobCacheDeviceVersion = 1;
 
-BlobCache::BlobCache(size_t maxKeySize, size_t maxValueSize, size_t maxTotalSize):
+BlobCache::BlobCache(size_t maxKeySize, size_t maxValueSize, size_t maxTotalSize,
+        EvictionPolicy policy):
         mMaxKeySize(maxKeySize),
         mMaxValueSize(maxValueSize),
         mMaxTotalSize(maxTotalSize),
+        mEvictionPolicy(policy),
         mTotalSize(0) {
     nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
 #ifdef _WIN32
@@ -80,15 +85,17 @@ void BlobCache::set(const void* key, size_t keySize, const void* value,
         return;
     }
 
-    sp<Blob> dummyKey(new Blob(key, keySize, false));
-    CacheEntry dummyEntry(dummyKey, NULL);
+    insert(key, keySize, value, valueSize, true);
+}
+
+void BlobCache::insert(const void* key, size_t keySize, const void* value,
+        size_t valueSize, bool copyData) {
+    KeyRef keyRef(key, keySize);
 
     while (true) {
-        ssize_t index = mCacheEntries.indexOf(dummyEntry);
-        if (index < 0) {
+        auto found = mIndex.find(keyRef);
+        if (found == mIndex.end()) {
             // Create a new cache entry.
-            sp<Blob> keyBlob(new Blob(key, keySize, true));
-            sp<Blob> valueBlob(new Blob(value, valueSize, true));
             size_t newTotalSize = mTotalSize + keySize + valueSize;
             if (mMaxTotalSize < newTotalSize) {
                 if (isCleanable()) {
@@ -103,15 +110,18 @@ void BlobCache::set(const void* key, size_t keySize, const void* value,
                     break;
                 }
             }
-            mCacheEntries.add(CacheEntry(keyBlob, valueBlob));
+            sp<Blob> keyBlob(new Blob(key, keySize, copyData));
+            sp<Blob> valueBlob(new Blob(value, valueSize, copyData));
+            mCacheEntries.push_back(CacheEntry(keyBlob, valueBlob));
+            keyRef.mData = keyBlob->getData();
+            mIndex.insert(std::make_pair(keyRef, --mCacheEntries.end()));
             mTotalSize = newTotalSize;
             ALOGV("set: created new cache entry with %zu byte key and %zu byte value",
                     keySize, valueSize);
         } else {
             // Update the existing cache entry.
-            sp<Blob> valueBlob(new Blob(value, valueSize, true));
-            sp<Blob> oldValueBlob(mCacheEntries[index].getValue());
-            size_t newTotalSize = mTotalSize + valueSize - oldValueBlob->getSize();
+            CacheEntryList::iterator entry = found->second;
+            size_t newTotalSize = mTotalSize + valueSize - entry->getValue()->getSize();
             if (mMaxTotalSize < newTotalSize) {
                 if (isCleanable()) {
                     // Clean the cache and try again.
@@ -124,7 +134,8 @@ void BlobCache::set(const void* key, size_t keySize, const void* value,
                     break;
                 }
             }
-            mCacheEntries.editItemAt(index).setValue(valueBlob);
+            entry->setValue(new Blob(value, valueSize, copyData));
+            mCacheEntries.splice(mCacheEntries.end(), mCacheEntries, entry);
             mTotalSize = newTotalSize;
             ALOGV("set: updated existing cache entry with %zu byte key and %zu byte "
                     "value", keySize, valueSize);
@@ -140,17 +151,17 @@ size_t BlobCache::get(const void* key, size_t keySize, void* value,
                 keySize, mMaxKeySize);
         return 0;
     }
-    sp<Blob> dummyKey(new Blob(key, keySize, false));
-    CacheEntry dummyEntry(dummyKey, NULL);
-    ssize_t index = mCacheEntries.indexOf(dummyEntry);
-    if (index < 0) {
+    auto found = mIndex.find(KeyRef(key, keySize));
+    if (found == mIndex.end()) {
         ALOGV("get: no cache entry found for key of size %zu", keySize);
         return 0;
     }
 
-    // The key was found. Return the value if the caller's buffer is large
-    // enough.
-    sp<Blob> valueBlob(mCacheEntries[index].getValue());
+    // The key was found, which makes it the most recently used entry. Return
+    // the value if the caller's buffer is large enough.
+    CacheEntryList::iterator entry = found->second;
+    mCacheEntries.splice(mCacheEntries.end(), mCacheEntries, entry);
+    const sp<Blob>& valueBlob(entry->getValue());
     size_t valueBlobSize = valueBlob->getSize();
     if (valueBlobSize <= valueSize) {
         ALOGV("get: copying %zu bytes to caller's buffer", valueBlobSize);
@@ -168,12 +179,9 @@ static inline size_t align4(size_t size) {
 
 size_t BlobCache::getFlattenedSize() const {
     size_t size = align4(sizeof(Header) + PROPERTY_VALUE_MAX);
-    for (size_t i = 0; i < mCacheEntries.size(); i++) {
-        const CacheEntry& e(mCacheEntries[i]);
-        sp<Blob> keyBlob = e.getKey();
-        sp<Blob> valueBlob = e.getValue();
-        size += align4(sizeof(EntryHeader) + keyBlob->getSize() +
-                       valueBlob->getSize());
+    for (const CacheEntry& e : mCacheEntries) {
+        size += align4(sizeof(EntryHeader) + e.getKey()->getSize() +
+                       e.getValue()->getSize());
     }
     return size;
 }
@@ -196,10 +204,9 @@ status_t BlobCache::flatten(void* buffer, size_t size) const {
     // Write cache entries
     uint8_t* byteBuffer = reinterpret_cast<uint8_t*>(buffer);
     off_t byteOffset = align4(sizeof(Header) + header->mBuildIdLength);
-    for (size_t i = 0; i < mCacheEntries.size(); i++) {
-        const CacheEntry& e(mCacheEntries[i]);
-        sp<Blob> keyBlob = e.getKey();
-        sp<Blob> valueBlob = e.getValue();
+    for (const CacheEntry& e : mCacheEntries) {
+        const sp<Blob>& keyBlob = e.getKey();
+        const sp<Blob>& valueBlob = e.getValue();
         size_t keySize = keyBlob->getSize();
         size_t valueSize = valueBlob->getSize();
 
@@ -231,8 +238,16 @@ status_t BlobCache::flatten(void* buffer, size_t size) const {
 }
 
 status_t BlobCache::unflatten(void const* buffer, size_t size) {
+    return unflattenEntries(buffer, size, true);
+}
+
+status_t BlobCache::unflattenInPlace(void const* buffer, size_t size) {
+    return unflattenEntries(buffer, size, false);
+}
+
+status_t BlobCache::unflattenEntries(void const* buffer, size_t size, bool copyData) {
     // All errors should result in the BlobCache being in an empty state.
-    mCacheEntries.clear();
+    clearEntries();
 
     // Read the cache header
     if (size < sizeof(Header)) {
@@ -260,7 +275,7 @@ status_t BlobCache::unflatten(void const* buffer, size_t size) {
     size_t numEntries = header->mNumEntries;
     for (size_t i = 0; i < numEntries; i++) {
         if (byteOffset + sizeof(EntryHeader) > size) {
-            mCacheEntries.clear();
+            clearEntries();
             ALOGE("unflatten: not enough room for cache entry headers");
             return BAD_VALUE;
         }
@@ -273,13 +288,18 @@ status_t BlobCache::unflatten(void const* buffer, size_t size) {
 
         size_t totalSize = align4(entrySize);
         if (byteOffset + totalSize > size) {
-            mCacheEntries.clear();
+            clearEntries();
             ALOGE("unflatten: not enough room for cache entry headers");
             return BAD_VALUE;
         }
 
         const uint8_t* data = eheader->mData;
-        set(data, keySize, data + keySize, valueSize);
+        if (copyData) {
+            set(data, keySize, data + keySize, valueSize);
+        } else if (keySize != 0 && valueSize != 0 && keySize <= mMaxKeySize &&
+                valueSize <= mMaxValueSize && keySize + valueSize <= mMaxTotalSize) {
+            insert(data, keySize, data + keySize, valueSize, false);
+        }
 
         byteOffset += totalSize;
     }
@@ -295,21 +315,47 @@ long int BlobCache::blob_random() {
 #endif
 }
 
+void BlobCache::removeEntry(CacheEntryList::iterator entry) {
+    const sp<Blob>& keyBlob = entry->getKey();
+    mIndex.erase(KeyRef(keyBlob->getData(), keyBlob->getSize()));
+    mTotalSize -= keyBlob->getSize() + entry->getValue()->getSize();
+    mCacheEntries.erase(entry);
+}
+
 void BlobCache::clean() {
+    if (mEvictionPolicy == EVICT_LRU) {
+        removeEntry(mCacheEntries.begin());
+        return;
+    }
+
     // Remove a random cache entry until the total cache size gets below half
     // the maximum total cache size.
+    std::vector<CacheEntryList::iterator> entries;
+    entries.reserve(mCacheEntries.size());
+    for (auto it = mCacheEntries.begin(); it != mCacheEntries.end(); ++it) {
+        entries.push_back(it);
+    }
     while (mTotalSize > mMaxTotalSize / 2) {
-        size_t i = size_t(blob_random() % (mCacheEntries.size()));
-        const CacheEntry& entry(mCacheEntries[i]);
-        mTotalSize -= entry.getKey()->getSize() + entry.getValue()->getSize();
-        mCacheEntries.removeAt(i);
+        size_t i = size_t(blob_random() % (entries.size()));
+        removeEntry(entries[i]);
+        entries[i] = entries.back();
+        entries.pop_back();
     }
 }
 
 bool BlobCache::isCleanable() const {
+    if (mEvictionPolicy == EVICT_LRU) {
+        return !mCacheEntries.empty();
+    }
     return mTotalSize > mMaxTotalSize / 2;
 }
 
+void BlobCache::clearEntries() {
+    mIndex.clear();
+    mCacheEntries.clear();
+    mTotalSize = 0;
+}
+
 BlobCache::Blob::Blob(const void* data, size_t size, bool copyData):
         mData(copyData ? malloc(size) : data),
         mSize(size),
@@ -325,14 +371,6 @@ BlobCache::Blob::~Blob() {
     }
 }
 
-bool BlobCache::Blob::operator<(const Blob& rhs) const {
-    if (mSize == rhs.mSize) {
-        return memcmp(mData, rhs.mData, mSize) < 0;
-    } else {
-        return mSize < rhs.mSize;
-    }
-}
-
 const void* BlobCache::Blob::getData() const {
     return mData;
 }
@@ -354,21 +392,17 @@ BlobCache::CacheEntry::CacheEntry(const CacheEntry& ce):
         mValue(ce.mValue) {
 }
 
-bool BlobCache::CacheEntry::operator<(const CacheEntry& rhs) const {
-    return *mKey < *rhs.mKey;
-}
-
 const BlobCache::CacheEntry& BlobCache::CacheEntry::operator=(const CacheEntry& rhs) {
     mKey = rhs.mKey;
     mValue = rhs.mValue;
     return *this;
 }
 
-sp<BlobCache::Blob> BlobCache::CacheEntry::getKey() const {
+const sp<BlobCache::Blob>& BlobCache::CacheEntry::getKey() const {
     return mKey;
 }
 
-sp<BlobCache::Blob> BlobCache::CacheEntry::getValue() const {
+const sp<BlobCache::Blob>& BlobCache::CacheEntry::getValue() const {
     return mValue;
 }
 
@@ -376,4 +410,15 @@ void BlobCache::CacheEntry::setValue(const sp<Blob>& value) {
     mValue = value;
 }
 
+BlobCache::KeyRef::KeyRef(const void* data, size_t size):
+        mData(data),
+        mSize(size),
+        mHash(JenkinsHashWhiten(JenkinsHashMixBytes(0,
+                reinterpret_cast<const uint8_t*>(data), size))) {
+}
+
+bool BlobCache::KeyRef::operator==(const KeyRef& rhs) const {
+    return mSize == rhs.mSize && memcmp(mData, rhs.mData, mSize) == 0;
+}
+
 } // namespace android
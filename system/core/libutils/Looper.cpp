@@ -23,8 +23,11 @@
 #include <inttypes.h>
 #include <string.h>
 #include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 
 namespace android {
 
@@ -64,26 +67,36 @@ int SimpleLooperCallback::handleEvent(int fd, int events, void* data) {
 // Hint for number of file descriptors to be associated with the epoll instance.
 static const int EPOLL_SIZE_HINT = 8;
 
-// Maximum number of file descriptors for which to retrieve poll events each iteration.
-static const int EPOLL_MAX_EVENTS = 16;
+// The clock systemTime(SYSTEM_TIME_MONOTONIC) reads, which message times are in.
+#if defined(__ANDROID__)
+static const clockid_t MESSAGE_TIMER_CLOCK = CLOCK_MONOTONIC;
+#else
+static const clockid_t MESSAGE_TIMER_CLOCK = CLOCK_REALTIME;
+#endif
 
 static pthread_once_t gTLSOnce = PTHREAD_ONCE_INIT;
 static pthread_key_t gTLSKey = 0;
 
 Looper::Looper(bool allowNonCallbacks) :
-        mAllowNonCallbacks(allowNonCallbacks), mSendingMessage(false),
-        mPolling(false), mEpollFd(-1), mEpollRebuildRequired(false),
-        mNextRequestSeq(0), mResponseIndex(0), mNextMessageUptime(LLONG_MAX) {
+        mAllowNonCallbacks(allowNonCallbacks), mNextMessageSeq(0), mSendingMessage(false),
+        mTimerUptime(LLONG_MAX), mPolling(false), mEpollFd(-1), mEpollRebuildRequired(false),
+        mNextRequestSeq(0), mResponseCount(0), mResponseIndex(0) {
     mWakeEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
     LOG_ALWAYS_FATAL_IF(mWakeEventFd < 0, "Could not make wake event fd: %s",
                         strerror(errno));
 
+    // Goes off when the earliest pending message is due.
+    mTimerFd = timerfd_create(MESSAGE_TIMER_CLOCK, TFD_NONBLOCK | TFD_CLOEXEC);
+    LOG_ALWAYS_FATAL_IF(mTimerFd < 0, "Could not make message timer fd: %s",
+                        strerror(errno));
+
     AutoMutex _l(mLock);
     rebuildEpollLocked();
 }
 
 Looper::~Looper() {
     close(mWakeEventFd);
+    close(mTimerFd);
     if (mEpollFd >= 0) {
         close(mEpollFd);
     }
@@ -161,6 +174,11 @@ void Looper::rebuildEpollLocked() {
     LOG_ALWAYS_FATAL_IF(result != 0, "Could not add wake event fd to epoll instance: %s",
                         strerror(errno));
 
+    eventItem.data.fd = mTimerFd;
+    result = epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mTimerFd, & eventItem);
+    LOG_ALWAYS_FATAL_IF(result != 0, "Could not add message timer fd to epoll instance: %s",
+                        strerror(errno));
+
     for (size_t i = 0; i < mRequests.size(); i++) {
         const Request& request = mRequests.valueAt(i);
         struct epoll_event eventItem;
@@ -187,8 +205,8 @@ void Looper::scheduleEpollRebuildLocked() {
 int Looper::pollOnce(int timeoutMillis, int* outFd, int* outEvents, void** outData) {
     int result = 0;
     for (;;) {
-        while (mResponseIndex < mResponses.size()) {
-            const Response& response = mResponses.itemAt(mResponseIndex++);
+        while (mResponseIndex < mResponseCount) {
+            const Response& response = mResponses[mResponseIndex++];
             int ident = response.request.ident;
             if (ident >= 0) {
                 int fd = response.request.fd;
@@ -225,23 +243,12 @@ int Looper::pollInner(int timeoutMillis) {
     ALOGD("%p ~ pollOnce - waiting: timeoutMillis=%d", this, timeoutMillis);
 #endif
 
-    // Adjust the timeout based on when the next message is due.
-    if (timeoutMillis != 0 && mNextMessageUptime != LLONG_MAX) {
-        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
-        int messageTimeoutMillis = toMillisecondTimeoutDelay(now, mNextMessageUptime);
-        if (messageTimeoutMillis >= 0
-                && (timeoutMillis < 0 || messageTimeoutMillis < timeoutMillis)) {
-            timeoutMillis = messageTimeoutMillis;
-        }
-#if DEBUG_POLL_AND_WAKE
-        ALOGD("%p ~ pollOnce - next message in %" PRId64 "ns, adjusted timeout: timeoutMillis=%d",
-                this, mNextMessageUptime - now, timeoutMillis);
-#endif
-    }
+    // There is no need to shorten the timeout for the next message: mTimerFd goes off
+    // when it is due.
 
     // Poll.
     int result = POLL_WAKE;
-    mResponses.clear();
+    mResponseCount = 0;
     mResponseIndex = 0;
 
     // We are about to idle.
@@ -296,6 +303,12 @@ int Looper::pollInner(int timeoutMillis) {
             } else {
                 ALOGW("Ignoring unexpected epoll events 0x%x on wake event fd.", epollEvents);
             }
+        } else if (fd == mTimerFd) {
+            // A message is due.  The timer is disarmed now that it has gone off;
+            // it is set again for the next one below.
+            uint64_t expirations;
+            TEMP_FAILURE_RETRY(read(mTimerFd, &expirations, sizeof(uint64_t)));
+            mTimerUptime = LLONG_MAX;
         } else {
             ssize_t requestIndex = mRequests.indexOfKey(fd);
             if (requestIndex >= 0) {
@@ -314,10 +327,9 @@ int Looper::pollInner(int timeoutMillis) {
 Done: ;
 
     // Invoke pending message callbacks.
-    mNextMessageUptime = LLONG_MAX;
-    while (mMessageEnvelopes.size() != 0) {
+    while (!mMessageEnvelopes.empty()) {
         nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
-        const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(0);
+        const MessageEnvelope& messageEnvelope = mMessageEnvelopes.front();
         if (messageEnvelope.uptime <= now) {
             // Remove the envelope from the list.
             // We keep a strong reference to the handler until the call to handleMessage
@@ -326,7 +338,8 @@ Done: ;
             { // obtain handler
                 sp<MessageHandler> handler = messageEnvelope.handler;
                 Message message = messageEnvelope.message;
-                mMessageEnvelopes.removeAt(0);
+                std::pop_heap(mMessageEnvelopes.begin(), mMessageEnvelopes.end());
+                mMessageEnvelopes.pop_back();
                 mSendingMessage = true;
                 mLock.unlock();
 
@@ -341,18 +354,19 @@ Done: ;
             mSendingMessage = false;
             result = POLL_CALLBACK;
         } else {
-            // The last message left at the head of the queue determines the next wakeup time.
-            mNextMessageUptime = messageEnvelope.uptime;
             break;
         }
     }
 
+    // The message left at the head of the queue determines the next wakeup time.
+    setTimerLocked(mMessageEnvelopes.empty() ? LLONG_MAX : mMessageEnvelopes.front().uptime);
+
     // Release lock.
     mLock.unlock();
 
     // Invoke all response callbacks.
-    for (size_t i = 0; i < mResponses.size(); i++) {
-        Response& response = mResponses.editItemAt(i);
+    for (size_t i = 0; i < mResponseCount; i++) {
+        Response& response = mResponses[i];
         if (response.request.ident == POLL_CALLBACK) {
             int fd = response.request.fd;
             int events = response.events;
@@ -428,10 +442,9 @@ void Looper::awoken() {
 }
 
 void Looper::pushResponse(int events, const Request& request) {
-    Response response;
+    Response& response = mResponses[mResponseCount++];
     response.events = events;
     response.request = request;
-    mResponses.push(response);
 }
 
 int Looper::addFd(int fd, int ident, int events, Looper_callbackFunc callback, void* data) {
@@ -596,38 +609,75 @@ void Looper::sendMessageDelayed(nsecs_t uptimeDelay, const sp<MessageHandler>& h
 
 void Looper::sendMessageAtTime(nsecs_t uptime, const sp<MessageHandler>& handler,
         const Message& message) {
+    sendMessagesAtTime(uptime, handler, &message, 1);
+}
+
+void Looper::sendMessages(const sp<MessageHandler>& handler, const Message* messages,
+        size_t count) {
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    sendMessagesAtTime(now, handler, messages, count);
+}
+
+void Looper::sendMessagesAtTime(nsecs_t uptime, const sp<MessageHandler>& handler,
+        const Message* messages, size_t count) {
 #if DEBUG_CALLBACKS
-    ALOGD("%p ~ sendMessageAtTime - uptime=%" PRId64 ", handler=%p, what=%d",
-            this, uptime, handler.get(), message.what);
+    ALOGD("%p ~ sendMessagesAtTime - uptime=%" PRId64 ", handler=%p, count=%zu",
+            this, uptime, handler.get(), count);
 #endif
 
-    size_t i = 0;
     { // acquire lock
         AutoMutex _l(mLock);
 
-        size_t messageCount = mMessageEnvelopes.size();
-        while (i < messageCount && uptime >= mMessageEnvelopes.itemAt(i).uptime) {
-            i += 1;
-        }
-
-        MessageEnvelope messageEnvelope(uptime, handler, message);
-        mMessageEnvelopes.insertAt(messageEnvelope, i, 1);
+        bool atHead = mMessageEnvelopes.empty() || uptime < mMessageEnvelopes.front().uptime;
+        enqueueMessagesLocked(uptime, handler, messages, count);
 
         // Optimization: If the Looper is currently sending a message, then we can skip
         // the call to wake() because the next thing the Looper will do after processing
         // messages is to decide when the next wakeup time should be.  In fact, it does
         // not even matter whether this code is running on the Looper thread.
-        if (mSendingMessage) {
+        if (mSendingMessage || !atHead) {
             return;
         }
+
+        // Messages already due are dispatched by the wake alone, the timer is only
+        // needed for later ones.
+        if (uptime < mTimerUptime && uptime > systemTime(SYSTEM_TIME_MONOTONIC)) {
+            setTimerLocked(uptime);
+        }
     } // release lock
 
-    // Wake the poll loop only when we enqueue a new message at the head.
-    if (i == 0) {
-        wake();
+    // Wake the poll loop only when we enqueue new messages at the head.
+    wake();
+}
+
+void Looper::enqueueMessagesLocked(nsecs_t uptime, const sp<MessageHandler>& handler,
+        const Message* messages, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        mMessageEnvelopes.push_back(MessageEnvelope(uptime, mNextMessageSeq++, handler,
+                messages[i]));
+        std::push_heap(mMessageEnvelopes.begin(), mMessageEnvelopes.end());
     }
 }
 
+void Looper::setTimerLocked(nsecs_t uptime) {
+    if (uptime == mTimerUptime) {
+        return;
+    }
+
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec)); // all zero disarms the timer
+    if (uptime != LLONG_MAX) {
+        // An absolute time in the past goes off at once, except for zero.
+        nsecs_t when = uptime > 0 ? uptime : 1;
+        spec.it_value.tv_sec = when / 1000000000LL;
+        spec.it_value.tv_nsec = when % 1000000000LL;
+    }
+    if (timerfd_settime(mTimerFd, TFD_TIMER_ABSTIME, &spec, NULL) != 0) {
+        ALOGW("Could not set message timer: %s", strerror(errno));
+    }
+    mTimerUptime = uptime;
+}
+
 void Looper::removeMessages(const sp<MessageHandler>& handler) {
 #if DEBUG_CALLBACKS
     ALOGD("%p ~ removeMessages - handler=%p", this, handler.get());
@@ -636,12 +686,11 @@ void Looper::removeMessages(const sp<MessageHandler>& handler) {
     { // acquire lock
         AutoMutex _l(mLock);
 
-        for (size_t i = mMessageEnvelopes.size(); i != 0; ) {
-            const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(--i);
-            if (messageEnvelope.handler == handler) {
-                mMessageEnvelopes.removeAt(i);
-            }
-        }
+        mMessageEnvelopes.erase(std::remove_if(mMessageEnvelopes.begin(),
+                mMessageEnvelopes.end(), [&](const MessageEnvelope& messageEnvelope) {
+                    return messageEnvelope.handler == handler;
+                }), mMessageEnvelopes.end());
+        std::make_heap(mMessageEnvelopes.begin(), mMessageEnvelopes.end());
     } // release lock
 }
 
@@ -653,13 +702,12 @@ void Looper::removeMessages(const sp<MessageHandler>& handler, int what) {
     { // acquire lock
         AutoMutex _l(mLock);
 
-        for (size_t i = mMessageEnvelopes.size(); i != 0; ) {
-            const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(--i);
-            if (messageEnvelope.handler == handler
-                    && messageEnvelope.message.what == what) {
-                mMessageEnvelopes.removeAt(i);
-            }
-        }
+        mMessageEnvelopes.erase(std::remove_if(mMessageEnvelopes.begin(),
+                mMessageEnvelopes.end(), [&](const MessageEnvelope& messageEnvelope) {
+                    return messageEnvelope.handler == handler
+                            && messageEnvelope.message.what == what;
+                }), mMessageEnvelopes.end());
+        std::make_heap(mMessageEnvelopes.begin(), mMessageEnvelopes.end());
     } // release lock
 }
 
@@ -46,3 +46,14 @@ LOCAL_SRC_FILES := Vector_test.cpp
 LOCAL_STATIC_LIBRARIES := libutils liblog
 
 include $(BUILD_HOST_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := libutils_benchmarks
+LOCAL_SRC_FILES := Looper_benchmark.cpp
+LOCAL_SHARED_LIBRARIES := \
+    liblog \
+    libcutils \
+    libutils \
+
+include $(BUILD_NATIVE_BENCHMARK)
@@ -16,6 +16,7 @@
 
 #include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <gtest/gtest.h>
 
@@ -258,6 +259,46 @@ TEST_F(BlobCacheTest, ExceedingTotalLimitHalvesCacheSize) {
     ASSERT_EQ(maxEntries/2 + 1, numCached);
 }
 
+TEST_F(BlobCacheTest, LruEvictsLeastRecentlyUsedEntry) {
+    mBC = new BlobCache(MAX_KEY_SIZE, MAX_VALUE_SIZE, MAX_TOTAL_SIZE,
+            BlobCache::EVICT_LRU);
+    // Fill up the entire cache with 1 char key/value pairs.
+    const int maxEntries = MAX_TOTAL_SIZE / 2;
+    for (int i = 0; i < maxEntries; i++) {
+        uint8_t k = i;
+        mBC->set(&k, 1, "x", 1);
+    }
+    // Use the oldest entry, leaving the second one least recently used.
+    {
+        uint8_t k = 0;
+        ASSERT_EQ(size_t(1), mBC->get(&k, 1, NULL, 0));
+    }
+    // Insert one more entry, causing a cache overflow.
+    {
+        uint8_t k = maxEntries;
+        mBC->set(&k, 1, "x", 1);
+    }
+    // Only the least recently used entry should be gone.
+    for (int i = 0; i < maxEntries+1; i++) {
+        uint8_t k = i;
+        SCOPED_TRACE(i);
+        ASSERT_EQ(size_t(i == 1 ? 0 : 1), mBC->get(&k, 1, NULL, 0));
+    }
+}
+
+TEST_F(BlobCacheTest, LruUpdateMakesEntryMostRecentlyUsed) {
+    mBC = new BlobCache(MAX_KEY_SIZE, MAX_VALUE_SIZE, MAX_TOTAL_SIZE,
+            BlobCache::EVICT_LRU);
+    mBC->set("ab", 2, "cd", 2);
+    mBC->set("ef", 2, "gh", 2);
+    mBC->set("ab", 2, "ij", 2);
+    // 7 more bytes than the 8 cached do not fit, evicting "ef" only.
+    mBC->set("kl", 2, "mnopq", 5);
+    ASSERT_EQ(size_t(2), mBC->get("ab", 2, NULL, 0));
+    ASSERT_EQ(size_t(0), mBC->get("ef", 2, NULL, 0));
+    ASSERT_EQ(size_t(5), mBC->get("kl", 2, NULL, 0));
+}
+
 class BlobCacheFlattenTest : public BlobCacheTest {
 protected:
     virtual void SetUp() {
@@ -333,6 +374,65 @@ TEST_F(BlobCacheFlattenTest, FlattenDoesntChangeCache) {
     }
 }
 
+TEST_F(BlobCacheFlattenTest, UnflattenInPlaceUsesBuffer) {
+    unsigned char buf[4] = { 0xee, 0xee, 0xee, 0xee };
+    mBC->set("abcd", 4, "efgh", 4);
+    mBC->set("ij", 2, "kl", 2);
+
+    size_t size = mBC->getFlattenedSize();
+    uint8_t* flat = new uint8_t[size];
+    ASSERT_EQ(OK, mBC->flatten(flat, size));
+    ASSERT_EQ(OK, mBC2->unflattenInPlace(flat, size));
+
+    ASSERT_EQ(size_t(4), mBC2->get("abcd", 4, buf, 4));
+    ASSERT_EQ(0, memcmp(buf, "efgh", 4));
+
+    // The entries are read from the buffer rather than from copies.
+    uint8_t* value = static_cast<uint8_t*>(memmem(flat, size, "efgh", 4));
+    ASSERT_TRUE(value != NULL);
+    value[0] = 'z';
+    ASSERT_EQ(size_t(4), mBC2->get("abcd", 4, buf, 4));
+    ASSERT_EQ('z', buf[0]);
+
+    // Values set later are copied as usual.
+    mBC2->set("abcd", 4, "opqr", 4);
+    value[0] = 'e';
+    ASSERT_EQ(size_t(4), mBC2->get("abcd", 4, buf, 4));
+    ASSERT_EQ(0, memcmp(buf, "opqr", 4));
+
+    mBC2.clear();
+    delete[] flat;
+}
+
+TEST_F(BlobCacheFlattenTest, FlattenKeepsLruOrder) {
+    mBC = new BlobCache(MAX_KEY_SIZE, MAX_VALUE_SIZE, MAX_TOTAL_SIZE,
+            BlobCache::EVICT_LRU);
+    mBC2 = new BlobCache(MAX_KEY_SIZE, MAX_VALUE_SIZE, MAX_TOTAL_SIZE,
+            BlobCache::EVICT_LRU);
+    const int maxEntries = MAX_TOTAL_SIZE / 2;
+    for (int i = 0; i < maxEntries; i++) {
+        uint8_t k = i;
+        mBC->set(&k, 1, &k, 1);
+    }
+    {
+        uint8_t k = 0;
+        ASSERT_EQ(size_t(1), mBC->get(&k, 1, NULL, 0));
+    }
+
+    roundTrip();
+
+    // Entry 1 is still the least recently used one.
+    {
+        uint8_t k = maxEntries;
+        mBC2->set(&k, 1, &k, 1);
+    }
+    for (int i = 0; i < maxEntries+1; i++) {
+        uint8_t k = i;
+        SCOPED_TRACE(i);
+        ASSERT_EQ(size_t(i == 1 ? 0 : 1), mBC2->get(&k, 1, NULL, 0));
+    }
+}
+
 TEST_F(BlobCacheFlattenTest, FlattenCatchesBufferTooSmall) {
     // Fill up the entire cache with 1 char key/value pairs.
     const int maxEntries = MAX_TOTAL_SIZE / 2;
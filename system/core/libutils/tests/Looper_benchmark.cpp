@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include <benchmark/benchmark_api.h>
+#include <utils/Looper.h>
+#include <utils/Timers.h>
+
+using namespace android;
+
+class CountingMessageHandler : public MessageHandler {
+public:
+    size_t count = 0;
+
+    virtual void handleMessage(const Message&) {
+        count += 1;
+    }
+};
+
+// Leaves the byte in the pipe, so the fd is ready again on the next poll
+class CountingCallback : public LooperCallback {
+public:
+    size_t count = 0;
+
+    virtual int handleEvent(int, int, void*) {
+        count += 1;
+        return 1;
+    }
+};
+
+// Sends a batch of messages one at a time, then dispatches them all
+static void BM_SendMessage(benchmark::State& state) {
+    sp<Looper> looper = new Looper(true);
+    sp<CountingMessageHandler> handler = new CountingMessageHandler();
+    const size_t batch = state.range_x();
+
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < batch; i++) {
+            looper->sendMessage(handler, Message(i));
+        }
+        while (handler->count < batch) {
+            looper->pollOnce(0);
+        }
+        handler->count = 0;
+    }
+    state.SetItemsProcessed(state.iterations() * batch);
+}
+BENCHMARK(BM_SendMessage)->Arg(1)->Arg(64)->Arg(1024);
+
+// The same batch in one call
+static void BM_SendMessages(benchmark::State& state) {
+    sp<Looper> looper = new Looper(true);
+    sp<CountingMessageHandler> handler = new CountingMessageHandler();
+    const size_t batch = state.range_x();
+    std::vector<Message> messages;
+    for (size_t i = 0; i < batch; i++) {
+        messages.push_back(Message(i));
+    }
+
+    while (state.KeepRunning()) {
+        looper->sendMessages(handler, messages.data(), messages.size());
+        while (handler->count < batch) {
+            looper->pollOnce(0);
+        }
+        handler->count = 0;
+    }
+    state.SetItemsProcessed(state.iterations() * batch);
+}
+BENCHMARK(BM_SendMessages)->Arg(1)->Arg(64)->Arg(1024);
+
+// Timeouts scattered over the next few seconds, as a busy UI thread has
+// them: where each one goes in the queue is what costs
+static void BM_SendMessageAtTime(benchmark::State& state) {
+    sp<Looper> looper = new Looper(true);
+    sp<CountingMessageHandler> handler = new CountingMessageHandler();
+    const size_t pending = state.range_x();
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    srand(0);
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < pending; i++) {
+            looper->sendMessageAtTime(now + s2ns(10) + ms2ns(rand() % 5000), handler,
+                    Message(i));
+        }
+        state.PauseTiming();
+        looper->removeMessages(handler);
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * pending);
+}
+BENCHMARK(BM_SendMessageAtTime)->Arg(64)->Arg(1024)->Arg(8192);
+
+// Several fds ready at once, each dispatched to its callback
+static void BM_PollFdCallbacks(benchmark::State& state) {
+    sp<Looper> looper = new Looper(true);
+    sp<CountingCallback> callback = new CountingCallback();
+    const int fds = state.range_x();
+    std::vector<int> pipes;
+
+    for (int i = 0; i < fds; i++) {
+        int p[2];
+        if (pipe(p) || write(p[1], "x", 1) != 1) {
+            fprintf(stderr, "Unable to make a pipe\n");
+            exit(1);
+        }
+        looper->addFd(p[0], 0, Looper::EVENT_INPUT, callback, NULL);
+        pipes.push_back(p[0]);
+        pipes.push_back(p[1]);
+    }
+
+    while (state.KeepRunning()) {
+        looper->pollOnce(0);
+    }
+    state.SetItemsProcessed(callback->count);
+
+    for (int fd : pipes) {
+        close(fd);
+    }
+}
+BENCHMARK(BM_PollFdCallbacks)->Arg(1)->Arg(8)->Arg(16);
+
+BENCHMARK_MAIN()
@@ -25,10 +25,18 @@
 #include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <string>
+#include <utility>
 #include <vector>
+#if !defined(_WIN32)
+#include <thread>
+#endif
 
 #include "android-base/file.h"
 #include "android-base/macros.h"  // TEMP_FAILURE_RETRY may or may not be in unistd
@@ -473,30 +481,363 @@ int32_t OpenArchive(const char* fileName, ZipArchiveHandle* handle) {
 }
 
 /*
- * Close a ZipArchive, closing the file and freeing the contents.
+ * The index files of OpenArchiveWithIndex: an IndexHeader followed by the
+ * displacement of each bucket and then the central directory offset held
+ * by each slot of a perfect hash of the entry names, built by hash and
+ * displace. They are in host byte order, for the machine that wrote them.
  */
-void CloseArchive(ZipArchiveHandle handle) {
-  ZipArchive* archive = reinterpret_cast<ZipArchive*>(handle);
-  ALOGV("Closing archive %p", archive);
-  delete archive;
+struct IndexHeader {
+  uint32_t magic;
+  uint32_t version;
+
+  // The archive the index was built from. Unlike mtime, ctime can not be
+  // set back after the archive is modified.
+  uint64_t archive_size;
+  int64_t mtime_sec;
+  int64_t ctime_sec;
+  uint32_t mtime_nsec;
+  uint32_t ctime_nsec;
+  uint32_t directory_offset;
+  uint32_t directory_size;
+  uint32_t num_entries;
+
+  uint32_t num_buckets;
+  uint32_t num_slots;
+  // of the displacements and slots
+  uint32_t crc32;
+};
+
+static const uint32_t kIndexMagic = 0x5844495a;  // ZIDX
+static const uint32_t kIndexVersion = 1;
+static const uint32_t kIndexEmptySlot = UINT32_MAX;
+
+// Past that the names have to share a hash, there is no index for them
+static const uint32_t kIndexMaxDisplacement = 1 << 16;
+
+// FNV-1a, which the bucket and slot each mix further.
+static uint64_t ComputeIndexHash(const ZipString& name) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (uint16_t i = 0; i < name.name_length; ++i) {
+    hash = (hash ^ name.name[i]) * 0x100000001b3ULL;
+  }
+  return hash;
 }
 
-static int32_t UpdateEntryFromDataDescriptor(int fd,
-                                             ZipEntry *entry) {
-  uint8_t ddBuf[sizeof(DataDescriptor) + sizeof(DataDescriptor::kOptSignature)];
-  if (!android::base::ReadFully(fd, ddBuf, sizeof(ddBuf))) {
+static uint64_t MixIndexHash(uint64_t hash) {
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb53fe1a85ec3ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+static uint32_t IndexBucket(uint64_t hash, uint32_t num_buckets) {
+  return MixIndexHash(hash) % num_buckets;
+}
+
+static uint32_t IndexSlot(uint64_t hash, uint32_t displacement,
+                          uint32_t num_slots) {
+  return MixIndexHash(hash + (displacement + 1) * 0x9e3779b97f4a7c15ULL) % num_slots;
+}
+
+/*
+ * Find |entry_name| through the index, pointing |name| at its copy in the
+ * central directory.
+ */
+static int32_t IndexLookup(const ZipArchive* archive,
+                           const ZipString& entry_name, ZipString* name) {
+  const uint64_t hash = ComputeIndexHash(entry_name);
+  const uint32_t displacement =
+      archive->index_displacements[IndexBucket(hash, archive->index_num_buckets)];
+  const uint32_t offset =
+      archive->index_slots[IndexSlot(hash, displacement, archive->index_num_slots)];
+
+  // Any name lands on some slot, only the central directory can tell
+  // whether it is there.
+  const uint8_t* const cd_ptr =
+      reinterpret_cast<const uint8_t*>(archive->directory_map.getDataPtr());
+  const size_t cd_length = archive->directory_map.getDataLength();
+  if (offset == kIndexEmptySlot || offset >= cd_length ||
+      cd_length - offset < sizeof(CentralDirectoryRecord)) {
+    return kEntryNotFound;
+  }
+
+  const CentralDirectoryRecord* cdr =
+      reinterpret_cast<const CentralDirectoryRecord*>(cd_ptr + offset);
+  const uint8_t* file_name = cd_ptr + offset + sizeof(CentralDirectoryRecord);
+  if (cdr->record_signature != CentralDirectoryRecord::kSignature ||
+      cdr->file_name_length != entry_name.name_length ||
+      static_cast<size_t>(cd_ptr + cd_length - file_name) < entry_name.name_length ||
+      memcmp(file_name, entry_name.name, entry_name.name_length)) {
+    return kEntryNotFound;
+  }
+
+  name->name = file_name;
+  name->name_length = entry_name.name_length;
+  return 0;
+}
+
+/*
+ * With an index, the hash table is built by the first iteration.
+ */
+static int32_t BuildHashTable(ZipArchive* archive) {
+#if !defined(_WIN32)
+  std::lock_guard<std::mutex> lock(archive->hash_table_lock);
+  if (archive->hash_table == NULL) {
+    const int32_t result = ParseZipArchive(archive);
+    if (result) {
+      free(archive->hash_table);
+      archive->hash_table = NULL;
+      return result;
+    }
+  }
+#endif
+  return 0;
+}
+
+#if !defined(_WIN32)
+static void SetIndexKey(const ZipArchive* archive, const struct stat& st,
+                        IndexHeader* header) {
+  header->archive_size = st.st_size;
+#if defined(__APPLE__)
+  header->mtime_sec = st.st_mtimespec.tv_sec;
+  header->mtime_nsec = st.st_mtimespec.tv_nsec;
+  header->ctime_sec = st.st_ctimespec.tv_sec;
+  header->ctime_nsec = st.st_ctimespec.tv_nsec;
+#else
+  header->mtime_sec = st.st_mtim.tv_sec;
+  header->mtime_nsec = st.st_mtim.tv_nsec;
+  header->ctime_sec = st.st_ctim.tv_sec;
+  header->ctime_nsec = st.st_ctim.tv_nsec;
+#endif
+  header->directory_offset = archive->directory_offset;
+  header->directory_size = archive->directory_map.getDataLength();
+  header->num_entries = archive->num_entries;
+}
+
+static uint32_t ComputeIndexCrc(const uint32_t* displacements,
+                                uint32_t num_buckets, const uint32_t* slots,
+                                uint32_t num_slots) {
+  uLong crc = crc32(0L, Z_NULL, 0);
+  crc = crc32(crc, reinterpret_cast<const Bytef*>(displacements),
+              num_buckets * sizeof(uint32_t));
+  crc = crc32(crc, reinterpret_cast<const Bytef*>(slots),
+              num_slots * sizeof(uint32_t));
+  return crc;
+}
+
+/*
+ * Maps the index at |index_file_name| if it was built from this archive,
+ * with |st| its attributes from before the central directory was mapped.
+ */
+static bool MapIndex(ZipArchive* archive, const struct stat& st,
+                     const char* index_file_name) {
+  const int fd = open(index_file_name, O_RDONLY | O_BINARY | O_CLOEXEC);
+  if (fd == -1) {
+    return false;
+  }
+
+  IndexHeader header;
+  IndexHeader expected;
+  struct stat index_st;
+  bool valid = !fstat(fd, &index_st) &&
+      android::base::ReadFully(fd, &header, sizeof(header));
+  if (valid) {
+    SetIndexKey(archive, st, &expected);
+    valid = header.magic == kIndexMagic &&
+        header.version == kIndexVersion &&
+        header.archive_size == expected.archive_size &&
+        header.mtime_sec == expected.mtime_sec &&
+        header.mtime_nsec == expected.mtime_nsec &&
+        header.ctime_sec == expected.ctime_sec &&
+        header.ctime_nsec == expected.ctime_nsec &&
+        header.directory_offset == expected.directory_offset &&
+        header.directory_size == expected.directory_size &&
+        header.num_entries == expected.num_entries &&
+        header.num_buckets != 0 && header.num_slots != 0 &&
+        static_cast<uint64_t>(index_st.st_size) == sizeof(header) +
+            (static_cast<uint64_t>(header.num_buckets) + header.num_slots) * sizeof(uint32_t);
+  }
+  if (valid) {
+    valid = archive->index_map.create(index_file_name, fd, 0, index_st.st_size,
+                                      true /* read only */);
+  }
+  close(fd);
+  if (!valid) {
+    ALOGV("Zip: no usable index in %s", index_file_name);
+    return false;
+  }
+
+  const uint32_t* displacements = reinterpret_cast<const uint32_t*>(
+      reinterpret_cast<const uint8_t*>(archive->index_map.getDataPtr()) + sizeof(header));
+  const uint32_t* slots = displacements + header.num_buckets;
+  if (ComputeIndexCrc(displacements, header.num_buckets, slots,
+                      header.num_slots) != header.crc32) {
+    ALOGW("Zip: bad crc32 in index %s", index_file_name);
+    return false;
+  }
+
+  archive->index_num_buckets = header.num_buckets;
+  archive->index_num_slots = header.num_slots;
+  archive->index_displacements = displacements;
+  archive->index_slots = slots;
+  return true;
+}
+
+/*
+ * Builds the perfect hash from the hash table: buckets take the smallest
+ * displacement that moves all of their names to free slots, the largest
+ * buckets first, while most slots still are.
+ */
+static bool BuildIndex(const ZipArchive* archive,
+                       std::vector<uint32_t>* displacements,
+                       std::vector<uint32_t>* slots) {
+  const uint8_t* const cd_ptr =
+      reinterpret_cast<const uint8_t*>(archive->directory_map.getDataPtr());
+  const uint32_t num_buckets = archive->num_entries / 4 + 1;
+  const uint32_t num_slots = archive->num_entries + archive->num_entries / 4 + 1;
+
+  // hash and central directory offset of the names
+  std::vector<std::vector<std::pair<uint64_t, uint32_t>>> buckets(num_buckets);
+  for (uint32_t i = 0; i < archive->hash_table_size; ++i) {
+    const ZipString& name = archive->hash_table[i];
+    if (name.name != NULL) {
+      const uint64_t hash = ComputeIndexHash(name);
+      const uint32_t offset = name.name - sizeof(CentralDirectoryRecord) - cd_ptr;
+      buckets[IndexBucket(hash, num_buckets)].push_back(std::make_pair(hash, offset));
+    }
+  }
+
+  std::vector<uint32_t> order(num_buckets);
+  for (uint32_t i = 0; i < num_buckets; ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&buckets](uint32_t a, uint32_t b) {
+    return buckets[a].size() > buckets[b].size();
+  });
+
+  displacements->assign(num_buckets, 0);
+  slots->assign(num_slots, kIndexEmptySlot);
+  for (uint32_t b : order) {
+    const auto& bucket = buckets[b];
+    if (bucket.empty()) {
+      break;
+    }
+
+    uint32_t displacement = 0;
+    for (; displacement < kIndexMaxDisplacement; ++displacement) {
+      size_t placed = 0;
+      for (; placed < bucket.size(); ++placed) {
+        uint32_t& slot = (*slots)[IndexSlot(bucket[placed].first, displacement, num_slots)];
+        if (slot != kIndexEmptySlot) {
+          break;
+        }
+        slot = bucket[placed].second;
+      }
+      if (placed == bucket.size()) {
+        break;
+      }
+      while (placed--) {
+        (*slots)[IndexSlot(bucket[placed].first, displacement, num_slots)] = kIndexEmptySlot;
+      }
+    }
+    if (displacement == kIndexMaxDisplacement) {
+      return false;
+    }
+    (*displacements)[b] = displacement;
+  }
+
+  return true;
+}
+
+static void WriteIndex(const ZipArchive* archive, const struct stat& st,
+                       const char* index_file_name) {
+  std::vector<uint32_t> displacements;
+  std::vector<uint32_t> slots;
+  if (!BuildIndex(archive, &displacements, &slots)) {
+    ALOGW("Zip: unable to build index %s", index_file_name);
+    return;
+  }
+
+  IndexHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = kIndexMagic;
+  header.version = kIndexVersion;
+  SetIndexKey(archive, st, &header);
+  header.num_buckets = displacements.size();
+  header.num_slots = slots.size();
+  header.crc32 = ComputeIndexCrc(displacements.data(), header.num_buckets,
+                                 slots.data(), header.num_slots);
+
+  // Renamed into place once complete, other openers only ever see whole
+  // indexes. Readable by whoever can read the archive.
+  std::string temp_name(index_file_name);
+  temp_name += ".XXXXXX";
+  const int fd = mkstemp(&temp_name[0]);
+  if (fd == -1) {
+    ALOGW("Zip: unable to create %s: %s", temp_name.c_str(), strerror(errno));
+    return;
+  }
+  bool written = !fchmod(fd, (st.st_mode & 0444) | S_IWUSR) &&
+      android::base::WriteFully(fd, &header, sizeof(header)) &&
+      android::base::WriteFully(fd, displacements.data(),
+                                displacements.size() * sizeof(uint32_t)) &&
+      android::base::WriteFully(fd, slots.data(), slots.size() * sizeof(uint32_t));
+  written = !close(fd) && written;
+  if (!written || rename(temp_name.c_str(), index_file_name)) {
+    ALOGW("Zip: unable to write index %s: %s", index_file_name, strerror(errno));
+    unlink(temp_name.c_str());
+  }
+}
+#endif  // !defined(_WIN32)
+
+int32_t OpenArchiveWithIndex(const char* fileName, const char* indexFileName,
+                             ZipArchiveHandle* handle) {
+#if defined(_WIN32)
+  UNUSED(indexFileName);
+  return OpenArchive(fileName, handle);
+#else
+  const int fd = open(fileName, O_RDONLY | O_BINARY, 0);
+  ZipArchive* archive = new ZipArchive(fd, true);
+  *handle = archive;
+
+  if (fd < 0) {
+    ALOGW("Unable to open '%s': %s", fileName, strerror(errno));
     return kIoError;
   }
 
-  const uint32_t ddSignature = *(reinterpret_cast<const uint32_t*>(ddBuf));
-  const uint16_t offset = (ddSignature == DataDescriptor::kOptSignature) ? 4 : 0;
-  const DataDescriptor* descriptor = reinterpret_cast<const DataDescriptor*>(ddBuf + offset);
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    ALOGW("Zip: fstat on '%s' failed: %s", fileName, strerror(errno));
+    return kIoError;
+  }
 
-  entry->crc32 = descriptor->crc32;
-  entry->compressed_length = descriptor->compressed_size;
-  entry->uncompressed_length = descriptor->uncompressed_size;
+  int32_t result = MapCentralDirectory(fd, fileName, archive);
+  if (result) {
+    return result;
+  }
+
+  if (MapIndex(archive, st, indexFileName)) {
+    return 0;
+  }
+
+  if ((result = ParseZipArchive(archive))) {
+    return result;
+  }
 
+  WriteIndex(archive, st, indexFileName);
   return 0;
+#endif
+}
+
+/*
+ * Close a ZipArchive, closing the file and freeing the contents.
+ */
+void CloseArchive(ZipArchiveHandle handle) {
+  ZipArchive* archive = reinterpret_cast<ZipArchive*>(handle);
+  ALOGV("Closing archive %p", archive);
+  delete archive;
 }
 
 // Attempts to read |len| bytes into |buf| at offset |off|.
@@ -506,7 +847,16 @@ static int32_t UpdateEntryFromDataDescriptor(int fd,
 // On Windows platforms this is not thread-safe.
 static inline bool ReadAtOffset(int fd, uint8_t* buf, size_t len, off64_t off) {
 #if !defined(_WIN32)
-  return TEMP_FAILURE_RETRY(pread64(fd, buf, len, off));
+  while (len > 0) {
+    const ssize_t n = TEMP_FAILURE_RETRY(pread64(fd, buf, len, off));
+    if (n <= 0) {
+      return false;
+    }
+    buf += n;
+    len -= n;
+    off += n;
+  }
+  return true;
 #else
   if (lseek64(fd, off, SEEK_SET) != off) {
     ALOGW("Zip: failed seek to offset %" PRId64, off);
@@ -516,14 +866,35 @@ static inline bool ReadAtOffset(int fd, uint8_t* buf, size_t len, off64_t off) {
 #endif
 }
 
-static int32_t FindEntry(const ZipArchive* archive, const int ent,
+// Reads the data descriptor that follows the compressed data of |entry|.
+static int32_t UpdateEntryFromDataDescriptor(int fd,
+                                             ZipEntry *entry) {
+  uint8_t ddBuf[sizeof(DataDescriptor) + sizeof(DataDescriptor::kOptSignature)];
+  if (!ReadAtOffset(fd, ddBuf, sizeof(ddBuf),
+                    entry->offset + entry->compressed_length)) {
+    return kIoError;
+  }
+
+  const uint32_t ddSignature = *(reinterpret_cast<const uint32_t*>(ddBuf));
+  const uint16_t offset = (ddSignature == DataDescriptor::kOptSignature) ? 4 : 0;
+  const DataDescriptor* descriptor = reinterpret_cast<const DataDescriptor*>(ddBuf + offset);
+
+  entry->crc32 = descriptor->crc32;
+  entry->compressed_length = descriptor->compressed_size;
+  entry->uncompressed_length = descriptor->uncompressed_size;
+
+  return 0;
+}
+
+// |name| points into the central directory, at the name of the entry.
+static int32_t FindEntry(const ZipArchive* archive, const ZipString& name,
                          ZipEntry* data) {
-  const uint16_t nameLen = archive->hash_table[ent].name_length;
+  const uint16_t nameLen = name.name_length;
 
   // Recover the start of the central directory entry from the filename
   // pointer.  The filename is the first entry past the fixed-size data,
   // so we can just subtract back from that.
-  const uint8_t* ptr = archive->hash_table[ent].name;
+  const uint8_t* ptr = name.name;
   ptr -= sizeof(CentralDirectoryRecord);
 
   // This is the base of our mmapped region, we have to sanity check that
@@ -610,7 +981,7 @@ static int32_t FindEntry(const ZipArchive* archive, const int ent,
       return kIoError;
     }
 
-    if (memcmp(archive->hash_table[ent].name, name_buf, nameLen)) {
+    if (memcmp(name.name, name_buf, nameLen)) {
       free(name_buf);
       return kInconsistentInformation;
     }
@@ -687,11 +1058,17 @@ int32_t StartIteration(ZipArchiveHandle handle, void** cookie_ptr,
                        const ZipString* optional_suffix) {
   ZipArchive* archive = reinterpret_cast<ZipArchive*>(handle);
 
-  if (archive == NULL || archive->hash_table == NULL) {
+  if (archive == NULL ||
+      (archive->hash_table == NULL && archive->index_slots == NULL)) {
     ALOGW("Zip: Invalid ZipArchiveHandle");
     return kInvalidHandle;
   }
 
+  const int32_t result = BuildHashTable(archive);
+  if (result) {
+    return result;
+  }
+
   IterationHandle* cookie = new IterationHandle(optional_prefix, optional_suffix);
   cookie->position = 0;
   cookie->archive = archive;
@@ -712,6 +1089,16 @@ int32_t FindEntry(const ZipArchiveHandle handle, const ZipString& entryName,
     return kInvalidEntryName;
   }
 
+  if (archive->index_slots != NULL) {
+    ZipString name;
+    const int32_t result = IndexLookup(archive, entryName, &name);
+    if (result) {
+      ALOGV("Zip: Could not find entry %.*s", entryName.name_length, entryName.name);
+      return result;
+    }
+    return FindEntry(archive, name, data);
+  }
+
   const int64_t ent = EntryToIndex(archive->hash_table,
     archive->hash_table_size, entryName);
 
@@ -720,7 +1107,7 @@ int32_t FindEntry(const ZipArchiveHandle handle, const ZipString& entryName,
     return ent;
   }
 
-  return FindEntry(archive, ent, data);
+  return FindEntry(archive, archive->hash_table[ent], data);
 }
 
 int32_t Next(void* cookie, ZipEntry* data, ZipString* name) {
@@ -746,7 +1133,7 @@ int32_t Next(void* cookie, ZipEntry* data, ZipString* name) {
         (handle->suffix.name_length == 0 ||
          hash_table[i].EndsWith(handle->suffix))) {
       handle->position = (i + 1);
-      const int error = FindEntry(archive, i, data);
+      const int error = FindEntry(archive, hash_table[i], data);
       if (!error) {
         name->name = hash_table[i].name;
         name->name_length = hash_table[i].name_length;
@@ -930,16 +1317,18 @@ static int32_t InflateEntryToWriter(int fd, const ZipEntry* entry,
   const uint32_t uncompressed_length = entry->uncompressed_length;
 
   uint32_t compressed_length = entry->compressed_length;
+  off64_t offset = entry->offset;
   do {
     /* read as much as we can */
     if (zstream.avail_in == 0) {
       const size_t getSize = (compressed_length > kBufSize) ? kBufSize : compressed_length;
-      if (!android::base::ReadFully(fd, read_buf.data(), getSize)) {
+      if (!ReadAtOffset(fd, read_buf.data(), getSize, offset)) {
         ALOGW("Zip: inflate read failed, getSize = %zu: %s", getSize, strerror(errno));
         return kIoError;
       }
 
       compressed_length -= getSize;
+      offset += getSize;
 
       zstream.next_in = &read_buf[0];
       zstream.avail_in = getSize;
@@ -996,7 +1385,7 @@ static int32_t CopyEntryToWriter(int fd, const ZipEntry* entry, Writer* writer,
     // Safe conversion because kBufSize is narrow enough for a 32 bit signed
     // value.
     const size_t block_size = (remaining > kBufSize) ? kBufSize : remaining;
-    if (!android::base::ReadFully(fd, buf.data(), block_size)) {
+    if (!ReadAtOffset(fd, buf.data(), block_size, entry->offset + count)) {
       ALOGW("CopyFileToFile: copy read failed, block_size = %zu: %s", block_size, strerror(errno));
       return kIoError;
     }
@@ -1017,12 +1406,6 @@ int32_t ExtractToWriter(ZipArchiveHandle handle,
                         ZipEntry* entry, Writer* writer) {
   ZipArchive* archive = reinterpret_cast<ZipArchive*>(handle);
   const uint16_t method = entry->method;
-  off64_t data_offset = entry->offset;
-
-  if (lseek64(archive->fd, data_offset, SEEK_SET) != data_offset) {
-    ALOGW("Zip: lseek to data at %" PRId64 " failed", static_cast<int64_t>(data_offset));
-    return kIoError;
-  }
 
   // this should default to kUnknownCompressionMethod.
   int32_t return_value = -1;
@@ -1066,6 +1449,110 @@ int32_t ExtractEntryToFile(ZipArchiveHandle handle,
   return ExtractToWriter(handle, entry, writer.get());
 }
 
+// Threads used by ExtractEntries when the caller leaves it to us. Each one
+// holds two 32K buffers and an inflate window while it runs.
+static const long kMaxExtractThreads = 8;
+
+int32_t ExtractEntries(ZipArchiveHandle handle, const ZipString* names,
+                       size_t num_names, const ZipString* optional_prefix,
+                       ExtractEntryOpenFn open_fn, void* cookie,
+                       int num_threads) {
+  std::vector<std::pair<ZipString, ZipEntry>> work;
+
+  if (names != NULL) {
+    work.reserve(num_names);
+    for (size_t i = 0; i < num_names; ++i) {
+      ZipEntry entry;
+      const int32_t result = FindEntry(handle, names[i], &entry);
+      if (result) {
+        return result;
+      }
+      work.push_back(std::make_pair(names[i], entry));
+    }
+  } else {
+    void* iteration_cookie;
+    int32_t result = StartIteration(handle, &iteration_cookie, optional_prefix, NULL);
+    if (result) {
+      return result;
+    }
+    ZipString name;
+    ZipEntry entry;
+    while ((result = Next(iteration_cookie, &entry, &name)) == 0) {
+      if (name.name_length && (name.name[name.name_length - 1] == '/')) {
+        continue;
+      }
+      work.push_back(std::make_pair(name, entry));
+    }
+    EndIteration(iteration_cookie);
+    if (result != kIterationEnd) {
+      return result;
+    }
+  }
+
+  // Biggest first, so that no thread starts a large entry just as the
+  // others run out of work.
+  std::sort(work.begin(), work.end(),
+            [](const std::pair<ZipString, ZipEntry>& lhs,
+               const std::pair<ZipString, ZipEntry>& rhs) {
+    return lhs.second.uncompressed_length > rhs.second.uncompressed_length;
+  });
+
+  std::atomic<size_t> next(0);
+  std::atomic<int32_t> first_error(0);
+  auto worker = [&]() {
+    for (;;) {
+      if (first_error.load(std::memory_order_relaxed)) {
+        return;
+      }
+      const size_t i = next.fetch_add(1, std::memory_order_relaxed);
+      if (i >= work.size()) {
+        return;
+      }
+
+      // ExtractToWriter updates it from the data descriptor
+      ZipEntry entry = work[i].second;
+      int32_t result = kIoError;
+      const int fd = open_fn(work[i].first, entry, cookie);
+      if (fd >= 0) {
+        std::unique_ptr<Writer> writer(FileWriter::Create(fd, &entry));
+        if (writer.get() != nullptr) {
+          result = ExtractToWriter(handle, &entry, writer.get());
+        }
+        close(fd);
+      }
+      if (result) {
+        int32_t expected = 0;
+        first_error.compare_exchange_strong(expected, result);
+      }
+    }
+  };
+
+#if !defined(_WIN32)
+  size_t thread_count = num_threads;
+  if (num_threads <= 0) {
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    thread_count = std::min(kMaxExtractThreads, (cpus > 0) ? cpus : 1L);
+  }
+  thread_count = std::min(thread_count, work.size());
+
+  // The caller's thread is one of them
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < thread_count; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+#else
+  // ReadAtOffset seeks the shared fd here
+  UNUSED(num_threads);
+  worker();
+#endif
+
+  return first_error.load();
+}
+
 const char* ErrorCodeString(int32_t error_code) {
   if (error_code > kErrorMessageLowerBound && error_code < kErrorMessageUpperBound) {
     return kErrorMessages[error_code * -1];
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <android-base/stringprintf.h>
+#include <android-base/test_utils.h>
+#include <benchmark/benchmark_api.h>
+#include <ziparchive/zip_archive.h>
+#include <ziparchive/zip_writer.h>
+
+// Shaped like a large APK: native libraries under lib/, lots of small
+// resources besides.
+static const char kLibPrefix[] = "lib/arm64-v8a/";
+static const int kNumLibs = 64;
+static const size_t kLibSize = 1024 * 1024;
+static const int kNumResources = 2000;
+static const size_t kResourceSize = 2048;
+
+static TemporaryFile* apk;
+static TemporaryDir* out_dir;
+
+// Compresses about as well as code does
+static void FillContents(std::vector<uint8_t>* buf, unsigned seed) {
+  for (size_t i = 0; i < buf->size(); ++i) {
+    seed = seed * 1103515245 + 12345;
+    (*buf)[i] = ((seed >> 16) & 0x3) ? static_cast<uint8_t>(i >> 4)
+                                      : static_cast<uint8_t>(seed >> 24);
+  }
+}
+
+static bool WriteEntry(ZipWriter* writer, const std::string& name, size_t size,
+                       unsigned seed) {
+  std::vector<uint8_t> contents(size);
+  FillContents(&contents, seed);
+  return !writer->StartEntry(name.c_str(), ZipWriter::kCompress) &&
+         !writer->WriteBytes(contents.data(), contents.size()) &&
+         !writer->FinishEntry();
+}
+
+static const char* GetApk() {
+  if (apk) {
+    return apk->path;
+  }
+
+  apk = new TemporaryFile;
+  out_dir = new TemporaryDir;
+  FILE* file = fdopen(dup(apk->fd), "w");
+  ZipWriter writer(file);
+  bool ok = true;
+  for (int i = 0; ok && (i < kNumResources); ++i) {
+    ok = WriteEntry(&writer, android::base::StringPrintf("res/raw/r%d.bin", i),
+                    kResourceSize, i);
+  }
+  for (int i = 0; ok && (i < kNumLibs); ++i) {
+    ok = WriteEntry(&writer,
+                    android::base::StringPrintf("%slib%d.so", kLibPrefix, i),
+                    kLibSize, kNumResources + i);
+  }
+  if (!ok || writer.Finish()) {
+    fprintf(stderr, "Unable to write the test apk\n");
+    exit(1);
+  }
+  fclose(file);
+  return apk->path;
+}
+
+static void OpenTestApk(ZipArchiveHandle* handle) {
+  if (OpenArchive(GetApk(), handle)) {
+    fprintf(stderr, "Unable to open the test apk\n");
+    exit(1);
+  }
+}
+
+static int OpenOutput(const ZipString& name, const ZipEntry&, void*) {
+  std::string path(reinterpret_cast<const char*>(name.name), name.name_length);
+  path = android::base::StringPrintf("%s/%s", out_dir->path,
+                                     path.substr(path.rfind('/') + 1).c_str());
+  // Written out in full all the same, but nothing is left behind
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  unlink(path.c_str());
+  return fd;
+}
+
+// What an installer does today, one library after the other
+static void BM_ExtractLibsSerial(benchmark::State& state) {
+  ZipArchiveHandle handle;
+  OpenTestApk(&handle);
+
+  ZipString prefix(kLibPrefix);
+  while (state.KeepRunning()) {
+    void* cookie;
+    StartIteration(handle, &cookie, &prefix, nullptr);
+    ZipEntry entry;
+    ZipString name;
+    while (!Next(cookie, &entry, &name)) {
+      int fd = OpenOutput(name, entry, nullptr);
+      ExtractEntryToFile(handle, &entry, fd);
+      close(fd);
+    }
+    EndIteration(cookie);
+  }
+  state.SetBytesProcessed(state.iterations() * kNumLibs * kLibSize);
+  CloseArchive(handle);
+}
+BENCHMARK(BM_ExtractLibsSerial)->UseRealTime();
+
+static void BM_ExtractLibs(benchmark::State& state) {
+  ZipArchiveHandle handle;
+  OpenTestApk(&handle);
+
+  ZipString prefix(kLibPrefix);
+  while (state.KeepRunning()) {
+    ExtractEntries(handle, nullptr, 0, &prefix, OpenOutput, nullptr,
+                   state.range_x());
+  }
+  state.SetBytesProcessed(state.iterations() * kNumLibs * kLibSize);
+  CloseArchive(handle);
+}
+// Real time, the CPU time of the caller's thread says little here
+BENCHMARK(BM_ExtractLibs)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime();
+
+// Many small entries, where the per entry overhead shows
+static void BM_ExtractResources(benchmark::State& state) {
+  ZipArchiveHandle handle;
+  OpenTestApk(&handle);
+
+  ZipString prefix("res/");
+  while (state.KeepRunning()) {
+    ExtractEntries(handle, nullptr, 0, &prefix, OpenOutput, nullptr,
+                   state.range_x());
+  }
+  state.SetBytesProcessed(state.iterations() * kNumResources * kResourceSize);
+  CloseArchive(handle);
+}
+BENCHMARK(BM_ExtractResources)->Arg(1)->Arg(4)->UseRealTime();
+
+// Open and one lookup, as each process using the apk does: the central
+// directory scanned every time
+static void BM_OpenFindEntry(benchmark::State& state) {
+  const char* path = GetApk();
+  ZipString name("res/raw/r1000.bin");
+  while (state.KeepRunning()) {
+    ZipArchiveHandle handle;
+    ZipEntry entry;
+    OpenArchive(path, &handle);
+    FindEntry(handle, name, &entry);
+    CloseArchive(handle);
+  }
+}
+BENCHMARK(BM_OpenFindEntry);
+
+// The same through an index written by the first open
+static void BM_OpenFindEntryWithIndex(benchmark::State& state) {
+  const char* path = GetApk();
+  const std::string index = android::base::StringPrintf("%s/apk.idx", out_dir->path);
+  ZipString name("res/raw/r1000.bin");
+  ZipArchiveHandle handle;
+  OpenArchiveWithIndex(path, index.c_str(), &handle);
+  CloseArchive(handle);
+
+  while (state.KeepRunning()) {
+    ZipEntry entry;
+    OpenArchiveWithIndex(path, index.c_str(), &handle);
+    FindEntry(handle, name, &entry);
+    CloseArchive(handle);
+  }
+  unlink(index.c_str());
+}
+BENCHMARK(BM_OpenFindEntryWithIndex);
+
+BENCHMARK_MAIN()
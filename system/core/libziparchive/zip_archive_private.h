@@ -21,6 +21,10 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#if !defined(_WIN32)
+#include <mutex>
+#endif
+
 #include <utils/FileMap.h>
 #include <ziparchive/zip_archive.h>
 
@@ -43,13 +47,31 @@ struct ZipArchive {
   uint32_t hash_table_size;
   ZipString* hash_table;
 
+  // Perfect hash of entry names to central directory offsets, mapped from
+  // the index file of OpenArchiveWithIndex. FindEntry goes through it when
+  // present, and the hash table above is then only built for iteration.
+  android::FileMap index_map;
+  uint32_t index_num_buckets;
+  uint32_t index_num_slots;
+  const uint32_t* index_displacements;
+  const uint32_t* index_slots;
+
+#if !defined(_WIN32)
+  // Guards building the hash table after the fact
+  std::mutex hash_table_lock;
+#endif
+
   ZipArchive(const int fd, bool assume_ownership) :
       fd(fd),
       close_file(assume_ownership),
       directory_offset(0),
       num_entries(0),
       hash_table_size(0),
-      hash_table(NULL) {}
+      hash_table(NULL),
+      index_num_buckets(0),
+      index_num_slots(0),
+      index_displacements(NULL),
+      index_slots(NULL) {}
 
   ~ZipArchive() {
     if (close_file && fd >= 0) {
@@ -21,7 +21,9 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #include <android-base/file.h>
@@ -283,6 +285,92 @@ TEST(ziparchive, FindEntry) {
   CloseArchive(handle);
 }
 
+static void AssertValidZipEntries(ZipArchiveHandle handle) {
+  ZipEntry data;
+  ZipString name;
+  SetZipString(&name, kATxtName);
+  ASSERT_EQ(0, FindEntry(handle, name, &data));
+  ASSERT_EQ(63, data.offset);
+  ASSERT_EQ(static_cast<uint32_t>(17), data.uncompressed_length);
+  ASSERT_EQ(0x950821c5, data.crc32);
+
+  ASSERT_EQ(0, FindEntry(handle, ZipString("b/d.txt"), &data));
+
+  ZipString absent_name;
+  SetZipString(&absent_name, kNonexistentTxtName);
+  ASSERT_LT(FindEntry(handle, absent_name, &data), 0);
+  ASSERT_LT(FindEntry(handle, ZipString("a.tx"), &data), 0);
+}
+
+TEST(ziparchive, OpenWithIndex) {
+  TemporaryDir tmp_dir;
+  const std::string index = std::string(tmp_dir.path) + "/valid.zip.idx";
+  const std::string zip = test_data_dir + "/" + kValidZip;
+
+  // Scanned, and the index written
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveWithIndex(zip.c_str(), index.c_str(), &handle));
+  AssertValidZipEntries(handle);
+  CloseArchive(handle);
+  std::string contents;
+  ASSERT_TRUE(android::base::ReadFileToString(index, &contents));
+  ASSERT_LT(0u, contents.size());
+
+  // From the index, which is left alone
+  ASSERT_EQ(0, OpenArchiveWithIndex(zip.c_str(), index.c_str(), &handle));
+  AssertValidZipEntries(handle);
+
+  // Iterates in the same order as without the index
+  void* iteration_cookie;
+  ASSERT_EQ(0, StartIteration(handle, &iteration_cookie, nullptr, nullptr));
+  ZipEntry data;
+  ZipString name;
+  for (const char* expected : { "b/c.txt", "b/d.txt", "a.txt", "b.txt", "b/" }) {
+    ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
+    AssertNameEquals(expected, name);
+  }
+  ASSERT_EQ(-1, Next(iteration_cookie, &data, &name));
+  EndIteration(iteration_cookie);
+  CloseArchive(handle);
+
+  std::string unchanged;
+  ASSERT_TRUE(android::base::ReadFileToString(index, &unchanged));
+  ASSERT_EQ(contents, unchanged);
+  unlink(index.c_str());
+}
+
+TEST(ziparchive, OpenWithStaleIndex) {
+  TemporaryDir tmp_dir;
+  const std::string index = std::string(tmp_dir.path) + "/zip.idx";
+  const std::string valid_zip = test_data_dir + "/" + kValidZip;
+  const std::string large_zip = test_data_dir + "/" + kLargeZip;
+
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveWithIndex(valid_zip.c_str(), index.c_str(), &handle));
+  CloseArchive(handle);
+  std::string valid_index;
+  ASSERT_TRUE(android::base::ReadFileToString(index, &valid_index));
+
+  // Built for another archive, replaced
+  ASSERT_EQ(0, OpenArchiveWithIndex(large_zip.c_str(), index.c_str(), &handle));
+  ZipEntry data;
+  ZipString name;
+  SetZipString(&name, kLargeCompressTxtName);
+  ASSERT_EQ(0, FindEntry(handle, name, &data));
+  CloseArchive(handle);
+  std::string large_index;
+  ASSERT_TRUE(android::base::ReadFileToString(index, &large_index));
+  ASSERT_NE(valid_index, large_index);
+
+  // Corrupt, ignored
+  valid_index[valid_index.size() - 1] ^= 0xff;
+  ASSERT_TRUE(android::base::WriteStringToFile(valid_index, index));
+  ASSERT_EQ(0, OpenArchiveWithIndex(valid_zip.c_str(), index.c_str(), &handle));
+  AssertValidZipEntries(handle);
+  CloseArchive(handle);
+  unlink(index.c_str());
+}
+
 TEST(ziparchive, TestInvalidDeclaredLength) {
   ZipArchiveHandle handle;
   ASSERT_EQ(0, OpenArchiveWrapper("declaredlength.zip", &handle));
@@ -494,6 +582,79 @@ TEST(ziparchive, ExtractToFile) {
             lseek64(tmp_file.fd, 0, SEEK_END));
 }
 
+struct ExtractedEntries {
+  std::vector<std::unique_ptr<TemporaryFile>> files;
+  std::vector<std::string> names;
+};
+
+static int OpenExtractedEntry(const ZipString& name, const ZipEntry&, void* cookie) {
+  // Called from each of the extracting threads
+  static std::mutex lock;
+  std::lock_guard<std::mutex> guard(lock);
+
+  ExtractedEntries* extracted = reinterpret_cast<ExtractedEntries*>(cookie);
+  extracted->files.emplace_back(new TemporaryFile);
+  extracted->names.emplace_back(reinterpret_cast<const char*>(name.name), name.name_length);
+  return dup(extracted->files.back()->fd);
+}
+
+static void AssertExtractedEntries(ZipArchiveHandle handle, const ExtractedEntries& extracted) {
+  for (size_t i = 0; i < extracted.files.size(); ++i) {
+    ZipString name;
+    SetZipString(&name, extracted.names[i]);
+    ZipEntry entry;
+    ASSERT_EQ(0, FindEntry(handle, name, &entry));
+
+    std::vector<uint8_t> expected(entry.uncompressed_length);
+    ASSERT_EQ(0, ExtractToMemory(handle, &entry, expected.data(), expected.size()));
+
+    std::string contents;
+    ASSERT_TRUE(android::base::ReadFileToString(extracted.files[i]->path, &contents));
+    ASSERT_EQ(expected.size(), contents.size());
+    ASSERT_EQ(0, memcmp(expected.data(), contents.data(), contents.size()));
+  }
+}
+
+TEST(ziparchive, ExtractEntries) {
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveWrapper(kLargeZip, &handle));
+
+  ZipString names[2];
+  SetZipString(&names[0], kLargeCompressTxtName);
+  SetZipString(&names[1], kLargeUncompressTxtName);
+
+  ExtractedEntries extracted;
+  ASSERT_EQ(0, ExtractEntries(handle, names, 2, nullptr, OpenExtractedEntry, &extracted, 2));
+  ASSERT_EQ(2u, extracted.files.size());
+  AssertExtractedEntries(handle, extracted);
+
+  ZipString missing;
+  SetZipString(&missing, kNonexistentTxtName);
+  ExtractedEntries none;
+  ASSERT_GT(0, ExtractEntries(handle, &missing, 1, nullptr, OpenExtractedEntry, &none, 2));
+  ASSERT_EQ(0u, none.files.size());
+
+  CloseArchive(handle);
+}
+
+TEST(ziparchive, ExtractEntriesPrefix) {
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveWrapper(kValidZip, &handle));
+
+  ZipString prefix("b/");
+  ExtractedEntries extracted;
+  ASSERT_EQ(0, ExtractEntries(handle, nullptr, 0, &prefix, OpenExtractedEntry, &extracted));
+
+  // b/c.txt and b/d.txt, but not the b/ directory itself
+  ASSERT_EQ(2u, extracted.names.size());
+  AssertExtractedEntries(handle, extracted);
+  std::sort(extracted.names.begin(), extracted.names.end());
+  ASSERT_EQ("b/c.txt", extracted.names[0]);
+  ASSERT_EQ("b/d.txt", extracted.names[1]);
+
+  CloseArchive(handle);
+}
+
 static void ZipArchiveStreamTest(
     ZipArchiveHandle& handle, const std::string& entry_name, bool raw,
     bool verified, ZipEntry* entry, std::vector<uint8_t>* read_data) {
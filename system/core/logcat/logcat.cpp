@@ -19,11 +19,19 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/strings.h>
@@ -35,11 +43,16 @@
 #include <log/logd.h>
 #include <log/logger.h>
 #include <log/logprint.h>
+#include <private/android_logger.h>
 #include <utils/threads.h>
 
 #include <pcrecpp.h>
 
 #define DEFAULT_MAX_ROTATED_LOGS 4
+// entries read ahead in dump mode before they are formatted and written out
+#define BATCH_ENTRIES 256
+// default ceiling for --threads
+#define DEFAULT_MAX_FORMAT_THREADS 4
 
 static AndroidLogFormat * g_logformat;
 
@@ -65,6 +78,18 @@ struct log_device_t {
     }
 };
 
+// A log entry read ahead, and once formatted, the line to print for it
+struct log_batch_entry {
+    struct log_msg msg;
+    log_device_t* dev;
+    bool binary;
+
+    bool match;
+    char* line; // NULL if nothing to print, lineBuf or malloc()'d
+    size_t lineLen;
+    char lineBuf[512];
+};
+
 namespace android {
 
 /* Global Variables */
@@ -83,6 +108,11 @@ static pcrecpp::RE* g_regex;
 static size_t g_maxCount;
 static size_t g_printCount;
 static bool g_printItAnyways;
+static log_batch_entry* g_batch;
+// 0 means "one per cpu, up to DEFAULT_MAX_FORMAT_THREADS"
+static size_t g_formatThreads;
+static EventTagMap* g_eventTagMap;
+static log_device_t* g_lastDev;
 
 // if showHelp is set, newline required in fmt statement to transition to usage
 __noreturn static void logcat_panic(bool showHelp, const char *fmt, ...) __printflike(2,3);
@@ -144,13 +174,6 @@ static void rotateLogs()
 
 }
 
-void printBinary(struct log_msg *buf)
-{
-    size_t size = buf->len();
-
-    TEMP_FAILURE_RETRY(write(g_outFD, buf, size));
-}
-
 static bool regexOk(const AndroidLogEntry& entry)
 {
     if (!g_regex) {
@@ -162,58 +185,268 @@ static bool regexOk(const AndroidLogEntry& entry)
     return g_regex->PartialMatch(messageString);
 }
 
-static void processBuffer(log_device_t* dev, struct log_msg *buf)
+// Safe to call from several threads at once, shares only read-only state
+static void formatEntry(log_batch_entry* e)
 {
-    int bytesWritten = 0;
     int err;
     AndroidLogEntry entry;
     char binaryMsgBuf[1024];
 
-    if (dev->binary) {
-        static bool hasOpenedEventTagMap = false;
-        static EventTagMap *eventTagMap = NULL;
+    e->match = false;
+    e->line = NULL;
 
-        if (!eventTagMap && !hasOpenedEventTagMap) {
-            eventTagMap = android_openEventTagMap(EVENT_TAG_MAP_FILE);
-            hasOpenedEventTagMap = true;
-        }
-        err = android_log_processBinaryLogBuffer(&buf->entry_v1, &entry,
-                                                 eventTagMap,
+    if (e->binary) {
+        err = android_log_processBinaryLogBuffer(&e->msg.entry_v1, &entry,
+                                                 g_eventTagMap,
                                                  binaryMsgBuf,
                                                  sizeof(binaryMsgBuf));
         //printf(">>> pri=%d len=%d msg='%s'\n",
         //    entry.priority, entry.messageLen, entry.message);
     } else {
-        err = android_log_processLogBuffer(&buf->entry_v1, &entry);
+        err = android_log_processLogBuffer(&e->msg.entry_v1, &entry);
     }
     if (err < 0) {
-        goto error;
+        //fprintf (stderr, "Error processing record\n");
+        return;
     }
 
-    if (android_log_shouldPrintLine(g_logformat, entry.tag, entry.priority)) {
-        bool match = regexOk(entry);
+    if (!android_log_shouldPrintLine(g_logformat, entry.tag, entry.priority)) {
+        return;
+    }
 
-        g_printCount += match;
-        if (match || g_printItAnyways) {
-            bytesWritten = android_log_printLogLine(g_logformat, g_outFD, &entry);
+    e->match = regexOk(entry);
+    if (e->match || g_printItAnyways) {
+        e->line = android_log_formatLogLine(g_logformat,
+                                            e->lineBuf, sizeof(e->lineBuf),
+                                            &entry, &e->lineLen);
+        if (!e->line) {
+            logcat_panic(false, "output error");
+        }
+    }
+}
 
-            if (bytesWritten < 0) {
-                logcat_panic(false, "output error");
+// Formats g_batch entries on a fixed set of threads, the caller takes part
+class FormatPool {
+    static const size_t stride = 16;
+
+    std::vector<std::thread> mThreads;
+    std::mutex mLock;
+    std::condition_variable mWork;
+    std::condition_variable mDone;
+    unsigned long mGeneration;
+    size_t mBusy;
+    size_t mEnd;
+    std::atomic<size_t> mNext;
+    bool mExit;
+
+    void drain() {
+        size_t i;
+        while ((i = mNext.fetch_add(stride)) < mEnd) {
+            for (size_t end = std::min(i + stride, mEnd); i < end; ++i) {
+                formatEntry(&g_batch[i]);
+            }
+        }
+    }
+
+    void worker() {
+        unsigned long generation = 0;
+        std::unique_lock<std::mutex> lock(mLock);
+        for (;;) {
+            mWork.wait(lock, [&] {
+                return mExit || (mGeneration != generation);
+            });
+            if (mExit) {
+                return;
             }
+            generation = mGeneration;
+            lock.unlock();
+            drain();
+            lock.lock();
+            if (--mBusy == 0) {
+                mDone.notify_one();
+            }
+        }
+    }
+
+public:
+    explicit FormatPool(size_t threads) :
+            mGeneration(0), mBusy(0), mEnd(0), mNext(0), mExit(false) {
+        for (size_t i = 1; i < threads; ++i) {
+            mThreads.emplace_back(&FormatPool::worker, this);
+        }
+    }
+
+    ~FormatPool() {
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            mExit = true;
+        }
+        mWork.notify_all();
+        for (auto& t : mThreads) {
+            t.join();
+        }
+    }
+
+    // returns once g_batch[start, end) are all formatted
+    void run(size_t start, size_t end) {
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            mNext = start;
+            mEnd = end;
+            mBusy = mThreads.size();
+            ++mGeneration;
+        }
+        mWork.notify_all();
+        drain();
+        std::unique_lock<std::mutex> lock(mLock);
+        mDone.wait(lock, [&] { return mBusy == 0; });
+    }
+};
+
+static FormatPool* g_formatPool;
+
+static void formatBatch(size_t count)
+{
+    static bool warm;
+    size_t start = 0;
+
+    // Formatting the first line in some formats (eg: monotonic) sets up
+    // shared state in liblog, so format serially until a line has been:
+    // entries that fail, are filtered out or miss the regex don't count.
+    while (!warm && start < count) {
+        formatEntry(&g_batch[start]);
+        warm = g_batch[start++].line != NULL;
+    }
+    if ((count - start) <= 1 || g_formatThreads <= 1) {
+        for (size_t i = start; i < count; ++i) {
+            formatEntry(&g_batch[i]);
+        }
+        return;
+    }
+    if (!g_formatPool) {
+        g_formatPool = new FormatPool(g_formatThreads);
+    }
+    g_formatPool->run(start, count);
+}
+
+// Pending output, gathered so a batch goes out in a few writev() calls
+class OutputVector {
+    struct iovec mVec[BATCH_ENTRIES];
+    size_t mCount;
+
+public:
+    OutputVector() : mCount(0) { }
+
+    void add(const void* buf, size_t len) {
+        if (!len) {
+            return;
+        }
+        if (mCount >= (sizeof(mVec) / sizeof(mVec[0]))) {
+            flush();
         }
+        mVec[mCount].iov_base = const_cast<void*>(buf);
+        mVec[mCount].iov_len = len;
+        ++mCount;
     }
 
-    g_outByteCount += bytesWritten;
+    void flush() {
+        struct iovec* vec = mVec;
+        size_t count = mCount;
 
+        mCount = 0;
+        while (count) {
+            ssize_t ret = TEMP_FAILURE_RETRY(writev(g_outFD, vec, count));
+            if (ret < 0) {
+                fprintf(stderr, "+++ LOG: write failed (errno=%d)\n", errno);
+                return;
+            }
+            // pick up after a partial write
+            while (count && ((size_t)ret >= vec->iov_len)) {
+                ret -= vec->iov_len;
+                ++vec;
+                --count;
+            }
+            if (count) {
+                vec->iov_base = static_cast<char*>(vec->iov_base) + ret;
+                vec->iov_len -= ret;
+            }
+        }
+    }
+};
+
+static void maybePrintStart(log_device_t* dev, bool printDividers);
+
+static void maybeRotate(OutputVector& out)
+{
     if (g_logRotateSizeKBytes > 0
         && (g_outByteCount / 1024) >= g_logRotateSizeKBytes
     ) {
+        out.flush();
         rotateLogs();
     }
+}
+
+static void maybeSwitchDevice(log_batch_entry* e, OutputVector& out,
+                              bool printDividers)
+{
+    if (g_lastDev != e->dev) {
+        g_lastDev = e->dev;
+        out.flush();
+        maybePrintStart(e->dev, printDividers);
+    }
+}
+
+// Raw entries straight from the read buffers, no formatting
+static void printBinary(size_t count, bool printDividers)
+{
+    OutputVector out;
+
+    for (size_t i = 0; i < count; ++i) {
+        log_batch_entry* e = &g_batch[i];
+
+        maybeSwitchDevice(e, out, printDividers);
+        out.add(&e->msg, e->msg.len());
+        g_outByteCount += e->msg.len();
+        maybeRotate(out);
+    }
+    out.flush();
+}
+
+static void processBatch(size_t count, bool printDividers)
+{
+    OutputVector out;
+    size_t i;
+
+    static bool hasOpenedEventTagMap = false;
+    for (i = 0; !hasOpenedEventTagMap && (i < count); ++i) {
+        if (g_batch[i].binary) {
+            g_eventTagMap = android_openEventTagMap(EVENT_TAG_MAP_FILE);
+            hasOpenedEventTagMap = true;
+        }
+    }
+
+    formatBatch(count);
+
+    // emit in log order, honouring --max-count and rotation as we go
+    for (i = 0; (i < count) && (!g_maxCount || (g_printCount < g_maxCount));
+            ++i) {
+        log_batch_entry* e = &g_batch[i];
+
+        maybeSwitchDevice(e, out, printDividers);
+        g_printCount += e->match;
+        if (e->line) {
+            out.add(e->line, e->lineLen);
+            g_outByteCount += e->lineLen;
+        }
+        maybeRotate(out);
+    }
+    out.flush();
 
-error:
-    //fprintf (stderr, "Error processing record\n");
-    return;
+    for (i = 0; i < count; ++i) {
+        if (g_batch[i].line != g_batch[i].lineBuf) {
+            free(g_batch[i].line);
+        }
+    }
 }
 
 static void maybePrintStart(log_device_t* dev, bool printDividers) {
@@ -319,8 +552,8 @@ static void show_help(const char *cmd)
                     "  --buffer=<buffer> 'events', 'crash', 'default' or 'all'. Multiple -b\n"
                     "                  parameters are allowed and results are interleaved. The\n"
                     "                  default is -b main -b system -b crash.\n"
-                    "  -B              output the log in binary.\n"
-                    "  --binary\n"
+                    "  -B              output the log in binary, entries are passed through\n"
+                    "  --binary        unformatted and unfiltered.\n"
                     "  -S              output statistics.\n"
                     "  --statistics\n"
                     "  -p              print prune white and ~black list. Service is specified as\n"
@@ -332,6 +565,12 @@ static void show_help(const char *cmd)
                     "  -P '<list> ...' set prune white and ~black list, using same format as\n"
                     "  --prune='<list> ...'  printed above. Must be quoted.\n"
                     "  --pid=<pid>     Only prints logs from the given pid.\n"
+                    "  --persisted[=<dir>] dump the segments logd keeps when\n"
+                    "                  persist.logd.logpersistd is \"logd\". Time (-t '<time>'),\n"
+                    "                  buffer, pid, uid and tag filters seek or skip segments.\n"
+                    "  --uid=<uid>     with --persisted, only prints logs from the given uid.\n"
+                    "  --threads=<n>   format with <n> threads when dumping (-d, -t), output\n"
+                    "                  order is unchanged. Default is one per cpu, up to 4.\n"
                     // Check ANDROID_LOG_WRAP_DEFAULT_TIMEOUT value
                     "  --wrap          Sleep for 2 hours or when buffer about to wrap whichever\n"
                     "                  comes first. Improves efficiency of polling by providing\n"
@@ -535,6 +774,241 @@ static log_time lastLogTime(char *outputFileName) {
     return retval;
 }
 
+// --persisted, reads back the segments logd writes to LOGPERSIST_DIR with
+// the same filtering logd applies to a reader. Sealed segments carry a
+// time range, a sparse time index and a bloom filter of tags and UIDs, so
+// that whole segments, and the early part of the first, can be skipped.
+class PersistedLog {
+    std::map<uint32_t, std::string> mSegments;
+    std::map<uint32_t, std::string>::iterator mNext;
+    int mFd;
+    off_t mPos;  // next record
+    off_t mEnd;  // end of records
+    std::unique_ptr<char[]> mBuf;
+    off_t mBufPos;
+    size_t mBufLen;
+
+    static const size_t bufSize = 256 * 1024;
+
+    bool openSegment(const std::string& path);
+    bool nextSegment();
+    const char* record(off_t pos, size_t len);
+
+public:
+    // filters, a zero mLogMask, mStart, or empty mTags or mUid mean any
+    unsigned mLogMask;
+    log_time mStart;
+    pid_t mPid;
+    std::string mUid;
+    std::vector<std::string> mTags;
+
+    PersistedLog() : mFd(-1), mPos(0), mEnd(0), mBuf(new char[bufSize]),
+            mBufPos(0), mBufLen(0), mLogMask(0), mStart(log_time::EPOCH),
+            mPid(0) { }
+
+    bool open(const char* directory);
+    // as android_logger_list_read, -EAGAIN once there are no more entries
+    int read(struct log_msg* msg);
+};
+
+bool PersistedLog::open(const char* directory)
+{
+    std::unique_ptr<DIR, int(*)(DIR*)> dir(opendir(directory), closedir);
+    if (!dir.get()) {
+        return false;
+    }
+
+    static const size_t prefixLen = sizeof(LOGPERSIST_PREFIX) - 1;
+    struct dirent* dp;
+    while ((dp = readdir(dir.get())) != NULL) {
+        if (strncmp(dp->d_name, LOGPERSIST_PREFIX, prefixLen)) {
+            continue;
+        }
+        char* cp;
+        unsigned long number = strtoul(dp->d_name + prefixLen, &cp, 10);
+        if (*cp || !number || (number > UINT32_MAX)) {
+            continue;
+        }
+        mSegments[number] = std::string(directory) + "/" + dp->d_name;
+    }
+    mNext = mSegments.begin();
+    return true;
+}
+
+bool PersistedLog::openSegment(const std::string& path)
+{
+    mFd = TEMP_FAILURE_RETRY(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (mFd < 0) {
+        return false;
+    }
+    mBufLen = 0;
+
+    struct stat st;
+    android_logpersist_header_t header;
+    if (fstat(mFd, &st)
+            || (TEMP_FAILURE_RETRY(pread(mFd, &header, sizeof(header), 0))
+                != sizeof(header))
+            || memcmp(header.magic, LOGPERSIST_MAGIC, sizeof(header.magic))
+            || (header.hdr_size < sizeof(header))
+            || ((off_t)header.hdr_size > st.st_size)) {
+        return false;
+    }
+    mPos = header.hdr_size;
+    mEnd = st.st_size;
+
+    // No valid trailer, still being written or cut short: scan it all
+    android_logpersist_trailer_t trailer;
+    if ((st.st_size < (off_t)(header.hdr_size + sizeof(trailer)))
+            || (TEMP_FAILURE_RETRY(pread(mFd, &trailer, sizeof(trailer),
+                                         st.st_size - sizeof(trailer)))
+                != sizeof(trailer))
+            || memcmp(trailer.magic, LOGPERSIST_TRAILER_MAGIC,
+                      sizeof(trailer.magic))
+            || (trailer.records_end < header.hdr_size)
+            || (trailer.bloom_size != LOGPERSIST_BLOOM_SIZE)
+            || ((off_t)(trailer.records_end
+                    + trailer.index_count * sizeof(android_logpersist_index_t)
+                    + trailer.bloom_size + sizeof(trailer))
+                != st.st_size)) {
+        return true;
+    }
+    mEnd = trailer.records_end;
+
+    if (mLogMask && !(trailer.lid_mask & mLogMask)) {
+        return false;
+    }
+    if ((mStart != log_time::EPOCH)
+            && (log_time(trailer.max_sec, trailer.max_nsec) < mStart)) {
+        return false;
+    }
+
+    off_t bloomPos = trailer.records_end
+                   + trailer.index_count * sizeof(android_logpersist_index_t);
+    if (mTags.size() || mUid.length()) {
+        uint8_t bloom[LOGPERSIST_BLOOM_SIZE];
+        if (TEMP_FAILURE_RETRY(pread(mFd, bloom, sizeof(bloom), bloomPos))
+                != sizeof(bloom)) {
+            return true;
+        }
+        if (mUid.length()
+                && !android_logpersist_bloom_test(bloom, LOGPERSIST_KEY_UID,
+                                                  mUid.c_str(),
+                                                  mUid.length())) {
+            return false;
+        }
+        bool found = mTags.empty();
+        for (auto& tag : mTags) {
+            if (android_logpersist_bloom_test(bloom, LOGPERSIST_KEY_TAG,
+                                              tag.c_str(), tag.length())) {
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            return false;
+        }
+    }
+
+    // skip the strides whose latest entry is still before mStart
+    if ((mStart != log_time::EPOCH) && trailer.index_count) {
+        std::vector<android_logpersist_index_t> index(trailer.index_count);
+        size_t len = index.size() * sizeof(android_logpersist_index_t);
+        if (TEMP_FAILURE_RETRY(pread(mFd, index.data(), len,
+                                     trailer.records_end)) != (ssize_t)len) {
+            return true;
+        }
+        for (auto& i : index) {
+            if (log_time(i.sec, i.nsec) >= mStart) {
+                if (((off_t)i.offset >= mPos) && ((off_t)i.offset < mEnd)) {
+                    mPos = i.offset;
+                }
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+bool PersistedLog::nextSegment()
+{
+    if (mFd >= 0) {
+        close(mFd);
+        mFd = -1;
+    }
+    while (mNext != mSegments.end()) {
+        const std::string& path = (mNext++)->second;
+        if (openSegment(path)) {
+            return true;
+        }
+        if (mFd >= 0) {
+            close(mFd);
+            mFd = -1;
+        }
+    }
+    return false;
+}
+
+// len bytes of the segment at pos, NULL if they are not all there
+const char* PersistedLog::record(off_t pos, size_t len)
+{
+    if ((pos + (off_t)len) > mEnd) {
+        return NULL;
+    }
+    if ((pos < mBufPos) || ((pos + (off_t)len) > (mBufPos + (off_t)mBufLen))) {
+        ssize_t ret = TEMP_FAILURE_RETRY(pread(mFd, mBuf.get(),
+                                               std::min((off_t)bufSize,
+                                                        mEnd - pos),
+                                               pos));
+        if (ret < (ssize_t)len) {
+            mBufLen = 0;
+            return NULL;
+        }
+        mBufPos = pos;
+        mBufLen = ret;
+    }
+    return mBuf.get() + (pos - mBufPos);
+}
+
+int PersistedLog::read(struct log_msg* msg)
+{
+    for (;;) {
+        if ((mFd < 0) && !nextSegment()) {
+            return -EAGAIN;
+        }
+
+        struct logger_entry_v4 entry;
+        const char* cp = record(mPos, sizeof(entry));
+        if (!cp) {
+            nextSegment();
+            continue;
+        }
+        memcpy(&entry, cp, sizeof(entry));
+        size_t size = entry.hdr_size + entry.len;
+        if ((entry.hdr_size < sizeof(entry))
+                || (entry.len > LOGGER_ENTRY_MAX_PAYLOAD)
+                || !(cp = record(mPos, size))) {
+            nextSegment(); // corrupt, or truncated by a reboot
+            continue;
+        }
+        mPos += size;
+
+        if ((mLogMask && !(mLogMask & (1 << entry.lid)))
+                || (mPid && (entry.pid != mPid))
+                || ((mStart != log_time::EPOCH)
+                    && (log_time(entry.sec, entry.nsec) < mStart))) {
+            continue;
+        }
+        if (mUid.length() && (mUid != std::to_string(entry.uid))) {
+            continue;
+        }
+
+        memcpy(msg->buf, cp, size);
+        return size;
+    }
+}
+
+static PersistedLog* g_persisted;
+
 } /* namespace android */
 
 
@@ -551,6 +1025,7 @@ int main(int argc, char **argv)
     int printStatistics = 0;
     int mode = ANDROID_LOG_RDONLY;
     const char *forceFilters = NULL;
+    const char *regex = NULL;
     log_device_t* devices = NULL;
     log_device_t* dev;
     bool printDividers = false;
@@ -559,6 +1034,9 @@ int main(int argc, char **argv)
     log_time tail_time(log_time::EPOCH);
     size_t pid = 0;
     bool got_t = false;
+    const char *persistedDir = NULL;
+    std::string uid;
+    bool silent = false;
 
     signal(SIGPIPE, exit);
 
@@ -577,6 +1055,9 @@ int main(int argc, char **argv)
         static const char pid_str[] = "pid";
         static const char wrap_str[] = "wrap";
         static const char print_str[] = "print";
+        static const char threads_str[] = "threads";
+        static const char persisted_str[] = "persisted";
+        static const char uid_str[] = "uid";
         static const struct option long_options[] = {
           { "binary",        no_argument,       NULL,   'B' },
           { "buffer",        required_argument, NULL,   'b' },
@@ -600,6 +1081,9 @@ int main(int argc, char **argv)
           { "statistics",    no_argument,       NULL,   'S' },
           // hidden and undocumented reserved alias for -t
           { "tail",          required_argument, NULL,   't' },
+          { threads_str,     required_argument, NULL,   0 },
+          { persisted_str,   optional_argument, NULL,   0 },
+          { uid_str,         required_argument, NULL,   0 },
           // support, but ignore and do not document, the optional argument
           { wrap_str,        optional_argument, NULL,   0 },
           { NULL,            0,                 NULL,   0 }
@@ -645,11 +1129,33 @@ int main(int argc, char **argv)
                     g_printItAnyways = true;
                     break;
                 }
+                if (long_options[option_index].name == persisted_str) {
+                    persistedDir = optarg ? optarg : LOGPERSIST_DIR;
+                    mode |= ANDROID_LOG_RDONLY | ANDROID_LOG_NONBLOCK;
+                    break;
+                }
+                if (long_options[option_index].name == uid_str) {
+                    size_t dummy;
+                    if (!getSizeTArg(optarg, &dummy, 0, UINT32_MAX)) {
+                        logcat_panic(true, "%s %s out of range\n",
+                                     long_options[option_index].name, optarg);
+                    }
+                    uid = std::to_string(dummy);
+                    break;
+                }
+                if (long_options[option_index].name == threads_str) {
+                    if (!getSizeTArg(optarg, &g_formatThreads, 1, 64)) {
+                        logcat_panic(true, "%s %s out of range\n",
+                                     long_options[option_index].name, optarg);
+                    }
+                    break;
+                }
             break;
 
             case 's':
                 // default to all silent
                 android_log_addFilterRule(g_logformat, "*:s");
+                silent = true;
             break;
 
             case 'c':
@@ -700,6 +1206,7 @@ int main(int argc, char **argv)
 
             case 'e':
                 g_regex = new pcrecpp::RE(optarg);
+                regex = optarg;
             break;
 
             case 'm': {
@@ -1033,11 +1540,13 @@ int main(int argc, char **argv)
         }
     }
 
+    std::vector<const char *> filterStrings;
     if (forceFilters) {
         err = android_log_addFilterString(g_logformat, forceFilters);
         if (err < 0) {
             logcat_panic(false, "Invalid filter expression in logcat args\n");
         }
+        filterStrings.push_back(forceFilters);
     } else if (argc == optind) {
         // Add from environment variable
         char *env_tags_orig = getenv("ANDROID_LOG_TAGS");
@@ -1049,6 +1558,7 @@ int main(int argc, char **argv)
                 logcat_panic(true,
                             "Invalid filter expression in ANDROID_LOG_TAGS\n");
             }
+            filterStrings.push_back(env_tags_orig);
         }
     } else {
         // Add from commandline
@@ -1058,7 +1568,63 @@ int main(int argc, char **argv)
             if (err < 0) {
                 logcat_panic(true, "Invalid filter expression '%s'\n", argv[i]);
             }
+            filterStrings.push_back(argv[i]);
+        }
+    }
+
+    // What logd, and --persisted, can filter for us: with everything else
+    // silenced the tags named, else when no tag is named the priority of
+    // "*". Any other mix would have them drop what we want to print.
+    std::vector<std::string> filterTags;
+    std::string filterSpecs;
+    int filterPrio = 0;
+    bool tagNamed = false;
+    for (const char *filterString : filterStrings) {
+        for (const auto& spec : android::base::Split(filterString, " \t\n")) {
+            if (spec.empty()) {
+                continue;
+            }
+            size_t colon = spec.find(':');
+            std::string tag = spec.substr(0, colon);
+            char prio = (colon != std::string::npos)
+                    ? tolower(spec[colon + 1]) : 'v';
+            if (tag == "*") {
+                static const char priorities[] = "vdiwef";
+                const char *letter = prio ? strchr(priorities, prio) : NULL;
+                silent = (prio == 's');
+                filterPrio = letter
+                        ? (ANDROID_LOG_VERBOSE + (letter - priorities)) : 0;
+            } else {
+                tagNamed = true;
+                if (prio != 's') {
+                    filterTags.push_back(tag);
+                    filterSpecs += spec + " ";
+                }
+            }
+        }
+    }
+
+    if (persistedDir) {
+        g_persisted = new PersistedLog();
+        if (!g_persisted->open(persistedDir)) {
+            logcat_panic(false, "Unable to open %s\n", persistedDir);
+        }
+        for (dev = devices; dev; dev = dev->next) {
+            g_persisted->mLogMask |= 1 << android_name_to_log_id(dev->device);
+        }
+        g_persisted->mStart = tail_time;
+        g_persisted->mPid = pid;
+        g_persisted->mUid = uid;
+        if (tail_lines) {
+            fprintf(stderr, "WARNING: --persisted ignores -t/-T <count>\n");
         }
+
+        // The named tags let us skip segments that hold none of them
+        if (silent) {
+            g_persisted->mTags = filterTags;
+        }
+    } else if (uid.length()) {
+        logcat_panic(true, "--uid requires --persisted\n");
     }
 
     dev = devices;
@@ -1067,6 +1633,18 @@ int main(int argc, char **argv)
     } else {
         logger_list = android_logger_list_alloc(mode, tail_lines, pid);
     }
+
+    // A regex without metacharacters is a plain substring, logd can look
+    // for that; --print wants to see the lines that do not match too.
+    const char *substring = (regex && !g_printItAnyways
+                                   && !strpbrk(regex, "\\^$.|?*+()[]{}"))
+                            ? regex : NULL;
+    if (silent || (!tagNamed && filterPrio) || substring) {
+        android_logger_list_set_filter(logger_list,
+                                       silent ? filterSpecs.c_str() : NULL,
+                                       silent ? 0 : filterPrio, substring,
+                                       NULL);
+    }
     const char *openDeviceFail = NULL;
     const char *clearFail = NULL;
     const char *setSizeFail = NULL;
@@ -1213,13 +1791,24 @@ int main(int argc, char **argv)
     //LOG_EVENT_LONG(11, 0x1122334455667788LL);
     //LOG_EVENT_STRING(0, "whassup, doc?");
 
-    dev = NULL;
     log_device_t unexpected("unexpected", false);
 
+    // When dumping, read ahead and format in parallel. When tailing, every
+    // entry is printed as soon as it arrives.
+    size_t batchSize = (mode & ANDROID_LOG_NONBLOCK) ? BATCH_ENTRIES : 1;
+    size_t count = 0;
+    g_batch = new log_batch_entry[batchSize];
+    if (!g_formatThreads) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        g_formatThreads = std::min(std::max(cpus, 1L),
+                                   (long)DEFAULT_MAX_FORMAT_THREADS);
+    }
+
     while (!g_maxCount || (g_printCount < g_maxCount)) {
-        struct log_msg log_msg;
+        struct log_msg& log_msg = g_batch[count].msg;
         log_device_t* d;
-        int ret = android_logger_list_read(logger_list, &log_msg);
+        int ret = g_persisted ? g_persisted->read(&log_msg)
+                              : android_logger_list_read(logger_list, &log_msg);
 
         if (ret == 0) {
             logcat_panic(false, "read: unexpected EOF!\n");
@@ -1249,19 +1838,29 @@ int main(int argc, char **argv)
             d = &unexpected;
             d->binary = log_msg.id() == LOG_ID_EVENTS;
         }
+        g_batch[count].dev = d;
+        g_batch[count].binary = d->binary;
 
-        if (dev != d) {
-            dev = d;
-            maybePrintStart(dev, printDividers);
+        if (++count < batchSize) {
+            continue;
         }
         if (g_printBinary) {
-            printBinary(&log_msg);
+            printBinary(count, printDividers);
         } else {
-            processBuffer(dev, &log_msg);
+            processBatch(count, printDividers);
         }
+        count = 0;
+    }
+    if (g_printBinary) {
+        printBinary(count, printDividers);
+    } else {
+        processBatch(count, printDividers);
     }
 
     android_logger_list_free(logger_list);
+    delete g_formatPool;
+    delete g_persisted;
+    delete [] g_batch;
 
     return EXIT_SUCCESS;
 }
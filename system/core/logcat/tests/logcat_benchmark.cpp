@@ -17,6 +17,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <gtest/gtest.h>
 
@@ -126,3 +127,45 @@ TEST(logcat, sorted_order) {
     // sample statistically too small
     EXPECT_LT(100, count);
 }
+
+static double dump_seconds(const char *options) {
+    char command[256];
+    struct timespec start, stop;
+    double best = 0;
+
+    snprintf(command, sizeof(command),
+             "logcat -b all -d %s >/dev/null 2>&1", options);
+
+    // best of three
+    for (int i = 0; i < 3; ++i) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (system(command)) {
+            return -1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        double seconds = (stop.tv_sec - start.tv_sec)
+                       + (stop.tv_nsec - start.tv_nsec) / 1e9;
+        if (!i || (seconds < best)) {
+            best = seconds;
+        }
+    }
+    return best;
+}
+
+TEST(logcat, dump_time) {
+    static const char *options[] = {
+        "-B",
+        "-v threadtime --threads=1",
+        "-v threadtime",
+        "-v threadtime -e '[0-9]+'",
+        "-v threadtime -s ActivityManager",
+        "-v threadtime -e ActivityManager",
+    };
+
+    for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); ++i) {
+        double seconds = dump_seconds(options[i]);
+
+        fprintf(stderr, "logcat -b all -d %s: %.3fs\n", options[i], seconds);
+        EXPECT_LE(0, seconds);
+    }
+}
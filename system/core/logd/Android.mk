@@ -15,6 +15,10 @@ LOCAL_SRC_FILES := \
     FlushCommand.cpp \
     LogBuffer.cpp \
     LogBufferElement.cpp \
+    LogCompress.cpp \
+    LogBufferChunk.cpp \
+    LogFilter.cpp \
+    LogPersist.cpp \
     LogTimes.cpp \
     LogStatistics.cpp \
     LogWhiteBlackList.cpp \
@@ -22,6 +22,7 @@
 #include "LogBuffer.h"
 #include "LogBufferElement.h"
 #include "LogCommand.h"
+#include "LogFilter.h"
 #include "LogReader.h"
 #include "LogTimes.h"
 #include "LogUtils.h"
@@ -32,14 +33,20 @@ FlushCommand::FlushCommand(LogReader &reader,
                            unsigned int logMask,
                            pid_t pid,
                            uint64_t start,
-                           uint64_t timeout) :
+                           uint64_t timeout,
+                           LogFilter *filter) :
         mReader(reader),
         mNonBlock(nonBlock),
         mTail(tail),
         mLogMask(logMask),
         mPid(pid),
         mStart(start),
-        mTimeout((start > 1) ? timeout : 0) {
+        mTimeout((start > 1) ? timeout : 0),
+        mFilter(filter) {
+}
+
+FlushCommand::~FlushCommand() {
+    delete mFilter;
 }
 
 // runSocketCommand is called once for every open client on the
@@ -82,7 +89,8 @@ void FlushCommand::runSocketCommand(SocketClient *client) {
             return;
         }
         entry = new LogTimeEntry(mReader, client, mNonBlock, mTail, mLogMask,
-                                 mPid, mStart, mTimeout);
+                                 mPid, mStart, mTimeout, mFilter);
+        mFilter = NULL;
         times.push_front(entry);
     }
 
@@ -20,6 +20,7 @@
 #include <sysutils/SocketClientCommand.h>
 
 class LogBufferElement;
+class LogFilter;
 
 #include "LogTimes.h"
 
@@ -33,6 +34,7 @@ class FlushCommand : public SocketClientCommand {
     pid_t mPid;
     uint64_t mStart;
     uint64_t mTimeout;
+    LogFilter *mFilter; // owned until handed to a new LogTimeEntry
 
 public:
     FlushCommand(LogReader &mReader,
@@ -41,7 +43,9 @@ public:
                  unsigned int logMask = -1,
                  pid_t pid = 0,
                  uint64_t start = 1,
-                 uint64_t timeout = 0);
+                 uint64_t timeout = 0,
+                 LogFilter *filter = NULL);
+    virtual ~FlushCommand();
     virtual void runSocketCommand(SocketClient *client);
 
     static bool hasReadLogs(SocketClient *client);
@@ -16,6 +16,7 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/user.h>
@@ -27,12 +28,15 @@
 #ifdef HAVE_AEE_FEATURE
 #include "aee.h"
 #endif
+#include <algorithm>
+#include <new>
 #include <unordered_map>
 
 #include <cutils/properties.h>
 #include <log/logger.h>
 
 #include "LogBuffer.h"
+#include "LogCompress.h"
 #include "LogKlog.h"
 #include "LogReader.h"
 #include "LogUtils.h"
@@ -119,7 +123,7 @@ static void *logd_performance_issue_thread_start(void * /*obj*/) {
 
 
 
-static unsigned long property_get_size(const char *key) {
+static unsigned long property_get_bytes(const char *key) {
     char property[PROPERTY_VALUE_MAX];
     property_get(key, property, "");
 
@@ -127,6 +131,10 @@ static unsigned long property_get_size(const char *key) {
     unsigned long value = strtoul(property, &cp, 10);
 
     switch(*cp) {
+    case 'g':
+    case 'G':
+        value *= 1024;
+    /* FALLTHRU */
     case 'm':
     case 'M':
         value *= 1024;
@@ -142,6 +150,12 @@ static unsigned long property_get_size(const char *key) {
         value = 0;
     }
 
+    return value;
+}
+
+static unsigned long property_get_size(const char *key) {
+    unsigned long value = property_get_bytes(key);
+
     if (!valid_size(value)) {
         value = 0;
     }
@@ -197,6 +211,14 @@ void LogBuffer::init() {
             setSize(i, LOG_BUFFER_MIN_SIZE);
         }
     }
+    mCompress = property_get_bool("logd.compress",
+                                  BOOL_DEFAULT_FALSE |
+                                  BOOL_DEFAULT_FLAG_PERSIST);
+    mChatty = property_get_bool("logd.chatty",
+                                BOOL_DEFAULT_FALSE |
+                                BOOL_DEFAULT_FLAG_PERSIST);
+    initPersist();
+
     bool lastMonotonic = monotonic;
     monotonic = android_log_clockid() == CLOCK_MONOTONIC;
     if (lastMonotonic != monotonic) {
@@ -215,7 +237,7 @@ void LogBuffer::init() {
         // as the act of mounting /data would trigger persist.logd.timestamp to
         // be corrected. 1/30 corner case YMMV.
         //
-        pthread_mutex_lock(&mLogElementsLock);
+        pthread_rwlock_wrlock(&mLogElementsLock);
         LogBufferElementCollection::iterator it = mLogElements.begin();
         while((it != mLogElements.end())) {
             LogBufferElement *e = *it;
@@ -230,7 +252,7 @@ void LogBuffer::init() {
             }
             ++it;
         }
-        pthread_mutex_unlock(&mLogElementsLock);
+        pthread_rwlock_unlock(&mLogElementsLock);
     }
 
     // We may have been triggered by a SIGHUP. Release any sleeping reader
@@ -252,10 +274,40 @@ void LogBuffer::init() {
     LogTimeEntry::unlock();
 }
 
+void LogBuffer::initPersist() {
+    if (!mPersist) {
+        return;
+    }
+
+    char property[PROPERTY_VALUE_MAX];
+    property_get("persist.logd.logpersistd", property, "");
+    unsigned long budget =
+        property_get_bytes("persist.logd.logpersistd.size");
+    if (!budget) {
+        budget = LOGPERSIST_DEFAULT_SIZE;
+    }
+    mPersist->enable(!strcmp(property, "logd"), budget);
+}
+
+void LogBuffer::setPersist(LogPersist *persist) {
+    mPersist = persist;
+    initPersist();
+}
+
 LogBuffer::LogBuffer(LastLogTimes *times):
         monotonic(android_log_clockid() == CLOCK_MONOTONIC),
+        mCompress(false),
+        mChatty(false),
+        mPersist(NULL),
         mTimes(*times) {
-    pthread_mutex_init(&mLogElementsLock, NULL);
+    // Writers are preferred so that a steady stream of reader threads
+    // walking the buffer can not starve the logd.writer thread.
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr,
+                                  PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&mLogElementsLock, &attr);
+    pthread_rwlockattr_destroy(&attr);
 
     init();
 }
@@ -267,8 +319,6 @@ int LogBuffer::log(log_id_t log_id, log_time realtime,
         return -EINVAL;
     }
 
-    LogBufferElement *elem = new LogBufferElement(log_id, realtime,
-                                                  uid, pid, tid, msg, len);
     int prio = ANDROID_LOG_INFO;
     const char *tag = NULL;
        int time_find_count = 0;
@@ -310,13 +360,13 @@ int LogBuffer::log(log_id_t log_id, log_time realtime,
 
     if (log_id != LOG_ID_SECURITY) {
         if (log_id == LOG_ID_EVENTS) {
-            tag = android::tagToName(elem->getTag());
+            tag = android::tagToName(
+                LogBufferElement::getTag(log_id, msg, len));
             if (!__android_log_is_loggable(prio, tag, ANDROID_LOG_VERBOSE)) {
                 // Log traffic received to total
-                pthread_mutex_lock(&mLogElementsLock);
-                stats.add_total_size(elem);
-                pthread_mutex_unlock(&mLogElementsLock);
-                delete elem;
+                pthread_rwlock_wrlock(&mLogElementsLock);
+                stats.add_total_size(log_id, len);
+                pthread_rwlock_unlock(&mLogElementsLock);
 #ifdef MTK_LOGD_DEBUG
 
                 clock_gettime(CLOCK_MONOTONIC, &ts_1);
@@ -335,7 +385,7 @@ int LogBuffer::log(log_id_t log_id, log_time realtime,
    clock_gettime(CLOCK_MONOTONIC, &ts_1);
 #endif
 
-    pthread_mutex_lock(&mLogElementsLock);
+    pthread_rwlock_wrlock(&mLogElementsLock);
 #if defined(HAVE_AEE_FEATURE) && defined(ANDROID_LOG_MUCH_COUNT)
     if (log_detect_value == 0) {
         pause_detect = 0;
@@ -438,6 +488,9 @@ int LogBuffer::log(log_id_t log_id, log_time realtime,
 #else
             ptm = localtime(&logs_time);
 #endif
+            if (!(*test)->getMsg()) { // dropped or compressed
+                goto next_log;
+            }
             switch ((*test)->getLogId()) {
                 case LOG_ID_KERNEL:
                     goto next_log;
@@ -553,6 +606,14 @@ log_much_exit:
     }
 #endif
 
+    // Carve the element and its payload out of the chunk storage for
+    // this log id, must hold mLogElementsLock.
+    LogBufferElement *elem = new (mChunks[log_id], len)
+        LogBufferElement(log_id, realtime, uid, pid, tid, msg, len);
+    if (!elem) {
+        pthread_rwlock_unlock(&mLogElementsLock);
+        return -ENOMEM;
+    }
 
     // Insert elements in time sorted order if possible
     //  NB: if end is region locked, place element at end of list
@@ -604,12 +665,17 @@ log_much_exit:
         LogTimeEntry::unlock();
     }
 
+    link(elem);
     stats.add(elem);
+    if (mPersist && mPersist->enabled()) {
+        mPersist->append(elem);
+    }
 #ifdef MTK_LOGD_DEBUG
     clock_gettime(CLOCK_MONOTONIC, &ts_3);
 #endif
     maybePrune(log_id);
-    pthread_mutex_unlock(&mLogElementsLock);
+    maybeCompress(log_id);
+    pthread_rwlock_unlock(&mLogElementsLock);
 
     if (log_id == LOG_ID_KERNEL)
         return len;
@@ -668,11 +734,215 @@ log_much_exit:
     return len;
 }
 
+// The size held against log_buffer_size(id). For compressed storage that is
+// the memory actually held by the chunks, so that the same budget holds
+// several times as much history. Otherwise it is the payload of the entries,
+// including what chatty dropped but its chunk still holds.
+//
+// mLogElementsLock must be held when this function is called.
+size_t LogBuffer::prunableSize(log_id_t id) {
+    if (mCompress && compressEnabledForLogid(id)) {
+        return mChunks[id].allocated();
+    }
+    return stats.sizes(id) + mChunks[id].dead();
+}
+
+// Pack sealed chunks that are far enough from the write end. Normally that
+// is just the chunk that was sealed most recently; a chunk skipped because
+// a reader was parked in it is picked up on a later pass, once that reader
+// has moved past it.
+//
+// mLogElementsLock must be held when this function is called.
+void LogBuffer::maybeCompress(log_id_t id) {
+    if (!mCompress || !compressEnabledForLogid(id)) {
+        return;
+    }
+
+    LogBufferChunkRing &ring = mChunks[id];
+    LogBufferChunk *chunk = ring.tail();
+    for (size_t i = 0; chunk && (i < uncompressedChunks); ++i) {
+        chunk = ring.prev(chunk);
+    }
+    if (!chunk || chunk->compressed()) {
+        return;
+    }
+
+    uint64_t oldest = ULLONG_MAX;
+    LogTimeEntry::lock();
+    LastLogTimes::iterator times = mTimes.begin();
+    while (times != mTimes.end()) {
+        LogTimeEntry *entry = (*times);
+        if (entry->mStart < oldest) {
+            oldest = entry->mStart;
+        }
+        times++;
+    }
+    LogTimeEntry::unlock();
+
+    for (size_t tries = 0; chunk && (tries < maxCompressTries); ++tries) {
+        if (chunk->compressed()) {
+            break;
+        }
+        // compress() may free the chunk, step first
+        LogBufferChunk *prev = ring.prev(chunk);
+        uint64_t retry = chunk->retrySequence();
+        if (!chunk->incompressible() && (!retry || (retry < oldest))) {
+            compress(id, chunk, oldest);
+        }
+        chunk = prev;
+    }
+}
+
+// Repack the live entries of a sealed chunk into a new chunk holding just
+// their headers followed by one compressed block of all their payloads.
+// The headers move, so nothing may hold an iterator into the chunk: reader
+// threads only keep one across the unlocked socket write, positioned at
+// their mStart, and the LogBuffer watermarks are fixed up below. |oldest|
+// is the lowest mStart of any reader.
+//
+// mLogElementsLock must be held when this function is called.
+bool LogBuffer::compress(log_id_t id, LogBufferChunk *chunk, uint64_t oldest) {
+    if (chunk->capacity() > LogBufferChunk::kChunkSize) {
+        chunk->setIncompressible(); // oversized single entry
+        return false;
+    }
+
+    size_t count = 0;
+    size_t raw = 0;
+    uint64_t last = 0;
+    for (void *p = chunk->firstLive(); p; p = chunk->nextLive(p)) {
+        LogBufferElement *element = static_cast<LogBufferElement *>(p);
+        last = element->getSequence();
+        ++count;
+        raw += element->getMsgLen();
+    }
+    if (last >= oldest) {
+        // Entries are in sequence order, a reader is at or before the last
+        chunk->setRetrySequence(last);
+        return false;
+    }
+    if (!count || !raw) {
+        return false;
+    }
+
+    struct timespec begin;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    std::unique_ptr<char[]> in(new char[raw]);
+    std::unique_ptr<char[]> out(new char[raw]);
+    size_t offset = 0;
+    for (void *p = chunk->firstLive(); p; p = chunk->nextLive(p)) {
+        LogBufferElement *element = static_cast<LogBufferElement *>(p);
+        if (element->getDropped()) {
+            continue;
+        }
+        memcpy(in.get() + offset, element->getMsg(), element->getMsgLen());
+        offset += element->getMsgLen();
+    }
+    raw = offset;
+
+    size_t headers = count * LogBufferChunk::align(sizeof(LogBufferElement));
+    // Must save at least an eighth of the memory to be worth the copy
+    size_t budget = chunk->used() - (chunk->used() / 8);
+    size_t packed = 0;
+    if (raw && (budget > headers)) {
+        packed = android::logCompress(in.get(), raw, out.get(),
+                                      std::min(raw, budget - headers));
+    }
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t ns = (end.tv_sec - begin.tv_sec) * NS_PER_SEC
+                + end.tv_nsec - begin.tv_nsec;
+
+    if (!packed) {
+        chunk->setIncompressible();
+        stats.compressed(id, 0, 0, ns);
+        return false;
+    }
+
+    LogBufferChunkRing &ring = mChunks[id];
+    LogBufferChunk *repacked = ring.insertChunk(chunk, headers + packed);
+    if (!repacked) {
+        return false;
+    }
+
+    offset = 0;
+    void *next;
+    for (void *p = chunk->firstLive(); p; p = next) {
+        next = chunk->nextLive(p);
+        LogBufferElement *element = static_cast<LogBufferElement *>(p);
+        LogBufferElement *moved = ::new (ring.allocate(repacked,
+                                                       sizeof(LogBufferElement)))
+            LogBufferElement(*element);
+        moved->mPayloadOffset = offset;
+        offset += element->getMsgLen();
+
+        LogBufferElementCollection::iterator from =
+            LogBufferElementCollection::iterator_to(element);
+        LogBufferElementCollection::iterator to =
+            LogBufferElementCollection::iterator_to(moved);
+        log_id_for_each(i) {
+            if (mLastSet[i] && (mLast[i] == from)) {
+                mLast[i] = to;
+            }
+        }
+
+        mLogElements.replace(element, moved);
+        LogBufferElementChain<CHAIN_UID>::replace(element, moved);
+        LogBufferElementChain<CHAIN_PID_OF_SYSTEM>::replace(element, moved);
+        delete element; // frees the old chunk along with its last entry
+    }
+
+    memcpy(ring.setBlock(repacked, packed, raw), out.get(), packed);
+
+    stats.compressed(id, raw, packed, ns);
+
+    return true;
+}
+
+// Return the payload of a compressed entry, inflating its chunk into the
+// per call cache unless that chunk is the one already there.
+//
+// mLogElementsLock must be held for read when this function is called.
+const char *LogBuffer::inflate(LogBufferElement *element,
+                               InflateCache &cache) {
+    LogBufferChunk *chunk = LogBufferChunk::chunkOf(element);
+
+    if (cache.serial != chunk->serial()) {
+        if (!cache.buffer) {
+            cache.buffer.reset(new char[LogBufferChunk::kChunkSize]);
+        }
+
+        struct timespec begin;
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+
+        ssize_t ret = android::logDecompress(chunk->block(),
+                                             chunk->blockSize(),
+                                             cache.buffer.get(),
+                                             LogBufferChunk::kChunkSize);
+
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        stats.inflated(element->getLogId(),
+                       (end.tv_sec - begin.tv_sec) * NS_PER_SEC
+                           + end.tv_nsec - begin.tv_nsec);
+
+        if ((ret < 0) || ((size_t)ret != chunk->rawSize())) {
+            cache.serial = 0;
+            return NULL;
+        }
+        cache.serial = chunk->serial();
+    }
+
+    return cache.buffer.get() + element->getPayloadOffset();
+}
+
 // Prune at most 10% of the log entries or maxPrune, whichever is less.
 //
 // mLogElementsLock must be held when this function is called.
 void LogBuffer::maybePrune(log_id_t id) {
-    size_t sizes = stats.sizes(id);
+    size_t sizes = prunableSize(id);
     unsigned long maxSize = log_buffer_size(id);
     if (sizes > maxSize) {
         size_t sizeOver = sizes - ((maxSize * 9) / 10);
@@ -695,26 +965,8 @@ void LogBuffer::maybePrune(log_id_t id) {
 LogBufferElementCollection::iterator LogBuffer::erase(
         LogBufferElementCollection::iterator it, bool coalesce) {
     LogBufferElement *element = *it;
-    log_id_t id = element->getLogId();
-
-    {   // start of scope for uid found iterator
-        LogBufferIteratorMap::iterator found =
-            mLastWorstUid[id].find(element->getUid());
-        if ((found != mLastWorstUid[id].end())
-                && (it == found->second)) {
-            mLastWorstUid[id].erase(found);
-        }
-    }
 
-    if (element->getUid() == AID_SYSTEM) {
-        // start of scope for pid found iterator
-        LogBufferPidIteratorMap::iterator found =
-            mLastWorstPidOfSystem[id].find(element->getPid());
-        if ((found != mLastWorstPidOfSystem[id].end())
-                && (it == found->second)) {
-            mLastWorstPidOfSystem[id].erase(found);
-        }
-    }
+    unlink(element);
 
     bool setLast[LOG_ID_MAX];
     bool doSetLast = false;
@@ -743,6 +995,62 @@ LogBufferElementCollection::iterator LogBuffer::erase(
     return it;
 }
 
+// Thread a newly inserted element onto the chains of its source. Elements
+// land at, or within a few places of, the end of mLogElements; counting the
+// later entries of the same source gives the position on each chain.
+//
+// mLogElementsLock must be held when this function is called.
+void LogBuffer::link(LogBufferElement *element) {
+    log_id_t id = element->getLogId();
+    uid_t uid = element->getUid();
+    pid_t pid = element->getPid();
+    bool system = uid == AID_SYSTEM;
+
+    size_t uidAfter = 0;
+    size_t pidAfter = 0;
+    LogBufferElementCollection::iterator it =
+        LogBufferElementCollection::iterator_to(element);
+    for (++it; it != mLogElements.end(); ++it) {
+        LogBufferElement *later = *it;
+        if ((later->getLogId() != id) || (later->getUid() != uid)) {
+            continue;
+        }
+        ++uidAfter;
+        if (system && (later->getPid() == pid)) {
+            ++pidAfter;
+        }
+    }
+
+    mUidChains[id][uid].insert(element, uidAfter);
+    if (system) {
+        mPidOfSystemChains[id][pid].insert(element, pidAfter);
+    }
+}
+
+// mLogElementsLock must be held when this function is called.
+void LogBuffer::unlink(LogBufferElement *element) {
+    log_id_t id = element->getLogId();
+
+    LogBufferUidChains::iterator uids = mUidChains[id].find(element->getUid());
+    if (uids != mUidChains[id].end()) {
+        uids->second.erase(element);
+        if (uids->second.empty()) {
+            mUidChains[id].erase(uids);
+        }
+    }
+
+    if (element->getUid() == AID_SYSTEM) {
+        LogBufferPidChains::iterator pids =
+            mPidOfSystemChains[id].find(element->getPid());
+        if (pids != mPidOfSystemChains[id].end()) {
+            pids->second.erase(element);
+            if (pids->second.empty()) {
+                mPidOfSystemChains[id].erase(pids);
+            }
+        }
+    }
+}
+
 // Define a temporary mechanism to report the last LogBufferElement pointer
 // for the specified uid, pid and tid. Used below to help merge-sort when
 // pruning for worst UID.
@@ -893,14 +1201,15 @@ bool LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
 
     LogBufferElementCollection::iterator it;
 
-    if (stats.sizes(id) > (100 * log_buffer_size(id))) {
+    if (prunableSize(id) > (100 * log_buffer_size(id))) {
 #if defined(__LP64__)
         kernel_log_print("logd: the %d log size is %lu.\n", id, stats.sizes(id));
 #else
         kernel_log_print("logd: the %d log size is %d.\n", id, stats.sizes(id));
 #endif
     if (pruneRows == maxPrune) {
-        pruneRows = stats.realElements(id) * (stats.sizes(id) - log_buffer_size(id)) / stats.sizes(id);
+        size_t sizes = prunableSize(id);
+        pruneRows = stats.realElements(id) * (sizes - log_buffer_size(id)) / sizes;
     }
 
 times = mTimes.begin();
@@ -968,20 +1277,12 @@ times = mTimes.begin();
 
     if (caller_uid != AID_ROOT) {
         // Only here if clearAll condition (pruneRows == ULONG_MAX)
-        it = mLastSet[id] ? mLast[id] : mLogElements.begin();
-        while (it != mLogElements.end()) {
-            LogBufferElement *element = *it;
-
-            if ((element->getLogId() != id) || (element->getUid() != caller_uid)) {
-                ++it;
-                continue;
-            }
-
-            if (!mLastSet[id] || ((*mLast[id])->getLogId() != id)) {
-                mLast[id] = it;
-                mLastSet[id] = true;
-            }
-
+        LogBufferUidChains::iterator found = mUidChains[id].find(caller_uid);
+        LogBufferElement *element = NULL;
+        if (found != mUidChains[id].end()) {
+            element = found->second.front();
+        }
+        while (element) {
             if (oldest && (oldest->mStart <= element->getSequence())) {
                 busy = true;
                 if (oldest->mTimeout.tv_sec || oldest->mTimeout.tv_nsec) {
@@ -992,8 +1293,11 @@ times = mTimes.begin();
                 break;
             }
 
-            it = erase(it);
+            // the chain is released along with its last entry
+            LogBufferElement *next = found->second.next(element);
+            erase(LogBufferElementCollection::iterator_to(element));
             pruneRows--;
+            element = next;
         }
         LogTimeEntry::unlock();
         return busy;
@@ -1001,9 +1305,7 @@ times = mTimes.begin();
 
     // prune by worst offenders; by blacklist, UID, and by PID of system UID
     bool hasBlacklist = (id != LOG_ID_SECURITY) && mPrune.naughty();
-#if 0
-    goto PRUNE;
-    while (!clearAll && (pruneRows > 0)) {
+    while (mChatty && !clearAll && (pruneRows > 0)) {
         // recalculate the worst offender on every batched pass
         uid_t worst = (uid_t) -1;
         size_t worst_sizes = 0;
@@ -1050,33 +1352,39 @@ times = mTimes.begin();
             break;
         }
 
-        bool kick = false;
-        bool leading = true;
-        it = mLastSet[id] ? mLast[id] : mLogElements.begin();
-        // Perform at least one mandatory garbage collection cycle in following
-        // - clear leading chatty tags
-        // - coalesce chatty tags
-        // - check age-out of preserved logs
-        bool gc = pruneRows <= 1;
-        if (!gc && (worst != (uid_t) -1)) {
-            {   // begin scope for uid worst found iterator
-                LogBufferIteratorMap::iterator found = mLastWorstUid[id].find(worst);
-                if ((found != mLastWorstUid[id].end())
-                        && (found->second != mLogElements.end())) {
-                    leading = false;
-                    it = found->second;
-                }
-            }
+        // Without a blacklist to apply, only the entries of the worst
+        // offender are of interest: follow its chain from the oldest entry
+        // rather than walking the whole log. The chain goes away with its
+        // last entry, so it is only touched while there is a next entry.
+        LogBufferElementChain<CHAIN_UID> *uidChain = NULL;
+        LogBufferElementChain<CHAIN_PID_OF_SYSTEM> *pidChain = NULL;
+        LogBufferElement *follow = NULL;
+        if (!hasBlacklist) {
             if (worstPid) {
-                // begin scope for pid worst found iterator
-                LogBufferPidIteratorMap::iterator found
-                    = mLastWorstPidOfSystem[id].find(worstPid);
-                if ((found != mLastWorstPidOfSystem[id].end())
-                        && (found->second != mLogElements.end())) {
-                    leading = false;
-                    it = found->second;
+                LogBufferPidChains::iterator found =
+                    mPidOfSystemChains[id].find(worstPid);
+                if (found != mPidOfSystemChains[id].end()) {
+                    pidChain = &found->second;
+                    follow = pidChain->front();
+                }
+            } else {
+                LogBufferUidChains::iterator found = mUidChains[id].find(worst);
+                if (found != mUidChains[id].end()) {
+                    uidChain = &found->second;
+                    follow = uidChain->front();
                 }
             }
+            if (!follow) {
+                break;
+            }
+        }
+
+        bool kick = false;
+        bool leading = !follow;
+        if (follow) {
+            it = LogBufferElementCollection::iterator_to(follow);
+        } else {
+            it = mLastSet[id] ? mLast[id] : mLogElements.begin();
         }
         static const timespec too_old = {
             EXPIRE_HOUR_THRESHOLD * 60 * 60, 0
@@ -1085,9 +1393,20 @@ times = mTimes.begin();
         lastt = mLogElements.end();
         --lastt;
         LogBufferElementLast last;
-        while (it != mLogElements.end()) {
+        LogBufferElement *next = NULL;
+        // when following a chain every path below moves on to its next entry
+        for (; it != mLogElements.end();
+                it = !follow ? it
+                   : next ? LogBufferElementCollection::iterator_to(next)
+                   : mLogElements.end()) {
             LogBufferElement *element = *it;
 
+            if (uidChain) {
+                next = uidChain->next(element);
+            } else if (pidChain) {
+                next = pidChain->next(element);
+            }
+
             if (oldest && (oldest->mStart <= element->getSequence())) {
                 busy = true;
                 if (oldest->mTimeout.tv_sec || oldest->mTimeout.tv_nsec) {
@@ -1121,6 +1440,9 @@ times = mTimes.begin();
 
             if (hasBlacklist && mPrune.naughty(element)) {
                 last.clear(element);
+                // erase() frees the element
+                uid_t uid = element->getUid();
+                unsigned short len = element->getMsgLen();
                 it = erase(it);
                 if (dropped) {
                     continue;
@@ -1131,12 +1453,12 @@ times = mTimes.begin();
                     break;
                 }
 
-                if (element->getUid() == worst) {
+                if (uid == worst) {
                     kick = true;
                     if (worst_sizes < second_worst_sizes) {
                         break;
                     }
-                    worst_sizes -= element->getMsgLen();
+                    worst_sizes -= len;
                 }
                 continue;
             }
@@ -1148,17 +1470,6 @@ times = mTimes.begin();
 
             if (dropped) {
                 last.add(element);
-                if (worstPid
-                        && ((!gc && (element->getPid() == worstPid))
-                            || (mLastWorstPidOfSystem[id].find(element->getPid())
-                                == mLastWorstPidOfSystem[id].end()))) {
-                    mLastWorstPidOfSystem[id][element->getUid()] = it;
-                }
-                if ((!gc && !worstPid && (element->getUid() == worst))
-                        || (mLastWorstUid[id].find(element->getUid())
-                            == mLastWorstUid[id].end())) {
-                    mLastWorstUid[id][element->getUid()] = it;
-                }
                 ++it;
                 continue;
             }
@@ -1184,21 +1495,16 @@ times = mTimes.begin();
             if (leading) {
                 it = erase(it);
             } else {
+                if (follow) {
+                    // no other sources pass by to age out merge targets
+                    last.clear(element);
+                }
                 stats.drop(element);
                 element->setDropped(1);
                 if (last.coalesce(element, 1)) {
                     it = erase(it, true);
                 } else {
                     last.add(element);
-                    if (worstPid && (!gc
-                                || (mLastWorstPidOfSystem[id].find(worstPid)
-                                    == mLastWorstPidOfSystem[id].end()))) {
-                        mLastWorstPidOfSystem[id][worstPid] = it;
-                    }
-                    if ((!gc && !worstPid) || (mLastWorstUid[id].find(worst)
-                                == mLastWorstUid[id].end())) {
-                        mLastWorstUid[id][worst] = it;
-                    }
                     ++it;
                 }
             }
@@ -1213,8 +1519,7 @@ times = mTimes.begin();
             break; // the following loop will ask bad clients to skip/drop
         }
     }
-PRUNE:
-#endif
+
     bool whitelist = false;
     bool hasWhitelist = (id != LOG_ID_SECURITY) && mPrune.nice() && !clearAll;
     it = mLastSet[id] ? mLast[id] : mLogElements.begin();
@@ -1237,7 +1542,7 @@ PRUNE:
                 break;
             }
 
-            if (stats.sizes(id) > (2 * log_buffer_size(id))) {
+            if (prunableSize(id) > (2 * log_buffer_size(id))) {
                 // kick a misbehaving log reader client off the island
                 oldest->release_Locked();
             } else if (oldest->mTimeout.tv_sec || oldest->mTimeout.tv_nsec) {
@@ -1277,7 +1582,7 @@ PRUNE:
 
             if (oldest && (oldest->mStart <= element->getSequence())) {
                 busy = true;
-                if (stats.sizes(id) > (2 * log_buffer_size(id))) {
+                if (prunableSize(id) > (2 * log_buffer_size(id))) {
                     // kick a misbehaving log reader client off the island
                     oldest->release_Locked();
                 } else if (oldest->mTimeout.tv_sec || oldest->mTimeout.tv_nsec) {
@@ -1308,9 +1613,9 @@ bool LogBuffer::clear(log_id_t id, uid_t uid) {
             // one entry, not another clear run, so we are looking for
             // the quick side effect of the return value to tell us if
             // we have a _blocked_ reader.
-            pthread_mutex_lock(&mLogElementsLock);
+            pthread_rwlock_wrlock(&mLogElementsLock);
             busy = prune(id, 1, uid);
-            pthread_mutex_unlock(&mLogElementsLock);
+            pthread_rwlock_unlock(&mLogElementsLock);
             // It is still busy, blocked reader(s), lets kill them all!
             // otherwise, lets be a good citizen and preserve the slow
             // readers and let the clear run (below) deal with determining
@@ -1329,9 +1634,9 @@ bool LogBuffer::clear(log_id_t id, uid_t uid) {
                 LogTimeEntry::unlock();
             }
         }
-        pthread_mutex_lock(&mLogElementsLock);
+        pthread_rwlock_wrlock(&mLogElementsLock);
         busy = prune(id, ULONG_MAX, uid);
-        pthread_mutex_unlock(&mLogElementsLock);
+        pthread_rwlock_unlock(&mLogElementsLock);
         if (!busy || !--retry) {
             break;
         }
@@ -1342,9 +1647,9 @@ bool LogBuffer::clear(log_id_t id, uid_t uid) {
 
 // get the used space associated with "id".
 unsigned long LogBuffer::getSizeUsed(log_id_t id) {
-    pthread_mutex_lock(&mLogElementsLock);
+    pthread_rwlock_rdlock(&mLogElementsLock);
     size_t retval = stats.sizes(id);
-    pthread_mutex_unlock(&mLogElementsLock);
+    pthread_rwlock_unlock(&mLogElementsLock);
     return retval;
 }
 
@@ -1354,17 +1659,17 @@ int LogBuffer::setSize(log_id_t id, unsigned long size) {
     if (!valid_size(size)) {
         return -1;
     }
-    pthread_mutex_lock(&mLogElementsLock);
+    pthread_rwlock_wrlock(&mLogElementsLock);
     log_buffer_size(id) = size;
-    pthread_mutex_unlock(&mLogElementsLock);
+    pthread_rwlock_unlock(&mLogElementsLock);
     return 0;
 }
 
 // get the total space allocated to "id"
 unsigned long LogBuffer::getSize(log_id_t id) {
-    pthread_mutex_lock(&mLogElementsLock);
+    pthread_rwlock_rdlock(&mLogElementsLock);
     size_t retval = log_buffer_size(id);
-    pthread_mutex_unlock(&mLogElementsLock);
+    pthread_rwlock_unlock(&mLogElementsLock);
     return retval;
 }
 
@@ -1376,8 +1681,9 @@ uint64_t LogBuffer::flushTo(
     uint64_t max = start;
     uid_t uid = reader->getUid();
     LogTimeEntry *me = reinterpret_cast<LogTimeEntry *>(arg);
+    InflateCache cache;
 
-    pthread_mutex_lock(&mLogElementsLock);
+    pthread_rwlock_rdlock(&mLogElementsLock);
 
     if (start <= 1) {
         // client wants to start from the beginning
@@ -1411,6 +1717,7 @@ uint64_t LogBuffer::flushTo(
         }
 
         // NB: calling out to another object with mLogElementsLock held (safe)
+        // as a reader; other reader threads may run the filters concurrently
         if (filter) {
             int ret = (*filter)(element, arg);
             if (ret == false) {
@@ -1421,31 +1728,39 @@ uint64_t LogBuffer::flushTo(
             }
         }
 
-        pthread_mutex_unlock(&mLogElementsLock);
+        const char *msg = NULL;
+        if (element->getMsgLen() && element->isCompressed()) {
+            msg = inflate(element, cache);
+            if (!msg) {
+                continue;
+            }
+        }
+
+        pthread_rwlock_unlock(&mLogElementsLock);
 
         // range locking in LastLogTimes looks after us
-        max = element->flushTo(reader, this, privileged);
+        max = element->flushTo(reader, this, privileged, msg);
 
         if (max == element->FLUSH_ERROR) {
             return max;
         }
 
-        pthread_mutex_lock(&mLogElementsLock);
+        pthread_rwlock_rdlock(&mLogElementsLock);
         if (me->isError_Locked())
             break;
     }
-    pthread_mutex_unlock(&mLogElementsLock);
+    pthread_rwlock_unlock(&mLogElementsLock);
 
     return max;
 }
 
 std::string LogBuffer::formatStatistics(uid_t uid, pid_t pid,
                                         unsigned int logMask) {
-    pthread_mutex_lock(&mLogElementsLock);
+    pthread_rwlock_rdlock(&mLogElementsLock);
 
     std::string ret = stats.format(uid, pid, logMask);
 
-    pthread_mutex_unlock(&mLogElementsLock);
+    pthread_rwlock_unlock(&mLogElementsLock);
 
     return ret;
 }
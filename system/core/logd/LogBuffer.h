@@ -17,9 +17,10 @@
 #ifndef _LOGD_LOG_BUFFER_H__
 #define _LOGD_LOG_BUFFER_H__
 
+#include <pthread.h>
 #include <sys/types.h>
 
-#include <list>
+#include <memory>
 #include <string>
 
 #include <log/log.h>
@@ -28,6 +29,7 @@
 #include <private/android_filesystem_config.h>
 
 #include "LogBufferElement.h"
+#include "LogPersist.h"
 #include "LogTimes.h"
 #include "LogStatistics.h"
 #include "LogWhiteBlackList.h"
@@ -73,11 +75,14 @@ static bool isMonotonic(const log_time &mono) {
 
 }
 
-typedef std::list<LogBufferElement *> LogBufferElementCollection;
-
 class LogBuffer {
+    // Time sorted view over all log ids, entries are stored in mChunks
     LogBufferElementCollection mLogElements;
-    pthread_mutex_t mLogElementsLock;
+    LogBufferChunkRing mChunks[LOG_ID_MAX];
+    // Readers (flushTo) share the lock and drop it around every socket
+    // write, the range lock in LastLogTimes keeps their position alive.
+    // Writers (log, prune, clear) hold it exclusively.
+    pthread_rwlock_t mLogElementsLock;
 
     LogStatistics stats;
 
@@ -85,20 +90,25 @@ class LogBuffer {
     // watermark for last per log id
     LogBufferElementCollection::iterator mLast[LOG_ID_MAX];
     bool mLastSet[LOG_ID_MAX];
-    // watermark of any worst/chatty uid processing
-    typedef std::unordered_map<uid_t,
-                               LogBufferElementCollection::iterator>
-                LogBufferIteratorMap;
-    LogBufferIteratorMap mLastWorstUid[LOG_ID_MAX];
-    // watermark of any worst/chatty pid of system processing
+    // entries of each uid, for worst/chatty uid processing
+    typedef std::unordered_map<uid_t, LogBufferElementChain<CHAIN_UID>>
+                LogBufferUidChains;
+    LogBufferUidChains mUidChains[LOG_ID_MAX];
+    // entries of each pid of system, for worst/chatty pid processing
     typedef std::unordered_map<pid_t,
-                               LogBufferElementCollection::iterator>
-                LogBufferPidIteratorMap;
-    LogBufferPidIteratorMap mLastWorstPidOfSystem[LOG_ID_MAX];
+                               LogBufferElementChain<CHAIN_PID_OF_SYSTEM>>
+                LogBufferPidChains;
+    LogBufferPidChains mPidOfSystemChains[LOG_ID_MAX];
 
     unsigned long mMaxSize[LOG_ID_MAX];
 
     bool monotonic;
+    // persist.logd.compress, pack sealed chunks of the text buffers
+    bool mCompress;
+    // persist.logd.chatty, prune the worst UID/PID offenders first
+    bool mChatty;
+    // persist.logd.logpersistd=logd, copy of every entry to the store
+    LogPersist *mPersist;
 
 public:
     LastLogTimes &mTimes;
@@ -106,6 +116,7 @@ public:
     LogBuffer(LastLogTimes *times);
     void init();
     bool isMonotonic() { return monotonic; }
+    void setPersist(LogPersist *persist);
 
     int log(log_id_t log_id, log_time realtime,
             uid_t uid, pid_t pid, pid_t tid,
@@ -133,18 +144,40 @@ public:
     const char *pidToName(pid_t pid) { return stats.pidToName(pid); }
     uid_t pidToUid(pid_t pid) { return stats.pidToUid(pid); }
     const char *uidToName(uid_t uid) { return stats.uidToName(uid); }
-    void lock() { pthread_mutex_lock(&mLogElementsLock); }
-    void unlock() { pthread_mutex_unlock(&mLogElementsLock); }
+    void lock() { pthread_rwlock_wrlock(&mLogElementsLock); }
+    void unlock() { pthread_rwlock_unlock(&mLogElementsLock); }
 
 private:
 
     static constexpr size_t minPrune = 4;
     static constexpr size_t maxPrune = 256;
 
+    // Chunks closest to the write end that are left uncompressed, they are
+    // what tailing readers and the next prune pass are most likely to touch
+    static constexpr size_t uncompressedChunks = 2;
+    static constexpr size_t maxCompressTries = 4;
+
+    // Last chunk inflated by a flushTo() caller, one per reader call
+    struct InflateCache {
+        uint64_t serial;
+        std::unique_ptr<char[]> buffer;
+
+        InflateCache() : serial(0) { }
+    };
+
+    void initPersist();
+
+    size_t prunableSize(log_id_t id);
+    void maybeCompress(log_id_t id);
+    bool compress(log_id_t id, LogBufferChunk *chunk, uint64_t oldest);
+    const char *inflate(LogBufferElement *element, InflateCache &cache);
+
     void maybePrune(log_id_t id);
     bool prune(log_id_t id, unsigned long pruneRows, uid_t uid = AID_ROOT);
     LogBufferElementCollection::iterator erase(
         LogBufferElementCollection::iterator it, bool coalesce = false);
+    void link(LogBufferElement *element);
+    void unlink(LogBufferElement *element);
 };
 
 #endif // _LOGD_LOG_BUFFER_H__
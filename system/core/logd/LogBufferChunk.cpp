@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "LogBufferChunk.h"
+
+uint64_t LogBufferChunkRing::sSerial;
+
+void *LogBufferChunk::firstLive() const {
+    for (size_t word = 0; word < kMapWords; ++word) {
+        if (mLiveMap[word]) {
+            size_t bit = (word * 64) + __builtin_ctzll(mLiveMap[word]);
+            return data() + (bit * kAlignment);
+        }
+    }
+    return NULL;
+}
+
+void *LogBufferChunk::nextLive(const void *p) const {
+    size_t bit = ((static_cast<const char *>(p) - data()) / kAlignment) + 1;
+    size_t word = bit / 64;
+    if (word >= kMapWords) {
+        return NULL;
+    }
+    uint64_t map = mLiveMap[word] & (~0ULL << (bit % 64));
+    for (;;) {
+        if (map) {
+            bit = (word * 64) + __builtin_ctzll(map);
+            return data() + (bit * kAlignment);
+        }
+        if (++word >= kMapWords) {
+            return NULL;
+        }
+        map = mLiveMap[word];
+    }
+}
+
+LogBufferChunkRing::LogBufferChunkRing() :
+        mHead(NULL),
+        mTail(NULL),
+        mSpare(NULL),
+        mChunks(0),
+        mAllocated(0),
+        mDead(0) {
+}
+
+LogBufferChunkRing::~LogBufferChunkRing() {
+    while (mHead) {
+        LogBufferChunk *chunk = mHead;
+        mHead = chunk->mNext;
+        free(chunk);
+    }
+    free(mSpare);
+}
+
+// Link a new chunk in after "after", or at the tail if NULL
+LogBufferChunk *LogBufferChunkRing::newChunk(size_t capacity,
+                                             LogBufferChunk *after) {
+    LogBufferChunk *chunk;
+    size_t size;
+
+    if (!after && mSpare && (capacity <= mSpare->mCapacity)) {
+        chunk = mSpare;
+        mSpare = NULL;
+        size = sizeof(LogBufferChunk) + chunk->mCapacity;
+    } else {
+        size = sizeof(LogBufferChunk) + capacity;
+        // write chunks are always full size, repacked chunks are exact
+        if (!after && (size < LogBufferChunk::kChunkSize)) {
+            size = LogBufferChunk::kChunkSize;
+        }
+        void *p = NULL;
+        if (posix_memalign(&p, LogBufferChunk::kChunkSize, size)) {
+            return NULL;
+        }
+        chunk = static_cast<LogBufferChunk *>(p);
+        chunk->mRing = this;
+        chunk->mCapacity = size - sizeof(LogBufferChunk);
+    }
+    mAllocated += size;
+
+    chunk->mUsed = 0;
+    chunk->mLive = 0;
+    chunk->mDead = 0;
+    chunk->mFlags = 0;
+    chunk->mRawSize = 0;
+    chunk->mBlockSize = 0;
+    chunk->mBlock = 0;
+    chunk->mSerial = 0;
+    chunk->mRetry = 0;
+    memset(chunk->mLiveMap, 0, sizeof(chunk->mLiveMap));
+
+    if (!after) {
+        after = mTail;
+    }
+    chunk->mPrev = after;
+    if (after) {
+        chunk->mNext = after->mNext;
+        after->mNext = chunk;
+    } else {
+        chunk->mNext = mHead;
+        mHead = chunk;
+    }
+    if (chunk->mNext) {
+        chunk->mNext->mPrev = chunk;
+    } else {
+        mTail = chunk;
+    }
+    ++mChunks;
+
+    return chunk;
+}
+
+void LogBufferChunkRing::freeChunk(LogBufferChunk *chunk) {
+    if (chunk->mPrev) {
+        chunk->mPrev->mNext = chunk->mNext;
+    } else {
+        mHead = chunk->mNext;
+    }
+    if (chunk->mNext) {
+        chunk->mNext->mPrev = chunk->mPrev;
+    } else {
+        mTail = chunk->mPrev;
+    }
+    --mChunks;
+
+    mDead -= chunk->mDead;
+    size_t size = sizeof(LogBufferChunk) + chunk->mCapacity;
+    mAllocated -= size;
+    if (!mSpare && (size == LogBufferChunk::kChunkSize)) {
+        mSpare = chunk;
+        return;
+    }
+    free(chunk);
+}
+
+void *LogBufferChunkRing::allocate(LogBufferChunk *chunk, size_t size) {
+    size = LogBufferChunk::align(size);
+
+    // An entry must start within the first kChunkSize bytes of its chunk
+    // for chunkOf() to find it, which only an oversized chunk could break.
+    if (((chunk->mCapacity - chunk->mUsed) < size)
+            || ((sizeof(LogBufferChunk) + chunk->mUsed)
+                    >= LogBufferChunk::kChunkSize)) {
+        return NULL;
+    }
+
+    size_t bit = chunk->mUsed / LogBufferChunk::kAlignment;
+    chunk->mLiveMap[bit / 64] |= 1ULL << (bit % 64);
+
+    void *p = chunk->data() + chunk->mUsed;
+    chunk->mUsed += size;
+    ++chunk->mLive;
+    return p;
+}
+
+void *LogBufferChunkRing::allocate(size_t size) {
+    if (mTail && !mTail->compressed()) {
+        void *p = allocate(mTail, size);
+        if (p) {
+            return p;
+        }
+    }
+
+    LogBufferChunk *chunk = newChunk(LogBufferChunk::align(size), NULL);
+    if (!chunk) {
+        return NULL;
+    }
+    return allocate(chunk, size);
+}
+
+LogBufferChunk *LogBufferChunkRing::insertChunk(LogBufferChunk *pos,
+                                                size_t capacity) {
+    return newChunk(capacity, pos);
+}
+
+char *LogBufferChunkRing::setBlock(LogBufferChunk *chunk, size_t size,
+                                   size_t rawSize) {
+    size_t offset = LogBufferChunk::align(chunk->mUsed);
+    if ((chunk->mCapacity < offset) || ((chunk->mCapacity - offset) < size)) {
+        return NULL;
+    }
+    chunk->mFlags |= LogBufferChunk::FLAG_COMPRESSED;
+    chunk->mBlock = offset;
+    chunk->mBlockSize = size;
+    chunk->mRawSize = rawSize;
+    chunk->mSerial = ++sSerial;
+    chunk->mUsed = offset + size;
+    return chunk->data() + offset;
+}
+
+void LogBufferChunkRing::release(void *p) {
+    LogBufferChunk *chunk = LogBufferChunk::chunkOf(p);
+
+    size_t bit = (static_cast<char *>(p) - chunk->data())
+               / LogBufferChunk::kAlignment;
+    chunk->mLiveMap[bit / 64] &= ~(1ULL << (bit % 64));
+
+    if (--chunk->mLive) {
+        return;
+    }
+    if ((chunk == mTail) && !chunk->compressed()) {
+        // Still the write chunk, rewind rather than return it
+        chunk->mUsed = 0;
+        mDead -= chunk->mDead;
+        chunk->mDead = 0;
+        return;
+    }
+    freeChunk(chunk);
+}
+
+void LogBufferChunkRing::drop(void *p, size_t size) {
+    LogBufferChunk *chunk = LogBufferChunk::chunkOf(p);
+
+    // A compressed chunk is held against the budget by what it allocated
+    if (chunk->compressed()) {
+        return;
+    }
+    chunk->mDead += size;
+    mDead += size;
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_BUFFER_CHUNK_H__
+#define _LOGD_LOG_BUFFER_CHUNK_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+class LogBufferChunkRing;
+
+// A chunk is one contiguous block of memory that holds a run of
+// LogBufferElement headers, each followed inline by its payload. Entries
+// are carved out with a bump pointer and the chunk is handed back to the
+// system once every entry in it has been erased.
+//
+// Chunks are allocated aligned to their nominal size, so the owning chunk
+// of any entry is found by masking the entry address. An entry larger than
+// a chunk gets a dedicated, oversized chunk of its own; it still starts
+// inside the first kChunkSize bytes so the mask continues to hold.
+//
+// A bitmap of entry start offsets lets the storage be walked in place,
+// which is how a sealed chunk is found and repacked for compression.
+// A compressed chunk holds only the entry headers, followed by one block
+// with the payloads of all its entries (see LogCompress.h).
+class LogBufferChunk {
+    friend LogBufferChunkRing;
+
+public:
+    static constexpr size_t kChunkSize = 32 * 1024;
+    static constexpr size_t kAlignment = sizeof(uint64_t);
+
+private:
+    static constexpr size_t kMapWords = kChunkSize / kAlignment / 64;
+
+    LogBufferChunkRing *mRing;
+    LogBufferChunk *mPrev;
+    LogBufferChunk *mNext;
+    size_t mCapacity; // payload bytes following this header
+    size_t mUsed;     // payload bytes handed out
+    size_t mLive;     // entries not yet released
+    size_t mDead;     // payload bytes of dropped entries, still held
+    uint32_t mFlags;
+    uint32_t mRawSize;   // payload bytes represented by the block
+    uint32_t mBlockSize; // compressed bytes at mBlock
+    uint32_t mBlock;     // offset of the block in data()
+    uint64_t mSerial;    // unique for the life of logd, for inflate caches
+    uint64_t mRetry;     // see retrySequence()
+    uint64_t mLiveMap[kMapWords];
+
+    char *data() const {
+        return reinterpret_cast<char *>(const_cast<LogBufferChunk *>(this + 1));
+    }
+
+public:
+    static constexpr uint32_t FLAG_COMPRESSED = 0x1;
+    static constexpr uint32_t FLAG_INCOMPRESSIBLE = 0x2;
+
+    static size_t align(size_t size) {
+        return (size + kAlignment - 1) & ~(kAlignment - 1);
+    }
+
+    static LogBufferChunk *chunkOf(const void *p) {
+        return reinterpret_cast<LogBufferChunk *>(
+            reinterpret_cast<uintptr_t>(p) & ~(uintptr_t)(kChunkSize - 1));
+    }
+
+    LogBufferChunkRing *ring() const { return mRing; }
+    size_t capacity() const { return mCapacity; }
+    size_t used() const { return mUsed; }
+    size_t live() const { return mLive; }
+    size_t dead() const { return mDead; }
+
+    bool compressed() const { return mFlags & FLAG_COMPRESSED; }
+    bool incompressible() const { return mFlags & FLAG_INCOMPRESSIBLE; }
+    void setIncompressible() { mFlags |= FLAG_INCOMPRESSIBLE; }
+    // Last entry sequence when a reader held off compression, the chunk is
+    // not tried again until every reader has moved past it; 0 if none did
+    uint64_t retrySequence() const { return mRetry; }
+    void setRetrySequence(uint64_t sequence) { mRetry = sequence; }
+    // only for compressed chunks
+    const char *block() const { return data() + mBlock; }
+    size_t blockSize() const { return mBlockSize; }
+    size_t rawSize() const { return mRawSize; }
+    uint64_t serial() const { return mSerial; }
+
+    // Walk the entries still live in this chunk in address order
+    void *firstLive() const;
+    void *nextLive(const void *p) const;
+};
+
+// The storage for one log id: chunks kept in allocation order, oldest at
+// the head, the chunk currently being filled at the tail. Pruning expires
+// the oldest entries first, so chunks are typically released from the head
+// and the ring stays compact. One empty chunk is held back as a spare to
+// avoid allocator churn when the buffer is running at its size limit.
+//
+// Not thread safe, all calls must be made with mLogElementsLock held.
+class LogBufferChunkRing {
+    LogBufferChunk *mHead;
+    LogBufferChunk *mTail;
+    LogBufferChunk *mSpare;
+    size_t mChunks;
+    size_t mAllocated;
+    size_t mDead;
+    static uint64_t sSerial;
+
+    LogBufferChunk *newChunk(size_t capacity, LogBufferChunk *after);
+    void freeChunk(LogBufferChunk *chunk);
+
+public:
+    LogBufferChunkRing();
+    ~LogBufferChunkRing();
+
+    // returns NULL if out of memory
+    void *allocate(size_t size);
+    void release(void *p);
+    // The size bytes of payload inline after the entry at p are no longer
+    // needed, but stay held until the whole chunk is released
+    void drop(void *p, size_t size);
+
+    // Compaction support: a chunk of exactly capacity bytes linked in after
+    // pos, never becoming the write chunk. Entries are placed in it with
+    // allocate(chunk, size), and its compressed block with setBlock().
+    LogBufferChunk *insertChunk(LogBufferChunk *pos, size_t capacity);
+    void *allocate(LogBufferChunk *chunk, size_t size);
+    char *setBlock(LogBufferChunk *chunk, size_t size, size_t rawSize);
+
+    // Oldest chunk first, for walkers that want to inspect storage
+    LogBufferChunk *head() const { return mHead; }
+    LogBufferChunk *tail() const { return mTail; }
+    static LogBufferChunk *next(const LogBufferChunk *chunk) {
+        return chunk->mNext;
+    }
+    static LogBufferChunk *prev(const LogBufferChunk *chunk) {
+        return chunk->mPrev;
+    }
+
+    size_t chunks() const { return mChunks; }
+    // bytes held by chunks in use, the spare is not included
+    size_t allocated() const { return mAllocated; }
+    // payload bytes held by chunks in use for entries that were dropped
+    size_t dead() const { return mDead; }
+};
+
+#endif // _LOGD_LOG_BUFFER_CHUNK_H__
@@ -42,23 +42,21 @@ LogBufferElement::LogBufferElement(log_id_t log_id, log_time realtime,
         mUid(uid),
         mPid(pid),
         mTid(tid),
-        mMsgLen(len),
         mSequence(sequence.fetch_add(1, memory_order_relaxed)),
-        mRealTime(realtime) {
-    mMsg = new char[len];
-    memcpy(mMsg, msg, len);
-}
-
-LogBufferElement::~LogBufferElement() {
-    delete [] mMsg;
+        mRealTime(realtime),
+        mMsgLen(len),
+        mDropped(0),
+        mPayloadOffset(0) {
+    memcpy(payload(), msg, len);
 }
 
-uint32_t LogBufferElement::getTag() const {
-    if (((mLogId != LOG_ID_EVENTS) && (mLogId != LOG_ID_SECURITY)) ||
-            !mMsg || (mMsgLen < sizeof(uint32_t))) {
+uint32_t LogBufferElement::getTag(log_id_t log_id, const char *msg,
+                                  unsigned short len) {
+    if (((log_id != LOG_ID_EVENTS) && (log_id != LOG_ID_SECURITY)) ||
+            !msg || (len < sizeof(uint32_t))) {
         return 0;
     }
-    return le32toh(reinterpret_cast<android_event_header_t *>(mMsg)->tag);
+    return le32toh(reinterpret_cast<const android_event_header_t *>(msg)->tag);
 }
 
 // caller must own and free character string
@@ -106,7 +104,7 @@ char *android::tidToName(pid_t tid) {
     return retval;
 }
 
-// assumption: mMsg == NULL
+// assumption: mDropped != 0
 size_t LogBufferElement::populateDroppedMessage(char *&buffer,
         LogBuffer *parent) {
     static const char tag[] = "chatty";
@@ -200,21 +198,27 @@ size_t LogBufferElement::populateDroppedMessage(char *&buffer,
     return retval;
 }
 
+void LogBufferElement::populateEntry(struct logger_entry_v4 *entry,
+                                     bool privileged) const {
+    memset(entry, 0, sizeof(struct logger_entry_v4));
+
+    entry->hdr_size = privileged ?
+                          sizeof(struct logger_entry_v4) :
+                          sizeof(struct logger_entry_v3);
+    entry->lid = mLogId;
+    entry->pid = mPid;
+    entry->tid = mTid;
+    entry->uid = mUid;
+    entry->sec = mRealTime.tv_sec;
+    entry->nsec = mRealTime.tv_nsec;
+    entry->len = getMsgLen();
+}
+
 uint64_t LogBufferElement::flushTo(SocketClient *reader, LogBuffer *parent,
-                                   bool privileged) {
+                                   bool privileged, const char *msg) {
     struct logger_entry_v4 entry;
 
-    memset(&entry, 0, sizeof(struct logger_entry_v4));
-
-    entry.hdr_size = privileged ?
-                         sizeof(struct logger_entry_v4) :
-                         sizeof(struct logger_entry_v3);
-    entry.lid = mLogId;
-    entry.pid = mPid;
-    entry.tid = mTid;
-    entry.uid = mUid;
-    entry.sec = mRealTime.tv_sec;
-    entry.nsec = mRealTime.tv_nsec;
+    populateEntry(&entry, privileged);
 
     struct iovec iovec[2];
     iovec[0].iov_base = &entry;
@@ -222,7 +226,7 @@ uint64_t LogBufferElement::flushTo(SocketClient *reader, LogBuffer *parent,
 
     char *buffer = NULL;
 
-    if (!mMsg) {
+    if (mDropped) {
         entry.len = populateDroppedMessage(buffer, parent);
         if (!entry.len) {
             return mSequence;
@@ -230,7 +234,7 @@ uint64_t LogBufferElement::flushTo(SocketClient *reader, LogBuffer *parent,
         iovec[1].iov_base = buffer;
     } else {
         entry.len = mMsgLen;
-        iovec[1].iov_base = mMsg;
+        iovec[1].iov_base = const_cast<char *>(msg ? msg : payload());
     }
     iovec[1].iov_len = entry.len;
 
@@ -25,6 +25,8 @@
 #include <log/log.h>
 #include <log/log_read.h>
 
+#include "LogBufferChunk.h"
+
 class LogBuffer;
 
 #define EXPIRE_HOUR_THRESHOLD 24 // Only expire chatty UID logs to preserve
@@ -33,7 +35,48 @@ class LogBuffer;
                                  // chatty for the temporal expire messages
 #define EXPIRE_RATELIMIT 10      // maximum rate in seconds to report expiration
 
-class LogBufferElement {
+// Intrusive linkage so that the time sorted collection of elements does
+// not need a separately allocated node for every log entry.
+class LogBufferElementLink {
+    friend class LogBufferElementCollection;
+
+    LogBufferElementLink *mPrev;
+    LogBufferElementLink *mNext;
+
+protected:
+    LogBufferElementLink() : mPrev(this), mNext(this) { }
+    // a copy starts out unlinked, see LogBufferElementCollection::replace
+    LogBufferElementLink(const LogBufferElementLink &) :
+        mPrev(this), mNext(this) { }
+};
+
+// Secondary linkage threading together, in time order, the elements of one
+// logging source within a log id. Lets pruning visit the entries of a UID,
+// or of one PID of the system UID, without walking the whole buffer.
+enum LogBufferElementChainId {
+    CHAIN_UID,
+    CHAIN_PID_OF_SYSTEM,
+};
+
+template <LogBufferElementChainId Id>
+class LogBufferElementChainLink {
+    template <LogBufferElementChainId> friend class LogBufferElementChain;
+
+    LogBufferElementChainLink *mPrev;
+    LogBufferElementChainLink *mNext;
+
+protected:
+    LogBufferElementChainLink() : mPrev(this), mNext(this) { }
+    LogBufferElementChainLink(const LogBufferElementChainLink &) :
+        mPrev(this), mNext(this) { }
+};
+
+// Elements live inside the LogBufferChunk storage of their log id with the
+// payload packed inline directly after the header, they must be created
+// with new (ring) and are returned to their chunk by delete.
+class LogBufferElement : public LogBufferElementLink,
+                         public LogBufferElementChainLink<CHAIN_UID>,
+                         public LogBufferElementChainLink<CHAIN_PID_OF_SYSTEM> {
 
     friend LogBuffer;
 
@@ -41,16 +84,18 @@ class LogBufferElement {
     const uid_t mUid;
     const pid_t mPid;
     const pid_t mTid;
-    char *mMsg;
-    union {
-        const unsigned short mMsgLen; // mMSg != NULL
-        unsigned short mDropped;      // mMsg == NULL
-    };
     const uint64_t mSequence;
     log_time mRealTime;
+    const unsigned short mMsgLen;
+    unsigned short mDropped;      // payload expired if non-zero
+    uint32_t mPayloadOffset;      // into the inflated block if compressed
     static atomic_int_fast64_t sequence;
 
-    // assumption: mMsg == NULL
+    char *payload() const {
+        return reinterpret_cast<char *>(const_cast<LogBufferElement *>(this + 1));
+    }
+
+    // assumption: mDropped != 0
     size_t populateDroppedMessage(char *&buffer,
                                   LogBuffer *parent);
 
@@ -58,29 +103,201 @@ public:
     LogBufferElement(log_id_t log_id, log_time realtime,
                      uid_t uid, pid_t pid, pid_t tid,
                      const char *msg, unsigned short len);
-    virtual ~LogBufferElement();
+
+    static void *operator new(size_t size, LogBufferChunkRing &ring,
+                              unsigned short len) noexcept {
+        return ring.allocate(size + len);
+    }
+    static void operator delete(void *p, LogBufferChunkRing &ring,
+                                unsigned short) {
+        ring.release(p);
+    }
+    static void operator delete(void *p) {
+        LogBufferChunk::chunkOf(p)->ring()->release(p);
+    }
+    static void *operator new(size_t) = delete;
 
     log_id_t getLogId() const { return mLogId; }
     uid_t getUid(void) const { return mUid; }
     pid_t getPid(void) const { return mPid; }
     pid_t getTid(void) const { return mTid; }
-    unsigned short getDropped(void) const { return mMsg ? 0 : mDropped; }
+    unsigned short getDropped(void) const { return mDropped; }
+    // payload storage is reclaimed along with the chunk, until then the
+    // chunk counts it as dead
     unsigned short setDropped(unsigned short value) {
-        if (mMsg) {
-            delete [] mMsg;
-            mMsg = NULL;
+        if (!mDropped && value) {
+            LogBufferChunk::chunkOf(this)->ring()->drop(this, mMsgLen);
         }
         return mDropped = value;
     }
-    unsigned short getMsgLen() const { return mMsg ? mMsgLen : 0; }
+    unsigned short getMsgLen() const { return mDropped ? 0 : mMsgLen; }
     uint64_t getSequence(void) const { return mSequence; }
     static uint64_t getCurrentSequence(void) { return sequence.load(memory_order_relaxed); }
     log_time getRealTime(void) const { return mRealTime; }
-    char *getMsg(void) const {return mMsg;}
-    uint32_t getTag(void) const;
+    // NULL if dropped, or if compressed (see LogBuffer::inflate)
+    char *getMsg(void) const {
+        return (mDropped || isCompressed()) ? NULL : payload();
+    }
+    bool isCompressed(void) const {
+        return LogBufferChunk::chunkOf(this)->compressed();
+    }
+    uint32_t getPayloadOffset(void) const { return mPayloadOffset; }
+    uint32_t getTag(void) const { return getTag(mLogId, getMsg(), getMsgLen()); }
+    static uint32_t getTag(log_id_t log_id, const char *msg,
+                           unsigned short len);
+
+    // header as sent to a reader, len is that of the inline payload
+    void populateEntry(struct logger_entry_v4 *entry, bool privileged) const;
 
     static const uint64_t FLUSH_ERROR;
-    uint64_t flushTo(SocketClient *writer, LogBuffer *parent, bool privileged);
+    // msg overrides the inline payload, for entries in compressed storage
+    uint64_t flushTo(SocketClient *writer, LogBuffer *parent, bool privileged,
+                     const char *msg = NULL);
+};
+
+// Drop in for the std::list<LogBufferElement *> that LogBuffer used to keep,
+// linking the elements through their embedded LogBufferElementLink.
+class LogBufferElementCollection {
+    LogBufferElementLink mHead;
+
+public:
+    class iterator {
+        friend LogBufferElementCollection;
+
+        LogBufferElementLink *mLink;
+
+        explicit iterator(LogBufferElementLink *link) : mLink(link) { }
+
+    public:
+        iterator() : mLink(NULL) { }
+
+        LogBufferElement *operator*() const {
+            return static_cast<LogBufferElement *>(mLink);
+        }
+        iterator &operator++() { mLink = mLink->mNext; return *this; }
+        iterator &operator--() { mLink = mLink->mPrev; return *this; }
+        iterator operator++(int) { iterator it(*this); ++*this; return it; }
+        iterator operator--(int) { iterator it(*this); --*this; return it; }
+        bool operator==(const iterator &rhs) const { return mLink == rhs.mLink; }
+        bool operator!=(const iterator &rhs) const { return mLink != rhs.mLink; }
+    };
+
+    iterator begin() { return iterator(mHead.mNext); }
+    iterator end() { return iterator(&mHead); }
+    bool empty() const { return mHead.mNext == &mHead; }
+
+    // link element in front of pos
+    iterator insert(iterator pos, LogBufferElement *element) {
+        LogBufferElementLink *link = element;
+        link->mNext = pos.mLink;
+        link->mPrev = pos.mLink->mPrev;
+        link->mPrev->mNext = link;
+        pos.mLink->mPrev = link;
+        return iterator(link);
+    }
+    void push_back(LogBufferElement *element) { insert(end(), element); }
+
+    static iterator iterator_to(LogBufferElement *element) {
+        return iterator(element);
+    }
+
+    // move the links of from over to to, used when storage is repacked
+    void replace(LogBufferElement *from, LogBufferElement *to) {
+        LogBufferElementLink *src = from;
+        LogBufferElementLink *dst = to;
+        dst->mPrev = src->mPrev;
+        dst->mNext = src->mNext;
+        dst->mPrev->mNext = dst;
+        dst->mNext->mPrev = dst;
+        src->mPrev = src->mNext = src;
+    }
+
+    // unlink, caller retains ownership of the element
+    iterator erase(iterator pos) {
+        LogBufferElementLink *link = pos.mLink;
+        LogBufferElementLink *next = link->mNext;
+        link->mPrev->mNext = next;
+        next->mPrev = link->mPrev;
+        link->mPrev = link->mNext = link;
+        return iterator(next);
+    }
+};
+
+// The entries of one source, oldest first. An element is on at most one
+// chain of each kind; LogBuffer keeps the chain heads in hash tables keyed
+// by UID (and PID for AID_SYSTEM), so the heads must not move once used.
+template <LogBufferElementChainId Id>
+class LogBufferElementChain {
+    typedef LogBufferElementChainLink<Id> Link;
+
+    Link mHead;
+    size_t mSize;
+
+    LogBufferElementChain(const LogBufferElementChain &) = delete;
+    LogBufferElementChain &operator=(const LogBufferElementChain &) = delete;
+
+    LogBufferElement *elementOf(Link *link) const {
+        if (link == &mHead) {
+            return NULL;
+        }
+        return static_cast<LogBufferElement *>(link);
+    }
+
+public:
+    LogBufferElementChain() : mSize(0) { }
+
+    bool empty() const { return mSize == 0; }
+    size_t size() const { return mSize; }
+
+    // NULL terminated walk from the oldest entry
+    LogBufferElement *front() const {
+        return elementOf(mHead.mNext);
+    }
+    LogBufferElement *next(LogBufferElement *element) const {
+        return elementOf(static_cast<Link *>(element)->mNext);
+    }
+
+    // Link element in ahead of the newest "after" entries. Elements are
+    // only ever inserted close to the end of the log, so after is small.
+    void insert(LogBufferElement *element, size_t after) {
+        Link *pos = &mHead;
+        while (after--) {
+            pos = pos->mPrev;
+        }
+        Link *link = element;
+        link->mNext = pos;
+        link->mPrev = pos->mPrev;
+        link->mPrev->mNext = link;
+        pos->mPrev = link;
+        ++mSize;
+    }
+
+    void erase(LogBufferElement *element) {
+        Link *link = element;
+        link->mPrev->mNext = link->mNext;
+        link->mNext->mPrev = link->mPrev;
+        link->mPrev = link->mNext = link;
+        --mSize;
+    }
+
+    static bool linked(LogBufferElement *element) {
+        Link *link = element;
+        return link->mNext != link;
+    }
+
+    // move the links of from over to to, used when storage is repacked
+    static void replace(LogBufferElement *from, LogBufferElement *to) {
+        Link *src = from;
+        Link *dst = to;
+        if (src->mNext == src) {
+            return;
+        }
+        dst->mPrev = src->mPrev;
+        dst->mNext = src->mNext;
+        dst->mPrev->mNext = dst;
+        dst->mNext->mPrev = dst;
+        src->mPrev = src->mNext = src;
+    }
 };
 
 #endif
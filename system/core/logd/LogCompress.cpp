@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "LogCompress.h"
+
+// LZ4 block format parameters
+#define MIN_MATCH     4
+#define LAST_LITERALS 5  // the last bytes of a block are always literals
+#define MF_LIMIT      12 // no match may start closer than this to the end
+#define MAX_OFFSET    65535
+#define RUN_MASK      15
+#define HASH_LOG      12
+
+static inline uint32_t read32(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash32(uint32_t v) {
+    return (v * 2654435761U) >> (32 - HASH_LOG);
+}
+
+// Emit a length extension, returns NULL on overflow
+static inline char *putLength(char *op, const char *oend, size_t len) {
+    while (len >= 255) {
+        if (op >= oend) {
+            return NULL;
+        }
+        *op++ = static_cast<char>(255);
+        len -= 255;
+    }
+    if (op >= oend) {
+        return NULL;
+    }
+    *op++ = static_cast<char>(len);
+    return op;
+}
+
+static char *putLiterals(char *op, const char *oend, char *&token,
+                         const char *anchor, size_t len) {
+    if (op >= oend) {
+        return NULL;
+    }
+    token = op++;
+    if (len >= RUN_MASK) {
+        *token = static_cast<char>(RUN_MASK << 4);
+        op = putLength(op, oend, len - RUN_MASK);
+        if (!op) {
+            return NULL;
+        }
+    } else {
+        *token = static_cast<char>(len << 4);
+    }
+    if ((size_t)(oend - op) < len) {
+        return NULL;
+    }
+    memcpy(op, anchor, len);
+    return op + len;
+}
+
+size_t android::logCompress(const char *src, size_t srcLen,
+                            char *dst, size_t dstLen) {
+    uint32_t table[1 << HASH_LOG];
+    const char *ip = src;
+    const char *anchor = src;
+    const char *iend = src + srcLen;
+    char *op = dst;
+    const char *oend = dst + dstLen;
+    char *token;
+
+    if (srcLen > MF_LIMIT) {
+        const char *mflimit = iend - MF_LIMIT;
+        const char *matchlimit = iend - LAST_LITERALS;
+
+        memset(table, 0, sizeof(table));
+        ++ip;
+
+        while (ip < mflimit) {
+            uint32_t sequence = read32(ip);
+            uint32_t h = hash32(sequence);
+            const char *ref = src + table[h];
+            table[h] = ip - src;
+
+            if ((ref >= ip) || ((ip - ref) > MAX_OFFSET)
+                    || (read32(ref) != sequence)) {
+                ++ip;
+                continue;
+            }
+
+            const char *mp = ip + MIN_MATCH;
+            const char *rp = ref + MIN_MATCH;
+            while ((mp < matchlimit) && (*mp == *rp)) {
+                ++mp;
+                ++rp;
+            }
+
+            op = putLiterals(op, oend, token, anchor, ip - anchor);
+            if (!op || ((oend - op) < 2)) {
+                return 0;
+            }
+            uint16_t offset = ip - ref;
+            *op++ = static_cast<char>(offset & 0xFF);
+            *op++ = static_cast<char>(offset >> 8);
+
+            size_t matchLen = (mp - ip) - MIN_MATCH;
+            if (matchLen >= RUN_MASK) {
+                *token |= RUN_MASK;
+                op = putLength(op, oend, matchLen - RUN_MASK);
+                if (!op) {
+                    return 0;
+                }
+            } else {
+                *token |= static_cast<char>(matchLen);
+            }
+
+            ip = anchor = mp;
+            if (ip < mflimit) {
+                table[hash32(read32(ip - 2))] = ip - 2 - src;
+            }
+        }
+    }
+
+    op = putLiterals(op, oend, token, anchor, iend - anchor);
+    if (!op) {
+        return 0;
+    }
+    return op - dst;
+}
+
+ssize_t android::logDecompress(const char *src, size_t srcLen,
+                               char *dst, size_t dstLen) {
+    const uint8_t *ip = reinterpret_cast<const uint8_t *>(src);
+    const uint8_t *iend = ip + srcLen;
+    char *op = dst;
+    char *oend = dst + dstLen;
+
+    while (ip < iend) {
+        unsigned token = *ip++;
+
+        size_t len = token >> 4;
+        if (len == RUN_MASK) {
+            unsigned s;
+            do {
+                if (ip >= iend) {
+                    return -1;
+                }
+                s = *ip++;
+                len += s;
+            } while (s == 255);
+        }
+        if (((size_t)(iend - ip) < len) || ((size_t)(oend - op) < len)) {
+            return -1;
+        }
+        memcpy(op, ip, len);
+        ip += len;
+        op += len;
+
+        if (ip >= iend) {
+            break; // last sequence carries literals only
+        }
+
+        if ((iend - ip) < 2) {
+            return -1;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (!offset || (offset > (size_t)(op - dst))) {
+            return -1;
+        }
+
+        len = token & RUN_MASK;
+        if (len == RUN_MASK) {
+            unsigned s;
+            do {
+                if (ip >= iend) {
+                    return -1;
+                }
+                s = *ip++;
+                len += s;
+            } while (s == 255);
+        }
+        len += MIN_MATCH;
+        if ((size_t)(oend - op) < len) {
+            return -1;
+        }
+        // may overlap, byte copy replicates short periods
+        const char *ref = op - offset;
+        while (len--) {
+            *op++ = *ref++;
+        }
+    }
+
+    return op - dst;
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_COMPRESS_H__
+#define _LOGD_LOG_COMPRESS_H__
+
+#include <sys/types.h>
+
+// Fast LZ77 block codec producing the LZ4 block format (no frame, no
+// checksum). Log text is highly repetitive (tags, prefixes, hex dumps) and
+// typically packs 3 to 5 times with this, at a cost well below the time
+// spent formatting the same content in logcat.
+
+namespace android {
+
+// Returns the compressed size, or 0 if the result would not fit in dstLen.
+size_t logCompress(const char *src, size_t srcLen, char *dst, size_t dstLen);
+
+// Returns the number of bytes produced, or -1 on malformed input or if
+// the result would overflow dstLen.
+ssize_t logDecompress(const char *src, size_t srcLen, char *dst, size_t dstLen);
+
+}
+
+#endif // _LOGD_LOG_COMPRESS_H__
@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <log/log.h>
+
+#include "LogBufferElement.h"
+#include "LogFilter.h"
+#include "LogUtils.h"
+
+LogFilter::LogFilter() :
+        mMinPriority(ANDROID_LOG_UNKNOWN),
+        mTagsOnly(false),
+        mHasRegex(false) {
+}
+
+LogFilter::~LogFilter() {
+    if (mHasRegex) {
+        regfree(&mRegex);
+    }
+}
+
+static int hexValue(char c) {
+    return isdigit(c) ? (c - '0') : (tolower(c) - 'a' + 10);
+}
+
+// Copy out a %XX escaped value up to the end of the key or one of delims
+static const char *unescape(const char *cp, const char *delims,
+                            std::string &value) {
+    value.clear();
+    while (*cp && !strchr(delims, *cp)) {
+        if ((cp[0] == '%') && isxdigit(cp[1]) && isxdigit(cp[2])) {
+            value += static_cast<char>((hexValue(cp[1]) << 4) | hexValue(cp[2]));
+            cp += 3;
+        } else {
+            value += *cp++;
+        }
+    }
+    return cp;
+}
+
+bool LogFilter::parse(const char *command) {
+    bool found = false;
+
+    static const char _prio[] = " prio=";
+    const char *cp = strstr(command, _prio);
+    if (cp) {
+        int prio = atoi(cp + sizeof(_prio) - 1);
+        if ((prio > ANDROID_LOG_VERBOSE) && (prio <= ANDROID_LOG_SILENT)) {
+            mMinPriority = prio;
+            found = true;
+        }
+    }
+
+    static const char _tags[] = " tags=";
+    cp = strstr(command, _tags);
+    if (cp) {
+        cp += sizeof(_tags) - 1;
+        // an empty list leaves nothing to match
+        mTagsOnly = true;
+        found = true;
+        while (*cp && (*cp != ' ')) {
+            std::string tag;
+            int prio = ANDROID_LOG_VERBOSE;
+
+            cp = unescape(cp, " ,:", tag);
+            if (*cp == ':') {
+                char *e;
+                prio = strtol(cp + 1, &e, 10);
+                cp = e;
+            }
+            if (!tag.empty()) {
+                mTags.push_back(std::make_pair(tag, prio));
+            }
+            if (*cp != ',') {
+                break;
+            }
+            ++cp;
+        }
+    }
+
+    static const char _grep[] = " grep=";
+    cp = strstr(command, _grep);
+    if (cp) {
+        unescape(cp + sizeof(_grep) - 1, " ", mSubstring);
+        found |= !mSubstring.empty();
+    }
+
+    static const char _regex[] = " regex=";
+    cp = strstr(command, _regex);
+    if (cp) {
+        std::string expression;
+        unescape(cp + sizeof(_regex) - 1, " ", expression);
+        // Not ours to report, the reader matches again with its own
+        if (!expression.empty() && !regcomp(&mRegex, expression.c_str(),
+                                            REG_EXTENDED | REG_NOSUB)) {
+            mHasRegex = true;
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+bool LogFilter::matchTag(const char *tag, size_t len, int prio) const {
+    for (const auto &t : mTags) {
+        if ((t.first.length() == len) && !memcmp(t.first.data(), tag, len)) {
+            return prio >= t.second;
+        }
+    }
+    return false;
+}
+
+bool LogFilter::matchMessage(const char *msg, size_t len) const {
+    // trailing nul and newlines are not part of what the reader matches
+    while (len && (!msg[len - 1] || (msg[len - 1] == '\n'))) {
+        --len;
+    }
+
+    if (!mSubstring.empty()
+            && !find(msg, len, mSubstring.data(), mSubstring.length())) {
+        return false;
+    }
+
+    if (mHasRegex) {
+        std::string message(msg, len);
+        if (regexec(&mRegex, message.c_str(), 0, NULL, 0)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool LogFilter::match(const LogBufferElement *element) const {
+    const char *msg = element->getMsg();
+    if (!msg) {
+        return true;
+    }
+    size_t len = element->getMsgLen();
+
+    log_id_t id = element->getLogId();
+    if ((id == LOG_ID_EVENTS) || (id == LOG_ID_SECURITY)) {
+        if (mMinPriority > ANDROID_LOG_INFO) {
+            return false;
+        }
+        if (!mTagsOnly) {
+            return true;
+        }
+        const char *tag = android::tagToName(element->getTag());
+        return !tag || matchTag(tag, strlen(tag), ANDROID_LOG_INFO);
+    }
+
+    // <prio:1><tag:N>\0<message:N>\0
+    const char *end = msg + len;
+    const char *tag = msg + 1;
+    const char *tagEnd = (len > 1)
+            ? static_cast<const char *>(memchr(tag, '\0', end - tag)) : NULL;
+    if (!tagEnd) {
+        return true;
+    }
+
+    int prio = msg[0];
+    if (prio < mMinPriority) {
+        return false;
+    }
+    if (mTagsOnly && !matchTag(tag, tagEnd - tag, prio)) {
+        return false;
+    }
+    return matchMessage(tagEnd + 1, end - tagEnd - 1);
+}
+
+typedef int8_t vec16 __attribute__((vector_size(16)));
+
+static inline vec16 load16(const char *p) {
+    vec16 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+const char *LogFilter::find(const char *haystack, size_t len,
+                            const char *needle, size_t needleLen) {
+    if (!needleLen) {
+        return haystack;
+    }
+    if (needleLen > len) {
+        return NULL;
+    }
+    if (needleLen == 1) {
+        return static_cast<const char *>(memchr(haystack, needle[0], len));
+    }
+
+    vec16 first, last;
+    for (size_t j = 0; j < sizeof(vec16); ++j) {
+        first[j] = needle[0];
+        last[j] = needle[needleLen - 1];
+    }
+
+    // Candidates have both ends of needle in place, only those get the
+    // full compare. Built with vector extensions, NEON or SSE2 code.
+    size_t i = 0;
+    const size_t lastOffset = needleLen - 1;
+    for (; (i + lastOffset + sizeof(vec16)) <= len; i += sizeof(vec16)) {
+        vec16 eq = (load16(haystack + i) == first)
+                 & (load16(haystack + i + lastOffset) == last);
+        uint64_t half[2];
+        memcpy(half, &eq, sizeof(half));
+        if (!(half[0] | half[1])) {
+            continue;
+        }
+        for (size_t j = 0; j < sizeof(vec16); ++j) {
+            if (eq[j] && !memcmp(haystack + i + j + 1, needle + 1,
+                                 needleLen - 2)) {
+                return haystack + i + j;
+            }
+        }
+    }
+
+    for (; (i + lastOffset) < len; ++i) {
+        if ((haystack[i] == needle[0])
+                && (haystack[i + lastOffset] == needle[lastOffset])
+                && !memcmp(haystack + i + 1, needle + 1, needleLen - 2)) {
+            return haystack + i;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_FILTER_H__
+#define _LOGD_LOG_FILTER_H__
+
+#include <regex.h>
+#include <stddef.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+class LogBufferElement;
+
+// The prio=, tags=, grep= and regex= keys of a reader command (see
+// LOGD_READER_COMMAND_MAX in private/android_logger.h). Evaluated by the
+// reader thread outside of LogTimeEntry::lock(), immutable once parsed.
+//
+// Anything the filter can not see into is let through for the reader to
+// deal with: binary payloads for grep= and regex=, entries in compressed
+// chunks and chatty expire markers.
+class LogFilter {
+    int mMinPriority;
+    bool mTagsOnly;
+    std::vector<std::pair<std::string, int>> mTags; // tag, minimum priority
+    std::string mSubstring;
+    bool mHasRegex;
+    regex_t mRegex;
+
+    LogFilter(const LogFilter &) = delete;
+    void operator=(const LogFilter &) = delete;
+
+    bool matchTag(const char *tag, size_t len, int prio) const;
+    bool matchMessage(const char *msg, size_t len) const;
+
+public:
+    LogFilter();
+    ~LogFilter();
+
+    // false if the command holds none of the keys, or none that parse
+    bool parse(const char *command);
+    bool match(const LogBufferElement *element) const;
+
+    // memmem() comparing the first and last byte of needle against 16
+    // positions of haystack at a time
+    static const char *find(const char *haystack, size_t len,
+                            const char *needle, size_t needleLen);
+};
+
+#endif // _LOGD_LOG_FILTER_H__
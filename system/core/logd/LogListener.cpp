@@ -14,7 +14,9 @@
  * limitations under the License.
  */
 
+#include <endian.h>
 #include <limits.h>
+#include <string.h>
 #include <sys/cdefs.h>
 #include <sys/prctl.h>
 #include <sys/socket.h>
@@ -44,8 +46,10 @@ bool LogListener::onDataAvailable(SocketClient *cli) {
         name_set = true;
     }
 
-    char buffer[sizeof_log_id_t + sizeof(uint16_t) + sizeof(log_time)
-        + LOGGER_ENTRY_MAX_PAYLOAD];
+    static_assert(LOGGER_ENTRY_MAX_BATCH >= (sizeof(android_log_header_t)
+                                             + LOGGER_ENTRY_MAX_PAYLOAD),
+                  "batch must hold at least one record");
+    char buffer[LOGGER_ENTRY_MAX_BATCH];
     struct iovec iov = { buffer, sizeof(buffer) };
 
     char control[CMSG_SPACE(sizeof(struct ucred))] __aligned(4);
@@ -92,7 +96,52 @@ bool LogListener::onDataAvailable(SocketClient *cli) {
         return false;
     }
 
+    // NB: hdr.msg_flags & MSG_TRUNC is not tested, silently passing a
+    // truncated message to the logs.
+
     android_log_header_t *header = reinterpret_cast<android_log_header_t *>(buffer);
+    if (header->id != LOG_ID_BATCH) {
+        if (!logRecord(cred, buffer, n)) {
+            return false;
+        }
+        reader->notifyNewLog();
+        return true;
+    }
+
+    // Records batched up by the client, see liblog logd_batch.c
+    bool notify = false;
+    char *record = buffer + sizeof(android_log_header_t);
+    n -= sizeof(android_log_header_t);
+    for (unsigned count = header->tid; count; --count) {
+        uint16_t len;
+        if (n < (ssize_t)sizeof(len)) {
+            break;
+        }
+        memcpy(&len, record, sizeof(len));
+        len = le16toh(len);
+        record += sizeof(len);
+        n -= sizeof(len);
+        if (len > n) {
+            break;
+        }
+        notify |= logRecord(cred, record, len);
+        record += len;
+        n -= len;
+    }
+    if (notify) {
+        reader->notifyNewLog();
+    }
+
+    return true;
+}
+
+// One android_log_header_t and its payload, returns true if it was logged
+bool LogListener::logRecord(struct ucred *cred, char *record, size_t len) {
+    if (len <= sizeof(android_log_header_t)) {
+        return false;
+    }
+
+    android_log_header_t *header = reinterpret_cast<android_log_header_t *>(record);
     if (/* header->id < LOG_ID_MIN || */ header->id >= LOG_ID_MAX || header->id == LOG_ID_KERNEL) {
         return false;
     }
@@ -103,19 +152,16 @@ bool LogListener::onDataAvailable(SocketClient *cli) {
         return false;
     }
 
-    char *msg = ((char *)buffer) + sizeof(android_log_header_t);
-    n -= sizeof(android_log_header_t);
-
-    // NB: hdr.msg_flags & MSG_TRUNC is not tested, silently passing a
-    // truncated message to the logs.
-
-    if (logbuf->log((log_id_t)header->id, header->realtime,
-            cred->uid, cred->pid, header->tid, msg,
-            ((size_t) n <= USHRT_MAX) ? (unsigned short) n : USHRT_MAX) >= 0) {
-        reader->notifyNewLog();
+    char *msg = record + sizeof(android_log_header_t);
+    size_t n = len - sizeof(android_log_header_t);
+    // Truncate as a single record datagram used to be, readers can not take
+    // more than that in one entry.
+    if (n > LOGGER_ENTRY_MAX_PAYLOAD) {
+        n = LOGGER_ENTRY_MAX_PAYLOAD;
     }
 
-    return true;
+    return logbuf->log((log_id_t)header->id, header->realtime,
+            cred->uid, cred->pid, header->tid, msg, n) >= 0;
 }
 
 int LogListener::getLogSocket() {
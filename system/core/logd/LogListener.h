@@ -32,6 +32,7 @@ protected:
 
 private:
     static int getLogSocket();
+    bool logRecord(struct ucred *cred, char *record, size_t len);
 };
 
 #endif
@@ -0,0 +1,403 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <dirent.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <memory>
+
+#include <private/android_filesystem_config.h>
+#include <utils/threads.h>
+
+#include "LogBufferElement.h"
+#include "LogPersist.h"
+#include "LogUtils.h"
+
+LogPersist::LogPersist() :
+        mEnabled(false),
+        mBudget(0),
+        mDropped(0),
+        mScanned(false),
+        mFd(-1),
+        mSegment(0),
+        mOffset(0),
+        mLidMask(0),
+        mMin(log_time::EPOCH),
+        mMax(log_time::EPOCH) {
+    pthread_mutex_init(&mLock, NULL);
+    pthread_cond_init(&mCond, NULL);
+    memset(mBloom, 0, sizeof(mBloom));
+}
+
+bool LogPersist::startWriter() {
+    pthread_attr_t attr;
+
+    if (pthread_attr_init(&attr)) {
+        return false;
+    }
+    bool ret = false;
+    if (!pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED)) {
+        pthread_t thread;
+        ret = !pthread_create(&thread, &attr, LogPersist::threadStart, this);
+    }
+    pthread_attr_destroy(&attr);
+    return ret;
+}
+
+void *LogPersist::threadStart(void *obj) {
+    prctl(PR_SET_NAME, "logd.persist");
+    setpriority(PRIO_PROCESS, 0, ANDROID_PRIORITY_BACKGROUND);
+
+    reinterpret_cast<LogPersist *>(obj)->run();
+    return NULL;
+}
+
+void LogPersist::enable(bool enabled, unsigned long budget) {
+    pthread_mutex_lock(&mLock);
+    if (enabled && !mEnabled) {
+        mPending.reserve(maxPending);
+    }
+    mEnabled = enabled;
+    mBudget = budget;
+    pthread_cond_signal(&mCond);
+    pthread_mutex_unlock(&mLock);
+}
+
+void LogPersist::append(const LogBufferElement *element) {
+    struct logger_entry_v4 entry;
+    const char *msg = element->getMsg();
+
+    if (!msg) {
+        return;
+    }
+    element->populateEntry(&entry, true);
+
+    size_t size = entry.hdr_size + entry.len;
+    const char *hdr = reinterpret_cast<const char *>(&entry);
+
+    pthread_mutex_lock(&mLock);
+    if (mEnabled) {
+        size_t pending = mPending.size();
+        if ((pending + size) > maxPending) {
+            ++mDropped;
+        } else {
+            mPending.insert(mPending.end(), hdr, hdr + entry.hdr_size);
+            mPending.insert(mPending.end(), msg, msg + entry.len);
+            // start the clock on a new burst, or cut it short
+            if (!pending ||
+                    ((pending < flushPending) &&
+                        (mPending.size() >= flushPending))) {
+                pthread_cond_signal(&mCond);
+            }
+        }
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
+void LogPersist::run() {
+    mWriting.reserve(maxPending);
+
+    pthread_mutex_lock(&mLock);
+    for (;;) {
+        if (mPending.empty() && !mDropped) {
+            if (!mEnabled && (mFd >= 0)) {
+                pthread_mutex_unlock(&mLock);
+                sealSegment();
+                pthread_mutex_lock(&mLock);
+                continue;
+            }
+            pthread_cond_wait(&mCond, &mLock);
+            continue;
+        }
+
+        if (mEnabled && (mPending.size() < flushPending)) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += flushSeconds;
+            while (mEnabled && (mPending.size() < flushPending)) {
+                if (pthread_cond_timedwait(&mCond, &mLock, &deadline)) {
+                    break;
+                }
+            }
+        }
+
+        mWriting.swap(mPending);
+        size_t dropped = mDropped;
+        mDropped = 0;
+        unsigned long budget = mBudget;
+        pthread_mutex_unlock(&mLock);
+
+        if (dropped) {
+            writeDropped(dropped);
+        }
+        writeRecords(mWriting.data(), mWriting.size());
+        mWriting.clear();
+        trimSegments(budget);
+
+        pthread_mutex_lock(&mLock);
+    }
+}
+
+// Records arrive in whole, walk them to keep the index and bloom filter
+// current and write out each run that lands in the same segment at once.
+void LogPersist::writeRecords(const char *buf, size_t len) {
+    size_t start = 0;
+    size_t pos = 0;
+
+    while ((pos + sizeof(struct logger_entry_v4)) <= len) {
+        struct logger_entry_v4 entry;
+        memcpy(&entry, buf + pos, sizeof(entry));
+        size_t size = entry.hdr_size + entry.len;
+
+        if ((mFd >= 0) && ((mOffset + size) > LOGPERSIST_SEGMENT_SIZE)) {
+            flushSpan(buf + start, pos - start);
+            start = pos;
+            sealSegment();
+        }
+        if ((mFd < 0) && !openSegment()) {
+            return; // nowhere to put them, /data not ready or full
+        }
+
+        addRecord(entry, buf + pos + entry.hdr_size);
+        mOffset += size;
+        pos += size;
+    }
+    flushSpan(buf + start, pos - start);
+}
+
+// Leave a trace in the store of what the queue could not hold
+void LogPersist::writeDropped(size_t dropped) {
+    static const char tag[] = "logd";
+    char buf[sizeof(struct logger_entry_v4) + 128];
+    struct logger_entry_v4 *entry =
+        reinterpret_cast<struct logger_entry_v4 *>(buf);
+    char *msg = buf + sizeof(struct logger_entry_v4);
+    log_time now(CLOCK_REALTIME);
+
+    memset(entry, 0, sizeof(*entry));
+    entry->hdr_size = sizeof(struct logger_entry_v4);
+    entry->pid = getpid();
+    entry->tid = gettid();
+    entry->sec = now.tv_sec;
+    entry->nsec = now.tv_nsec;
+    entry->lid = LOG_ID_MAIN;
+    entry->uid = AID_LOGD;
+
+    msg[0] = ANDROID_LOG_WARN;
+    memcpy(msg + 1, tag, sizeof(tag));
+    size_t len = 1 + sizeof(tag);
+    len += snprintf(msg + len, sizeof(buf) - sizeof(*entry) - len,
+                    "persist fell behind, dropped %zu entries", dropped) + 1;
+    entry->len = len;
+
+    writeRecords(buf, sizeof(*entry) + len);
+}
+
+void LogPersist::addRecord(const struct logger_entry_v4 &entry,
+                           const char *msg) {
+    log_time realtime(entry.sec, entry.nsec);
+
+    if (mIndex.empty() ||
+            ((mOffset - mIndex.back().offset) >= LOGPERSIST_INDEX_STRIDE)) {
+        android_logpersist_index_t index = { mOffset, entry.sec, entry.nsec };
+        mIndex.push_back(index);
+    } else {
+        android_logpersist_index_t &index = mIndex.back();
+        if (realtime > log_time(index.sec, index.nsec)) {
+            index.sec = entry.sec;
+            index.nsec = entry.nsec;
+        }
+    }
+
+    if (!mLidMask || (realtime < mMin)) {
+        mMin = realtime;
+    }
+    if (!mLidMask || (realtime > mMax)) {
+        mMax = realtime;
+    }
+    mLidMask |= 1 << entry.lid;
+
+    char key[32];
+    int len = snprintf(key, sizeof(key), "%u", entry.uid);
+    android_logpersist_bloom_add(mBloom, LOGPERSIST_KEY_UID, key, len);
+
+    if ((entry.lid == LOG_ID_EVENTS) || (entry.lid == LOG_ID_SECURITY)) {
+        if (entry.len < sizeof(android_event_header_t)) {
+            return;
+        }
+        uint32_t tag = le32toh(
+            reinterpret_cast<const android_event_header_t *>(msg)->tag);
+        len = snprintf(key, sizeof(key), "%u", tag);
+        android_logpersist_bloom_add(mBloom, LOGPERSIST_KEY_TAG, key, len);
+        const char *name = android::tagToName(tag);
+        if (name) {
+            android_logpersist_bloom_add(mBloom, LOGPERSIST_KEY_TAG,
+                                         name, strlen(name));
+        }
+    } else if (entry.len > 1) {
+        const char *tag = msg + 1;
+        android_logpersist_bloom_add(mBloom, LOGPERSIST_KEY_TAG,
+                                     tag, strnlen(tag, entry.len - 1));
+    }
+}
+
+bool LogPersist::flushSpan(const char *buf, size_t len) {
+    while (len && (mFd >= 0)) {
+        ssize_t ret = TEMP_FAILURE_RETRY(write(mFd, buf, len));
+        if (ret <= 0) {
+            // Keep what made it without a trailer, readers scan it
+            close(mFd);
+            mFd = -1;
+            return false;
+        }
+        buf += ret;
+        len -= ret;
+    }
+    return !len;
+}
+
+void LogPersist::scanSegments() {
+    std::unique_ptr<DIR, int(*)(DIR*)> dir(opendir(LOGPERSIST_DIR), closedir);
+    if (!dir) {
+        return;
+    }
+
+    static const size_t prefixLen = sizeof(LOGPERSIST_PREFIX) - 1;
+    struct dirent *dp;
+    while ((dp = readdir(dir.get()))) {
+        if (strncmp(dp->d_name, LOGPERSIST_PREFIX, prefixLen)) {
+            continue;
+        }
+        char *cp;
+        unsigned long number = strtoul(dp->d_name + prefixLen, &cp, 10);
+        if (*cp || !number || (number > UINT32_MAX)) {
+            continue;
+        }
+        struct stat st;
+        if (fstatat(dirfd(dir.get()), dp->d_name, &st, 0)) {
+            continue;
+        }
+        mSegments[number] = st.st_size;
+        if (number > mSegment) {
+            mSegment = number;
+        }
+    }
+    mScanned = true;
+}
+
+bool LogPersist::openSegment() {
+    if (!mScanned) {
+        scanSegments();
+    }
+
+    uint32_t segment = mSegment + 1;
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s%08u",
+             LOGPERSIST_DIR, LOGPERSIST_PREFIX, segment);
+    int fd = TEMP_FAILURE_RETRY(open(path,
+        O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR));
+    if (fd < 0) {
+        return false;
+    }
+
+    android_logpersist_header_t header;
+    memcpy(header.magic, LOGPERSIST_MAGIC, sizeof(header.magic));
+    header.hdr_size = sizeof(header);
+    header.segment = segment;
+    if (TEMP_FAILURE_RETRY(write(fd, &header, sizeof(header)))
+            != sizeof(header)) {
+        close(fd);
+        unlink(path);
+        return false;
+    }
+
+    mFd = fd;
+    mSegment = segment;
+    mOffset = sizeof(header);
+    mIndex.clear();
+    memset(mBloom, 0, sizeof(mBloom));
+    mLidMask = 0;
+    mSegments[segment] = mOffset;
+    return true;
+}
+
+void LogPersist::sealSegment() {
+    if (mFd < 0) {
+        return;
+    }
+
+    android_logpersist_trailer_t trailer;
+    trailer.records_end = mOffset;
+    trailer.index_count = mIndex.size();
+    trailer.bloom_size = sizeof(mBloom);
+    trailer.lid_mask = mLidMask;
+    trailer.min_sec = mMin.tv_sec;
+    trailer.min_nsec = mMin.tv_nsec;
+    trailer.max_sec = mMax.tv_sec;
+    trailer.max_nsec = mMax.tv_nsec;
+    memcpy(trailer.magic, LOGPERSIST_TRAILER_MAGIC, sizeof(trailer.magic));
+
+    struct iovec iov[3];
+    iov[0].iov_base = mIndex.data();
+    iov[0].iov_len = mIndex.size() * sizeof(android_logpersist_index_t);
+    iov[1].iov_base = mBloom;
+    iov[1].iov_len = sizeof(mBloom);
+    iov[2].iov_base = &trailer;
+    iov[2].iov_len = sizeof(trailer);
+    size_t size = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
+
+    // a short write leaves no valid trailer, readers then scan the segment
+    if (TEMP_FAILURE_RETRY(writev(mFd, iov, 3)) == (ssize_t)size) {
+        mSegments[mSegment] = mOffset + size;
+    } else {
+        mSegments[mSegment] = mOffset;
+    }
+    close(mFd);
+    mFd = -1;
+}
+
+// Delete the oldest segments past the budget, never the open one
+void LogPersist::trimSegments(unsigned long budget) {
+    if (mFd >= 0) {
+        mSegments[mSegment] = mOffset;
+    }
+
+    unsigned long total = 0;
+    for (auto &it : mSegments) {
+        total += it.second;
+    }
+
+    while ((total > budget) && (mSegments.size() > 1)) {
+        auto oldest = mSegments.begin();
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s%08u",
+                 LOGPERSIST_DIR, LOGPERSIST_PREFIX, oldest->first);
+        unlink(path);
+        total -= oldest->second;
+        mSegments.erase(oldest);
+    }
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_PERSIST_H__
+#define _LOGD_LOG_PERSIST_H__
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <map>
+#include <vector>
+
+#include <log/log.h>
+#include <log/logger.h>
+#include <private/android_logger.h>
+
+class LogBufferElement;
+
+// persist.logd.logpersistd.size default, what logcatd kept (-r 1024 -n 256)
+#define LOGPERSIST_DEFAULT_SIZE (256 * 1024 * 1024UL)
+
+// Appends every new log entry to indexed segment files in LOGPERSIST_DIR
+// (format in private/android_logger.h) when persist.logd.logpersistd is
+// "logd". LogBuffer::log only queues a copy of the entry, the logd.persist
+// thread does all of the file I/O.
+class LogPersist {
+    pthread_mutex_t mLock;
+    pthread_cond_t mCond;
+    bool mEnabled;
+    unsigned long mBudget;      // total bytes of segments to keep
+    std::vector<char> mPending; // records waiting for the writer
+    size_t mDropped;            // records lost because mPending was full
+
+    // Writer thread only
+    std::vector<char> mWriting;
+    bool mScanned;
+    int mFd;
+    uint32_t mSegment;          // number of the open, or last, segment
+    uint32_t mOffset;           // end of the records in the open segment
+    std::vector<android_logpersist_index_t> mIndex;
+    uint8_t mBloom[LOGPERSIST_BLOOM_SIZE];
+    uint32_t mLidMask;
+    log_time mMin;
+    log_time mMax;
+    std::map<uint32_t, size_t> mSegments; // sizes on disk, oldest first
+
+    static const size_t maxPending = 1024 * 1024;
+    // Wake the writer early once this much is pending, otherwise each
+    // burst gets up to flushSeconds to collect
+    static const size_t flushPending = 64 * 1024;
+    static const unsigned flushSeconds = 1;
+
+    static void *threadStart(void *obj);
+    void run();
+
+    void writeRecords(const char *buf, size_t len);
+    void writeDropped(size_t dropped);
+    void addRecord(const struct logger_entry_v4 &entry, const char *msg);
+    bool flushSpan(const char *buf, size_t len);
+    void scanSegments();
+    bool openSegment();
+    void sealSegment();
+    void trimSegments(unsigned long budget);
+
+public:
+    LogPersist();
+
+    // Start the logd.persist thread, it inherits the caller's credentials
+    bool startWriter();
+    // from LogBuffer::init, persist.logd.logpersistd{,.size}
+    void enable(bool enabled, unsigned long budget);
+    bool enabled() const { return mEnabled; }
+
+    // Caller holds the LogBuffer lock, never waits on the writer
+    void append(const LogBufferElement *element);
+};
+
+#endif // _LOGD_LOG_PERSIST_H__
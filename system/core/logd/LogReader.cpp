@@ -21,10 +21,12 @@
 #include <sys/types.h>
 
 #include <cutils/sockets.h>
+#include <private/android_logger.h>
 
 #include "FlushCommand.h"
 #include "LogBuffer.h"
 #include "LogBufferElement.h"
+#include "LogFilter.h"
 #include "LogReader.h"
 #include "LogUtils.h"
 
@@ -47,7 +49,7 @@ bool LogReader::onDataAvailable(SocketClient *cli) {
         name_set = true;
     }
 
-    char buffer[255];
+    char buffer[LOGD_READER_COMMAND_MAX];
 
     int len = read(cli->getSocket(), buffer, sizeof(buffer) - 1);
     if (len <= 0) {
@@ -179,7 +181,14 @@ bool LogReader::onDataAvailable(SocketClient *cli) {
         }
     }
 
-    FlushCommand command(*this, nonBlock, tail, logMask, pid, sequence, timeout);
+    LogFilter *filter = new LogFilter();
+    if (!filter->parse(buffer)) {
+        delete filter;
+        filter = NULL;
+    }
+
+    FlushCommand command(*this, nonBlock, tail, logMask, pid, sequence, timeout,
+                         filter);
 
     // Set acceptable upper limit to wait for slow reader processing b/27242723
     struct timeval t = { LOGD_SNDTIMEO, 0 };
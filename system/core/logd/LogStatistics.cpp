@@ -30,6 +30,10 @@ LogStatistics::LogStatistics() : enable(false) {
         mDroppedElements[id] = 0;
         mSizesTotal[id] = 0;
         mElementsTotal[id] = 0;
+        mCompressIn[id] = 0;
+        mCompressOut[id] = 0;
+        mCompressNs[id] = 0;
+        mInflateNs[id].store(0, memory_order_relaxed);
     }
 }
 
@@ -95,10 +99,7 @@ void LogStatistics::add(LogBufferElement *element) {
         }
     }
 }
-void LogStatistics::add_total_size(LogBufferElement *e) {
-    log_id_t log_id = e->getLogId();
-    unsigned short size = e->getMsgLen();
-
+void LogStatistics::add_total_size(log_id_t log_id, unsigned short size) {
     mSizesTotal[log_id] += size;
     ++mElementsTotal[log_id];
 }
@@ -501,6 +502,79 @@ std::string LogStatistics::format(uid_t uid, pid_t pid,
         spaces += spaces_total;
     }
 
+    // Report on compressed storage, cumulative packed payload in/out
+    // bytes, ratio, and milliseconds spent packing/unpacking.
+
+    bool compressing = false;
+    log_id_for_each(id) {
+        if ((logMask & (1 << id)) && mCompressIn[id]) {
+            compressing = true;
+        }
+    }
+
+    if (compressing) {
+        spaces = 3;
+        output += "\nPacked";
+
+        log_id_for_each(id) {
+            if (!(logMask & (1 << id))) {
+                continue;
+            }
+            if (mCompressIn[id]) {
+                oldLength = output.length();
+                if (spaces < 0) {
+                    spaces = 0;
+                }
+                output += android::base::StringPrintf("%*s%zu/%zu", spaces, "",
+                                                      mCompressIn[id],
+                                                      mCompressOut[id]);
+                spaces -= output.length() - oldLength;
+            }
+            spaces += spaces_total;
+        }
+
+        spaces = 4;
+        output += "\nRatio";
+
+        log_id_for_each(id) {
+            if (!(logMask & (1 << id))) {
+                continue;
+            }
+            if (mCompressIn[id] && mCompressOut[id]) {
+                oldLength = output.length();
+                if (spaces < 0) {
+                    spaces = 0;
+                }
+                size_t ratio = mCompressIn[id] * 100 / mCompressOut[id];
+                output += android::base::StringPrintf("%*s%zu.%02zux", spaces, "",
+                                                      ratio / 100, ratio % 100);
+                spaces -= output.length() - oldLength;
+            }
+            spaces += spaces_total;
+        }
+
+        spaces = 3;
+        output += "\nCPU ms";
+
+        log_id_for_each(id) {
+            if (!(logMask & (1 << id))) {
+                continue;
+            }
+            if (mCompressIn[id]) {
+                oldLength = output.length();
+                if (spaces < 0) {
+                    spaces = 0;
+                }
+                output += android::base::StringPrintf("%*s%llu/%llu", spaces, "",
+                    (unsigned long long)(mCompressNs[id] / 1000000),
+                    (unsigned long long)(mInflateNs[id].load(memory_order_relaxed)
+                                         / 1000000));
+                spaces -= output.length() - oldLength;
+            }
+            spaces += spaces_total;
+        }
+    }
+
     // Report on Chattiest
 
     std::string name;
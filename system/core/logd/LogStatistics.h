@@ -410,6 +410,12 @@ class LogStatistics {
     size_t mDroppedElements[LOG_ID_MAX];
     size_t mSizesTotal[LOG_ID_MAX];
     size_t mElementsTotal[LOG_ID_MAX];
+    // compressed storage, packing is done by the writer and unpacking by
+    // any number of readers concurrently, hence the atomics for the latter.
+    size_t mCompressIn[LOG_ID_MAX];
+    size_t mCompressOut[LOG_ID_MAX];
+    uint64_t mCompressNs[LOG_ID_MAX];
+    atomic_int_fast64_t mInflateNs[LOG_ID_MAX];
     bool enable;
 
     // uid to size list
@@ -441,7 +447,7 @@ public:
     void enableStatistics() { enable = true; }
 
     void add(LogBufferElement *entry);
-    void add_total_size(LogBufferElement *entry);
+    void add_total_size(log_id_t log_id, unsigned short size);
     void subtract(LogBufferElement *entry);
     // entry->setDropped(1) must follow this call
     void drop(LogBufferElement *entry);
@@ -452,6 +458,15 @@ public:
         --mDroppedElements[log_id];
     }
 
+    void compressed(log_id_t id, size_t in, size_t out, uint64_t ns) {
+        mCompressIn[id] += in;
+        mCompressOut[id] += out;
+        mCompressNs[id] += ns;
+    }
+    void inflated(log_id_t id, uint64_t ns) {
+        mInflateNs[id].fetch_add(ns, memory_order_relaxed);
+    }
+
     std::unique_ptr<const UidEntry *[]> sort(uid_t uid, pid_t pid,
                                              size_t len, log_id id) {
         return uidTable[id].sort(uid, pid, len);
@@ -19,6 +19,7 @@
 
 #include "FlushCommand.h"
 #include "LogBuffer.h"
+#include "LogFilter.h"
 #include "LogTimes.h"
 #include "LogReader.h"
 #include "LogUtils.h"
@@ -28,7 +29,8 @@ pthread_mutex_t LogTimeEntry::timesLock = PTHREAD_MUTEX_INITIALIZER;
 LogTimeEntry::LogTimeEntry(LogReader &reader, SocketClient *client,
                            bool nonBlock, unsigned long tail,
                            unsigned int logMask, pid_t pid,
-                           uint64_t start, uint64_t timeout) :
+                           uint64_t start, uint64_t timeout,
+                           LogFilter *filter) :
         mRefCount(1),
         mRelease(false),
         mError(false),
@@ -37,6 +39,7 @@ LogTimeEntry::LogTimeEntry(LogReader &reader, SocketClient *client,
         mReader(reader),
         mLogMask(logMask),
         mPid(pid),
+        mFilter(filter),
         mCount(0),
         mTail(tail),
         mIndex(0),
@@ -50,6 +53,10 @@ LogTimeEntry::LogTimeEntry(LogReader &reader, SocketClient *client,
     cleanSkip_Locked();
 }
 
+LogTimeEntry::~LogTimeEntry() {
+    delete mFilter;
+}
+
 void LogTimeEntry::startReader_Locked(void) {
     pthread_attr_t attr;
 
@@ -200,6 +207,10 @@ void *LogTimeEntry::threadStart(void *obj) {
 int LogTimeEntry::FilterFirstPass(const LogBufferElement *element, void *obj) {
     LogTimeEntry *me = reinterpret_cast<LogTimeEntry *>(obj);
 
+    // mFilter is immutable, keep its cost out from under the global lock
+    bool match = !me->mFilter || !me->isWatching(element->getLogId())
+            || me->mFilter->match(element);
+
     LogTimeEntry::lock();
 
     if (me->leadingDropped) {
@@ -215,7 +226,7 @@ int LogTimeEntry::FilterFirstPass(const LogBufferElement *element, void *obj) {
     }
 
     if ((!me->mPid || (me->mPid == element->getPid()))
-            && (me->isWatching(element->getLogId()))) {
+            && (me->isWatching(element->getLogId())) && match) {
         ++me->mCount;
     }
 
@@ -228,6 +239,9 @@ int LogTimeEntry::FilterFirstPass(const LogBufferElement *element, void *obj) {
 int LogTimeEntry::FilterSecondPass(const LogBufferElement *element, void *obj) {
     LogTimeEntry *me = reinterpret_cast<LogTimeEntry *>(obj);
 
+    bool match = !me->mFilter || !me->isWatching(element->getLogId())
+            || me->mFilter->match(element);
+
     LogTimeEntry::lock();
 
     me->mStart = element->getSequence();
@@ -257,6 +271,11 @@ int LogTimeEntry::FilterSecondPass(const LogBufferElement *element, void *obj) {
         goto skip;
     }
 
+    // before the tail count, -t counts what the reader gets to see
+    if (!match) {
+        goto skip;
+    }
+
     if (me->isError_Locked()) {
         goto stop;
     }
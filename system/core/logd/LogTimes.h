@@ -28,6 +28,7 @@
 
 class LogReader;
 class LogBufferElement;
+class LogFilter;
 
 class LogTimeEntry {
     static pthread_mutex_t timesLock;
@@ -43,6 +44,7 @@ class LogTimeEntry {
     static void threadStop(void *me);
     const unsigned int mLogMask;
     const pid_t mPid;
+    const LogFilter *const mFilter; // owned, NULL if the reader asked for none
     unsigned int skipAhead[LOG_ID_MAX];
     unsigned long mCount;
     unsigned long mTail;
@@ -51,7 +53,8 @@ class LogTimeEntry {
 public:
     LogTimeEntry(LogReader &reader, SocketClient *client, bool nonBlock,
                  unsigned long tail, unsigned int logMask, pid_t pid,
-                 uint64_t start, uint64_t timeout);
+                 uint64_t start, uint64_t timeout, LogFilter *filter = NULL);
+    ~LogTimeEntry();
 
     SocketClient *mClient;
     uint64_t mStart;
@@ -72,6 +72,12 @@ static inline bool worstUidEnabledForLogid(log_id_t id) {
     return (id == LOG_ID_MAIN) || (id == LOG_ID_SYSTEM) || (id == LOG_ID_RADIO);
 }
 
+// Binary buffers keep their payload inline, LogStatistics and the event
+// tag lookups read the tag straight out of it.
+static inline bool compressEnabledForLogid(log_id_t id) {
+    return (id != LOG_ID_EVENTS) && (id != LOG_ID_SECURITY);
+}
+
 template <int (*cmp)(const char *l, const char *r, const size_t s)>
 static inline int fast(const char *l, const char *r, const size_t s) {
     return (*l != *r) || cmp(l + 1, r + 1, s - 1);
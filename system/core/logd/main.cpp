@@ -49,6 +49,7 @@
 #include "LogListener.h"
 #include "LogAudit.h"
 #include "LogKlog.h"
+#include "LogPersist.h"
 #include "LogUtils.h"
 
 #define KMSG_PRIORITY(PRI)                            \
@@ -579,6 +580,15 @@ int main(int argc, char *argv[]) {
 
     logBuf = new LogBuffer(times);
 
+    // LogPersist copies log entries to segment files in /data/misc/logd
+    // when persist.logd.logpersistd is "logd". Its writer thread is started
+    // here so that it runs with our dropped privileges.
+
+    LogPersist *persist = new LogPersist();
+    if (persist->startWriter()) {
+        logBuf->setPersist(persist);
+    }
+
     signal(SIGHUP, reinit_signal_handler);
 
     if (property_get_bool("logd.statistics",
@@ -23,6 +23,27 @@ LOCAL_PATH := $(call my-dir)
 test_module_prefix := logd-
 test_tags := tests
 
+benchmark_c_flags := \
+    -I$(LOCAL_PATH)/../../liblog/tests \
+    -Wall -Wextra \
+    -Werror \
+    -fno-builtin \
+    -std=gnu++11
+
+benchmark_src_files := \
+    ../../liblog/tests/benchmark_main.cpp \
+    logd_benchmark.cpp
+
+# Build benchmarks for the device. Run with:
+#   adb shell logd-benchmarks
+include $(CLEAR_VARS)
+LOCAL_MODULE := $(test_module_prefix)benchmarks
+LOCAL_MODULE_TAGS := $(test_tags)
+LOCAL_CFLAGS += $(benchmark_c_flags)
+LOCAL_SHARED_LIBRARIES += liblog libm
+LOCAL_SRC_FILES := $(benchmark_src_files)
+include $(BUILD_NATIVE_TEST)
+
 # -----------------------------------------------------------------------------
 # Unit tests.
 # -----------------------------------------------------------------------------
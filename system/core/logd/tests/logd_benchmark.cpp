@@ -0,0 +1,308 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <log/log.h>
+#include <log/logger.h>
+#include <log/log_read.h>
+
+#include "benchmark.h"
+
+// enhanced version of LOG_FAILURE_RETRY to add support for EAGAIN and
+// non-syscall libs. See ../../liblog/tests/liblog_benchmark.cpp
+#define LOG_FAILURE_RETRY(exp) ({  \
+    typeof (exp) _rc;              \
+    do {                           \
+        _rc = (exp);               \
+    } while (((_rc == -1)          \
+           && ((errno == EINTR)    \
+            || (errno == EAGAIN))) \
+          || (_rc == -EINTR)       \
+          || (_rc == -EAGAIN));    \
+    _rc; })
+
+static const char benchmark_tag[] = "logd_benchmark";
+static const char stop_message[] = "stop";
+static const int alarm_time = 10;
+
+struct reader_state {
+    pthread_t thread;
+    struct logger_list *logger_list;
+    unsigned long count;
+    bool running;
+};
+
+static volatile bool readers_stop;
+
+static void caught_reader_alarm(int /*signum*/) {
+    // Wake any reader blocked in android_logger_list_read
+    readers_stop = true;
+    __android_log_buf_write(LOG_ID_MAIN, ANDROID_LOG_INFO,
+                            benchmark_tag, stop_message);
+}
+
+// Each reader streams LOG_ID_MAIN for this pid, the same as a logcat
+// client would, until it sees the stop message.
+static void *reader_thread(void *obj) {
+    reader_state *state = reinterpret_cast<reader_state *>(obj);
+
+    for (;;) {
+        log_msg log_msg;
+        int ret = android_logger_list_read(state->logger_list, &log_msg);
+        if (ret <= 0) {
+            break;
+        }
+        ++state->count;
+        if (readers_stop
+                && (log_msg.entry.len == (1 + sizeof(benchmark_tag)
+                                          + sizeof(stop_message)))
+                && !strcmp(log_msg.msg() + 1 + sizeof(benchmark_tag),
+                           stop_message)) {
+            break;
+        }
+    }
+    state->running = false;
+    return NULL;
+}
+
+/*
+ *	Measure the rate at which a single writer can push lines through logd
+ * while N reader threads are streaming the same buffer. With one global
+ * mutex the writer latency grows with the reader count, with reader/writer
+ * locking it should stay close to the zero reader case.
+ */
+static void BM_log_write_readers(int iters, int readers) {
+    pid_t pid = getpid();
+    reader_state *state = new reader_state[readers];
+
+    readers_stop = false;
+
+    for (int i = 0; i < readers; ++i) {
+        state[i].count = 0;
+        state[i].running = false;
+        state[i].logger_list = android_logger_list_alloc_time(
+            ANDROID_LOG_RDONLY, log_time(CLOCK_REALTIME), pid);
+        if (!state[i].logger_list
+                || !android_logger_open(state[i].logger_list, LOG_ID_MAIN)) {
+            fprintf(stderr, "Unable to open main log: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        state[i].running = !pthread_create(&state[i].thread, NULL,
+                                           reader_thread, &state[i]);
+    }
+
+    // Give the readers a chance to connect before the clock starts
+    usleep(100000);
+
+    StartBenchmarkTiming();
+
+    for (int i = 0; i < iters; ++i) {
+        LOG_FAILURE_RETRY(
+            __android_log_buf_print(LOG_ID_MAIN, ANDROID_LOG_INFO,
+                                    benchmark_tag, "%d", i));
+    }
+
+    StopBenchmarkTiming();
+
+    readers_stop = true;
+    LOG_FAILURE_RETRY(
+        __android_log_buf_write(LOG_ID_MAIN, ANDROID_LOG_INFO,
+                                benchmark_tag, stop_message));
+
+    // In case the stop message was pruned before a slow reader got to it
+    signal(SIGALRM, caught_reader_alarm);
+    alarm(alarm_time);
+
+    for (int i = 0; i < readers; ++i) {
+        if (state[i].running) {
+            pthread_join(state[i].thread, NULL);
+        }
+        android_logger_list_free(state[i].logger_list);
+    }
+
+    signal(SIGALRM, SIG_DFL);
+    alarm(0);
+
+    delete [] state;
+}
+
+// Single line end to end through logd under reader load, run as a pair
+// with the above to report how much logd itself is slowed by readers.
+static void BM_log_delay_readers(int iters, int readers) {
+    pid_t pid = getpid();
+    reader_state *state = new reader_state[readers + 1];
+
+    readers_stop = false;
+
+    for (int i = 0; i <= readers; ++i) {
+        state[i].count = 0;
+        state[i].running = false;
+        state[i].logger_list = android_logger_list_alloc_time(
+            ANDROID_LOG_RDONLY, log_time(CLOCK_REALTIME), pid);
+        if (!state[i].logger_list
+                || !android_logger_open(state[i].logger_list, LOG_ID_MAIN)) {
+            fprintf(stderr, "Unable to open main log: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        // state[readers] is read inline below as the latency probe
+        if (i < readers) {
+            state[i].running = !pthread_create(&state[i].thread, NULL,
+                                               reader_thread, &state[i]);
+        }
+    }
+
+    usleep(100000);
+
+    signal(SIGALRM, caught_reader_alarm);
+    alarm(alarm_time);
+
+    StartBenchmarkTiming();
+
+    for (int i = 0; i < iters; ++i) {
+        LOG_FAILURE_RETRY(
+            __android_log_buf_print(LOG_ID_MAIN, ANDROID_LOG_INFO,
+                                    benchmark_tag, "%d", i));
+
+        log_msg log_msg;
+        if (android_logger_list_read(state[readers].logger_list,
+                                     &log_msg) <= 0) {
+            break;
+        }
+        alarm(alarm_time);
+    }
+
+    StopBenchmarkTiming();
+
+    readers_stop = true;
+    LOG_FAILURE_RETRY(
+        __android_log_buf_write(LOG_ID_MAIN, ANDROID_LOG_INFO,
+                                benchmark_tag, stop_message));
+
+    for (int i = 0; i < readers; ++i) {
+        if (state[i].running) {
+            pthread_join(state[i].thread, NULL);
+        }
+        android_logger_list_free(state[i].logger_list);
+    }
+    android_logger_list_free(state[readers].logger_list);
+
+    signal(SIGALRM, SIG_DFL);
+    alarm(0);
+
+    delete [] state;
+}
+
+#define BENCHMARK_READERS(f, n)                      \
+    static void f##_##n(int iters) { f(iters, n); } \
+    BENCHMARK(f##_##n)
+
+BENCHMARK_READERS(BM_log_write_readers, 0);
+BENCHMARK_READERS(BM_log_write_readers, 1);
+BENCHMARK_READERS(BM_log_write_readers, 2);
+BENCHMARK_READERS(BM_log_write_readers, 4);
+BENCHMARK_READERS(BM_log_write_readers, 8);
+
+BENCHMARK_READERS(BM_log_delay_readers, 0);
+BENCHMARK_READERS(BM_log_delay_readers, 1);
+BENCHMARK_READERS(BM_log_delay_readers, 2);
+BENCHMARK_READERS(BM_log_delay_readers, 4);
+BENCHMARK_READERS(BM_log_delay_readers, 8);
+
+/*
+ *	Measure end to end latency of a line through logd with the main buffer
+ * full and resized to the given size, so that every few writes logd has to
+ * prune. This benchmark process is by far the chattiest UID, so with
+ * persist.logd.chatty set the cost of locating its oldest entries is what
+ * dominates; compare runs across builds, or with the property toggled.
+ */
+static void BM_log_prune(int iters, unsigned long size) {
+    pid_t pid = getpid();
+    static const char line[] =
+        "0123456789abcdef0123456789abcdef0123456789abcdef"
+        "0123456789abcdef0123456789abcdef0123456789";
+
+    struct logger_list *logger_list = android_logger_list_alloc_time(
+        ANDROID_LOG_RDONLY, log_time(CLOCK_REALTIME), pid);
+    struct logger *logger;
+    if (!logger_list
+            || !(logger = android_logger_open(logger_list, LOG_ID_MAIN))) {
+        fprintf(stderr, "Unable to open main log: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    long original = android_logger_get_log_size(logger);
+    if ((original <= 0) || android_logger_set_log_size(logger, size)) {
+        fprintf(stderr, "Unable to resize main log, need root\n");
+        android_logger_list_free(logger_list);
+        return;
+    }
+
+    // Fill the buffer twice over so that it sits at its limit
+    for (unsigned long fill = 0; fill < (2 * size); fill += sizeof(line)) {
+        LOG_FAILURE_RETRY(
+            __android_log_buf_write(LOG_ID_MAIN, ANDROID_LOG_INFO,
+                                    benchmark_tag, line));
+    }
+    // Read back only what is written from here on
+    android_logger_list_free(logger_list);
+    logger_list = android_logger_list_alloc_time(
+        ANDROID_LOG_RDONLY, log_time(CLOCK_REALTIME), pid);
+    if (!logger_list || !android_logger_open(logger_list, LOG_ID_MAIN)) {
+        fprintf(stderr, "Unable to open main log: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    signal(SIGALRM, caught_reader_alarm);
+    alarm(alarm_time);
+
+    StartBenchmarkTiming();
+
+    for (int i = 0; i < iters; ++i) {
+        LOG_FAILURE_RETRY(
+            __android_log_buf_write(LOG_ID_MAIN, ANDROID_LOG_INFO,
+                                    benchmark_tag, line));
+
+        log_msg log_msg;
+        if (android_logger_list_read(logger_list, &log_msg) <= 0) {
+            break;
+        }
+        alarm(alarm_time);
+    }
+
+    StopBenchmarkTiming();
+
+    signal(SIGALRM, SIG_DFL);
+    alarm(0);
+
+    android_logger_set_log_size(android_logger_open(logger_list, LOG_ID_MAIN),
+                                original);
+    android_logger_list_free(logger_list);
+}
+
+#define BENCHMARK_SIZE(f, name, size)                    \
+    static void f##_##name(int iters) { f(iters, size); } \
+    BENCHMARK(f##_##name)
+
+BENCHMARK_SIZE(BM_log_prune, 256K, 256 * 1024UL);
+BENCHMARK_SIZE(BM_log_prune, 1M, 1024 * 1024UL);
+BENCHMARK_SIZE(BM_log_prune, 16M, 16 * 1024 * 1024UL);
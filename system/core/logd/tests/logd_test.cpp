@@ -26,6 +26,7 @@
 #include <gtest/gtest.h>
 
 #include <android-base/stringprintf.h>
+#include <cutils/properties.h>
 #include <cutils/sockets.h>
 #include <log/log.h>
 #include <log/logger.h>
@@ -768,3 +769,100 @@ TEST(logd, SNDTIMEO) {
 
     close(fd);
 }
+
+/*
+ * sends a command to logd, returns its reply in the same buffer
+ */
+static bool send_to_control(char *buf, size_t len)
+{
+    int sock = socket_local_client("logd",
+                                   ANDROID_SOCKET_NAMESPACE_RESERVED,
+                                   SOCK_STREAM);
+    if (sock < 0) {
+        return false;
+    }
+    bool ret = write(sock, buf, strlen(buf) + 1) > 0;
+    if (ret) {
+        memset(buf, 0, len);
+        ret = read(sock, buf, len - 1) > 0;
+    }
+    close(sock);
+    return ret;
+}
+
+static void reinit_logd()
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "reinit");
+    EXPECT_TRUE(send_to_control(buf, sizeof(buf)));
+    EXPECT_STREQ("success", buf);
+    sleep(1); // logd reinitializes from a thread of its own
+}
+
+// Prune the main log with persist.logd.chatty on and the UID of this test
+// blacklisted, so that the blacklist pass of LogBuffer::prune() erases its
+// entries while it also looks for the worst UID.
+TEST(logd, prune_blacklist) {
+    static const unsigned long size = 64 * 1024UL;
+    static const char line[] =
+        "0123456789abcdef0123456789abcdef0123456789abcdef"
+        "0123456789abcdef0123456789abcdef0123456789";
+
+    char chatty[PROPERTY_VALUE_MAX];
+    property_get("persist.logd.chatty", chatty, "false");
+    if (property_set("persist.logd.chatty", "true")) {
+        fprintf(stderr, "WARNING: Unable to set persist.logd.chatty, need root\n"
+                        "         can not perform test\n");
+        return;
+    }
+    reinit_logd();
+
+    // Remember the prune list, the reply is "<size>\n<list>\n\f"
+    char prune[256];
+    snprintf(prune, sizeof(prune), "getPruneList");
+    ASSERT_TRUE(send_to_control(prune, sizeof(prune)));
+    char *list = strchr(prune, '\n');
+    ASSERT_TRUE(list != NULL);
+    ++list;
+    char *cp = strchr(list, '\n');
+    if (cp) {
+        *cp = '\0';
+    }
+    std::string restore = android::base::StringPrintf("setPruneList %s",
+        *list ? list : "default");
+
+    char buf[256];
+    snprintf(buf, sizeof(buf), "setPruneList ~! ~%u", getuid());
+    ASSERT_TRUE(send_to_control(buf, sizeof(buf)));
+    EXPECT_STREQ("success", buf);
+
+    struct logger_list *logger_list = android_logger_list_alloc(
+        ANDROID_LOG_RDONLY | ANDROID_LOG_NONBLOCK, 1, getpid());
+    ASSERT_TRUE(logger_list != NULL);
+    struct logger *logger = android_logger_open(logger_list, LOG_ID_MAIN);
+    ASSERT_TRUE(logger != NULL);
+    long original = android_logger_get_log_size(logger);
+    EXPECT_LT(0, original);
+    EXPECT_EQ(0, android_logger_set_log_size(logger, size));
+
+    // Fill the buffer a few times over so that logd has to prune
+    for (unsigned long fill = 0; fill < (4 * size); fill += sizeof(line)) {
+        __android_log_buf_write(LOG_ID_MAIN, ANDROID_LOG_INFO,
+                                "logd.prune_blacklist", line);
+    }
+
+    // logd is still there, and kept the last entry
+    log_msg msg;
+    EXPECT_LT(0, android_logger_list_read(logger_list, &msg));
+
+    snprintf(buf, sizeof(buf), "%s", restore.c_str());
+    EXPECT_TRUE(send_to_control(buf, sizeof(buf)));
+    EXPECT_STREQ("success", buf);
+    if (original > 0) {
+        android_logger_set_log_size(logger, original);
+    }
+    android_logger_list_free(logger_list);
+
+    property_set("persist.logd.chatty", chatty);
+    reinit_logd();
+}
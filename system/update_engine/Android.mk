@@ -169,7 +169,9 @@ ue_libpayload_consumer_src_files := \
     common/subprocess.cc \
     common/terminator.cc \
     common/utils.cc \
+    payload_consumer/bspatch.cc \
     payload_consumer/bzip_extent_writer.cc \
+    payload_consumer/chunk_hash_verifier.cc \
     payload_consumer/delta_performer.cc \
     payload_consumer/download_action.cc \
     payload_consumer/extent_writer.cc \
@@ -177,6 +179,7 @@ ue_libpayload_consumer_src_files := \
     payload_consumer/file_writer.cc \
     payload_consumer/filesystem_verifier_action.cc \
     payload_consumer/install_plan.cc \
+    payload_consumer/operation_applier.cc \
     payload_consumer/payload_constants.cc \
     payload_consumer/payload_verifier.cc \
     payload_consumer/postinstall_runner_action.cc \
@@ -419,7 +422,6 @@ include $(CLEAR_VARS)
 LOCAL_MODULE := update_engine
 LOCAL_MODULE_CLASS := EXECUTABLES
 LOCAL_REQUIRED_MODULES := \
-    bspatch \
     cacerts_google
 ifeq ($(local_use_weave),1)
 LOCAL_REQUIRED_MODULES += updater.json
@@ -565,6 +567,7 @@ ue_libpayload_generator_src_files := \
     payload_generator/annotated_operation.cc \
     payload_generator/blob_file_writer.cc \
     payload_generator/block_mapping.cc \
+    payload_generator/bsdiff.cc \
     payload_generator/bzip.cc \
     payload_generator/cycle_breaker.cc \
     payload_generator/delta_diff_generator.cc \
@@ -580,6 +583,7 @@ ue_libpayload_generator_src_files := \
     payload_generator/payload_generation_config.cc \
     payload_generator/payload_signer.cc \
     payload_generator/raw_filesystem.cc \
+    payload_generator/suffix_array_cache.cc \
     payload_generator/tarjan.cc \
     payload_generator/topological_sort.cc \
     payload_generator/xz_android.cc
@@ -686,6 +690,30 @@ LOCAL_SHARED_LIBRARIES := \
 LOCAL_SRC_FILES := $(ue_delta_generator_src_files)
 include $(BUILD_EXECUTABLE)
 
+# update_engine_benchmarks (type: executable)
+# ========================================================
+# Apply-time benchmarks of the payload operations.
+include $(CLEAR_VARS)
+LOCAL_MODULE := update_engine_benchmarks
+LOCAL_REQUIRED_MODULES := bspatch
+LOCAL_CPP_EXTENSION := .cc
+LOCAL_CLANG := true
+LOCAL_CFLAGS := $(ue_common_cflags)
+LOCAL_CPPFLAGS := $(ue_common_cppflags)
+LOCAL_LDFLAGS := $(ue_common_ldflags)
+LOCAL_C_INCLUDES := $(ue_common_c_includes)
+LOCAL_STATIC_LIBRARIES := \
+    libpayload_consumer \
+    libpayload_generator \
+    $(ue_libpayload_consumer_exported_static_libraries:-host=) \
+    $(ue_libpayload_generator_exported_static_libraries:-host=)
+LOCAL_SHARED_LIBRARIES := \
+    $(ue_common_shared_libraries) \
+    $(ue_libpayload_consumer_exported_shared_libraries:-host=) \
+    $(ue_libpayload_generator_exported_shared_libraries:-host=)
+LOCAL_SRC_FILES := payload_consumer/bspatch_benchmark.cc
+include $(BUILD_NATIVE_BENCHMARK)
+
 # TODO(deymo): Enable the unittest binaries in non-Brillo builds once the DBus
 # dependencies are removed or placed behind the USE_DBUS flag.
 ifdef BRILLO
@@ -778,6 +806,30 @@ LOCAL_SRC_FILES := \
     test_http_server.cc
 include $(BUILD_EXECUTABLE)
 
+# update_engine_download_benchmarks (type: executable)
+# ========================================================
+# End-to-end benchmark of downloading and applying a payload.
+include $(CLEAR_VARS)
+LOCAL_MODULE := update_engine_download_benchmarks
+LOCAL_REQUIRED_MODULES := test_http_server
+LOCAL_CPP_EXTENSION := .cc
+LOCAL_CLANG := true
+LOCAL_CFLAGS := $(ue_common_cflags)
+LOCAL_CPPFLAGS := $(ue_common_cppflags)
+LOCAL_LDFLAGS := $(ue_common_ldflags)
+LOCAL_C_INCLUDES := $(ue_common_c_includes)
+LOCAL_STATIC_LIBRARIES := \
+    libpayload_consumer \
+    libpayload_generator \
+    $(ue_libpayload_consumer_exported_static_libraries:-host=) \
+    $(ue_libpayload_generator_exported_static_libraries:-host=)
+LOCAL_SHARED_LIBRARIES := \
+    $(ue_common_shared_libraries) \
+    $(ue_libpayload_consumer_exported_shared_libraries:-host=) \
+    $(ue_libpayload_generator_exported_shared_libraries:-host=)
+LOCAL_SRC_FILES := payload_consumer/delta_performer_benchmark.cc
+include $(BUILD_NATIVE_BENCHMARK)
+
 # update_engine_unittests (type: executable)
 # ========================================================
 # Main unittest file.
@@ -843,18 +895,22 @@ LOCAL_SRC_FILES := \
     omaha_request_params_unittest.cc \
     omaha_response_handler_action_unittest.cc \
     p2p_manager_unittest.cc \
+    payload_consumer/bspatch_unittest.cc \
     payload_consumer/bzip_extent_writer_unittest.cc \
+    payload_consumer/chunk_hash_verifier_unittest.cc \
     payload_consumer/delta_performer_integration_test.cc \
     payload_consumer/delta_performer_unittest.cc \
     payload_consumer/download_action_unittest.cc \
     payload_consumer/extent_writer_unittest.cc \
     payload_consumer/file_writer_unittest.cc \
     payload_consumer/filesystem_verifier_action_unittest.cc \
+    payload_consumer/operation_applier_unittest.cc \
     payload_consumer/postinstall_runner_action_unittest.cc \
     payload_consumer/xz_extent_writer_unittest.cc \
     payload_generator/ab_generator_unittest.cc \
     payload_generator/blob_file_writer_unittest.cc \
     payload_generator/block_mapping_unittest.cc \
+    payload_generator/bsdiff_unittest.cc \
     payload_generator/cycle_breaker_unittest.cc \
     payload_generator/delta_diff_utils_unittest.cc \
     payload_generator/ext2_filesystem_unittest.cc \
@@ -867,6 +923,7 @@ LOCAL_SRC_FILES := \
     payload_generator/payload_file_unittest.cc \
     payload_generator/payload_generation_config_unittest.cc \
     payload_generator/payload_signer_unittest.cc \
+    payload_generator/suffix_array_cache_unittest.cc \
     payload_generator/tarjan_unittest.cc \
     payload_generator/topological_sort_unittest.cc \
     payload_generator/zip_unittest.cc \
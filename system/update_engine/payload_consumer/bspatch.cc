@@ -0,0 +1,202 @@
+//
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/bspatch.h"
+
+#include <bzlib.h>
+#include <limits.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include <base/macros.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/common/utils.h"
+
+using std::max;
+using std::min;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The patch starts with the magic, the compressed sizes of the control and
+// diff streams, and the size of the new data; the extra stream follows the
+// diff stream up to the end of the patch.
+const char kBsdiffMagic[] = "BSDIFF40";
+const uint64_t kBsdiffHeaderSize = 32;
+
+// Each control entry says how many bytes to take from the diff stream, how
+// many to take from the extra stream, and how far to then move in the old
+// data.
+const size_t kControlEntrySize = 24;
+
+// How much of the new data is put together before it is written out.
+const uint64_t kChunkSize = 256 * 1024;
+
+// Bounds the sizes and the position in the old data, far beyond any
+// partition, so that adding one to another can't overflow.
+const int64_t kMaxOffset = 1LL << 61;
+
+// Decodes the signed 64-bit numbers of the patch, which are stored as a
+// little-endian magnitude with the sign in the top bit.
+int64_t DecodeOffset(const uint8_t* buf) {
+  int64_t value = buf[7] & 0x7F;
+  for (int i = 6; i >= 0; i--)
+    value = value * 256 + buf[i];
+  return (buf[7] & 0x80) ? -value : value;
+}
+
+// Decompresses one of the bzip2 streams of the patch, reading the compressed
+// data where it is.
+class BzipStreamReader {
+ public:
+  BzipStreamReader() {
+    memset(&stream_, 0, sizeof(stream_));
+  }
+  ~BzipStreamReader() {
+    if (initialized_)
+      BZ2_bzDecompressEnd(&stream_);
+  }
+
+  bool Init(const uint8_t* data, uint64_t size) {
+    TEST_AND_RETURN_FALSE(size <= UINT_MAX);
+    TEST_AND_RETURN_FALSE(BZ2_bzDecompressInit(&stream_, 0, 0) == BZ_OK);
+    initialized_ = true;
+    stream_.next_in = reinterpret_cast<char*>(const_cast<uint8_t*>(data));
+    stream_.avail_in = size;
+    return true;
+  }
+
+  // Reads exactly |size| bytes, failing if the stream ends before that.
+  bool Read(uint8_t* out, size_t size) {
+    TEST_AND_RETURN_FALSE(size <= UINT_MAX);
+    stream_.next_out = reinterpret_cast<char*>(out);
+    stream_.avail_out = size;
+    while (stream_.avail_out > 0) {
+      const unsigned int avail_out = stream_.avail_out;
+      int rc = BZ2_bzDecompress(&stream_);
+      TEST_AND_RETURN_FALSE(rc == BZ_OK || rc == BZ_STREAM_END);
+      if (rc == BZ_STREAM_END || stream_.avail_out == avail_out) {
+        // There is no more to come; the patch is truncated.
+        TEST_AND_RETURN_FALSE(stream_.avail_out == 0);
+      }
+    }
+    return true;
+  }
+
+ private:
+  bz_stream stream_;
+  bool initialized_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(BzipStreamReader);
+};
+
+// Adds the old data from |old_pos| on to the |size| bytes of diff in |buf|.
+// Where that goes outside the old data, the diff bytes are the new ones.
+void AddOldData(const uint8_t* old_data,
+                uint64_t old_size,
+                int64_t old_pos,
+                uint8_t* buf,
+                uint64_t size) {
+  // Done in 64 bits, as |old_pos| may be anywhere the patch seeked to.
+  int64_t begin = max<int64_t>(old_pos, 0);
+  int64_t end = min<int64_t>(old_pos + static_cast<int64_t>(size),
+                             static_cast<int64_t>(old_size));
+  for (int64_t i = begin; i < end; i++)
+    buf[i - old_pos] += old_data[i];
+}
+
+}  // namespace
+
+bool ApplyBsdiffPatch(const uint8_t* old_data,
+                      uint64_t old_size,
+                      const uint8_t* patch,
+                      uint64_t patch_size,
+                      uint64_t new_size,
+                      ExtentWriter* writer) {
+  TEST_AND_RETURN_FALSE(old_size <= static_cast<uint64_t>(kMaxOffset) &&
+                        new_size <= static_cast<uint64_t>(kMaxOffset));
+  TEST_AND_RETURN_FALSE(patch_size >= kBsdiffHeaderSize);
+  TEST_AND_RETURN_FALSE(
+      memcmp(patch, kBsdiffMagic, sizeof(kBsdiffMagic) - 1) == 0);
+
+  int64_t ctrl_size = DecodeOffset(patch + 8);
+  int64_t diff_size = DecodeOffset(patch + 16);
+  int64_t patch_new_size = DecodeOffset(patch + 24);
+  TEST_AND_RETURN_FALSE(ctrl_size >= 0 && diff_size >= 0);
+  TEST_AND_RETURN_FALSE(static_cast<uint64_t>(ctrl_size) +
+                            static_cast<uint64_t>(diff_size) <=
+                        patch_size - kBsdiffHeaderSize);
+  if (patch_new_size < 0 ||
+      static_cast<uint64_t>(patch_new_size) != new_size) {
+    LOG(ERROR) << "The patch makes " << patch_new_size << " bytes, expected "
+               << new_size;
+    return false;
+  }
+
+  const uint8_t* ctrl = patch + kBsdiffHeaderSize;
+  const uint8_t* diff = ctrl + ctrl_size;
+  const uint8_t* extra = diff + diff_size;
+  BzipStreamReader ctrl_stream, diff_stream, extra_stream;
+  TEST_AND_RETURN_FALSE(ctrl_stream.Init(ctrl, ctrl_size));
+  TEST_AND_RETURN_FALSE(diff_stream.Init(diff, diff_size));
+  TEST_AND_RETURN_FALSE(extra_stream.Init(extra, patch + patch_size - extra));
+
+  brillo::Blob buf(min(kChunkSize, new_size));
+  uint64_t new_pos = 0;
+  int64_t old_pos = 0;
+  while (new_pos < new_size) {
+    uint8_t entry[kControlEntrySize];
+    TEST_AND_RETURN_FALSE(ctrl_stream.Read(entry, sizeof(entry)));
+    int64_t diff_count = DecodeOffset(entry);
+    int64_t extra_count = DecodeOffset(entry + 8);
+    int64_t seek = DecodeOffset(entry + 16);
+    TEST_AND_RETURN_FALSE(diff_count >= 0 && extra_count >= 0);
+    TEST_AND_RETURN_FALSE(static_cast<uint64_t>(diff_count) <=
+                          new_size - new_pos);
+
+    // The old data plus the diff, where they overlap.
+    while (diff_count > 0) {
+      uint64_t count = min(static_cast<uint64_t>(diff_count), kChunkSize);
+      TEST_AND_RETURN_FALSE(diff_stream.Read(buf.data(), count));
+      AddOldData(old_data, old_size, old_pos, buf.data(), count);
+      TEST_AND_RETURN_FALSE(writer->Write(buf.data(), count));
+      old_pos += count;
+      new_pos += count;
+      diff_count -= count;
+    }
+
+    // Then new data that was nowhere in the old.
+    TEST_AND_RETURN_FALSE(static_cast<uint64_t>(extra_count) <=
+                          new_size - new_pos);
+    while (extra_count > 0) {
+      uint64_t count = min(static_cast<uint64_t>(extra_count), kChunkSize);
+      TEST_AND_RETURN_FALSE(extra_stream.Read(buf.data(), count));
+      TEST_AND_RETURN_FALSE(writer->Write(buf.data(), count));
+      new_pos += count;
+      extra_count -= count;
+    }
+
+    TEST_AND_RETURN_FALSE(seek <= kMaxOffset && seek >= -kMaxOffset);
+    old_pos += seek;
+    TEST_AND_RETURN_FALSE(old_pos <= kMaxOffset && old_pos >= -kMaxOffset);
+  }
+  return true;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,46 @@
+//
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_BSPATCH_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_BSPATCH_H_
+
+#include <stdint.h>
+
+#include "update_engine/payload_consumer/extent_writer.h"
+
+// In-process replacement for the bspatch tool, used to apply the BSDIFF and
+// SOURCE_BSDIFF operations without writing the patch out to a file and
+// running a separate process for each of them.
+
+namespace chromeos_update_engine {
+
+// Applies the bsdiff patch in the |patch_size| bytes at |patch| to the
+// |old_size| bytes at |old_data|. The patch is in the BSDIFF40 format the
+// bsdiff tool generates, and its three bzip2 streams are decompressed
+// straight from |patch|. The |new_size| bytes of new data, which must be
+// what the patch says it makes, are passed to |writer| a chunk at a time as
+// they are put together. |writer| must already be initialized; End() is left
+// to the caller. Returns false if the patch is corrupt or writing fails.
+bool ApplyBsdiffPatch(const uint8_t* old_data,
+                      uint64_t old_size,
+                      const uint8_t* patch,
+                      uint64_t patch_size,
+                      uint64_t new_size,
+                      ExtentWriter* writer);
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_BSPATCH_H_
@@ -0,0 +1,233 @@
+//
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Apply-time benchmark of the BSDIFF operations, on a sample delta that
+// changes a few bytes in every block and replaces a little of the old data
+// with new data here and there, as a rebuilt binary does. The same operations
+// are also applied the way update_engine used to, writing each patch to a
+// file and running the bspatch program on it, as the baseline to compare with.
+
+#include <fcntl.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <base/logging.h>
+#include <benchmark/benchmark_api.h>
+#include <brillo/make_unique_ptr.h>
+
+#include "update_engine/common/subprocess.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/bspatch.h"
+#include "update_engine/payload_consumer/delta_performer.h"
+#include "update_engine/payload_consumer/extent_writer.h"
+#include "update_engine/payload_generator/bzip.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+const uint32_t kBlockSize = 4096;
+
+// The bspatch program update_engine used to run for each operation.
+const char kBspatchPath[] = "bspatch";
+
+void AppendOffset(int64_t value, brillo::Blob* out) {
+  uint64_t magnitude = value < 0 ? -value : value;
+  for (int i = 0; i < 8; i++) {
+    uint8_t byte = magnitude & 0xFF;
+    if (i == 7 && value < 0)
+      byte |= 0x80;
+    out->push_back(byte);
+    magnitude >>= 8;
+  }
+}
+
+// A sample delta of |size| bytes of old data into as many bytes of new data.
+struct SampleDelta {
+  brillo::Blob old_data;
+  brillo::Blob patch;
+  uint64_t new_size;
+};
+
+SampleDelta MakeSampleDelta(size_t size) {
+  SampleDelta delta;
+  std::mt19937 gen(0);
+  // Words from a small dictionary, so it compresses about as well as code.
+  vector<uint32_t> words(256);
+  for (uint32_t& word : words)
+    word = gen();
+  delta.old_data.resize(size);
+  for (size_t i = 0; i + 4 <= size; i += 4) {
+    uint32_t word = words[gen() % words.size()];
+    memcpy(delta.old_data.data() + i, &word, 4);
+  }
+
+  // Every block gets a couple of changed bytes; every eighth block is
+  // followed by 64 new bytes, and the old data skips as much to stay in step.
+  brillo::Blob ctrl, diff, extra;
+  uint64_t new_size = 0;
+  for (size_t pos = 0; pos < size; pos += kBlockSize) {
+    size_t diff_count = std::min<size_t>(kBlockSize, size - pos);
+    size_t extra_count = (pos / kBlockSize) % 8 == 7 ? 64 : 0;
+    extra_count = std::min<size_t>(extra_count, size - pos - diff_count);
+    brillo::Blob block_diff(diff_count, 0);
+    block_diff[gen() % diff_count] = gen();
+    block_diff[gen() % diff_count] = gen();
+    diff.insert(diff.end(), block_diff.begin(), block_diff.end());
+    for (size_t i = 0; i < extra_count; i++)
+      extra.push_back(gen());
+    AppendOffset(diff_count, &ctrl);
+    AppendOffset(extra_count, &ctrl);
+    AppendOffset(extra_count, &ctrl);
+    new_size += diff_count + extra_count;
+    pos += extra_count;
+  }
+
+  brillo::Blob ctrl_bz, diff_bz, extra_bz;
+  BzipCompress(ctrl, &ctrl_bz);
+  BzipCompress(diff, &diff_bz);
+  BzipCompress(extra, &extra_bz);
+  string magic = "BSDIFF40";
+  delta.patch.assign(magic.begin(), magic.end());
+  AppendOffset(ctrl_bz.size(), &delta.patch);
+  AppendOffset(diff_bz.size(), &delta.patch);
+  AppendOffset(new_size, &delta.patch);
+  delta.patch.insert(delta.patch.end(), ctrl_bz.begin(), ctrl_bz.end());
+  delta.patch.insert(delta.patch.end(), diff_bz.begin(), diff_bz.end());
+  delta.patch.insert(delta.patch.end(), extra_bz.begin(), extra_bz.end());
+  delta.new_size = new_size;
+  return delta;
+}
+
+FileDescriptorPtr OpenTempFile(string* path) {
+  CHECK(utils::MakeTempFile("bspatch_benchmark.XXXXXX", path, nullptr));
+  FileDescriptorPtr fd(new EintrSafeFileDescriptor);
+  CHECK(fd->Open(path->c_str(), O_RDWR, 0600));
+  return fd;
+}
+
+// Applies |range_y()| bytes worth of operations, each patching |range_x()|
+// bytes of old data and writing the result to its own blocks of a file
+// through the same writers DeltaPerformer uses.
+void BM_ApplyBsdiff(benchmark::State& state) {
+  const size_t op_size = state.range_x();
+  const size_t total_size = state.range_y();
+  SampleDelta delta = MakeSampleDelta(op_size);
+  string path;
+  FileDescriptorPtr fd = OpenTempFile(&path);
+  ScopedPathUnlinker unlinker(path);
+  const uint64_t new_blocks = (delta.new_size + kBlockSize - 1) / kBlockSize;
+  const size_t ops = total_size / op_size;
+
+  while (state.KeepRunning()) {
+    for (size_t i = 0; i < ops; i++) {
+      Extent extent;
+      extent.set_start_block(i * new_blocks);
+      extent.set_num_blocks(new_blocks);
+      std::unique_ptr<ExtentWriter> writer =
+          brillo::make_unique_ptr(new ZeroPadExtentWriter(
+              brillo::make_unique_ptr(new DirectExtentWriter())));
+      CHECK(writer->Init(fd, {extent}, kBlockSize));
+      CHECK(ApplyBsdiffPatch(delta.old_data.data(), delta.old_data.size(),
+                             delta.patch.data(), delta.patch.size(),
+                             delta.new_size, writer.get()));
+      CHECK(writer->End());
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * ops * delta.new_size);
+  fd->Close();
+}
+// Many small operations, as from files that changed a little, and fewer
+// large ones.
+BENCHMARK(BM_ApplyBsdiff)
+    ->ArgPair(16 * 1024, 16 * 1024 * 1024)
+    ->ArgPair(256 * 1024, 16 * 1024 * 1024)
+    ->ArgPair(4 * 1024 * 1024, 16 * 1024 * 1024);
+
+// Applies the same operations as BM_ApplyBsdiff, but as update_engine did
+// before bspatch was built in: each patch is written to a temporary file and
+// the bspatch program reads the old data from and writes the new data to the
+// block device, here a file, at the positions of the extents.
+void BM_ForkExecBspatch(benchmark::State& state) {
+  const size_t op_size = state.range_x();
+  const size_t total_size = state.range_y();
+  SampleDelta delta = MakeSampleDelta(op_size);
+  string old_path;
+  CHECK(utils::MakeTempFile("bspatch_benchmark_old.XXXXXX", &old_path,
+                            nullptr));
+  ScopedPathUnlinker old_unlinker(old_path);
+  CHECK(utils::WriteFile(old_path.c_str(), delta.old_data.data(),
+                         delta.old_data.size()));
+  string new_path;
+  FileDescriptorPtr fd = OpenTempFile(&new_path);
+  fd->Close();
+  ScopedPathUnlinker new_unlinker(new_path);
+  const uint64_t new_blocks = (delta.new_size + kBlockSize - 1) / kBlockSize;
+  const size_t ops = total_size / op_size;
+
+  google::protobuf::RepeatedPtrField<Extent> src_extents;
+  Extent* src_extent = src_extents.Add();
+  src_extent->set_start_block(0);
+  src_extent->set_num_blocks(
+      (delta.old_data.size() + kBlockSize - 1) / kBlockSize);
+  string input_positions;
+  CHECK(DeltaPerformer::ExtentsToBsdiffPositionsString(
+      src_extents, kBlockSize, delta.old_data.size(), &input_positions));
+
+  while (state.KeepRunning()) {
+    for (size_t i = 0; i < ops; i++) {
+      google::protobuf::RepeatedPtrField<Extent> dst_extents;
+      Extent* dst_extent = dst_extents.Add();
+      dst_extent->set_start_block(i * new_blocks);
+      dst_extent->set_num_blocks(new_blocks);
+      string output_positions;
+      CHECK(DeltaPerformer::ExtentsToBsdiffPositionsString(
+          dst_extents, kBlockSize, delta.new_size, &output_positions));
+
+      string patch_path;
+      CHECK(utils::MakeTempFile("au_patch.XXXXXX", &patch_path, nullptr));
+      ScopedPathUnlinker patch_unlinker(patch_path);
+      CHECK(utils::WriteFile(patch_path.c_str(), delta.patch.data(),
+                             delta.patch.size()));
+
+      vector<string> cmd{kBspatchPath, old_path, new_path, patch_path,
+                         input_positions, output_positions};
+      int return_code = 0;
+      CHECK(Subprocess::SynchronousExecFlags(cmd, Subprocess::kSearchPath,
+                                             &return_code, nullptr));
+      CHECK_EQ(0, return_code);
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * ops * delta.new_size);
+}
+BENCHMARK(BM_ForkExecBspatch)
+    ->ArgPair(16 * 1024, 16 * 1024 * 1024)
+    ->ArgPair(256 * 1024, 16 * 1024 * 1024)
+    ->ArgPair(4 * 1024 * 1024, 16 * 1024 * 1024);
+
+}  // namespace
+
+}  // namespace chromeos_update_engine
+
+BENCHMARK_MAIN()
@@ -0,0 +1,200 @@
+//
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/bspatch.h"
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/payload_consumer/fake_extent_writer.h"
+#include "update_engine/payload_generator/bzip.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+struct ControlEntry {
+  int64_t diff_count;
+  int64_t extra_count;
+  int64_t seek;
+};
+
+void AppendOffset(int64_t value, brillo::Blob* out) {
+  uint64_t magnitude = value < 0 ? -value : value;
+  for (int i = 0; i < 8; i++) {
+    uint8_t byte = magnitude & 0xFF;
+    if (i == 7 && value < 0)
+      byte |= 0x80;
+    out->push_back(byte);
+    magnitude >>= 8;
+  }
+}
+
+brillo::Blob ToBlob(const string& str) {
+  return brillo::Blob(str.begin(), str.end());
+}
+
+// Puts together a BSDIFF40 patch the way the bsdiff tool lays it out.
+brillo::Blob MakePatch(const vector<ControlEntry>& entries,
+                       const brillo::Blob& diff,
+                       const brillo::Blob& extra,
+                       int64_t new_size) {
+  brillo::Blob ctrl;
+  for (const ControlEntry& entry : entries) {
+    AppendOffset(entry.diff_count, &ctrl);
+    AppendOffset(entry.extra_count, &ctrl);
+    AppendOffset(entry.seek, &ctrl);
+  }
+  brillo::Blob ctrl_bz, diff_bz, extra_bz;
+  EXPECT_TRUE(BzipCompress(ctrl, &ctrl_bz));
+  EXPECT_TRUE(BzipCompress(diff, &diff_bz));
+  EXPECT_TRUE(BzipCompress(extra, &extra_bz));
+
+  brillo::Blob patch = ToBlob("BSDIFF40");
+  AppendOffset(ctrl_bz.size(), &patch);
+  AppendOffset(diff_bz.size(), &patch);
+  AppendOffset(new_size, &patch);
+  patch.insert(patch.end(), ctrl_bz.begin(), ctrl_bz.end());
+  patch.insert(patch.end(), diff_bz.begin(), diff_bz.end());
+  patch.insert(patch.end(), extra_bz.begin(), extra_bz.end());
+  return patch;
+}
+
+bool Apply(const brillo::Blob& old_data,
+           const brillo::Blob& patch,
+           uint64_t new_size,
+           brillo::Blob* new_data) {
+  FakeExtentWriter writer;
+  writer.Init(nullptr, {}, 4096);
+  bool result = ApplyBsdiffPatch(old_data.data(), old_data.size(),
+                                 patch.data(), patch.size(),
+                                 new_size, &writer);
+  *new_data = writer.WrittenData();
+  return result;
+}
+
+}  // namespace
+
+class BspatchTest : public ::testing::Test {
+ protected:
+  brillo::Blob old_data_ = ToBlob("0123456789");
+};
+
+TEST_F(BspatchTest, IdenticalTest) {
+  brillo::Blob patch = MakePatch(
+      {{10, 0, 0}}, brillo::Blob(10, 0), brillo::Blob(), 10);
+  brillo::Blob new_data;
+  EXPECT_TRUE(Apply(old_data_, patch, 10, &new_data));
+  EXPECT_EQ(old_data_, new_data);
+}
+
+TEST_F(BspatchTest, DiffExtraAndSeekTest) {
+  // "0123" with the second byte one up, then "xy" from the extra stream,
+  // then back to 2 in the old data for "234", and on past the end of the
+  // old data where the diff bytes are taken as they are.
+  brillo::Blob diff = {0, 1, 0, 0, 0, 0, 0};
+  diff.insert(diff.end(), {'A', 'B'});
+  brillo::Blob patch = MakePatch({{4, 2, -2}, {3, 0, 5}, {2, 1, 0}},
+                                 diff, ToBlob("xyz"), 12);
+  brillo::Blob new_data;
+  EXPECT_TRUE(Apply(old_data_, patch, 12, &new_data));
+  EXPECT_EQ(ToBlob("0223xy234ABz"), new_data);
+}
+
+TEST_F(BspatchTest, SeekBeforeStartTest) {
+  // Starting two bytes before the old data, the first two diff bytes are
+  // the new ones.
+  brillo::Blob patch = MakePatch({{0, 0, -2}, {4, 0, 0}},
+                                 {'a', 'b', 0, 0}, brillo::Blob(), 4);
+  brillo::Blob new_data;
+  EXPECT_TRUE(Apply(old_data_, patch, 4, &new_data));
+  EXPECT_EQ(ToBlob("ab01"), new_data);
+}
+
+TEST_F(BspatchTest, LargeOutputIsChunkedTest) {
+  // More than one chunk's worth from both streams.
+  const size_t kSize = 600 * 1024;
+  brillo::Blob old_data(kSize);
+  for (size_t i = 0; i < kSize; i++)
+    old_data[i] = i * 7;
+  brillo::Blob extra(kSize, 'e');
+  brillo::Blob patch = MakePatch({{kSize, kSize, 0}},
+                                 brillo::Blob(kSize, 1), extra, 2 * kSize);
+  brillo::Blob new_data;
+  EXPECT_TRUE(Apply(old_data, patch, 2 * kSize, &new_data));
+  ASSERT_EQ(2 * kSize, new_data.size());
+  for (size_t i = 0; i < kSize; i++)
+    ASSERT_EQ(static_cast<uint8_t>(old_data[i] + 1), new_data[i]) << i;
+  EXPECT_TRUE(std::equal(extra.begin(), extra.end(), new_data.begin() + kSize));
+}
+
+TEST_F(BspatchTest, BadMagicTest) {
+  brillo::Blob patch = MakePatch(
+      {{10, 0, 0}}, brillo::Blob(10, 0), brillo::Blob(), 10);
+  patch[7] = '9';
+  brillo::Blob new_data;
+  EXPECT_FALSE(Apply(old_data_, patch, 10, &new_data));
+}
+
+TEST_F(BspatchTest, NewSizeMismatchTest) {
+  brillo::Blob patch = MakePatch(
+      {{10, 0, 0}}, brillo::Blob(10, 0), brillo::Blob(), 10);
+  brillo::Blob new_data;
+  EXPECT_FALSE(Apply(old_data_, patch, 11, &new_data));
+}
+
+TEST_F(BspatchTest, TruncatedPatchTest) {
+  brillo::Blob patch = MakePatch(
+      {{10, 5, 0}}, brillo::Blob(10, 0), ToBlob("abcde"), 15);
+  // Cut off in the header, in the control stream, and where the extra
+  // stream starts.
+  const size_t extra_start = 32 + patch[8] + patch[16];
+  brillo::Blob new_data;
+  for (size_t size : {size_t{20}, size_t{40}, extra_start}) {
+    brillo::Blob truncated(patch.begin(), patch.begin() + size);
+    EXPECT_FALSE(Apply(old_data_, truncated, 15, &new_data)) << size;
+  }
+}
+
+TEST_F(BspatchTest, ShortStreamsTest) {
+  // The control entries ask for more than the streams have.
+  brillo::Blob new_data;
+  brillo::Blob patch = MakePatch(
+      {{10, 0, 0}}, brillo::Blob(5, 0), brillo::Blob(), 10);
+  EXPECT_FALSE(Apply(old_data_, patch, 10, &new_data));
+  patch = MakePatch({{0, 10, 0}}, brillo::Blob(), ToBlob("abc"), 10);
+  EXPECT_FALSE(Apply(old_data_, patch, 10, &new_data));
+  patch = MakePatch({{5, 0, 0}}, brillo::Blob(5, 0), brillo::Blob(), 10);
+  EXPECT_FALSE(Apply(old_data_, patch, 10, &new_data));
+}
+
+TEST_F(BspatchTest, BadControlEntryTest) {
+  brillo::Blob new_data;
+  // Negative counts.
+  brillo::Blob patch = MakePatch(
+      {{-1, 11, 0}}, brillo::Blob(), brillo::Blob(11, 'a'), 10);
+  EXPECT_FALSE(Apply(old_data_, patch, 10, &new_data));
+  // More than the new data.
+  patch = MakePatch({{0, 11, 0}}, brillo::Blob(), brillo::Blob(11, 'a'), 10);
+  EXPECT_FALSE(Apply(old_data_, patch, 10, &new_data));
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,190 @@
+//
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/chunk_hash_verifier.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <base/bind.h>
+#include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/utils.h"
+
+using brillo::MessageLoop;
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+// Each thread reads its chunk in pieces of this size, large enough for the
+// storage to stream them.
+const size_t kReadBufferSize = 1024 * 1024;  // bytes
+}  // namespace
+
+ChunkHashVerifier::ChunkHashVerifier(const string& path,
+                                     uint64_t size,
+                                     uint64_t chunk_size,
+                                     const vector<brillo::Blob>& chunk_hashes)
+    : path_(path),
+      size_(size),
+      chunk_size_(chunk_size),
+      chunk_hashes_(chunk_hashes) {}
+
+ChunkHashVerifier::~ChunkHashVerifier() {
+  Cancel();
+}
+
+bool ChunkHashVerifier::HashesCoverPartition(
+    uint64_t size,
+    uint64_t chunk_size,
+    const vector<brillo::Blob>& chunk_hashes) {
+  if (chunk_size == 0 || chunk_hashes.empty())
+    return false;
+  return chunk_hashes.size() == (size + chunk_size - 1) / chunk_size;
+}
+
+bool ChunkHashVerifier::Start(size_t max_threads, const DoneCallback& done) {
+  CHECK(!thread_pool_);
+  CHECK(HashesCoverPartition(size_, chunk_size_, chunk_hashes_));
+  fd_ = HANDLE_EINTR(open(path_.c_str(), O_RDONLY));
+  if (fd_ < 0) {
+    PLOG(ERROR) << "Unable to open " << path_ << " for reading";
+    return false;
+  }
+  // Each thread reads its chunk front to back, so a larger readahead helps.
+  posix_fadvise(fd_, 0, size_, POSIX_FADV_SEQUENTIAL);
+  if (pipe(done_pipe_) != 0) {
+    PLOG(ERROR) << "Unable to create a pipe";
+    Cancel();
+    return false;
+  }
+  done_task_ = MessageLoop::current()->WatchFileDescriptor(
+      FROM_HERE,
+      done_pipe_[0],
+      MessageLoop::WatchMode::kWatchRead,
+      false,
+      base::Bind(&ChunkHashVerifier::OnThreadsDone, base::Unretained(this)));
+  done_ = done;
+
+  size_t num_threads = std::max(
+      std::min(max_threads, chunk_hashes_.size()), static_cast<size_t>(1));
+  LOG(INFO) << "Verifying " << chunk_hashes_.size() << " chunks of " << path_
+            << " using " << num_threads << " threads";
+  running_threads_ = num_threads;
+  thread_pool_.reset(
+      new base::DelegateSimpleThreadPool("chunk-hash-verifier", num_threads));
+  thread_pool_->Start();
+  // Each thread runs this delegate once, and it takes chunks until no more are
+  // left.
+  thread_pool_->AddWork(this, num_threads);
+  return true;
+}
+
+void ChunkHashVerifier::Cancel() {
+  if (done_task_ != MessageLoop::kTaskIdNull) {
+    MessageLoop::current()->CancelTask(done_task_);
+    done_task_ = MessageLoop::kTaskIdNull;
+  }
+  if (thread_pool_) {
+    {
+      base::AutoLock auto_lock(lock_);
+      stopping_ = true;
+    }
+    thread_pool_->JoinAll();
+    thread_pool_.reset();
+  }
+  for (int* fd : {&fd_, &done_pipe_[0], &done_pipe_[1]}) {
+    if (*fd >= 0) {
+      IGNORE_EINTR(close(*fd));
+      *fd = -1;
+    }
+  }
+}
+
+void ChunkHashVerifier::Run() {
+  brillo::Blob buffer(std::min<uint64_t>(kReadBufferSize, chunk_size_));
+  while (true) {
+    size_t chunk_index;
+    {
+      base::AutoLock auto_lock(lock_);
+      if (stopping_ || next_chunk_ == chunk_hashes_.size())
+        break;
+      chunk_index = next_chunk_++;
+    }
+    if (!ChunkMatches(chunk_index, &buffer)) {
+      base::AutoLock auto_lock(lock_);
+      // Once one chunk failed, the rest don't need to be hashed.
+      failed_ = true;
+      stopping_ = true;
+    }
+  }
+
+  base::AutoLock auto_lock(lock_);
+  if (--running_threads_ == 0 &&
+      HANDLE_EINTR(write(done_pipe_[1], "", 1)) != 1) {
+    PLOG(ERROR) << "Unable to notify the message loop";
+  }
+}
+
+bool ChunkHashVerifier::ChunkMatches(size_t chunk_index,
+                                     brillo::Blob* buffer) {
+  uint64_t offset = chunk_index * chunk_size_;
+  const uint64_t end = std::min(offset + chunk_size_, size_);
+  HashCalculator hasher;
+  while (offset < end) {
+    {
+      base::AutoLock auto_lock(lock_);
+      if (stopping_)
+        return false;
+    }
+    size_t bytes_to_read = std::min<uint64_t>(buffer->size(), end - offset);
+    ssize_t bytes_read;
+    if (!utils::PReadAll(
+            fd_, buffer->data(), bytes_to_read, offset, &bytes_read) ||
+        bytes_read != static_cast<ssize_t>(bytes_to_read)) {
+      LOG(ERROR) << "Unable to read " << bytes_to_read << " bytes at offset "
+                 << offset << " from " << path_;
+      return false;
+    }
+    TEST_AND_RETURN_FALSE(hasher.Update(buffer->data(), bytes_to_read));
+    offset += bytes_to_read;
+  }
+  TEST_AND_RETURN_FALSE(hasher.Finalize());
+  if (hasher.raw_hash() != chunk_hashes_[chunk_index]) {
+    LOG(ERROR) << "Chunk " << chunk_index << " of " << path_
+               << " doesn't match its hash, got " << hasher.hash();
+    return false;
+  }
+  return true;
+}
+
+void ChunkHashVerifier::OnThreadsDone() {
+  // The watch isn't persistent, so the task is already gone.
+  done_task_ = MessageLoop::kTaskIdNull;
+  Cancel();
+  DoneCallback done = done_;
+  done_.Reset();
+  // The |done| callback may destroy this object.
+  done.Run(!failed_);
+}
+
+}  // namespace chromeos_update_engine
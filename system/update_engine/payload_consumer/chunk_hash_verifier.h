@@ -0,0 +1,113 @@
+//
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_CHUNK_HASH_VERIFIER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_CHUNK_HASH_VERIFIER_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/callback.h>
+#include <base/macros.h>
+#include <base/synchronization/lock.h>
+#include <base/threading/simple_thread.h>
+#include <brillo/message_loops/message_loop.h>
+#include <brillo/secure_blob.h>
+
+namespace chromeos_update_engine {
+
+// Verifies a partition against the hashes of its chunks, hashing several
+// chunks at a time on a pool of threads instead of the whole partition in
+// sequence. The result is reported back on the message loop it was started
+// from.
+class ChunkHashVerifier : public base::DelegateSimpleThread::Delegate {
+ public:
+  // Called with whether all the chunks matched their hashes.
+  using DoneCallback = base::Callback<void(bool success)>;
+
+  // Verifies the first |size| bytes of the file or device at |path|, split in
+  // chunks of |chunk_size| bytes, the last one possibly shorter, against their
+  // |chunk_hashes|.
+  ChunkHashVerifier(const std::string& path,
+                    uint64_t size,
+                    uint64_t chunk_size,
+                    const std::vector<brillo::Blob>& chunk_hashes);
+
+  // Cancels the verification, if still running, as Cancel() does.
+  ~ChunkHashVerifier() override;
+
+  // Returns whether the |chunk_hashes| of |chunk_size| bytes each cover the
+  // |size| bytes of a partition exactly, so they can be used to verify it.
+  static bool HashesCoverPartition(
+      uint64_t size,
+      uint64_t chunk_size,
+      const std::vector<brillo::Blob>& chunk_hashes);
+
+  // Opens the partition and starts hashing its chunks on up to |max_threads|
+  // threads. The |done| callback is called from the current message loop once
+  // all the chunks are hashed, or soon after one doesn't match or can't be
+  // read. Returns false if the verification couldn't be started, in which case
+  // |done| is never called.
+  bool Start(size_t max_threads, const DoneCallback& done);
+
+  // Stops the verification without calling the |done| callback, waiting for
+  // the reads in flight to finish.
+  void Cancel();
+
+  // Overrides DelegateSimpleThread::Delegate.
+  // Run() hashes the next chunk not taken by another thread until none is
+  // left, one of them fails or the verification is cancelled.
+  void Run() override;
+
+ private:
+  // Hashes the chunk number |chunk_index| reading it through |buffer| and
+  // returns whether it matches its hash. Returns false as well if the
+  // verification stopped before the whole chunk was read.
+  bool ChunkMatches(size_t chunk_index, brillo::Blob* buffer);
+
+  // Called from the message loop once all the threads stopped hashing.
+  void OnThreadsDone();
+
+  const std::string path_;
+  const uint64_t size_;
+  const uint64_t chunk_size_;
+  const std::vector<brillo::Blob> chunk_hashes_;
+
+  // The partition being read and the pipe the last thread to stop writes to,
+  // to wake up the message loop.
+  int fd_{-1};
+  int done_pipe_[2]{-1, -1};
+  brillo::MessageLoop::TaskId done_task_{brillo::MessageLoop::kTaskIdNull};
+  DoneCallback done_;
+
+  std::unique_ptr<base::DelegateSimpleThreadPool> thread_pool_;
+
+  // Protects the state shared with the threads below.
+  base::Lock lock_;
+  size_t next_chunk_{0};
+  size_t running_threads_{0};
+  bool failed_{false};
+  // Whether the threads should stop hashing, either because a chunk failed or
+  // because the verification was cancelled.
+  bool stopping_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(ChunkHashVerifier);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_CHUNK_HASH_VERIFIER_H_
@@ -0,0 +1,158 @@
+//
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/chunk_hash_verifier.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <base/bind.h>
+#include <base/message_loop/message_loop.h>
+#include <brillo/bind_lambda.h>
+#include <brillo/message_loops/base_message_loop.h>
+#include <brillo/message_loops/message_loop_utils.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+const uint64_t kChunkSize = 64 * 1024;
+// Three whole chunks and a partial one.
+const uint64_t kPartitionSize = 3 * kChunkSize + 1000;
+}  // namespace
+
+class ChunkHashVerifierTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    loop_.SetAsCurrent();
+    ASSERT_TRUE(utils::MakeTempFile("ChunkHashVerifierTest-part.XXXXXX",
+                                    &part_path_,
+                                    nullptr));
+    part_data_.resize(kPartitionSize);
+    test_utils::FillWithData(&part_data_);
+    ASSERT_TRUE(test_utils::WriteFileVector(part_path_, part_data_));
+    for (uint64_t offset = 0; offset < kPartitionSize; offset += kChunkSize) {
+      brillo::Blob chunk_hash;
+      ASSERT_TRUE(HashCalculator::RawHashOfBytes(
+          part_data_.data() + offset,
+          std::min(kChunkSize, kPartitionSize - offset),
+          &chunk_hash));
+      chunk_hashes_.push_back(chunk_hash);
+    }
+  }
+
+  void TearDown() override {
+    unlink(part_path_.c_str());
+  }
+
+  // Runs the |verifier| on up to |max_threads| threads until it is done and
+  // returns whether it succeeded.
+  bool RunVerifier(ChunkHashVerifier* verifier, size_t max_threads) {
+    bool done = false;
+    bool success = false;
+    EXPECT_TRUE(verifier->Start(
+        max_threads,
+        base::Bind(&ChunkHashVerifierTest::OnDone, base::Unretained(this),
+                   &done, &success)));
+    loop_.Run();
+    EXPECT_TRUE(done);
+    return success;
+  }
+
+  void OnDone(bool* done, bool* success_out, bool success) {
+    *done = true;
+    *success_out = success;
+    loop_.BreakLoop();
+  }
+
+  base::MessageLoopForIO base_loop_;
+  brillo::BaseMessageLoop loop_{&base_loop_};
+
+  string part_path_;
+  brillo::Blob part_data_;
+  vector<brillo::Blob> chunk_hashes_;
+};
+
+TEST_F(ChunkHashVerifierTest, HashesCoverPartitionTest) {
+  EXPECT_TRUE(ChunkHashVerifier::HashesCoverPartition(
+      kPartitionSize, kChunkSize, chunk_hashes_));
+  EXPECT_TRUE(ChunkHashVerifier::HashesCoverPartition(
+      3 * kChunkSize + 1, kChunkSize, chunk_hashes_));
+  EXPECT_TRUE(ChunkHashVerifier::HashesCoverPartition(
+      4 * kChunkSize, kChunkSize, chunk_hashes_));
+  EXPECT_FALSE(ChunkHashVerifier::HashesCoverPartition(
+      3 * kChunkSize, kChunkSize, chunk_hashes_));
+  EXPECT_FALSE(ChunkHashVerifier::HashesCoverPartition(
+      4 * kChunkSize + 1, kChunkSize, chunk_hashes_));
+  EXPECT_FALSE(ChunkHashVerifier::HashesCoverPartition(
+      kPartitionSize, 0, chunk_hashes_));
+  EXPECT_FALSE(ChunkHashVerifier::HashesCoverPartition(0, kChunkSize, {}));
+}
+
+TEST_F(ChunkHashVerifierTest, MatchingChunksTest) {
+  for (size_t max_threads : {1, 2, 8}) {
+    ChunkHashVerifier verifier(
+        part_path_, kPartitionSize, kChunkSize, chunk_hashes_);
+    EXPECT_TRUE(RunVerifier(&verifier, max_threads));
+  }
+}
+
+TEST_F(ChunkHashVerifierTest, CorruptedChunkTest) {
+  // Only the last, partial chunk is different.
+  part_data_[kPartitionSize - 1] ^= 0xff;
+  ASSERT_TRUE(test_utils::WriteFileVector(part_path_, part_data_));
+  for (size_t max_threads : {1, 4}) {
+    ChunkHashVerifier verifier(
+        part_path_, kPartitionSize, kChunkSize, chunk_hashes_);
+    EXPECT_FALSE(RunVerifier(&verifier, max_threads));
+  }
+}
+
+TEST_F(ChunkHashVerifierTest, ShortPartitionTest) {
+  // The last chunk can't be read whole.
+  part_data_.resize(kPartitionSize - 1);
+  ASSERT_TRUE(test_utils::WriteFileVector(part_path_, part_data_));
+  ChunkHashVerifier verifier(
+      part_path_, kPartitionSize, kChunkSize, chunk_hashes_);
+  EXPECT_FALSE(RunVerifier(&verifier, 4));
+}
+
+TEST_F(ChunkHashVerifierTest, MissingPartitionTest) {
+  ChunkHashVerifier verifier(
+      "/non/existent/path", kPartitionSize, kChunkSize, chunk_hashes_);
+  EXPECT_FALSE(verifier.Start(
+      4, base::Bind([](bool success) { ADD_FAILURE(); })));
+}
+
+TEST_F(ChunkHashVerifierTest, CancelTest) {
+  ChunkHashVerifier verifier(
+      part_path_, kPartitionSize, kChunkSize, chunk_hashes_);
+  EXPECT_TRUE(verifier.Start(
+      4, base::Bind([](bool success) { ADD_FAILURE(); })));
+  verifier.Cancel();
+  // The callback isn't called after the verification was cancelled.
+  brillo::MessageLoopRunMaxIterations(&loop_, 10);
+}
+
+}  // namespace chromeos_update_engine
@@ -26,6 +26,7 @@
 #include <string>
 #include <vector>
 
+#include <base/bind.h>
 #include <base/files/file_util.h>
 #include <base/format_macros.h>
 #include <base/strings/string_util.h>
@@ -37,8 +38,8 @@
 #include "update_engine/common/constants.h"
 #include "update_engine/common/hardware_interface.h"
 #include "update_engine/common/prefs_interface.h"
-#include "update_engine/common/subprocess.h"
 #include "update_engine/common/terminator.h"
+#include "update_engine/payload_consumer/bspatch.h"
 #include "update_engine/payload_consumer/bzip_extent_writer.h"
 #include "update_engine/payload_consumer/download_action.h"
 #include "update_engine/payload_consumer/extent_writer.h"
@@ -71,6 +72,8 @@ const unsigned DeltaPerformer::kProgressLogTimeoutSeconds = 30;
 const unsigned DeltaPerformer::kProgressDownloadWeight = 50;
 const unsigned DeltaPerformer::kProgressOperationsWeight = 50;
 
+const uint64_t DeltaPerformer::kMaxQueuedOperationBytes = 8 * 1024 * 1024;
+
 namespace {
 const int kUpdateStateOperationInvalid = -1;
 const int kMaxResumedUpdateFailures = 10;
@@ -243,18 +246,14 @@ size_t DeltaPerformer::CopyDataToBuffer(const char** bytes_p, size_t* count_p,
 }
 
 
-bool DeltaPerformer::HandleOpResult(bool op_result, const char* op_type_name,
-                                    ErrorCode* error) {
-  if (op_result)
-    return true;
-
-  LOG(ERROR) << "Failed to perform " << op_type_name << " operation "
-             << next_operation_num_;
-  *error = ErrorCode::kDownloadOperationExecutionError;
-  return false;
-}
-
 int DeltaPerformer::Close() {
+  if (applier_) {
+    // Lets the queued operations finish so that a resumed update doesn't need
+    // their data again.
+    ErrorCode error;
+    WaitForAppliedOperations(&error);
+    applier_.reset();
+  }
   int err = -CloseCurrentPartition();
   LOG_IF(ERROR, !payload_hash_calculator_.Finalize() ||
                 !signed_hash_calculator_.Finalize())
@@ -564,6 +563,10 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode *error) {
     if ((*error = ValidateManifest()) != ErrorCode::kSuccess)
       return false;
     manifest_valid_ = true;
+    applier_.reset(new OperationApplier(
+        base::Bind(&DeltaPerformer::PerformInstallOperation,
+                   base::Unretained(this)),
+        kMaxQueuedOperationBytes));
 
     // Clear the download buffer.
     DiscardBuffer(false, metadata_size_);
@@ -609,9 +612,15 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode *error) {
     if (download_delegate_ && download_delegate_->ShouldCancel(error))
       return false;
 
+    if (!SaveAppliedCheckpoints(error))
+      return false;
+
     // We know there are more operations to perform because we didn't reach the
     // |num_total_operations_| limit yet.
     while (next_operation_num_ >= acc_num_operations_[current_partition_]) {
+      // The queued operations write to the current partition.
+      if (!WaitForAppliedOperations(error))
+        return false;
       CloseCurrentPartition();
       current_partition_++;
       if (!OpenCurrentPartition()) {
@@ -654,44 +663,45 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode *error) {
       }
     }
 
-    // Makes sure we unblock exit when this operation completes.
-    ScopedTerminatorExitUnblocker exit_unblocker =
-        ScopedTerminatorExitUnblocker();  // Avoids a compiler unused var bug.
-
-    bool op_result;
-    switch (op.type()) {
-      case InstallOperation::REPLACE:
-      case InstallOperation::REPLACE_BZ:
-      case InstallOperation::REPLACE_XZ:
-        op_result = PerformReplaceOperation(op);
-        break;
-      case InstallOperation::ZERO:
-      case InstallOperation::DISCARD:
-        op_result = PerformZeroOrDiscardOperation(op);
-        break;
-      case InstallOperation::MOVE:
-        op_result = PerformMoveOperation(op);
-        break;
-      case InstallOperation::BSDIFF:
-        op_result = PerformBsdiffOperation(op);
-        break;
-      case InstallOperation::SOURCE_COPY:
-        op_result = PerformSourceCopyOperation(op);
-        break;
-      case InstallOperation::SOURCE_BSDIFF:
-        op_result = PerformSourceBsdiffOperation(op);
-        break;
-      default:
-       op_result = false;
+    // Extract the signature message if it's in this operation. If this is
+    // the dummy replace operation, we ignore it after extracting the signature.
+    if (ExtractSignatureMessageFromOperation(op)) {
+      // The checkpoint below covers all the operations before this one.
+      if (!WaitForAppliedOperations(error))
+        return false;
+      DiscardBuffer(true, 0);
+      next_operation_num_++;
+      UpdateOverallProgress(false, "Completed ");
+      ScopedTerminatorExitUnblocker exit_unblocker =
+          ScopedTerminatorExitUnblocker();  // Avoids a compiler unused var bug.
+      CheckpointUpdateProgress();
+      continue;
     }
-    if (!HandleOpResult(op_result, InstallOperationTypeName(op.type()), error))
+
+    // Since we delete data off the beginning of the buffer as we use it,
+    // the data we need should be exactly at the beginning of the buffer.
+    if (op.has_data_offset() && op.data_offset() != buffer_offset_) {
+      LOG(ERROR) << "Data of operation " << next_operation_num_
+                 << " expected at offset " << op.data_offset()
+                 << " but buffer is at offset " << buffer_offset_;
+      *error = ErrorCode::kDownloadOperationExecutionError;
       return false;
+    }
 
+    // Queues the operation to be applied while the next ones are downloaded.
+    // Its checkpoint is saved once it was applied.
+    brillo::Blob data;
+    TakeBuffer(&data);
     next_operation_num_++;
     UpdateOverallProgress(false, "Completed ");
-    CheckpointUpdateProgress();
+    pending_checkpoints_.push_back(CurrentCheckpoint());
+    applier_->Push(next_operation_num_ - 1, &op, std::move(data));
   }
 
+  // All the operations must be applied before the payload is complete.
+  if (!WaitForAppliedOperations(error))
+    return false;
+
   // In major version 2, we don't add dummy operation to the payload.
   // If we already extracted the signature we should skip this step.
   if (major_payload_version_ == kBrilloMajorPayloadVersion &&
@@ -805,6 +815,11 @@ bool DeltaPerformer::ParseManifestPartitions(ErrorCode* error) {
       const PartitionInfo& info = partition.old_partition_info();
       install_part.source_size = info.size();
       install_part.source_hash.assign(info.hash().begin(), info.hash().end());
+      install_part.source_hash_chunk_size = info.hash_chunk_size();
+      for (const string& chunk_hash : info.chunk_hashes()) {
+        install_part.source_chunk_hashes.emplace_back(chunk_hash.begin(),
+                                                      chunk_hash.end());
+      }
     }
 
     if (!partition.has_new_partition_info()) {
@@ -816,6 +831,11 @@ bool DeltaPerformer::ParseManifestPartitions(ErrorCode* error) {
     const PartitionInfo& info = partition.new_partition_info();
     install_part.target_size = info.size();
     install_part.target_hash.assign(info.hash().begin(), info.hash().end());
+    install_part.target_hash_chunk_size = info.hash_chunk_size();
+    for (const string& chunk_hash : info.chunk_hashes()) {
+      install_part.target_chunk_hashes.emplace_back(chunk_hash.begin(),
+                                                    chunk_hash.end());
+    }
 
     install_plan_->partitions.push_back(install_part);
   }
@@ -845,24 +865,48 @@ bool DeltaPerformer::CanPerformInstallOperation(
           buffer_offset_ + buffer_.size());
 }
 
+bool DeltaPerformer::PerformInstallOperation(
+    size_t operation_num,
+    const InstallOperation& operation,
+    const brillo::Blob& data) {
+  bool op_result;
+  switch (operation.type()) {
+    case InstallOperation::REPLACE:
+    case InstallOperation::REPLACE_BZ:
+    case InstallOperation::REPLACE_XZ:
+      op_result = PerformReplaceOperation(operation, data);
+      break;
+    case InstallOperation::ZERO:
+    case InstallOperation::DISCARD:
+      op_result = PerformZeroOrDiscardOperation(operation);
+      break;
+    case InstallOperation::MOVE:
+      op_result = PerformMoveOperation(operation);
+      break;
+    case InstallOperation::BSDIFF:
+      op_result = PerformBsdiffOperation(operation, data);
+      break;
+    case InstallOperation::SOURCE_COPY:
+      op_result = PerformSourceCopyOperation(operation);
+      break;
+    case InstallOperation::SOURCE_BSDIFF:
+      op_result = PerformSourceBsdiffOperation(operation, data);
+      break;
+    default:
+      op_result = false;
+  }
+  LOG_IF(ERROR, !op_result) << "Failed to perform "
+                            << InstallOperationTypeName(operation.type())
+                            << " operation " << operation_num;
+  return op_result;
+}
+
 bool DeltaPerformer::PerformReplaceOperation(
-    const InstallOperation& operation) {
+    const InstallOperation& operation, const brillo::Blob& data) {
   CHECK(operation.type() == InstallOperation::REPLACE ||
         operation.type() == InstallOperation::REPLACE_BZ ||
         operation.type() == InstallOperation::REPLACE_XZ);
-
-  // Since we delete data off the beginning of the buffer as we use it,
-  // the data we need should be exactly at the beginning of the buffer.
-  TEST_AND_RETURN_FALSE(buffer_offset_ == operation.data_offset());
-  TEST_AND_RETURN_FALSE(buffer_.size() >= operation.data_length());
-
-  // Extract the signature message if it's in this operation.
-  if (ExtractSignatureMessageFromOperation(operation)) {
-    // If this is dummy replace operation, we ignore it after extracting the
-    // signature.
-    DiscardBuffer(true, 0);
-    return true;
-  }
+  TEST_AND_RETURN_FALSE(data.size() >= operation.data_length());
 
   // Setup the ExtentWriter stack based on the operation type.
   std::unique_ptr<ExtentWriter> writer =
@@ -882,11 +926,8 @@ bool DeltaPerformer::PerformReplaceOperation(
   }
 
   TEST_AND_RETURN_FALSE(writer->Init(target_fd_, extents, block_size_));
-  TEST_AND_RETURN_FALSE(writer->Write(buffer_.data(), operation.data_length()));
+  TEST_AND_RETURN_FALSE(writer->Write(data.data(), operation.data_length()));
   TEST_AND_RETURN_FALSE(writer->End());
-
-  // Update buffer
-  DiscardBuffer(true, buffer_.size());
   return true;
 }
 
@@ -1019,6 +1060,31 @@ bool ValidateSourceHash(const brillo::Blob& calculated_hash,
   return true;
 }
 
+// Reads all the blocks in |extents| of |fd| into |data|, as the bsdiff
+// operations need the whole of their source at hand. Sparse holes read as
+// zeros.
+bool ReadExtentsToBlob(const FileDescriptorPtr& fd,
+                       const RepeatedPtrField<Extent>& extents,
+                       uint64_t block_size,
+                       brillo::Blob* data) {
+  data->assign(GetBlockCount(extents) * block_size, 0);
+  uint64_t offset = 0;
+  for (const Extent& extent : extents) {
+    const uint64_t bytes = extent.num_blocks() * block_size;
+    if (extent.start_block() != kSparseHole) {
+      ssize_t bytes_read = 0;
+      TEST_AND_RETURN_FALSE(utils::PReadAll(fd,
+                                            data->data() + offset,
+                                            bytes,
+                                            extent.start_block() * block_size,
+                                            &bytes_read));
+      TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(bytes));
+    }
+    offset += bytes;
+  }
+  return true;
+}
+
 }  // namespace
 
 bool DeltaPerformer::PerformSourceCopyOperation(
@@ -1104,133 +1170,67 @@ bool DeltaPerformer::ExtentsToBsdiffPositionsString(
   return true;
 }
 
-bool DeltaPerformer::PerformBsdiffOperation(const InstallOperation& operation) {
-  // Since we delete data off the beginning of the buffer as we use it,
-  // the data we need should be exactly at the beginning of the buffer.
-  TEST_AND_RETURN_FALSE(buffer_offset_ == operation.data_offset());
-  TEST_AND_RETURN_FALSE(buffer_.size() >= operation.data_length());
-
-  string input_positions;
-  TEST_AND_RETURN_FALSE(ExtentsToBsdiffPositionsString(operation.src_extents(),
-                                                       block_size_,
-                                                       operation.src_length(),
-                                                       &input_positions));
-  string output_positions;
-  TEST_AND_RETURN_FALSE(ExtentsToBsdiffPositionsString(operation.dst_extents(),
-                                                       block_size_,
-                                                       operation.dst_length(),
-                                                       &output_positions));
-
-  string temp_filename;
-  TEST_AND_RETURN_FALSE(utils::MakeTempFile("au_patch.XXXXXX",
-                                            &temp_filename,
-                                            nullptr));
-  ScopedPathUnlinker path_unlinker(temp_filename);
-  {
-    int fd = open(temp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    ScopedFdCloser fd_closer(&fd);
-    TEST_AND_RETURN_FALSE(
-        utils::WriteAll(fd, buffer_.data(), operation.data_length()));
-  }
-
-  // Update the buffer to release the patch data memory as soon as the patch
-  // file is written out.
-  DiscardBuffer(true, buffer_.size());
-
-  vector<string> cmd{kBspatchPath, target_path_, target_path_, temp_filename,
-                     input_positions, output_positions};
+bool DeltaPerformer::PerformBsdiffOperation(const InstallOperation& operation,
+                                            const brillo::Blob& data) {
+  TEST_AND_RETURN_FALSE(data.size() >= operation.data_length());
 
-  int return_code = 0;
-  TEST_AND_RETURN_FALSE(
-      Subprocess::SynchronousExecFlags(cmd, Subprocess::kSearchPath,
-                                       &return_code, nullptr));
-  TEST_AND_RETURN_FALSE(return_code == 0);
-
-  if (operation.dst_length() % block_size_) {
-    // Zero out rest of final block.
-    // TODO(adlr): build this into bspatch; it's more efficient that way.
-    const Extent& last_extent =
-        operation.dst_extents(operation.dst_extents_size() - 1);
-    const uint64_t end_byte =
-        (last_extent.start_block() + last_extent.num_blocks()) * block_size_;
-    const uint64_t begin_byte =
-        end_byte - (block_size_ - operation.dst_length() % block_size_);
-    brillo::Blob zeros(end_byte - begin_byte);
-    TEST_AND_RETURN_FALSE(
-        utils::PWriteAll(target_fd_, zeros.data(), end_byte - begin_byte, begin_byte));
-  }
+  // The source and destination extents are in the same partition and may
+  // overlap, so all of the source is read before anything is written.
+  brillo::Blob old_data;
+  TEST_AND_RETURN_FALSE(ReadExtentsToBlob(
+      target_fd_, operation.src_extents(), block_size_, &old_data));
+  TEST_AND_RETURN_FALSE(ApplyBsdiffToTarget(operation, old_data, data));
   return true;
 }
 
 bool DeltaPerformer::PerformSourceBsdiffOperation(
-    const InstallOperation& operation) {
-  // Since we delete data off the beginning of the buffer as we use it,
-  // the data we need should be exactly at the beginning of the buffer.
-  TEST_AND_RETURN_FALSE(buffer_offset_ == operation.data_offset());
-  TEST_AND_RETURN_FALSE(buffer_.size() >= operation.data_length());
+    const InstallOperation& operation, const brillo::Blob& data) {
+  TEST_AND_RETURN_FALSE(data.size() >= operation.data_length());
   if (operation.has_src_length())
     TEST_AND_RETURN_FALSE(operation.src_length() % block_size_ == 0);
   if (operation.has_dst_length())
     TEST_AND_RETURN_FALSE(operation.dst_length() % block_size_ == 0);
 
+  brillo::Blob old_data;
+  TEST_AND_RETURN_FALSE(ReadExtentsToBlob(
+      source_fd_, operation.src_extents(), block_size_, &old_data));
+
   if (operation.has_src_sha256_hash()) {
-    HashCalculator source_hasher;
-    const uint64_t kMaxBlocksToRead = 512;  // 2MB if block size is 4KB
-    brillo::Blob buf(kMaxBlocksToRead * block_size_);
-    for (const Extent& extent : operation.src_extents()) {
-      for (uint64_t i = 0; i < extent.num_blocks(); i += kMaxBlocksToRead) {
-        uint64_t blocks_to_read =
-            min(kMaxBlocksToRead, extent.num_blocks() - i);
-        ssize_t bytes_to_read = blocks_to_read * block_size_;
-        ssize_t bytes_read_this_iteration = 0;
-        TEST_AND_RETURN_FALSE(
-            utils::PReadAll(source_fd_, buf.data(), bytes_to_read,
-                            (extent.start_block() + i) * block_size_,
-                            &bytes_read_this_iteration));
-        TEST_AND_RETURN_FALSE(bytes_read_this_iteration == bytes_to_read);
-        TEST_AND_RETURN_FALSE(source_hasher.Update(buf.data(), bytes_to_read));
-      }
-    }
-    TEST_AND_RETURN_FALSE(source_hasher.Finalize());
+    brillo::Blob source_hash;
     TEST_AND_RETURN_FALSE(
-        ValidateSourceHash(source_hasher.raw_hash(), operation));
+        HashCalculator::RawHashOfData(old_data, &source_hash));
+    TEST_AND_RETURN_FALSE(ValidateSourceHash(source_hash, operation));
   }
 
-  string input_positions;
-  TEST_AND_RETURN_FALSE(ExtentsToBsdiffPositionsString(operation.src_extents(),
-                                                       block_size_,
-                                                       operation.src_length(),
-                                                       &input_positions));
-  string output_positions;
-  TEST_AND_RETURN_FALSE(ExtentsToBsdiffPositionsString(operation.dst_extents(),
-                                                       block_size_,
-                                                       operation.dst_length(),
-                                                       &output_positions));
-
-  string temp_filename;
-  TEST_AND_RETURN_FALSE(utils::MakeTempFile("au_patch.XXXXXX",
-                                            &temp_filename,
-                                            nullptr));
-  ScopedPathUnlinker path_unlinker(temp_filename);
-  {
-    int fd = open(temp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    ScopedFdCloser fd_closer(&fd);
-    TEST_AND_RETURN_FALSE(
-        utils::WriteAll(fd, buffer_.data(), operation.data_length()));
-  }
+  TEST_AND_RETURN_FALSE(ApplyBsdiffToTarget(operation, old_data, data));
+  return true;
+}
 
-  // Update the buffer to release the patch data memory as soon as the patch
-  // file is written out.
-  DiscardBuffer(true, buffer_.size());
+bool DeltaPerformer::ApplyBsdiffToTarget(const InstallOperation& operation,
+                                         const brillo::Blob& old_data,
+                                         const brillo::Blob& data) {
+  TEST_AND_RETURN_FALSE(operation.src_length() <= old_data.size());
 
-  vector<string> cmd{kBspatchPath, source_path_, target_path_, temp_filename,
-                     input_positions, output_positions};
+  vector<Extent> extents(operation.dst_extents().begin(),
+                         operation.dst_extents().end());
+  TEST_AND_RETURN_FALSE(operation.dst_length() <=
+                        GetBlockCount(operation.dst_extents()) * block_size_);
 
-  int return_code = 0;
-  TEST_AND_RETURN_FALSE(
-      Subprocess::SynchronousExecFlags(cmd, Subprocess::kSearchPath,
-                                       &return_code, nullptr));
-  TEST_AND_RETURN_FALSE(return_code == 0);
+  // The zero padding fills the rest of the last block.
+  std::unique_ptr<ExtentWriter> writer =
+    brillo::make_unique_ptr(new ZeroPadExtentWriter(
+      brillo::make_unique_ptr(new DirectExtentWriter())));
+  TEST_AND_RETURN_FALSE(writer->Init(target_fd_, extents, block_size_));
+
+  // The patch is read from |data| as it is applied, rather than written out
+  // for a bspatch process to read back.
+  TEST_AND_RETURN_FALSE(ApplyBsdiffPatch(old_data.data(),
+                                         operation.src_length(),
+                                         data.data(),
+                                         operation.data_length(),
+                                         operation.dst_length(),
+                                         writer.get()));
+  TEST_AND_RETURN_FALSE(writer->End());
   return true;
 }
 
@@ -1668,6 +1668,14 @@ void DeltaPerformer::DiscardBuffer(bool do_advance_offset,
   brillo::Blob().swap(buffer_);
 }
 
+void DeltaPerformer::TakeBuffer(brillo::Blob* data) {
+  buffer_offset_ += buffer_.size();
+  payload_hash_calculator_.Update(buffer_.data(), buffer_.size());
+  signed_hash_calculator_.Update(buffer_.data(), buffer_.size());
+  brillo::Blob().swap(*data);
+  data->swap(buffer_);
+}
+
 bool DeltaPerformer::CanResumeUpdate(PrefsInterface* prefs,
                                      string update_check_response_hash) {
   int64_t next_operation = kUpdateStateOperationInvalid;
@@ -1731,27 +1739,37 @@ bool DeltaPerformer::ResetUpdateProgress(PrefsInterface* prefs, bool quick) {
   return true;
 }
 
-bool DeltaPerformer::CheckpointUpdateProgress() {
+DeltaPerformer::Checkpoint DeltaPerformer::CurrentCheckpoint() const {
+  return {next_operation_num_,
+          buffer_offset_,
+          payload_hash_calculator_.GetContext(),
+          signed_hash_calculator_.GetContext()};
+}
+
+bool DeltaPerformer::SaveCheckpoint(const Checkpoint& checkpoint) {
   Terminator::set_exit_blocked(true);
-  if (last_updated_buffer_offset_ != buffer_offset_) {
+  if (last_updated_buffer_offset_ != checkpoint.next_data_offset) {
     // Resets the progress in case we die in the middle of the state update.
     ResetUpdateProgress(prefs_, true);
     TEST_AND_RETURN_FALSE(
         prefs_->SetString(kPrefsUpdateStateSHA256Context,
-                          payload_hash_calculator_.GetContext()));
+                          checkpoint.payload_hash_context));
     TEST_AND_RETURN_FALSE(
         prefs_->SetString(kPrefsUpdateStateSignedSHA256Context,
-                          signed_hash_calculator_.GetContext()));
+                          checkpoint.signed_hash_context));
     TEST_AND_RETURN_FALSE(prefs_->SetInt64(kPrefsUpdateStateNextDataOffset,
-                                           buffer_offset_));
-    last_updated_buffer_offset_ = buffer_offset_;
-
-    if (next_operation_num_ < num_total_operations_) {
-      size_t partition_index = current_partition_;
-      while (next_operation_num_ >= acc_num_operations_[partition_index])
-        partition_index++;
-      const size_t partition_operation_num = next_operation_num_ - (
-          partition_index ? acc_num_operations_[partition_index - 1] : 0);
+                                           checkpoint.next_data_offset));
+    last_updated_buffer_offset_ = checkpoint.next_data_offset;
+
+    if (checkpoint.next_operation_num < num_total_operations_) {
+      const size_t partition_index =
+          std::upper_bound(acc_num_operations_.begin(),
+                           acc_num_operations_.end(),
+                           checkpoint.next_operation_num) -
+          acc_num_operations_.begin();
+      const size_t partition_operation_num =
+          checkpoint.next_operation_num -
+          (partition_index ? acc_num_operations_[partition_index - 1] : 0);
       const InstallOperation& op =
           partitions_[partition_index].operations(partition_operation_num);
       TEST_AND_RETURN_FALSE(prefs_->SetInt64(kPrefsUpdateStateNextDataLength,
@@ -1762,10 +1780,38 @@ bool DeltaPerformer::CheckpointUpdateProgress() {
     }
   }
   TEST_AND_RETURN_FALSE(prefs_->SetInt64(kPrefsUpdateStateNextOperation,
-                                         next_operation_num_));
+                                         checkpoint.next_operation_num));
   return true;
 }
 
+bool DeltaPerformer::CheckpointUpdateProgress() {
+  return SaveCheckpoint(CurrentCheckpoint());
+}
+
+bool DeltaPerformer::SaveAppliedCheckpoints(ErrorCode* error) {
+  const size_t applied_count = applier_->TakeAppliedCount();
+  if (applied_count > 0) {
+    CHECK_LE(applied_count, pending_checkpoints_.size());
+    // The checkpoint of the last applied operation covers the ones before.
+    auto last_applied = pending_checkpoints_.begin() + applied_count - 1;
+    // Makes sure we unblock exit when the checkpoint is saved.
+    ScopedTerminatorExitUnblocker exit_unblocker =
+        ScopedTerminatorExitUnblocker();  // Avoids a compiler unused var bug.
+    SaveCheckpoint(*last_applied);
+    pending_checkpoints_.erase(pending_checkpoints_.begin(), last_applied + 1);
+  }
+  if (applier_->failed()) {
+    *error = ErrorCode::kDownloadOperationExecutionError;
+    return false;
+  }
+  return true;
+}
+
+bool DeltaPerformer::WaitForAppliedOperations(ErrorCode* error) {
+  applier_->Wait();
+  return SaveAppliedCheckpoints(error);
+}
+
 bool DeltaPerformer::PrimeUpdateState() {
   CHECK(manifest_valid_);
   block_size_ = manifest_.block_size();
@@ -19,6 +19,8 @@
 
 #include <inttypes.h>
 
+#include <deque>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -32,6 +34,7 @@
 #include "update_engine/payload_consumer/file_descriptor.h"
 #include "update_engine/payload_consumer/file_writer.h"
 #include "update_engine/payload_consumer/install_plan.h"
+#include "update_engine/payload_consumer/operation_applier.h"
 #include "update_engine/update_metadata.pb.h"
 
 namespace chromeos_update_engine {
@@ -41,8 +44,10 @@ class BootControlInterface;
 class HardwareInterface;
 class PrefsInterface;
 
-// This class performs the actions in a delta update synchronously. The delta
-// update itself should be passed in in chunks as it is received.
+// This class performs the actions in a delta update. The delta update itself
+// should be passed in in chunks as it is received. The operations are applied
+// in order on a thread of their own while the data of the next ones is still
+// being passed in.
 
 class DeltaPerformer : public FileWriter {
  public:
@@ -74,6 +79,10 @@ class DeltaPerformer : public FileWriter {
   static const unsigned kProgressDownloadWeight;
   static const unsigned kProgressOperationsWeight;
 
+  // The maximum size of the operation data received but not applied yet. Once
+  // reached, Write() waits for the operations to be applied.
+  static const uint64_t kMaxQueuedOperationBytes;
+
   DeltaPerformer(PrefsInterface* prefs,
                  BootControlInterface* boot_control,
                  HardwareInterface* hardware,
@@ -206,11 +215,6 @@ class DeltaPerformer : public FileWriter {
   // and returns this number.
   size_t CopyDataToBuffer(const char** bytes_p, size_t* count_p, size_t max);
 
-  // If |op_result| is false, emits an error message using |op_type_name| and
-  // sets |*error| accordingly. Otherwise does nothing. Returns |op_result|.
-  bool HandleOpResult(bool op_result, const char* op_type_name,
-                      ErrorCode* error);
-
   // Logs the progress of downloading/applying an update.
   void LogProgress(const char* message_prefix);
 
@@ -246,16 +250,30 @@ class DeltaPerformer : public FileWriter {
   // buffer.
   ErrorCode ValidateMetadataSignature(const brillo::Blob& payload);
 
-  // Returns true on success.
-  bool PerformInstallOperation(const InstallOperation& operation);
+  // Performs the operation number |operation_num| with its |data| blob and
+  // returns true on success. Called by |applier_| on its thread.
+  bool PerformInstallOperation(size_t operation_num,
+                               const InstallOperation& operation,
+                               const brillo::Blob& data);
 
   // These perform a specific type of operation and return true on success.
-  bool PerformReplaceOperation(const InstallOperation& operation);
+  // The ones with a blob get it in |data|.
+  bool PerformReplaceOperation(const InstallOperation& operation,
+                               const brillo::Blob& data);
   bool PerformZeroOrDiscardOperation(const InstallOperation& operation);
   bool PerformMoveOperation(const InstallOperation& operation);
-  bool PerformBsdiffOperation(const InstallOperation& operation);
+  bool PerformBsdiffOperation(const InstallOperation& operation,
+                              const brillo::Blob& data);
   bool PerformSourceCopyOperation(const InstallOperation& operation);
-  bool PerformSourceBsdiffOperation(const InstallOperation& operation);
+  bool PerformSourceBsdiffOperation(const InstallOperation& operation,
+                                    const brillo::Blob& data);
+
+  // Applies the bsdiff patch |data| to |old_data|, the contents of the source
+  // extents of |operation|, writing the result to its destination extents in
+  // |target_fd_|.
+  bool ApplyBsdiffToTarget(const InstallOperation& operation,
+                           const brillo::Blob& old_data,
+                           const brillo::Blob& data);
 
   // Extracts the payload signature message from the blob on the |operation| if
   // the offset matches the one specified by the manifest. Returns whether the
@@ -274,10 +292,40 @@ class DeltaPerformer : public FileWriter {
   // accordingly.
   void DiscardBuffer(bool do_advance_offset, size_t signed_hash_buffer_size);
 
+  // Like DiscardBuffer(true, buffer_.size()), but moves the content of
+  // |buffer_| to |*data| instead of freeing it.
+  void TakeBuffer(brillo::Blob* data);
+
+  // The progress of the update right after an operation, as saved to
+  // persistent storage.
+  struct Checkpoint {
+    size_t next_operation_num;
+    uint64_t next_data_offset;
+    std::string payload_hash_context;
+    std::string signed_hash_context;
+  };
+
+  // Returns the checkpoint for the current progress, assuming all the
+  // operations before |next_operation_num_| were applied.
+  Checkpoint CurrentCheckpoint() const;
+
+  // Saves |checkpoint| into persistent storage to allow this update attempt to
+  // be resumed after reboot.
+  bool SaveCheckpoint(const Checkpoint& checkpoint);
+
   // Checkpoints the update progress into persistent storage to allow this
-  // update attempt to be resumed after reboot.
+  // update attempt to be resumed after reboot. All the operations before
+  // |next_operation_num_| must have been applied.
   bool CheckpointUpdateProgress();
 
+  // Saves the checkpoint of the last operation |applier_| applied since the
+  // last call, if any. Returns false and sets |*error| if an operation failed.
+  bool SaveAppliedCheckpoints(ErrorCode* error);
+
+  // Waits until |applier_| applied all the queued operations, then saves the
+  // checkpoint as SaveAppliedCheckpoints() does.
+  bool WaitForAppliedOperations(ErrorCode* error);
+
   // Primes the required update state. Returns true if the update state was
   // successfully initialized to a saved resume state or if the update is a new
   // update. Returns false otherwise.
@@ -399,6 +447,15 @@ class DeltaPerformer : public FileWriter {
   // The delta minor payload version supported by DeltaPerformer.
   uint32_t supported_minor_version_{kSupportedMinorPayloadVersion};
 
+  // The checkpoints of the operations queued in |applier_|, in the same order.
+  // Each one is saved once its operation was applied.
+  std::deque<Checkpoint> pending_checkpoints_;
+
+  // Applies the operations once their data was received. Created once the
+  // manifest is valid. Declared last so that its thread is stopped before the
+  // members it uses are destroyed.
+  std::unique_ptr<OperationApplier> applier_;
+
   DISALLOW_COPY_AND_ASSIGN(DeltaPerformer);
 };
 
@@ -0,0 +1,255 @@
+//
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// End-to-end benchmark of applying a full payload while it is downloaded from
+// a local test_http_server, so that the download, the decompression of the
+// operations and the writes to the target partition all count, as well as how
+// much of them overlaps.
+
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <base/bind.h>
+#include <base/files/scoped_temp_dir.h>
+#include <base/logging.h>
+#include <base/message_loop/message_loop.h>
+#include <base/posix/eintr_wrapper.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/strings/stringprintf.h>
+#include <benchmark/benchmark_api.h>
+#include <brillo/message_loops/base_message_loop.h>
+#include <brillo/process.h>
+
+#include "update_engine/common/error_code_utils.h"
+#include "update_engine/common/fake_boot_control.h"
+#include "update_engine/common/fake_hardware.h"
+#include "update_engine/common/http_fetcher.h"
+#include "update_engine/common/libcurl_http_fetcher.h"
+#include "update_engine/common/prefs.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/delta_performer.h"
+#include "update_engine/payload_consumer/install_plan.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_generator/blob_file_writer.h"
+#include "update_engine/payload_generator/full_update_generator.h"
+#include "update_engine/payload_generator/payload_file.h"
+#include "update_engine/payload_generator/payload_generation_config.h"
+
+using brillo::MessageLoop;
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The test_http_server is installed along with the unittests.
+const char kTestHttpServerPath[] =
+    "/data/nativetest/update_engine_unittests/test_http_server";
+const char kListeningMsgPrefix[] = "listening on port ";
+
+const char kPartitionName[] = "system";
+
+// Runs a test_http_server for as long as this object exists.
+class TestHttpServer {
+ public:
+  TestHttpServer() {
+    process_.AddArg(kTestHttpServerPath);
+    process_.RedirectUsingPipe(STDOUT_FILENO, false);
+    CHECK(process_.Start()) << "Unable to start " << kTestHttpServerPath;
+
+    // The server reports its port once it accepts connections.
+    string line;
+    char c;
+    while (HANDLE_EINTR(read(process_.GetPipe(STDOUT_FILENO), &c, 1)) == 1 &&
+           c != '\n') {
+      line += c;
+    }
+    CHECK_EQ(0u, line.find(kListeningMsgPrefix)) << line;
+    CHECK(base::StringToUint(line.substr(strlen(kListeningMsgPrefix)),
+                             &port_));
+  }
+
+  ~TestHttpServer() {
+    process_.Kill(SIGTERM, 10);
+  }
+
+  // The URL that serves the local file at |path|.
+  string FileUrl(const string& path) const {
+    return base::StringPrintf("http://127.0.0.1:%u/file%s", port_,
+                              path.c_str());
+  }
+
+ private:
+  brillo::ProcessImpl process_;
+  unsigned int port_{0};
+};
+
+// Writes |size| bytes of data that compresses about as well as code to the
+// file at |path|.
+void WriteSampleImage(const string& path, size_t size) {
+  std::mt19937 gen(0);
+  vector<uint32_t> words(256);
+  for (uint32_t& word : words)
+    word = gen();
+  brillo::Blob data(size);
+  for (size_t i = 0; i + 4 <= size; i += 4) {
+    uint32_t word = words[gen() % words.size()];
+    memcpy(data.data() + i, &word, 4);
+  }
+  CHECK(utils::WriteFile(path.c_str(), data.data(), data.size()));
+}
+
+// Generates a full payload at |payload_path| for the image at |image_path|,
+// with operations of |chunk_size| bytes. Returns the metadata size.
+uint64_t GenerateFullPayload(const string& image_path,
+                             size_t image_size,
+                             size_t chunk_size,
+                             const string& payload_path) {
+  PayloadGenerationConfig config;
+  config.version.major = kBrilloMajorPayloadVersion;
+  config.version.minor = kFullPayloadMinorVersion;
+  config.hard_chunk_size = chunk_size;
+  config.soft_chunk_size = chunk_size;
+
+  PartitionConfig old_part(kPartitionName);
+  PartitionConfig new_part(kPartitionName);
+  new_part.path = image_path;
+  new_part.size = image_size;
+
+  string blobs_path;
+  int blobs_fd;
+  CHECK(utils::MakeTempFile("delta_performer_benchmark_blobs.XXXXXX",
+                            &blobs_path, &blobs_fd));
+  ScopedPathUnlinker blobs_unlinker(blobs_path);
+  ScopedFdCloser blobs_fd_closer(&blobs_fd);
+  off_t blobs_size = 0;
+  BlobFileWriter blob_file(blobs_fd, &blobs_size);
+
+  vector<AnnotatedOperation> aops;
+  FullUpdateGenerator generator;
+  CHECK(generator.GenerateOperations(config, old_part, new_part, &blob_file,
+                                     &aops));
+
+  PayloadFile payload;
+  CHECK(payload.Init(config));
+  CHECK(payload.AddPartition(old_part, new_part, aops));
+  uint64_t metadata_size;
+  CHECK(payload.WritePayload(payload_path, blobs_path, "", &metadata_size));
+  return metadata_size;
+}
+
+// Passes the downloaded data to a DeltaPerformer, as DownloadAction does.
+class PayloadWriter : public HttpFetcherDelegate {
+ public:
+  explicit PayloadWriter(DeltaPerformer* performer) : performer_(performer) {}
+
+  void ReceivedBytes(HttpFetcher* fetcher,
+                     const void* bytes,
+                     size_t length) override {
+    ErrorCode error;
+    if (!performer_->Write(bytes, length, &error)) {
+      LOG(ERROR) << "Error " << utils::ErrorCodeToString(error)
+                 << " applying the payload";
+      fetcher->TerminateTransfer();
+    }
+  }
+
+  void TransferComplete(HttpFetcher* fetcher, bool successful) override {
+    successful_ = successful;
+    MessageLoop::current()->BreakLoop();
+  }
+
+  void TransferTerminated(HttpFetcher* fetcher) override {
+    successful_ = false;
+    MessageLoop::current()->BreakLoop();
+  }
+
+  bool successful() const { return successful_; }
+
+ private:
+  DeltaPerformer* performer_;
+  bool successful_{false};
+};
+
+// Downloads and applies a full payload for |range_x()| bytes of image, with
+// operations of |range_y()| bytes each.
+void BM_DownloadAndApplyFullPayload(benchmark::State& state) {
+  const size_t image_size = state.range_x();
+  const size_t chunk_size = state.range_y();
+
+  base::ScopedTempDir temp_dir;
+  CHECK(temp_dir.CreateUniqueTempDir());
+  const string image_path = temp_dir.path().Append("image").value();
+  const string payload_path = temp_dir.path().Append("payload").value();
+  const string target_path = temp_dir.path().Append("target").value();
+  WriteSampleImage(image_path, image_size);
+  const uint64_t metadata_size =
+      GenerateFullPayload(image_path, image_size, chunk_size, payload_path);
+  CHECK(utils::WriteFile(target_path.c_str(), "", 0));
+
+  base::MessageLoopForIO base_loop;
+  brillo::BaseMessageLoop loop(&base_loop);
+  loop.SetAsCurrent();
+  TestHttpServer server;
+
+  FakeBootControl boot_control;
+  boot_control.SetPartitionDevice(kPartitionName, 1, target_path);
+  FakeHardware hardware;
+  hardware.SetIsOfficialBuild(false);
+  Prefs prefs;
+  CHECK(prefs.Init(temp_dir.path().Append("prefs")));
+
+  while (state.KeepRunning()) {
+    InstallPlan install_plan;
+    install_plan.payload_type = InstallPayloadType::kFull;
+    install_plan.source_slot = BootControlInterface::kInvalidSlot;
+    install_plan.target_slot = 1;
+    install_plan.metadata_size = metadata_size;
+    DeltaPerformer performer(&prefs, &boot_control, &hardware, nullptr,
+                             &install_plan);
+    PayloadWriter writer(&performer);
+    LibcurlHttpFetcher fetcher(nullptr, &hardware);
+    fetcher.set_delegate(&writer);
+
+    loop.PostTask(FROM_HERE,
+                  base::Bind(&LibcurlHttpFetcher::BeginTransfer,
+                             base::Unretained(&fetcher),
+                             server.FileUrl(payload_path)));
+    loop.Run();
+    CHECK(writer.successful());
+    CHECK_EQ(0, performer.Close());
+    DeltaPerformer::ResetUpdateProgress(&prefs, false);
+  }
+  state.SetBytesProcessed(state.iterations() * image_size);
+}
+// Many small operations and a few large ones, as chosen by the generator with
+// and without a hard chunk size.
+BENCHMARK(BM_DownloadAndApplyFullPayload)
+    ->ArgPair(64 * 1024 * 1024, 256 * 1024)
+    ->ArgPair(64 * 1024 * 1024, 2 * 1024 * 1024);
+
+}  // namespace
+
+}  // namespace chromeos_update_engine
+
+BENCHMARK_MAIN()
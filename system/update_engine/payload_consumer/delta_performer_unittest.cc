@@ -19,6 +19,7 @@
 #include <endian.h>
 #include <inttypes.h>
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -397,6 +398,133 @@ TEST_F(DeltaPerformerTest, ReplaceOperationTest) {
   EXPECT_EQ(expected_data, ApplyPayload(payload_data, "/dev/null", true));
 }
 
+TEST_F(DeltaPerformerTest, ChunkedWriteCheckpointTest) {
+  // Many operations passed in small chunks are applied while the rest is
+  // still being written, and the progress is saved after the last one.
+  const size_t kNumOperations = 16;
+  brillo::Blob expected_data(kNumOperations * 4096);
+  for (size_t i = 0; i < expected_data.size(); i++)
+    expected_data[i] = kRandomString[i % sizeof(kRandomString)] + i / 4096;
+  vector<AnnotatedOperation> aops;
+  for (size_t i = 0; i < kNumOperations; i++) {
+    AnnotatedOperation aop;
+    *(aop.op.add_dst_extents()) = ExtentForRange(i, 1);
+    aop.op.set_data_offset(i * 4096);
+    aop.op.set_data_length(4096);
+    aop.op.set_type(InstallOperation::REPLACE);
+    aops.push_back(aop);
+  }
+  brillo::Blob payload_data = GeneratePayload(expected_data, aops, false);
+
+  string new_part;
+  EXPECT_TRUE(utils::MakeTempFile("Partition-XXXXXX", &new_part, nullptr));
+  ScopedPathUnlinker partition_unlinker(new_part);
+  fake_boot_control_.SetPartitionDevice(
+      kLegacyPartitionNameRoot, install_plan_.target_slot, new_part);
+  fake_boot_control_.SetPartitionDevice(
+      kLegacyPartitionNameRoot, install_plan_.source_slot, "/dev/null");
+  fake_boot_control_.SetPartitionDevice(
+      kLegacyPartitionNameKernel, install_plan_.target_slot, "/dev/null");
+  fake_boot_control_.SetPartitionDevice(
+      kLegacyPartitionNameKernel, install_plan_.source_slot, "/dev/null");
+
+  const size_t kChunkSize = 1000;
+  for (size_t offset = 0; offset < payload_data.size(); offset += kChunkSize) {
+    EXPECT_TRUE(performer_.Write(
+        payload_data.data() + offset,
+        std::min(kChunkSize, payload_data.size() - offset)));
+  }
+  EXPECT_EQ(0, performer_.Close());
+
+  brillo::Blob partition_data;
+  EXPECT_TRUE(utils::ReadFile(new_part, &partition_data));
+  EXPECT_EQ(expected_data, partition_data);
+
+  int64_t next_operation = 0;
+  EXPECT_TRUE(prefs_.GetInt64(kPrefsUpdateStateNextOperation,
+                              &next_operation));
+  EXPECT_EQ(static_cast<int64_t>(kNumOperations), next_operation);
+  int64_t next_data_offset = 0;
+  EXPECT_TRUE(prefs_.GetInt64(kPrefsUpdateStateNextDataOffset,
+                              &next_data_offset));
+  EXPECT_EQ(static_cast<int64_t>(expected_data.size()), next_data_offset);
+}
+
+TEST_F(DeltaPerformerTest, QueuedOperationFailureCheckpointTest) {
+  // One of many queued operations fails to apply, the progress is saved up to
+  // the last one applied before it and nothing after it is applied.
+  const size_t kNumOperations = 16;
+  const size_t kFailedOperation = 10;
+  brillo::Blob blob_data;
+  vector<AnnotatedOperation> aops;
+  for (size_t i = 0; i < kNumOperations; i++) {
+    AnnotatedOperation aop;
+    *(aop.op.add_dst_extents()) = ExtentForRange(i, 1);
+    if (i == kFailedOperation) {
+      // The source partition doesn't match this hash.
+      *(aop.op.add_src_extents()) = ExtentForRange(0, 1);
+      aop.op.set_type(InstallOperation::SOURCE_COPY);
+      brillo::Blob src_hash;
+      EXPECT_TRUE(HashCalculator::RawHashOfData(brillo::Blob(4096, 'a'),
+                                                &src_hash));
+      aop.op.set_src_sha256_hash(src_hash.data(), src_hash.size());
+    } else {
+      aop.op.set_data_offset(blob_data.size());
+      aop.op.set_data_length(4096);
+      aop.op.set_type(InstallOperation::REPLACE);
+      blob_data.insert(blob_data.end(), 4096, static_cast<uint8_t>('c' + i));
+    }
+    aops.push_back(aop);
+  }
+  brillo::Blob payload_data = GeneratePayload(blob_data, aops, false);
+
+  string source_path;
+  EXPECT_TRUE(utils::MakeTempFile("Source-XXXXXX", &source_path, nullptr));
+  ScopedPathUnlinker source_unlinker(source_path);
+  brillo::Blob source_data(4096, 'b');
+  EXPECT_TRUE(utils::WriteFile(source_path.c_str(), source_data.data(),
+                               source_data.size()));
+  string new_part;
+  EXPECT_TRUE(utils::MakeTempFile("Partition-XXXXXX", &new_part, nullptr));
+  ScopedPathUnlinker partition_unlinker(new_part);
+  fake_boot_control_.SetPartitionDevice(
+      kLegacyPartitionNameRoot, install_plan_.target_slot, new_part);
+  fake_boot_control_.SetPartitionDevice(
+      kLegacyPartitionNameRoot, install_plan_.source_slot, source_path);
+  fake_boot_control_.SetPartitionDevice(
+      kLegacyPartitionNameKernel, install_plan_.target_slot, "/dev/null");
+  fake_boot_control_.SetPartitionDevice(
+      kLegacyPartitionNameKernel, install_plan_.source_slot, "/dev/null");
+
+  const size_t kChunkSize = 1000;
+  bool success = true;
+  for (size_t offset = 0; success && offset < payload_data.size();
+       offset += kChunkSize) {
+    success = performer_.Write(
+        payload_data.data() + offset,
+        std::min(kChunkSize, payload_data.size() - offset));
+  }
+  EXPECT_FALSE(success);
+  // The data of the operations after the failed one may be left unused.
+  performer_.Close();
+
+  // Only the operations before the failed one were written.
+  brillo::Blob partition_data;
+  EXPECT_TRUE(utils::ReadFile(new_part, &partition_data));
+  EXPECT_EQ(brillo::Blob(blob_data.begin(),
+                         blob_data.begin() + kFailedOperation * 4096),
+            partition_data);
+
+  int64_t next_operation = 0;
+  EXPECT_TRUE(prefs_.GetInt64(kPrefsUpdateStateNextOperation,
+                              &next_operation));
+  EXPECT_EQ(static_cast<int64_t>(kFailedOperation), next_operation);
+  int64_t next_data_offset = 0;
+  EXPECT_TRUE(prefs_.GetInt64(kPrefsUpdateStateNextDataOffset,
+                              &next_data_offset));
+  EXPECT_EQ(static_cast<int64_t>(kFailedOperation * 4096), next_data_offset);
+}
+
 TEST_F(DeltaPerformerTest, ReplaceBzOperationTest) {
   brillo::Blob expected_data = brillo::Blob(std::begin(kRandomString),
                                             std::end(kRandomString));
@@ -20,6 +20,7 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <cstdlib>
@@ -30,15 +31,21 @@
 
 #include "update_engine/common/boot_control_interface.h"
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/chunk_hash_verifier.h"
 #include "update_engine/payload_consumer/delta_performer.h"
 #include "update_engine/payload_consumer/payload_constants.h"
 
 using std::string;
+using std::vector;
 
 namespace chromeos_update_engine {
 
 namespace {
 const off_t kReadFileBufferSize = 128 * 1024;
+
+// The most threads used to verify the chunks of a partition. More than a few
+// don't read the storage any faster, and the device is still in use.
+const size_t kMaxChunkHashingThreads = 4;
 }  // namespace
 
 FilesystemVerifierAction::FilesystemVerifierAction(
@@ -111,11 +118,12 @@ void FilesystemVerifierAction::TerminateProcessing() {
 }
 
 bool FilesystemVerifierAction::IsCleanupPending() const {
-  return src_stream_ != nullptr;
+  return src_stream_ != nullptr || chunk_verifier_ != nullptr;
 }
 
 void FilesystemVerifierAction::Cleanup(ErrorCode code) {
   src_stream_.reset();
+  chunk_verifier_.reset();
   // This memory is not used anymore.
   buffer_.clear();
 
@@ -141,17 +149,27 @@ void FilesystemVerifierAction::StartPartitionHashing() {
       install_plan_.partitions[partition_index_];
 
   string part_path;
+  // The hashes of the chunks of the partition to verify, if any. The source
+  // hash can only be computed from the whole partition.
+  uint64_t hash_chunk_size = 0;
+  const vector<brillo::Blob>* chunk_hashes = nullptr;
   switch (verifier_mode_) {
     case VerifierMode::kComputeSourceHash:
     case VerifierMode::kVerifySourceHash:
       boot_control_->GetPartitionDevice(
           partition.name, install_plan_.source_slot, &part_path);
       remaining_size_ = partition.source_size;
+      if (verifier_mode_ == VerifierMode::kVerifySourceHash) {
+        hash_chunk_size = partition.source_hash_chunk_size;
+        chunk_hashes = &partition.source_chunk_hashes;
+      }
       break;
     case VerifierMode::kVerifyTargetHash:
       boot_control_->GetPartitionDevice(
           partition.name, install_plan_.target_slot, &part_path);
       remaining_size_ = partition.target_size;
+      hash_chunk_size = partition.target_hash_chunk_size;
+      chunk_hashes = &partition.target_chunk_hashes;
       break;
   }
   LOG(INFO) << "Hashing partition " << partition_index_ << " ("
@@ -159,6 +177,18 @@ void FilesystemVerifierAction::StartPartitionHashing() {
   if (part_path.empty())
     return Cleanup(ErrorCode::kFilesystemVerifierError);
 
+  if (chunk_hashes && !chunk_hashes->empty()) {
+    if (ChunkHashVerifier::HashesCoverPartition(
+            remaining_size_, hash_chunk_size, *chunk_hashes)) {
+      return StartChunkHashing(part_path, hash_chunk_size, *chunk_hashes);
+    }
+    // Chunk hashes that don't add up to the partition size can't be used, but
+    // the whole partition can still be hashed.
+    LOG(WARNING) << "The " << chunk_hashes->size() << " chunk hashes of "
+                 << hash_chunk_size << " bytes don't cover the "
+                 << remaining_size_ << " bytes of " << partition.name;
+  }
+
   brillo::ErrorPtr error;
   src_stream_ = brillo::FileStream::Open(
       base::FilePath(part_path),
@@ -179,6 +209,33 @@ void FilesystemVerifierAction::StartPartitionHashing() {
   ScheduleRead();
 }
 
+void FilesystemVerifierAction::StartChunkHashing(
+    const string& part_path,
+    uint64_t hash_chunk_size,
+    const vector<brillo::Blob>& chunk_hashes) {
+  chunk_verifier_.reset(new ChunkHashVerifier(
+      part_path, remaining_size_, hash_chunk_size, chunk_hashes));
+  size_t max_threads = std::min(
+      static_cast<size_t>(std::max(sysconf(_SC_NPROCESSORS_ONLN), 1L)),
+      kMaxChunkHashingThreads);
+  if (!chunk_verifier_->Start(
+          max_threads,
+          base::Bind(&FilesystemVerifierAction::OnChunkHashingDone,
+                     base::Unretained(this)))) {
+    return Cleanup(ErrorCode::kFilesystemVerifierError);
+  }
+}
+
+void FilesystemVerifierAction::OnChunkHashingDone(bool success) {
+  // This is called from the |chunk_verifier_| itself, which doesn't use its
+  // members after the call.
+  chunk_verifier_.reset();
+  LOG(INFO) << "Chunks of "
+            << install_plan_.partitions[partition_index_].name
+            << (success ? " match" : " don't match") << " their hashes";
+  FinishPartitionVerification(success);
+}
+
 void FilesystemVerifierAction::ScheduleRead() {
   size_t bytes_to_read = std::min(static_cast<int64_t>(buffer_.size()),
                                   remaining_size_);
@@ -247,13 +304,33 @@ void FilesystemVerifierAction::FinishPartitionHashing() {
       install_plan_.partitions[partition_index_];
   LOG(INFO) << "Hash of " << partition.name << ": " << hasher_->hash();
 
+  bool hash_matches = true;
   switch (verifier_mode_) {
     case VerifierMode::kComputeSourceHash:
       partition.source_hash = hasher_->raw_hash();
+      break;
+    case VerifierMode::kVerifyTargetHash:
+      hash_matches = partition.target_hash == hasher_->raw_hash();
+      break;
+    case VerifierMode::kVerifySourceHash:
+      hash_matches = partition.source_hash == hasher_->raw_hash();
+      break;
+  }
+  hasher_.reset();
+  buffer_.clear();
+  src_stream_->CloseBlocking(nullptr);
+  FinishPartitionVerification(hash_matches);
+}
+
+void FilesystemVerifierAction::FinishPartitionVerification(bool hash_matches) {
+  InstallPlan::Partition& partition =
+      install_plan_.partitions[partition_index_];
+  switch (verifier_mode_) {
+    case VerifierMode::kComputeSourceHash:
       partition_index_++;
       break;
     case VerifierMode::kVerifyTargetHash:
-      if (partition.target_hash != hasher_->raw_hash()) {
+      if (!hash_matches) {
         LOG(ERROR) << "New '" << partition.name
                    << "' partition verification failed.";
         if (DeltaPerformer::kSupportedMinorPayloadVersion <
@@ -270,7 +347,7 @@ void FilesystemVerifierAction::FinishPartitionHashing() {
       }
       break;
     case VerifierMode::kVerifySourceHash:
-      if (partition.source_hash != hasher_->raw_hash()) {
+      if (!hash_matches) {
         LOG(ERROR) << "Old '" << partition.name
                    << "' partition verification failed.";
         return Cleanup(ErrorCode::kDownloadStateInitializationError);
@@ -279,9 +356,6 @@ void FilesystemVerifierAction::FinishPartitionHashing() {
       break;
   }
   // Start hashing the next partition, if any.
-  hasher_.reset();
-  buffer_.clear();
-  src_stream_->CloseBlocking(nullptr);
   StartPartitionHashing();
 }
 
@@ -20,6 +20,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -28,6 +29,7 @@
 
 #include "update_engine/common/action.h"
 #include "update_engine/common/hash_calculator.h"
+#include "update_engine/payload_consumer/chunk_hash_verifier.h"
 #include "update_engine/payload_consumer/install_plan.h"
 
 // This action will hash all the partitions of a single slot involved in the
@@ -75,6 +77,16 @@ class FilesystemVerifierAction : public InstallPlanAction {
   // remaining to be hashed, if finishes the action.
   void StartPartitionHashing();
 
+  // Starts verifying the current partition at |part_path| against the
+  // |chunk_hashes| of |hash_chunk_size| bytes each, on several threads.
+  void StartChunkHashing(const std::string& part_path,
+                         uint64_t hash_chunk_size,
+                         const std::vector<brillo::Blob>& chunk_hashes);
+
+  // Called from the main loop once the chunks of the current partition were
+  // verified, with whether they all matched.
+  void OnChunkHashingDone(bool success);
+
   // Schedules the asynchronous read of the filesystem.
   void ScheduleRead();
 
@@ -87,6 +99,10 @@ class FilesystemVerifierAction : public InstallPlanAction {
   // and continue checking the next one.
   void FinishPartitionHashing();
 
+  // Handles the result of checking the current partition, either by its whole
+  // hash or by its chunks, and continues checking the next one.
+  void FinishPartitionVerification(bool hash_matches);
+
   // Cleans up all the variables we use for async operations and tells the
   // ActionProcessor we're done w/ |code| as passed in. |cancelled_| should be
   // true if TerminateProcessing() was called.
@@ -108,6 +124,10 @@ class FilesystemVerifierAction : public InstallPlanAction {
   // Buffer for storing data we read.
   brillo::Blob buffer_;
 
+  // If not null, verifies the chunks of the current partition instead of
+  // |src_stream_| and |hasher_|.
+  std::unique_ptr<ChunkHashVerifier> chunk_verifier_;
+
   bool read_done_{false};  // true if reached EOF on the input stream.
   bool cancelled_{false};  // true if the action has been cancelled.
 
@@ -18,15 +18,18 @@
 
 #include <fcntl.h>
 
+#include <algorithm>
 #include <set>
 #include <string>
 #include <vector>
 
 #include <base/bind.h>
+#include <base/message_loop/message_loop.h>
 #include <base/posix/eintr_wrapper.h>
 #include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
 #include <brillo/bind_lambda.h>
+#include <brillo/message_loops/base_message_loop.h>
 #include <brillo/message_loops/fake_message_loop.h>
 #include <brillo/message_loops/message_loop_utils.h>
 #include <gmock/gmock.h>
@@ -327,6 +330,90 @@ TEST_F(FilesystemVerifierActionTest, RunAsRootTerminateEarlyTest) {
   while (loop_.RunOnce(false)) {}
 }
 
+// The chunks are verified on other threads, which report back through the
+// message loop, so these tests need a real one.
+class FilesystemVerifierActionChunksTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    loop_.SetAsCurrent();
+  }
+
+  // Verifies the target partitions of the |install_plan| and returns the error
+  // code the action completed with.
+  ErrorCode RunTargetVerifier(const InstallPlan& install_plan);
+
+  base::MessageLoopForIO base_loop_;
+  brillo::BaseMessageLoop loop_{&base_loop_};
+  FakeBootControl fake_boot_control_;
+};
+
+ErrorCode FilesystemVerifierActionChunksTest::RunTargetVerifier(
+    const InstallPlan& install_plan) {
+  ActionProcessor processor;
+  ObjectFeederAction<InstallPlan> feeder_action;
+  FilesystemVerifierAction verifier_action(&fake_boot_control_,
+                                           VerifierMode::kVerifyTargetHash);
+  ObjectCollectorAction<InstallPlan> collector_action;
+
+  BondActions(&feeder_action, &verifier_action);
+  BondActions(&verifier_action, &collector_action);
+
+  FilesystemVerifierActionTestDelegate delegate(&verifier_action);
+  processor.set_delegate(&delegate);
+  processor.EnqueueAction(&feeder_action);
+  processor.EnqueueAction(&verifier_action);
+  processor.EnqueueAction(&collector_action);
+
+  feeder_action.set_obj(install_plan);
+  loop_.PostTask(FROM_HERE,
+                 base::Bind([&processor]{ processor.StartProcessing(); }));
+  loop_.Run();
+  EXPECT_TRUE(delegate.ran());
+  return delegate.code();
+}
+
+TEST_F(FilesystemVerifierActionChunksTest, VerifyChunkHashesTest) {
+  string part_path;
+  ASSERT_TRUE(utils::MakeTempFile("part.XXXXXX", &part_path, nullptr));
+  ScopedPathUnlinker part_path_unlinker(part_path);
+  const uint64_t kChunkSize = 1024 * 1024;
+  brillo::Blob part_data(5 * kChunkSize + 512);
+  test_utils::FillWithData(&part_data);
+  ASSERT_TRUE(test_utils::WriteFileVector(part_path, part_data));
+
+  InstallPlan install_plan;
+  install_plan.source_slot = 0;
+  install_plan.target_slot = 1;
+  InstallPlan::Partition part;
+  part.name = "part";
+  part.source_size = part_data.size();
+  part.target_size = part_data.size();
+  ASSERT_TRUE(HashCalculator::RawHashOfData(part_data, &part.source_hash));
+  part.target_hash = part.source_hash;
+  part.target_hash_chunk_size = kChunkSize;
+  for (uint64_t offset = 0; offset < part_data.size(); offset += kChunkSize) {
+    brillo::Blob chunk_hash;
+    ASSERT_TRUE(HashCalculator::RawHashOfBytes(
+        part_data.data() + offset,
+        std::min<uint64_t>(kChunkSize, part_data.size() - offset),
+        &chunk_hash));
+    part.target_chunk_hashes.push_back(chunk_hash);
+  }
+  install_plan.partitions = {part};
+  fake_boot_control_.SetPartitionDevice(
+      part.name, install_plan.source_slot, part_path);
+  fake_boot_control_.SetPartitionDevice(
+      part.name, install_plan.target_slot, part_path);
+
+  EXPECT_EQ(ErrorCode::kSuccess, RunTargetVerifier(install_plan));
+
+  // A chunk that doesn't match fails the verification even when the hash of
+  // the whole partition does.
+  install_plan.partitions[0].target_chunk_hashes[3][0] ^= 0xff;
+  EXPECT_EQ(ErrorCode::kNewRootfsVerificationError,
+            RunTargetVerifier(install_plan));
+}
+
 // Disabled as we switched to minor version 3, so this test is obsolete, will be
 // deleted when we delete the corresponding code in PerformAction().
 // Test that the rootfs and kernel size used for hashing in delta payloads for
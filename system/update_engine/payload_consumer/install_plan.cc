@@ -110,9 +110,13 @@ bool InstallPlan::Partition::operator==(
           source_path == that.source_path &&
           source_size == that.source_size &&
           source_hash == that.source_hash &&
+          source_hash_chunk_size == that.source_hash_chunk_size &&
+          source_chunk_hashes == that.source_chunk_hashes &&
           target_path == that.target_path &&
           target_size == that.target_size &&
           target_hash == that.target_hash &&
+          target_hash_chunk_size == that.target_hash_chunk_size &&
+          target_chunk_hashes == that.target_chunk_hashes &&
           run_postinstall == that.run_postinstall &&
           postinstall_path == that.postinstall_path &&
           filesystem_type == that.filesystem_type);
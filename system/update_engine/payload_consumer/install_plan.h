@@ -85,10 +85,16 @@ struct InstallPlan {
     std::string source_path;
     uint64_t source_size{0};
     brillo::Blob source_hash;
+    // The hashes of the consecutive chunks of |source_hash_chunk_size| bytes of
+    // the source partition, if the payload has them.
+    uint64_t source_hash_chunk_size{0};
+    std::vector<brillo::Blob> source_chunk_hashes;
 
     std::string target_path;
     uint64_t target_size{0};
     brillo::Blob target_hash;
+    uint64_t target_hash_chunk_size{0};
+    std::vector<brillo::Blob> target_chunk_hashes;
 
     // Whether we should run the postinstall script from this partition and the
     // postinstall parameters.
@@ -0,0 +1,121 @@
+//
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/operation_applier.h"
+
+#include <utility>
+
+#include <base/logging.h>
+
+namespace chromeos_update_engine {
+
+OperationApplier::OperationApplier(const ApplyCallback& apply,
+                                   uint64_t max_queued_bytes)
+    : apply_(apply),
+      max_queued_bytes_(max_queued_bytes),
+      changed_(&lock_),
+      thread_(this, "operation-applier") {
+  thread_.Start();
+}
+
+OperationApplier::~OperationApplier() {
+  Stop();
+}
+
+void OperationApplier::Push(size_t operation_num,
+                            const InstallOperation* operation,
+                            brillo::Blob data) {
+  base::AutoLock auto_lock(lock_);
+  CHECK(!stopping_);
+  while (!queue_.empty() && !failed_ &&
+         queued_bytes_ + data.size() > max_queued_bytes_) {
+    changed_.Wait();
+  }
+  if (failed_)
+    return;
+  queued_bytes_ += data.size();
+  queue_.push_back({operation_num, operation, std::move(data)});
+  changed_.Broadcast();
+}
+
+bool OperationApplier::Wait() {
+  base::AutoLock auto_lock(lock_);
+  while (!queue_.empty() && !failed_)
+    changed_.Wait();
+  return !failed_;
+}
+
+size_t OperationApplier::TakeAppliedCount() {
+  base::AutoLock auto_lock(lock_);
+  size_t applied_count = applied_count_;
+  applied_count_ = 0;
+  return applied_count;
+}
+
+bool OperationApplier::failed() {
+  base::AutoLock auto_lock(lock_);
+  return failed_;
+}
+
+void OperationApplier::Stop() {
+  {
+    base::AutoLock auto_lock(lock_);
+    if (stopping_)
+      return;
+    stopping_ = true;
+    // The one being applied stays in the queue until it is done.
+    while (queue_.size() > (applying_ ? 1u : 0u)) {
+      queued_bytes_ -= queue_.back().data.size();
+      queue_.pop_back();
+    }
+    changed_.Broadcast();
+  }
+  thread_.Join();
+}
+
+void OperationApplier::Run() {
+  base::AutoLock auto_lock(lock_);
+  while (true) {
+    while (queue_.empty() && !stopping_)
+      changed_.Wait();
+    if (queue_.empty())
+      return;
+
+    // The front of the queue is only removed by this thread, and pushing to
+    // the back doesn't move it, so it can be used without the lock.
+    const QueuedOperation& queued = queue_.front();
+    applying_ = true;
+    bool success;
+    {
+      base::AutoUnlock auto_unlock(lock_);
+      success = apply_.Run(queued.operation_num, *queued.operation,
+                           queued.data);
+    }
+    applying_ = false;
+    queued_bytes_ -= queued.data.size();
+    queue_.pop_front();
+    if (success) {
+      applied_count_++;
+    } else {
+      failed_ = true;
+      queue_.clear();
+      queued_bytes_ = 0;
+    }
+    changed_.Broadcast();
+  }
+}
+
+}  // namespace chromeos_update_engine
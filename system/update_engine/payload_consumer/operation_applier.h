@@ -0,0 +1,111 @@
+//
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_OPERATION_APPLIER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_OPERATION_APPLIER_H_
+
+#include <deque>
+
+#include <base/callback.h>
+#include <base/macros.h>
+#include <base/synchronization/condition_variable.h>
+#include <base/synchronization/lock.h>
+#include <base/threading/simple_thread.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// Applies the operations of a payload on a thread of its own, one at a time
+// and in the order they were pushed, so the operations can be decompressed
+// and written while the data of the next ones is still being downloaded. Up
+// to a given amount of operation data may be waiting to be applied; pushing
+// more blocks until enough of it was applied. Once an operation fails, the
+// rest are dropped.
+class OperationApplier : public base::DelegateSimpleThread::Delegate {
+ public:
+  // Applies the operation number |operation_num| with its |data| blob.
+  // Returns whether it succeeded.
+  using ApplyCallback = base::Callback<bool(size_t operation_num,
+                                            const InstallOperation& operation,
+                                            const brillo::Blob& data)>;
+
+  // Starts the thread that calls |apply| for each operation.
+  OperationApplier(const ApplyCallback& apply, uint64_t max_queued_bytes);
+
+  // Stops the thread as Stop() does.
+  ~OperationApplier() override;
+
+  // Queues |operation| with its |data| blob to be applied after the ones
+  // queued before. The |operation| must remain valid until it is applied.
+  // Waits first while the data already queued and the |data| are more than
+  // the limit, unless nothing else is queued.
+  void Push(size_t operation_num,
+            const InstallOperation* operation,
+            brillo::Blob data);
+
+  // Waits until all the queued operations are applied, or until one fails.
+  // Returns false if one failed.
+  bool Wait();
+
+  // Returns the number of operations applied since the last call. They are
+  // always the first ones that were pushed and not yet returned.
+  size_t TakeAppliedCount();
+
+  // Whether an operation failed.
+  bool failed();
+
+  // Drops the queued operations, waits for the one being applied, if any, and
+  // stops the thread. Nothing more may be pushed after this.
+  void Stop();
+
+  // Overrides DelegateSimpleThread::Delegate.
+  void Run() override;
+
+ private:
+  struct QueuedOperation {
+    size_t operation_num;
+    const InstallOperation* operation;
+    brillo::Blob data;
+  };
+
+  friend class OperationApplierTest;
+
+  const ApplyCallback apply_;
+  const uint64_t max_queued_bytes_;
+
+  base::Lock lock_;
+  // Signaled when the queue or the state of the thread change.
+  base::ConditionVariable changed_;
+
+  // The operations to apply. While |applying_| is true, the front one is being
+  // applied without the lock held.
+  std::deque<QueuedOperation> queue_;
+  uint64_t queued_bytes_{0};
+  bool applying_{false};
+  size_t applied_count_{0};
+  bool failed_{false};
+  bool stopping_{false};
+
+  base::DelegateSimpleThread thread_;
+
+  DISALLOW_COPY_AND_ASSIGN(OperationApplier);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_OPERATION_APPLIER_H_
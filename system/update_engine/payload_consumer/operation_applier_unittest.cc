@@ -0,0 +1,147 @@
+//
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/operation_applier.h"
+
+#include <thread>
+#include <vector>
+
+#include <base/bind.h>
+#include <base/synchronization/condition_variable.h>
+#include <gtest/gtest.h>
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+class OperationApplierTest : public ::testing::Test {
+ protected:
+  // Records the operation and fails the one numbered |fail_operation_num_|.
+  // The one numbered |block_operation_num_| waits for |unblocked_| first.
+  bool Apply(size_t operation_num,
+             const InstallOperation& operation,
+             const brillo::Blob& data) {
+    base::AutoLock auto_lock(lock_);
+    if (operation_num == block_operation_num_) {
+      blocked_ = true;
+      changed_.Broadcast();
+      while (!unblocked_)
+        changed_.Wait();
+    }
+    applied_.push_back(operation_num);
+    applied_bytes_ += data.size();
+    return operation_num != fail_operation_num_;
+  }
+
+  OperationApplier::ApplyCallback ApplyCallback() {
+    return base::Bind(&OperationApplierTest::Apply, base::Unretained(this));
+  }
+
+  // Whether Stop() was called on the |applier|.
+  bool Stopping(OperationApplier* applier) {
+    base::AutoLock auto_lock(applier->lock_);
+    return applier->stopping_;
+  }
+
+  base::Lock lock_;
+  // Signaled when |blocked_| or |unblocked_| change.
+  base::ConditionVariable changed_{&lock_};
+  vector<size_t> applied_;
+  uint64_t applied_bytes_{0};
+  size_t fail_operation_num_{static_cast<size_t>(-1)};
+  size_t block_operation_num_{static_cast<size_t>(-1)};
+  bool blocked_{false};
+  bool unblocked_{false};
+
+  InstallOperation operation_;
+};
+
+TEST_F(OperationApplierTest, AppliesInOrderTest) {
+  OperationApplier applier(ApplyCallback(), 1000);
+  size_t expected_bytes = 0;
+  for (size_t i = 0; i < 100; i++) {
+    applier.Push(i, &operation_, brillo::Blob(i * 10));
+    expected_bytes += i * 10;
+  }
+  EXPECT_TRUE(applier.Wait());
+  EXPECT_EQ(100u, applier.TakeAppliedCount());
+  EXPECT_EQ(0u, applier.TakeAppliedCount());
+
+  base::AutoLock auto_lock(lock_);
+  ASSERT_EQ(100u, applied_.size());
+  for (size_t i = 0; i < applied_.size(); i++)
+    EXPECT_EQ(i, applied_[i]);
+  EXPECT_EQ(expected_bytes, applied_bytes_);
+}
+
+TEST_F(OperationApplierTest, DataBiggerThanLimitTest) {
+  // Data bigger than the limit is still applied, once nothing else is queued.
+  OperationApplier applier(ApplyCallback(), 10);
+  applier.Push(0, &operation_, brillo::Blob(5));
+  applier.Push(1, &operation_, brillo::Blob(100));
+  applier.Push(2, &operation_, brillo::Blob(100));
+  EXPECT_TRUE(applier.Wait());
+  EXPECT_EQ(3u, applier.TakeAppliedCount());
+}
+
+TEST_F(OperationApplierTest, StopsAfterFailureTest) {
+  fail_operation_num_ = 5;
+  OperationApplier applier(ApplyCallback(), 1000);
+  for (size_t i = 0; i < 10; i++)
+    applier.Push(i, &operation_, brillo::Blob(10));
+  EXPECT_FALSE(applier.Wait());
+  EXPECT_TRUE(applier.failed());
+  EXPECT_EQ(5u, applier.TakeAppliedCount());
+  // Nothing is applied after the failure.
+  applier.Push(10, &operation_, brillo::Blob(10));
+  EXPECT_FALSE(applier.Wait());
+  applier.Stop();
+
+  base::AutoLock auto_lock(lock_);
+  EXPECT_EQ(6u, applied_.size());
+}
+
+TEST_F(OperationApplierTest, StopDropsQueuedOperationsTest) {
+  block_operation_num_ = 0;
+  OperationApplier applier(ApplyCallback(), 1000);
+  for (size_t i = 0; i < 10; i++)
+    applier.Push(i, &operation_, brillo::Blob(10));
+  {
+    base::AutoLock auto_lock(lock_);
+    while (!blocked_)
+      changed_.Wait();
+  }
+
+  // Stop() waits for the operation being applied, so it runs on a thread of
+  // its own and the first operation is only let go once the rest were
+  // dropped.
+  std::thread stopper([&applier] { applier.Stop(); });
+  while (!Stopping(&applier))
+    std::this_thread::yield();
+  {
+    base::AutoLock auto_lock(lock_);
+    unblocked_ = true;
+    changed_.Broadcast();
+  }
+  stopper.join();
+
+  EXPECT_FALSE(applier.failed());
+  EXPECT_EQ(1u, applier.TakeAppliedCount());
+  base::AutoLock auto_lock(lock_);
+  EXPECT_EQ(vector<size_t>{0}, applied_);
+}
+
+}  // namespace chromeos_update_engine
@@ -53,7 +53,6 @@ extern const uint32_t kImgdiffMinorPayloadVersion;
 extern const char kLegacyPartitionNameKernel[];
 extern const char kLegacyPartitionNameRoot[];
 
-extern const char kBspatchPath[];
 extern const char kDeltaMagic[4];
 
 // The list of compatible SHA256 hashes of zlib source code.
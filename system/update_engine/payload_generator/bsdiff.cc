@@ -0,0 +1,350 @@
+//
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/bsdiff.h"
+
+#include <bzlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/bzip.h"
+
+using std::min;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+const char kBsdiffMagic[] = "BSDIFF40";
+
+// Sorts the |len| suffixes in |index| from |start| by the |h| bytes after the
+// |h| bytes they are already sorted by, in the qsufsort algorithm of Larsson
+// and Sadakane that bsdiff uses. |group| holds the group of each suffix.
+void Split(int32_t* index, int32_t* group, int32_t start, int32_t len,
+           int32_t h) {
+  while (len >= 16) {
+    int32_t x = group[index[start + len / 2] + h];
+    int32_t jj = 0, kk = 0;
+    for (int32_t i = start; i < start + len; i++) {
+      if (group[index[i] + h] < x)
+        jj++;
+      if (group[index[i] + h] == x)
+        kk++;
+    }
+    jj += start;
+    kk += jj;
+
+    int32_t i = start, j = 0, k = 0;
+    while (i < jj) {
+      if (group[index[i] + h] < x) {
+        i++;
+      } else if (group[index[i] + h] == x) {
+        std::swap(index[i], index[jj + j]);
+        j++;
+      } else {
+        std::swap(index[i], index[kk + k]);
+        k++;
+      }
+    }
+    while (jj + j < kk) {
+      if (group[index[jj + j] + h] == x) {
+        j++;
+      } else {
+        std::swap(index[jj + j], index[kk + k]);
+        k++;
+      }
+    }
+
+    if (jj > start)
+      Split(index, group, start, jj - start, h);
+
+    for (i = 0; i < kk - jj; i++)
+      group[index[jj + i]] = kk - 1;
+    if (jj == kk - 1)
+      index[jj] = -1;
+
+    // The rest is split in this same call rather than recursing again.
+    len = start + len - kk;
+    start = kk;
+  }
+
+  // Few enough to sort by selection.
+  for (int32_t k = start, j; k < start + len; k += j) {
+    j = 1;
+    int32_t x = group[index[k] + h];
+    for (int32_t i = 1; k + i < start + len; i++) {
+      if (group[index[k + i] + h] < x) {
+        x = group[index[k + i] + h];
+        j = 0;
+      }
+      if (group[index[k + i] + h] == x) {
+        std::swap(index[k + j], index[k + i]);
+        j++;
+      }
+    }
+    for (int32_t i = 0; i < j; i++)
+      group[index[k + i]] = k + j - 1;
+    if (j == 1)
+      index[k] = -1;
+  }
+}
+
+void SortSuffixes(const uint8_t* data, int32_t size, int32_t* index) {
+  vector<int32_t> group(size + 1);
+  int32_t buckets[256] = {};
+  for (int32_t i = 0; i < size; i++)
+    buckets[data[i]]++;
+  for (int i = 1; i < 256; i++)
+    buckets[i] += buckets[i - 1];
+  for (int i = 255; i > 0; i--)
+    buckets[i] = buckets[i - 1];
+  buckets[0] = 0;
+
+  for (int32_t i = 0; i < size; i++)
+    index[++buckets[data[i]]] = i;
+  index[0] = size;
+  for (int32_t i = 0; i < size; i++)
+    group[i] = buckets[data[i]];
+  group[size] = 0;
+  for (int i = 1; i < 256; i++) {
+    if (buckets[i] == buckets[i - 1] + 1)
+      index[buckets[i]] = -1;
+  }
+  index[0] = -1;
+
+  // Negative entries in |index| mark runs of suffixes already sorted.
+  for (int32_t h = 1; index[0] != -(size + 1); h += h) {
+    int32_t len = 0;
+    int32_t i = 0;
+    while (i < size + 1) {
+      if (index[i] < 0) {
+        len -= index[i];
+        i -= index[i];
+      } else {
+        if (len)
+          index[i - len] = -len;
+        len = group[index[i]] + 1 - i;
+        Split(index, group.data(), i, len, h);
+        i += len;
+        len = 0;
+      }
+    }
+    if (len)
+      index[i - len] = -len;
+  }
+
+  for (int32_t i = 0; i < size + 1; i++)
+    index[group[i]] = i;
+}
+
+int32_t MatchLength(const uint8_t* a, int32_t a_size,
+                    const uint8_t* b, int32_t b_size) {
+  int32_t i = 0;
+  while (i < a_size && i < b_size && a[i] == b[i])
+    i++;
+  return i;
+}
+
+void EncodeOffset(int64_t value, uint8_t* buf) {
+  uint64_t magnitude = value < 0 ? -value : value;
+  for (int i = 0; i < 8; i++) {
+    buf[i] = magnitude & 0xFF;
+    magnitude >>= 8;
+  }
+  if (value < 0)
+    buf[7] |= 0x80;
+}
+
+// Compresses a stream of the patch. Unlike BzipCompress(), an empty |in|
+// still gives a valid bzip2 stream, as the bspatch tool expects one.
+bool CompressStream(const brillo::Blob& in, brillo::Blob* out) {
+  if (!in.empty())
+    return BzipCompress(in, out);
+  unsigned int size = 64;
+  out->resize(size);
+  char empty = 0;
+  TEST_AND_RETURN_FALSE(
+      BZ2_bzBuffToBuffCompress(reinterpret_cast<char*>(out->data()), &size,
+                               &empty, 0, 9, 0, 0) == BZ_OK);
+  out->resize(size);
+  return true;
+}
+
+}  // namespace
+
+SuffixArray::SuffixArray(brillo::Blob old_data)
+    : old_data_(std::move(old_data)) {
+  CHECK_LT(old_data_.size(),
+           static_cast<uint64_t>(std::numeric_limits<int32_t>::max()));
+  index_.resize(old_data_.size() + 1);
+  SortSuffixes(old_data_.data(), old_data_.size(), index_.data());
+}
+
+uint64_t SuffixArray::MemoryUsage(uint64_t size, bool building) {
+  // The old data and the index, plus the groups while sorting.
+  uint64_t usage = size + (size + 1) * sizeof(int32_t);
+  if (building)
+    usage += (size + 1) * sizeof(int32_t);
+  return usage;
+}
+
+int32_t SuffixArray::Search(const uint8_t* data, int32_t size,
+                            int32_t* pos) const {
+  const uint8_t* old = old_data_.data();
+  const int32_t old_size = old_data_.size();
+  int32_t st = 0, en = old_size;
+  while (en - st >= 2) {
+    int32_t x = st + (en - st) / 2;
+    if (memcmp(old + index_[x], data, min(old_size - index_[x], size)) < 0)
+      st = x;
+    else
+      en = x;
+  }
+  int32_t x = MatchLength(old + index_[st], old_size - index_[st], data, size);
+  int32_t y = MatchLength(old + index_[en], old_size - index_[en], data, size);
+  if (x > y) {
+    *pos = index_[st];
+    return x;
+  }
+  *pos = index_[en];
+  return y;
+}
+
+bool CreateBsdiffPatch(const SuffixArray& old_index,
+                       const brillo::Blob& new_data,
+                       brillo::Blob* patch) {
+  const uint8_t* old = old_index.old_data().data();
+  const int32_t old_size = old_index.old_data().size();
+  const uint8_t* data = new_data.data();
+  TEST_AND_RETURN_FALSE(new_data.size() <
+                        static_cast<uint64_t>(
+                            std::numeric_limits<int32_t>::max()));
+  const int32_t new_size = new_data.size();
+
+  brillo::Blob ctrl, diff, extra;
+  diff.reserve(new_size);
+  int32_t scan = 0, len = 0, pos = 0;
+  int32_t last_scan = 0, last_pos = 0, last_offset = 0;
+  while (scan < new_size) {
+    int32_t old_score = 0;
+    int32_t scsc;
+    for (scsc = scan += len; scan < new_size; scan++) {
+      len = old_index.Search(data + scan, new_size - scan, &pos);
+
+      for (; scsc < scan + len; scsc++) {
+        if (scsc + last_offset < old_size &&
+            old[scsc + last_offset] == data[scsc])
+          old_score++;
+      }
+
+      if ((len == old_score && len != 0) || len > old_score + 8)
+        break;
+
+      if (scan + last_offset < old_size &&
+          old[scan + last_offset] == data[scan])
+        old_score--;
+    }
+
+    if (len == old_score && scan != new_size)
+      continue;
+
+    // How far forward from the last match the old data still fits.
+    int32_t s = 0, best_forward = 0, len_forward = 0;
+    for (int32_t i = 0; last_scan + i < scan && last_pos + i < old_size;) {
+      if (old[last_pos + i] == data[last_scan + i])
+        s++;
+      i++;
+      if (s * 2 - i > best_forward * 2 - len_forward) {
+        best_forward = s;
+        len_forward = i;
+      }
+    }
+
+    // And how far back from the new match.
+    int32_t len_back = 0;
+    if (scan < new_size) {
+      int32_t best_back = 0;
+      s = 0;
+      for (int32_t i = 1; scan >= last_scan + i && pos >= i; i++) {
+        if (old[pos - i] == data[scan - i])
+          s++;
+        if (s * 2 - i > best_back * 2 - len_back) {
+          best_back = s;
+          len_back = i;
+        }
+      }
+    }
+
+    // Where they overlap, the split goes where it matches best.
+    if (last_scan + len_forward > scan - len_back) {
+      int32_t overlap = (last_scan + len_forward) - (scan - len_back);
+      int32_t best_split = 0, len_split = 0;
+      s = 0;
+      for (int32_t i = 0; i < overlap; i++) {
+        if (data[last_scan + len_forward - overlap + i] ==
+            old[last_pos + len_forward - overlap + i])
+          s++;
+        if (data[scan - len_back + i] == old[pos - len_back + i])
+          s--;
+        if (s > best_split) {
+          best_split = s;
+          len_split = i + 1;
+        }
+      }
+      len_forward += len_split - overlap;
+      len_back -= len_split;
+    }
+
+    for (int32_t i = 0; i < len_forward; i++)
+      diff.push_back(data[last_scan + i] - old[last_pos + i]);
+    int32_t extra_len = (scan - len_back) - (last_scan + len_forward);
+    extra.insert(extra.end(),
+                 data + last_scan + len_forward,
+                 data + last_scan + len_forward + extra_len);
+
+    uint8_t entry[24];
+    EncodeOffset(len_forward, entry);
+    EncodeOffset(extra_len, entry + 8);
+    EncodeOffset((pos - len_back) - (last_pos + len_forward), entry + 16);
+    ctrl.insert(ctrl.end(), entry, entry + sizeof(entry));
+
+    last_scan = scan - len_back;
+    last_pos = pos - len_back;
+    last_offset = pos - scan;
+  }
+
+  brillo::Blob ctrl_bz, diff_bz, extra_bz;
+  TEST_AND_RETURN_FALSE(CompressStream(ctrl, &ctrl_bz));
+  TEST_AND_RETURN_FALSE(CompressStream(diff, &diff_bz));
+  TEST_AND_RETURN_FALSE(CompressStream(extra, &extra_bz));
+
+  patch->assign(kBsdiffMagic, kBsdiffMagic + sizeof(kBsdiffMagic) - 1);
+  patch->resize(32);
+  EncodeOffset(ctrl_bz.size(), patch->data() + 8);
+  EncodeOffset(diff_bz.size(), patch->data() + 16);
+  EncodeOffset(new_size, patch->data() + 24);
+  patch->insert(patch->end(), ctrl_bz.begin(), ctrl_bz.end());
+  patch->insert(patch->end(), diff_bz.begin(), diff_bz.end());
+  patch->insert(patch->end(), extra_bz.begin(), extra_bz.end());
+  return true;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,69 @@
+//
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_BSDIFF_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_BSDIFF_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include <base/macros.h>
+#include <brillo/secure_blob.h>
+
+// In-process replacement for the bsdiff tool. The suffix array of the old
+// data, which is most of the work, is kept in a SuffixArray object so it can
+// be built once and used to diff any number of new data against the same old
+// data.
+
+namespace chromeos_update_engine {
+
+class SuffixArray {
+ public:
+  // Sorts the suffixes of |old_data|, which is moved into the object. The old
+  // data must be smaller than 2 GiB.
+  explicit SuffixArray(brillo::Blob old_data);
+
+  // Returns the number of bytes used to hold the suffix array of |size| bytes
+  // of old data, or to build it if |building| is true.
+  static uint64_t MemoryUsage(uint64_t size, bool building);
+
+  const brillo::Blob& old_data() const { return old_data_; }
+
+  // Finds a long match of the |size| bytes at |data| in the old data by the
+  // same binary search as the bsdiff tool, which may miss the longest one.
+  // Returns its length and stores its position in |pos|.
+  int32_t Search(const uint8_t* data, int32_t size, int32_t* pos) const;
+
+ private:
+  brillo::Blob old_data_;
+  // The position in |old_data_| of each suffix, in order, with the empty
+  // suffix first.
+  std::vector<int32_t> index_;
+
+  DISALLOW_COPY_AND_ASSIGN(SuffixArray);
+};
+
+// Generates in |patch| the bsdiff patch in the BSDIFF40 format to produce
+// |new_data| from the old data of |old_index|. The patch is the same the
+// bsdiff tool generates for those files. Returns false on failure.
+bool CreateBsdiffPatch(const SuffixArray& old_index,
+                       const brillo::Blob& new_data,
+                       brillo::Blob* patch);
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_BSDIFF_H_
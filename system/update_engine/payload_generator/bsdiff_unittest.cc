@@ -0,0 +1,123 @@
+//
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/bsdiff.h"
+
+#include <string.h>
+
+#include <random>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/payload_consumer/bspatch.h"
+#include "update_engine/payload_consumer/fake_extent_writer.h"
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+brillo::Blob ToBlob(const string& str) {
+  return brillo::Blob(str.begin(), str.end());
+}
+
+brillo::Blob RandomBlob(size_t size, uint32_t seed) {
+  std::mt19937 gen(seed);
+  brillo::Blob blob(size);
+  for (uint8_t& byte : blob)
+    byte = gen();
+  return blob;
+}
+
+// Diffs |new_data| against |old_index| and checks that applying the patch to
+// the old data gives |new_data| back. Returns the patch.
+brillo::Blob DiffAndApply(const SuffixArray& old_index,
+                          const brillo::Blob& new_data) {
+  brillo::Blob patch;
+  EXPECT_TRUE(CreateBsdiffPatch(old_index, new_data, &patch));
+  FakeExtentWriter writer;
+  writer.Init(nullptr, {}, 4096);
+  EXPECT_TRUE(ApplyBsdiffPatch(old_index.old_data().data(),
+                               old_index.old_data().size(),
+                               patch.data(), patch.size(),
+                               new_data.size(), &writer));
+  EXPECT_EQ(new_data, writer.WrittenData());
+  return patch;
+}
+
+}  // namespace
+
+class BsdiffTest : public ::testing::Test {};
+
+TEST_F(BsdiffTest, SearchTest) {
+  SuffixArray old_index(ToBlob("the quick brown fox jumps over the lazy dog"));
+  brillo::Blob query = ToBlob("the lazy cat");
+  int32_t pos = -1;
+  EXPECT_EQ(9, old_index.Search(query.data(), query.size(), &pos));
+  EXPECT_EQ(31, pos);
+  query = ToBlob("QRS");
+  EXPECT_EQ(0, old_index.Search(query.data(), query.size(), &pos));
+}
+
+TEST_F(BsdiffTest, SmallChangesTest) {
+  brillo::Blob old_data = RandomBlob(64 * 1024, 1);
+  brillo::Blob new_data = old_data;
+  // A few changed bytes, some inserted data and some removed.
+  for (size_t i = 1000; i < new_data.size(); i += 5000)
+    new_data[i]++;
+  brillo::Blob inserted = RandomBlob(300, 2);
+  new_data.insert(new_data.begin() + 20000, inserted.begin(), inserted.end());
+  new_data.erase(new_data.begin() + 40000, new_data.begin() + 41000);
+
+  SuffixArray old_index(old_data);
+  brillo::Blob patch = DiffAndApply(old_index, new_data);
+  // Random data doesn't compress, so only the changes make it big.
+  EXPECT_LT(patch.size(), 4 * 1024u);
+}
+
+TEST_F(BsdiffTest, EmptyDataTest) {
+  brillo::Blob data = RandomBlob(1000, 3);
+  DiffAndApply(SuffixArray(brillo::Blob()), data);
+  DiffAndApply(SuffixArray(data), brillo::Blob());
+  DiffAndApply(SuffixArray(data), data);
+}
+
+TEST_F(BsdiffTest, SameSuffixArrayTest) {
+  // The suffix array is only read, so it can be used for any new data.
+  brillo::Blob old_data = RandomBlob(16 * 1024, 4);
+  SuffixArray old_index(old_data);
+  for (uint32_t seed = 0; seed < 4; seed++) {
+    brillo::Blob new_data = old_data;
+    std::mt19937 gen(seed);
+    for (int i = 0; i < 10; i++)
+      new_data[gen() % new_data.size()] = gen();
+    DiffAndApply(old_index, new_data);
+  }
+  EXPECT_EQ(old_data, old_index.old_data());
+}
+
+TEST_F(BsdiffTest, RepetitiveDataTest) {
+  // Long runs of the same bytes are the worst case for sorting the suffixes.
+  brillo::Blob old_data(32 * 1024, 'a');
+  memset(old_data.data() + 10000, 'b', 5000);
+  brillo::Blob new_data(40 * 1024, 'a');
+  memset(new_data.data() + 12000, 'b', 3000);
+  DiffAndApply(SuffixArray(old_data), new_data);
+}
+
+}  // namespace chromeos_update_engine
@@ -19,6 +19,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -29,6 +30,7 @@
 #include <vector>
 
 #include <base/logging.h>
+#include <base/time/time.h>
 
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_consumer/delta_performer.h"
@@ -40,12 +42,28 @@
 #include "update_engine/payload_generator/inplace_generator.h"
 #include "update_engine/payload_generator/payload_file.h"
 
+using base::TimeTicks;
 using std::string;
 using std::unique_ptr;
 using std::vector;
 
 namespace chromeos_update_engine {
 
+namespace {
+
+// Logs how long the generation of |what| took since |start| and the peak
+// resident memory of the process so far.
+void LogGenerationStats(const string& what, TimeTicks start) {
+  struct rusage usage;
+  int64_t peak_rss_kib = getrusage(RUSAGE_SELF, &usage) == 0 ?
+      usage.ru_maxrss : -1;
+  LOG(INFO) << "Generated " << what << " in "
+            << (TimeTicks::Now() - start).InSecondsF()
+            << " seconds, peak RSS " << peak_rss_kib / 1024 << " MiB";
+}
+
+}  // namespace
+
 // bytes
 const size_t kRootFSPartitionSize = static_cast<size_t>(2) * 1024 * 1024 * 1024;
 const size_t kBlockSize = 4096;  // bytes
@@ -61,6 +79,8 @@ bool GenerateUpdatePayloadFile(
     return false;
   }
 
+  const TimeTicks start_time = TimeTicks::Now();
+
   // Create empty payload file object.
   PayloadFile payload;
   TEST_AND_RETURN_FALSE(payload.Init(config));
@@ -89,6 +109,7 @@ bool GenerateUpdatePayloadFile(
       LOG(INFO) << "Partition name: " << new_part.name;
       LOG(INFO) << "Partition size: " << new_part.size;
       LOG(INFO) << "Block count: " << new_part.size / config.block_size;
+      const TimeTicks partition_start_time = TimeTicks::Now();
 
       // Select payload generation strategy based on the config.
       unique_ptr<OperationsGenerator> strategy;
@@ -132,6 +153,8 @@ bool GenerateUpdatePayloadFile(
       diff_utils::FilterNoopOperations(&aops);
 
       TEST_AND_RETURN_FALSE(payload.AddPartition(old_part, new_part, aops));
+      LogGenerationStats("the operations of " + new_part.name,
+                         partition_start_time);
     }
   }
 
@@ -142,6 +165,7 @@ bool GenerateUpdatePayloadFile(
 
   LOG(INFO) << "All done. Successfully created delta file with "
             << "metadata size = " << *metadata_size;
+  LogGenerationStats("the payload", start_time);
   return true;
 }
 
@@ -16,17 +16,23 @@
 
 #include "update_engine/payload_generator/delta_diff_utils.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <algorithm>
 #include <map>
+#include <memory>
 
 #include <base/files/file_util.h>
 #include <base/format_macros.h>
 #include <base/strings/stringprintf.h>
+#include <base/threading/simple_thread.h>
 
 #include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/subprocess.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_generator/block_mapping.h"
+#include "update_engine/payload_generator/bsdiff.h"
 #include "update_engine/payload_generator/bzip.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
 #include "update_engine/payload_generator/extent_ranges.h"
@@ -40,7 +46,6 @@ using std::vector;
 namespace chromeos_update_engine {
 namespace {
 
-const char* const kBsdiffPath = "bsdiff";
 const char* const kImgdiffPath = "imgdiff";
 
 // The maximum destination size allowed for bsdiff. In general, bsdiff should
@@ -55,6 +60,11 @@ const uint64_t kMaxBsdiffDestinationSize = 200 * 1024 * 1024;  // bytes
 // intensive, so we limit these operations to 50 MiB.
 const uint64_t kMaxImgdiffDestinationSize = 50 * 1024 * 1024;  // bytes
 
+// The size of the chunks of a partition hashed separately in its
+// PartitionInfo, so the client can verify them in parallel. Small enough to
+// split even the kernel partition across a few threads.
+const uint64_t kPartitionHashChunkSize = 4 * 1024 * 1024;  // bytes
+
 // Process a range of blocks from |range_start| to |range_end| in the extent at
 // position |*idx_p| of |extents|. If |do_remove| is true, this range will be
 // removed, which may cause the extent to be trimmed, split or removed entirely.
@@ -162,6 +172,157 @@ bool ContainsGZip(const brillo::Blob& data) {
                      std::end(kGZipMagic)) != data.end();
 }
 
+// This class encapsulates the work of producing the operation for one chunk
+// of a file, so the chunks of all the files in a partition can be diffed by a
+// pool of threads. The resulting operation is kept until MergeOperation() is
+// called, which callers do in the order the chunks were created so the
+// operations come out in the same order regardless of the number of threads.
+class FileDeltaProcessor : public base::DelegateSimpleThread::Delegate {
+ public:
+  FileDeltaProcessor(const string& old_part,
+                     const string& new_part,
+                     const PayloadVersion& version,
+                     const vector<Extent>& old_extents,
+                     const vector<Extent>& new_extents,
+                     const string& name,
+                     SuffixArrayCache* suffix_array_cache,
+                     BlobFileWriter* blob_file)
+      : old_part_(old_part),
+        new_part_(new_part),
+        version_(version),
+        old_extents_(old_extents),
+        new_extents_(new_extents),
+        name_(name),
+        suffix_array_cache_(suffix_array_cache),
+        blob_file_(blob_file) {}
+  FileDeltaProcessor(FileDeltaProcessor&&) = default;
+  ~FileDeltaProcessor() override = default;
+
+  // Overrides DelegateSimpleThread::Delegate.
+  // Run() reads the old and new data of the chunk, stores the blob of the
+  // best operation to produce it in |blob_file_| and keeps the operation.
+  void Run() override;
+
+  // Appends the operation produced by Run(), if any, to |aops|. Returns false
+  // if Run() failed.
+  bool MergeOperation(vector<AnnotatedOperation>* aops);
+
+ private:
+  bool ProcessChunk();
+
+  // Work parameters.
+  string old_part_;
+  string new_part_;
+  const PayloadVersion& version_;
+  vector<Extent> old_extents_;
+  vector<Extent> new_extents_;
+  string name_;
+  SuffixArrayCache* suffix_array_cache_;
+  BlobFileWriter* blob_file_;
+
+  // The result of the work.
+  vector<AnnotatedOperation> file_aops_;
+  bool failed_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(FileDeltaProcessor);
+};
+
+void FileDeltaProcessor::Run() {
+  if (!ProcessChunk()) {
+    LOG(ERROR) << "Error generating the operation for " << name_;
+    failed_ = true;
+  }
+}
+
+bool FileDeltaProcessor::ProcessChunk() {
+  brillo::Blob data;
+  InstallOperation operation;
+  TEST_AND_RETURN_FALSE(diff_utils::ReadExtentsToDiff(old_part_,
+                                                      new_part_,
+                                                      old_extents_,
+                                                      new_extents_,
+                                                      version_,
+                                                      suffix_array_cache_,
+                                                      &data,
+                                                      &operation));
+
+  // Check if the operation writes nothing.
+  if (operation.dst_extents_size() == 0) {
+    if (operation.type() == InstallOperation::MOVE) {
+      LOG(INFO) << "Empty MOVE operation (" << name_ << "), skipping";
+      return true;
+    } else {
+      LOG(ERROR) << "Empty non-MOVE operation";
+      return false;
+    }
+  }
+
+  AnnotatedOperation aop;
+  aop.name = name_;
+  aop.op = operation;
+
+  // Write the data
+  TEST_AND_RETURN_FALSE(aop.SetOperationBlob(data, blob_file_));
+  file_aops_.emplace_back(aop);
+  return true;
+}
+
+bool FileDeltaProcessor::MergeOperation(vector<AnnotatedOperation>* aops) {
+  if (failed_)
+    return false;
+  for (AnnotatedOperation& aop : file_aops_)
+    aops->emplace_back(std::move(aop));
+  file_aops_.clear();
+  return true;
+}
+
+// Appends to |processors| the work to produce the file |name| from the blocks
+// |old_extents| in |old_part| to the blocks |new_extents| in |new_part|, split
+// in chunks of |chunk_blocks| blocks each or as a single chunk if
+// |chunk_blocks| is -1. Both the old and new file are split in the same
+// chunks. Note that this could drop some information from the old file used
+// for the new chunk. If the old file is smaller (or even empty when there's
+// no old file) the chunk will also be empty. The suffix arrays of the old
+// data are taken from |suffix_array_cache| if not null.
+void AddFileProcessors(vector<FileDeltaProcessor>* processors,
+                       const string& old_part,
+                       const string& new_part,
+                       const vector<Extent>& old_extents,
+                       const vector<Extent>& new_extents,
+                       const string& name,
+                       ssize_t chunk_blocks,
+                       const PayloadVersion& version,
+                       SuffixArrayCache* suffix_array_cache,
+                       BlobFileWriter* blob_file) {
+  uint64_t total_blocks = BlocksInExtents(new_extents);
+  if (chunk_blocks == -1)
+    chunk_blocks = total_blocks;
+
+  for (uint64_t block_offset = 0; block_offset < total_blocks;
+      block_offset += chunk_blocks) {
+    vector<Extent> old_extents_chunk = ExtentsSublist(
+        old_extents, block_offset, chunk_blocks);
+    vector<Extent> new_extents_chunk = ExtentsSublist(
+        new_extents, block_offset, chunk_blocks);
+    NormalizeExtents(&old_extents_chunk);
+    NormalizeExtents(&new_extents_chunk);
+
+    string chunk_name = name;
+    if (static_cast<uint64_t>(chunk_blocks) < total_blocks) {
+      chunk_name = base::StringPrintf(
+          "%s:%" PRIu64, name.c_str(), block_offset / chunk_blocks);
+    }
+    processors->emplace_back(old_part,
+                             new_part,
+                             version,
+                             old_extents_chunk,
+                             new_extents_chunk,
+                             chunk_name,
+                             suffix_array_cache,
+                             blob_file);
+  }
+}
+
 }  // namespace
 
 namespace diff_utils {
@@ -171,6 +332,8 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
                         const PartitionConfig& new_part,
                         ssize_t hard_chunk_blocks,
                         size_t soft_chunk_blocks,
+                        size_t max_threads,
+                        uint64_t suffix_array_memory_budget,
                         const PayloadVersion& version,
                         BlobFileWriter* blob_file) {
   ExtentRanges old_visited_blocks;
@@ -207,6 +370,10 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
   // packing or compression where the blocks store more than one file) are only
   // generated once in the new image, but are also used only once from the old
   // image due to some simplifications (see below).
+  // The blocks used by each file are decided here, in order, while the
+  // operations for them are generated later by a pool of threads.
+  SuffixArrayCache suffix_array_cache(suffix_array_memory_budget);
+  vector<FileDeltaProcessor> file_delta_processors;
   for (const FilesystemInterface::File& new_file : new_files) {
     // Ignore the files in the new filesystem without blocks. Symlinks with
     // data blocks (for example, symlinks bigger than 60 bytes in ext2) are
@@ -234,45 +401,74 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
         old_files_map[new_file.name], old_visited_blocks);
     old_visited_blocks.AddExtents(old_file_extents);
 
-    TEST_AND_RETURN_FALSE(DeltaReadFile(aops,
-                                        old_part.path,
-                                        new_part.path,
-                                        old_file_extents,
-                                        new_file_extents,
-                                        new_file.name,  // operation name
-                                        hard_chunk_blocks,
-                                        version,
-                                        blob_file));
+    AddFileProcessors(&file_delta_processors,
+                      old_part.path,
+                      new_part.path,
+                      old_file_extents,
+                      new_file_extents,
+                      new_file.name,  // operation name
+                      hard_chunk_blocks,
+                      version,
+                      &suffix_array_cache,
+                      blob_file);
   }
   // Process all the blocks not included in any file. We provided all the unused
   // blocks in the old partition as available data.
   vector<Extent> new_unvisited = {
       ExtentForRange(0, new_part.size / kBlockSize)};
   new_unvisited = FilterExtentRanges(new_unvisited, new_visited_blocks);
-  if (new_unvisited.empty())
-    return true;
+  if (!new_unvisited.empty()) {
+    vector<Extent> old_unvisited;
+    if (old_part.fs_interface) {
+      old_unvisited.push_back(ExtentForRange(0, old_part.size / kBlockSize));
+      old_unvisited = FilterExtentRanges(old_unvisited, old_visited_blocks);
+    }
 
-  vector<Extent> old_unvisited;
-  if (old_part.fs_interface) {
-    old_unvisited.push_back(ExtentForRange(0, old_part.size / kBlockSize));
-    old_unvisited = FilterExtentRanges(old_unvisited, old_visited_blocks);
+    LOG(INFO) << "Scanning " << BlocksInExtents(new_unvisited)
+              << " unwritten blocks using chunk size of "
+              << soft_chunk_blocks << " blocks.";
+    // We use the soft_chunk_blocks limit for the <non-file-data> as we don't
+    // really know the structure of this data and we should not expect it to
+    // have redundancy between partitions.
+    AddFileProcessors(&file_delta_processors,
+                      old_part.path,
+                      new_part.path,
+                      old_unvisited,
+                      new_unvisited,
+                      "<non-file-data>",  // operation name
+                      soft_chunk_blocks,
+                      version,
+                      &suffix_array_cache,
+                      blob_file);
   }
 
-  LOG(INFO) << "Scanning " << BlocksInExtents(new_unvisited)
-            << " unwritten blocks using chunk size of "
-            << soft_chunk_blocks << " blocks.";
-  // We use the soft_chunk_blocks limit for the <non-file-data> as we don't
-  // really know the structure of this data and we should not expect it to have
-  // redundancy between partitions.
-  TEST_AND_RETURN_FALSE(DeltaReadFile(aops,
-                                      old_part.path,
-                                      new_part.path,
-                                      old_unvisited,
-                                      new_unvisited,
-                                      "<non-file-data>",  // operation name
-                                      soft_chunk_blocks,
-                                      version,
-                                      blob_file));
+  if (max_threads == 0)
+    max_threads = std::max(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+  max_threads = std::min(max_threads, file_delta_processors.size());
+  if (max_threads > 0) {
+    LOG(INFO) << "Generating " << file_delta_processors.size()
+              << " operations for the files using " << max_threads
+              << " threads";
+    // Idle threads take the next chunk off the shared queue, so a few large
+    // files don't leave the other threads waiting.
+    base::DelegateSimpleThreadPool thread_pool("delta-read-partition",
+                                               max_threads);
+    thread_pool.Start();
+    for (FileDeltaProcessor& processor : file_delta_processors)
+      thread_pool.AddWork(&processor);
+    thread_pool.JoinAll();
+  }
+  LOG(INFO) << "Built " << suffix_array_cache.builds()
+            << " suffix arrays for bsdiff and reused "
+            << suffix_array_cache.hits() << ", using up to "
+            << suffix_array_cache.peak_memory_usage() / (1024 * 1024)
+            << " MiB of the " << suffix_array_memory_budget / (1024 * 1024)
+            << " MiB budget";
+
+  // The operations are added in the order of the files, as the blob offsets
+  // are reassigned in that order when the payload is written.
+  for (FileDeltaProcessor& processor : file_delta_processors)
+    TEST_AND_RETURN_FALSE(processor.MergeOperation(aops));
 
   return true;
 }
@@ -430,58 +626,20 @@ bool DeltaReadFile(vector<AnnotatedOperation>* aops,
                    ssize_t chunk_blocks,
                    const PayloadVersion& version,
                    BlobFileWriter* blob_file) {
-  brillo::Blob data;
-  InstallOperation operation;
-
-  uint64_t total_blocks = BlocksInExtents(new_extents);
-  if (chunk_blocks == -1)
-    chunk_blocks = total_blocks;
-
-  for (uint64_t block_offset = 0; block_offset < total_blocks;
-      block_offset += chunk_blocks) {
-    // Split the old/new file in the same chunks. Note that this could drop
-    // some information from the old file used for the new chunk. If the old
-    // file is smaller (or even empty when there's no old file) the chunk will
-    // also be empty.
-    vector<Extent> old_extents_chunk = ExtentsSublist(
-        old_extents, block_offset, chunk_blocks);
-    vector<Extent> new_extents_chunk = ExtentsSublist(
-        new_extents, block_offset, chunk_blocks);
-    NormalizeExtents(&old_extents_chunk);
-    NormalizeExtents(&new_extents_chunk);
-
-    TEST_AND_RETURN_FALSE(ReadExtentsToDiff(old_part,
-                                            new_part,
-                                            old_extents_chunk,
-                                            new_extents_chunk,
-                                            version,
-                                            &data,
-                                            &operation));
-
-    // Check if the operation writes nothing.
-    if (operation.dst_extents_size() == 0) {
-      if (operation.type() == InstallOperation::MOVE) {
-        LOG(INFO) << "Empty MOVE operation ("
-                  << name << "), skipping";
-        continue;
-      } else {
-        LOG(ERROR) << "Empty non-MOVE operation";
-        return false;
-      }
-    }
-
-    // Now, insert into the list of operations.
-    AnnotatedOperation aop;
-    aop.name = name;
-    if (static_cast<uint64_t>(chunk_blocks) < total_blocks) {
-      aop.name = base::StringPrintf("%s:%" PRIu64,
-                                    name.c_str(), block_offset / chunk_blocks);
-    }
-    aop.op = operation;
-
-    // Write the data
-    TEST_AND_RETURN_FALSE(aop.SetOperationBlob(data, blob_file));
-    aops->emplace_back(aop);
+  vector<FileDeltaProcessor> file_delta_processors;
+  AddFileProcessors(&file_delta_processors,
+                    old_part,
+                    new_part,
+                    old_extents,
+                    new_extents,
+                    name,
+                    chunk_blocks,
+                    version,
+                    nullptr,  // suffix_array_cache
+                    blob_file);
+  for (FileDeltaProcessor& processor : file_delta_processors) {
+    processor.Run();
+    TEST_AND_RETURN_FALSE(processor.MergeOperation(aops));
   }
   return true;
 }
@@ -545,6 +703,7 @@ bool ReadExtentsToDiff(const string& old_part,
                        const vector<Extent>& old_extents,
                        const vector<Extent>& new_extents,
                        const PayloadVersion& version,
+                       SuffixArrayCache* suffix_array_cache,
                        brillo::Blob* out_data,
                        InstallOperation* out_op) {
   InstallOperation operation;
@@ -610,21 +769,17 @@ bool ReadExtentsToDiff(const string& old_part,
     } else if (bsdiff_allowed || imgdiff_allowed) {
       // If the source file is considered bsdiff safe (no bsdiff bugs
       // triggered), see if BSDIFF encoding is smaller.
-      base::FilePath old_chunk;
-      TEST_AND_RETURN_FALSE(base::CreateTemporaryFile(&old_chunk));
-      ScopedPathUnlinker old_unlinker(old_chunk.value());
-      TEST_AND_RETURN_FALSE(utils::WriteFile(
-          old_chunk.value().c_str(), old_data.data(), old_data.size()));
-      base::FilePath new_chunk;
-      TEST_AND_RETURN_FALSE(base::CreateTemporaryFile(&new_chunk));
-      ScopedPathUnlinker new_unlinker(new_chunk.value());
-      TEST_AND_RETURN_FALSE(utils::WriteFile(
-          new_chunk.value().c_str(), new_data.data(), new_data.size()));
-
       if (bsdiff_allowed) {
+        // Sorting the suffixes of the old data is most of the work, so the
+        // suffix array is reused when the same old data was diffed before.
+        std::shared_ptr<const SuffixArray> old_index;
+        if (suffix_array_cache)
+          old_index = suffix_array_cache->Get(src_extents, old_data);
+        else
+          old_index = std::make_shared<const SuffixArray>(old_data);
         brillo::Blob bsdiff_delta;
-        TEST_AND_RETURN_FALSE(DiffFiles(
-            kBsdiffPath, old_chunk.value(), new_chunk.value(), &bsdiff_delta));
+        TEST_AND_RETURN_FALSE(
+            CreateBsdiffPatch(*old_index, new_data, &bsdiff_delta));
         CHECK_GT(bsdiff_delta.size(), static_cast<brillo::Blob::size_type>(0));
         if (bsdiff_delta.size() < data_blob.size()) {
           operation.set_type(
@@ -635,6 +790,17 @@ bool ReadExtentsToDiff(const string& old_part,
         }
       }
       if (imgdiff_allowed && ContainsGZip(old_data) && ContainsGZip(new_data)) {
+        base::FilePath old_chunk;
+        TEST_AND_RETURN_FALSE(base::CreateTemporaryFile(&old_chunk));
+        ScopedPathUnlinker old_unlinker(old_chunk.value());
+        TEST_AND_RETURN_FALSE(utils::WriteFile(
+            old_chunk.value().c_str(), old_data.data(), old_data.size()));
+        base::FilePath new_chunk;
+        TEST_AND_RETURN_FALSE(base::CreateTemporaryFile(&new_chunk));
+        ScopedPathUnlinker new_unlinker(new_chunk.value());
+        TEST_AND_RETURN_FALSE(utils::WriteFile(
+            new_chunk.value().c_str(), new_data.data(), new_data.size()));
+
         brillo::Blob imgdiff_delta;
         // Imgdiff might fail in some cases, only use the result if it succeed,
         // otherwise print the extents to analyze.
@@ -737,13 +903,31 @@ void FilterNoopOperations(vector<AnnotatedOperation>* ops) {
 
 bool InitializePartitionInfo(const PartitionConfig& part, PartitionInfo* info) {
   info->set_size(part.size);
+  int fd = open(part.path.c_str(), O_RDONLY);
+  TEST_AND_RETURN_FALSE_ERRNO(fd >= 0);
+  ScopedFdCloser fd_closer(&fd);
+
+  // The whole partition and each of its chunks are hashed in the same pass.
   HashCalculator hasher;
-  TEST_AND_RETURN_FALSE(hasher.UpdateFile(part.path, part.size) ==
-                        static_cast<off_t>(part.size));
+  info->set_hash_chunk_size(kPartitionHashChunkSize);
+  brillo::Blob chunk(kPartitionHashChunkSize);
+  for (uint64_t offset = 0; offset < part.size; offset += chunk.size()) {
+    size_t chunk_size = std::min<uint64_t>(chunk.size(), part.size - offset);
+    ssize_t bytes_read;
+    TEST_AND_RETURN_FALSE(
+        utils::PReadAll(fd, chunk.data(), chunk_size, offset, &bytes_read));
+    TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(chunk_size));
+    TEST_AND_RETURN_FALSE(hasher.Update(chunk.data(), chunk_size));
+    brillo::Blob chunk_hash;
+    TEST_AND_RETURN_FALSE(
+        HashCalculator::RawHashOfBytes(chunk.data(), chunk_size, &chunk_hash));
+    info->add_chunk_hashes(chunk_hash.data(), chunk_hash.size());
+  }
   TEST_AND_RETURN_FALSE(hasher.Finalize());
   const brillo::Blob& hash = hasher.raw_hash();
   info->set_hash(hash.data(), hash.size());
-  LOG(INFO) << part.path << ": size=" << part.size << " hash=" << hasher.hash();
+  LOG(INFO) << part.path << ": size=" << part.size << " hash=" << hasher.hash()
+            << " chunks=" << info->chunk_hashes_size();
   return true;
 }
 
@@ -25,6 +25,7 @@
 #include "update_engine/payload_generator/annotated_operation.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/payload_generation_config.h"
+#include "update_engine/payload_generator/suffix_array_cache.h"
 #include "update_engine/update_metadata.pb.h"
 
 namespace chromeos_update_engine {
@@ -41,11 +42,18 @@ namespace diff_utils {
 // is used to split MOVE and SOURCE_COPY operations and REPLACE_BZ of zeroed
 // blocks, while the hard limit is used to split a file when generating other
 // operations. A value of -1 in |hard_chunk_blocks| means whole files.
+// The files are diffed by up to |max_threads| threads, or one per CPU if
+// |max_threads| is 0, but the operations are added to |aops| in the same order
+// regardless of the number of threads. The suffix arrays of the old data used
+// to bsdiff it are shared by the threads and kept for reuse within
+// |suffix_array_memory_budget| bytes.
 bool DeltaReadPartition(std::vector<AnnotatedOperation>* aops,
                         const PartitionConfig& old_part,
                         const PartitionConfig& new_part,
                         ssize_t hard_chunk_blocks,
                         size_t soft_chunk_blocks,
+                        size_t max_threads,
+                        uint64_t suffix_array_memory_budget,
                         const PayloadVersion& version,
                         BlobFileWriter* blob_file);
 
@@ -93,18 +101,20 @@ bool DeltaReadFile(std::vector<AnnotatedOperation>* aops,
 // fills in |out_op|. If there's no change in old and new files, it creates a
 // MOVE or SOURCE_COPY operation. If there is a change, the smallest of the
 // operations allowed in the given |version| (REPLACE, REPLACE_BZ, BSDIFF,
-// SOURCE_BSDIFF or IMGDIFF) wins.
+// SOURCE_BSDIFF or IMGDIFF) wins. The suffix array of the old data for bsdiff
+// is taken from |suffix_array_cache| if not null, or built just for this call.
 // |new_extents| must not be empty. Returns true on success.
 bool ReadExtentsToDiff(const std::string& old_part,
                        const std::string& new_part,
                        const std::vector<Extent>& old_extents,
                        const std::vector<Extent>& new_extents,
                        const PayloadVersion& version,
+                       SuffixArrayCache* suffix_array_cache,
                        brillo::Blob* out_data,
                        InstallOperation* out_op);
 
-// Runs the bsdiff or imgdiff tool in |diff_path| on two files and returns the
-// resulting delta in |out|. Returns true on success.
+// Runs the diff tool in |diff_path|, such as imgdiff, on two files and returns
+// the resulting delta in |out|. Returns true on success.
 bool DiffFiles(const std::string& diff_path,
                const std::string& old_file,
                const std::string& new_file,
@@ -130,6 +140,8 @@ bool IsNoopOperation(const InstallOperation& op);
 // of the rest of the operations.
 void FilterNoopOperations(std::vector<AnnotatedOperation>* ops);
 
+// Sets the size of the |partition| in |info|, and the hashes of the whole
+// partition and of each of its chunks.
 bool InitializePartitionInfo(const PartitionConfig& partition,
                              PartitionInfo* info);
 
@@ -26,6 +26,7 @@
 #include <base/strings/stringprintf.h>
 #include <gtest/gtest.h>
 
+#include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/test_utils.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
@@ -180,6 +181,7 @@ TEST_F(DeltaDiffUtilsTest, MoveSmallTest) {
       old_extents,
       new_extents,
       PayloadVersion(kChromeOSMajorPayloadVersion, kInPlaceMinorPayloadVersion),
+      nullptr,  // suffix_array_cache
       &data,
       &op));
   EXPECT_TRUE(data.empty());
@@ -239,6 +241,7 @@ TEST_F(DeltaDiffUtilsTest, MoveWithSameBlock) {
       old_extents,
       new_extents,
       PayloadVersion(kChromeOSMajorPayloadVersion, kInPlaceMinorPayloadVersion),
+      nullptr,  // suffix_array_cache
       &data,
       &op));
 
@@ -302,6 +305,7 @@ TEST_F(DeltaDiffUtilsTest, BsdiffSmallTest) {
       old_extents,
       new_extents,
       PayloadVersion(kChromeOSMajorPayloadVersion, kInPlaceMinorPayloadVersion),
+      nullptr,  // suffix_array_cache
       &data,
       &op));
 
@@ -351,6 +355,7 @@ TEST_F(DeltaDiffUtilsTest, ReplaceSmallTest) {
         new_extents,
         PayloadVersion(kChromeOSMajorPayloadVersion,
                        kInPlaceMinorPayloadVersion),
+        nullptr,  // suffix_array_cache
         &data,
         &op));
     EXPECT_FALSE(data.empty());
@@ -391,6 +396,7 @@ TEST_F(DeltaDiffUtilsTest, SourceCopyTest) {
       old_extents,
       new_extents,
       PayloadVersion(kChromeOSMajorPayloadVersion, kSourceMinorPayloadVersion),
+      nullptr,  // suffix_array_cache
       &data,
       &op));
   EXPECT_TRUE(data.empty());
@@ -423,6 +429,7 @@ TEST_F(DeltaDiffUtilsTest, SourceBsdiffTest) {
       old_extents,
       new_extents,
       PayloadVersion(kChromeOSMajorPayloadVersion, kSourceMinorPayloadVersion),
+      nullptr,  // suffix_array_cache
       &data,
       &op));
 
@@ -703,4 +710,114 @@ TEST_F(DeltaDiffUtilsTest, ShuffledBlocksAreTracked) {
   EXPECT_EQ(0, blob_size_);
 }
 
+TEST_F(DeltaDiffUtilsTest, DeltaReadPartitionIsDeterministic) {
+  InitializePartitionWithUniqueBlocks(old_part_, block_size_, 42);
+
+  // The new partition has a byte changed in each of the first 110 blocks, so
+  // those need a diff while the rest are copied from the old partition.
+  brillo::Blob new_contents;
+  EXPECT_TRUE(utils::ReadFile(old_part_.path, &new_contents));
+  for (size_t block = 0; block < 110; block++)
+    new_contents[block * block_size_ + block_size_ / 2] = 'Y';
+  EXPECT_TRUE(test_utils::WriteFileVector(new_part_.path, new_contents));
+
+  // The blocks 100 to 109 are not in any file.
+  for (PartitionConfig* part : {&old_part_, &new_part_}) {
+    FakeFilesystem* fs = static_cast<FakeFilesystem*>(part->fs_interface.get());
+    fs->AddFile("/a", {ExtentForRange(0, 20)});
+    fs->AddFile("/b", {ExtentForRange(20, 50)});
+    fs->AddFile("/c", {ExtentForRange(70, 10)});
+  }
+
+  // The operations must be the same one by one however many threads generate
+  // them, and only their blobs' offsets in the blob file may differ.
+  PayloadVersion version(kChromeOSMajorPayloadVersion,
+                         kSourceMinorPayloadVersion);
+  // Small enough that the threads wait for each other's suffix arrays.
+  const uint64_t kSuffixArrayMemoryBudget = 256 * 1024;
+  vector<vector<AnnotatedOperation>> results;
+  vector<brillo::Blob> blobs;
+  for (size_t max_threads : {1, 4}) {
+    string blob_path;
+    int blob_fd = -1;
+    ASSERT_TRUE(utils::MakeTempFile("DeltaDiffUtilsTest-blob-XXXXXX",
+                                    &blob_path,
+                                    &blob_fd));
+    ScopedPathUnlinker blob_path_unlinker(blob_path);
+    ScopedFdCloser blob_fd_closer(&blob_fd);
+    off_t blob_size = 0;
+    BlobFileWriter blob_file(blob_fd, &blob_size);
+
+    vector<AnnotatedOperation> aops;
+    EXPECT_TRUE(diff_utils::DeltaReadPartition(&aops,
+                                               old_part_,
+                                               new_part_,
+                                               16,  // hard_chunk_blocks
+                                               32,  // soft_chunk_blocks
+                                               max_threads,
+                                               kSuffixArrayMemoryBudget,
+                                               version,
+                                               &blob_file));
+    brillo::Blob blob_contents;
+    EXPECT_TRUE(utils::ReadFile(blob_path, &blob_contents));
+    for (AnnotatedOperation& aop : aops) {
+      if (aop.op.has_data_offset()) {
+        blobs.emplace_back(
+            blob_contents.begin() + aop.op.data_offset(),
+            blob_contents.begin() + aop.op.data_offset() +
+                aop.op.data_length());
+        aop.op.clear_data_offset();
+      }
+    }
+    results.push_back(aops);
+  }
+
+  // Each chunk of each file got its own operation.
+  ASSERT_EQ(results[0].size(), results[1].size());
+  EXPECT_LT(6U, results[0].size());
+  for (size_t i = 0; i < results[0].size(); ++i) {
+    SCOPED_TRACE(base::StringPrintf("Failed on operation number %" PRIuS, i));
+    EXPECT_EQ(results[0][i].name, results[1][i].name);
+    EXPECT_EQ(results[0][i].op.SerializeAsString(),
+              results[1][i].op.SerializeAsString());
+  }
+  ASSERT_EQ(0U, blobs.size() % 2);
+  for (size_t i = 0; i < blobs.size() / 2; ++i)
+    EXPECT_EQ(blobs[i], blobs[blobs.size() / 2 + i]);
+}
+
+TEST_F(DeltaDiffUtilsTest, InitializePartitionInfoHashesChunks) {
+  PartitionConfig part("part");
+  ASSERT_TRUE(utils::MakeTempFile("DeltaDiffUtilsTest-part-XXXXXX",
+                                  &part.path,
+                                  nullptr));
+  ScopedPathUnlinker part_path_unlinker(part.path);
+  // Two whole chunks and a partial one.
+  brillo::Blob part_data(2 * 4 * 1024 * 1024 + 1000);
+  test_utils::FillWithData(&part_data);
+  ASSERT_TRUE(test_utils::WriteFileVector(part.path, part_data));
+  part.size = part_data.size();
+
+  PartitionInfo info;
+  EXPECT_TRUE(diff_utils::InitializePartitionInfo(part, &info));
+  EXPECT_EQ(part_data.size(), info.size());
+  brillo::Blob hash;
+  EXPECT_TRUE(HashCalculator::RawHashOfData(part_data, &hash));
+  EXPECT_EQ(hash, brillo::Blob(info.hash().begin(), info.hash().end()));
+
+  const uint64_t chunk_size = info.hash_chunk_size();
+  ASSERT_EQ(4u * 1024 * 1024, chunk_size);
+  ASSERT_EQ(3, info.chunk_hashes_size());
+  for (int i = 0; i < info.chunk_hashes_size(); ++i) {
+    uint64_t offset = i * chunk_size;
+    brillo::Blob chunk_hash;
+    EXPECT_TRUE(HashCalculator::RawHashOfBytes(
+        part_data.data() + offset,
+        std::min<uint64_t>(chunk_size, part_data.size() - offset),
+        &chunk_hash));
+    EXPECT_EQ(chunk_hash, brillo::Blob(info.chunk_hashes(i).begin(),
+                                       info.chunk_hashes(i).end()));
+  }
+}
+
 }  // namespace chromeos_update_engine
@@ -299,6 +299,13 @@ int Main(int argc, char** argv) {
                 "e.g. /path/to/sig:/path/to/next:/path/to/last_sig .");
   DEFINE_int32(chunk_size, 200 * 1024 * 1024,
                "Payload chunk size (-1 for whole files)");
+  DEFINE_uint64(max_threads, 0,
+                "Maximum number of threads used to generate the operations "
+                "(0 means one per CPU). It doesn't change the payload.");
+  DEFINE_uint64(suffix_array_memory_budget, 2048ULL * 1024 * 1024,
+                "Memory in bytes used by the suffix arrays to bsdiff a "
+                "partition, shared by all the threads. It doesn't change the "
+                "payload.");
   DEFINE_uint64(rootfs_partition_size,
                chromeos_update_engine::kRootFSPartitionSize,
                "RootFS partition size for the image once installed");
@@ -478,6 +485,8 @@ int Main(int argc, char** argv) {
   // Use the default soft_chunk_size defined in the config.
   payload_config.hard_chunk_size = FLAGS_chunk_size;
   payload_config.block_size = kBlockSize;
+  payload_config.max_threads = FLAGS_max_threads;
+  payload_config.suffix_array_memory_budget = FLAGS_suffix_array_memory_budget;
 
   // The partition size is never passed to the delta_generator, so we
   // need to detect those from the provided files.
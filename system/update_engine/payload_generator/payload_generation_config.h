@@ -176,6 +176,16 @@ struct PayloadGenerationConfig {
   // chunks.
   size_t soft_chunk_size = 2 * 1024 * 1024;
 
+  // The maximum number of threads used to generate the operations of a
+  // partition. A value of 0 means one thread per CPU. The payload is the same
+  // regardless of the number of threads.
+  size_t max_threads = 0;
+
+  // The memory in bytes the suffix arrays of the old data used to generate the
+  // bsdiff operations of a partition may take, counting those being built by
+  // all the threads and those kept to be reused.
+  uint64_t suffix_array_memory_budget = 2048ULL * 1024 * 1024;
+
   // TODO(deymo): Remove the block_size member and maybe replace it with a
   // minimum alignment size for blocks (if needed). Algorithms should be able to
   // pick the block_size they want, but for now only 4 KiB is supported.
@@ -0,0 +1,130 @@
+//
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/suffix_array_cache.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "update_engine/payload_generator/extent_utils.h"
+
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+SuffixArrayCache::SuffixArrayCache(uint64_t memory_budget)
+    : memory_budget_(memory_budget), changed_(&lock_) {}
+
+SuffixArrayCache::~SuffixArrayCache() {
+  // Destroyed here, while the lock and the rest of the members still exist.
+  std::map<string, Entry> entries;
+  {
+    base::AutoLock auto_lock(lock_);
+    entries.swap(entries_);
+  }
+}
+
+shared_ptr<const SuffixArray> SuffixArrayCache::Get(
+    const vector<Extent>& old_extents, const brillo::Blob& old_data) {
+  const string key = ExtentsToString(old_extents);
+  const uint64_t size = old_data.size();
+  const uint64_t build_usage = SuffixArray::MemoryUsage(size, true);
+
+  // Evicted suffix arrays are destroyed without holding the lock, as that
+  // releases their memory.
+  vector<shared_ptr<const SuffixArray>> evicted;
+  {
+    base::AutoLock auto_lock(lock_);
+    while (true) {
+      auto it = entries_.find(key);
+      if (it != entries_.end()) {
+        hits_++;
+        it->second.last_used = ++last_used_;
+        return it->second.suffix_array;
+      }
+      if (building_.count(key)) {
+        changed_.Wait();
+        continue;
+      }
+      if (memory_usage_ + build_usage <= memory_budget_ || memory_usage_ == 0)
+        break;
+      if (entries_.empty()) {
+        changed_.Wait();
+        continue;
+      }
+      EvictOldest(&evicted);
+      base::AutoUnlock auto_unlock(lock_);
+      evicted.clear();
+    }
+    building_.insert(key);
+    memory_usage_ += build_usage;
+    peak_memory_usage_ = std::max(peak_memory_usage_, memory_usage_);
+  }
+
+  // Only copied once it is known to be needed, not on a hit.
+  const SuffixArray* suffix_array = new SuffixArray(old_data);
+  const uint64_t usage = SuffixArray::MemoryUsage(size, false);
+  shared_ptr<const SuffixArray> result(
+      suffix_array, [this, usage](const SuffixArray* suffix_array) {
+        delete suffix_array;
+        Release(usage);
+      });
+
+  base::AutoLock auto_lock(lock_);
+  memory_usage_ -= build_usage - usage;
+  builds_++;
+  building_.erase(key);
+  entries_[key] = {result, ++last_used_};
+  changed_.Broadcast();
+  return result;
+}
+
+uint64_t SuffixArrayCache::hits() const {
+  base::AutoLock auto_lock(lock_);
+  return hits_;
+}
+
+uint64_t SuffixArrayCache::builds() const {
+  base::AutoLock auto_lock(lock_);
+  return builds_;
+}
+
+uint64_t SuffixArrayCache::peak_memory_usage() const {
+  base::AutoLock auto_lock(lock_);
+  return peak_memory_usage_;
+}
+
+void SuffixArrayCache::Release(uint64_t bytes) {
+  base::AutoLock auto_lock(lock_);
+  memory_usage_ -= bytes;
+  changed_.Broadcast();
+}
+
+void SuffixArrayCache::EvictOldest(
+    vector<shared_ptr<const SuffixArray>>* evicted) {
+  auto oldest = std::min_element(
+      entries_.begin(), entries_.end(),
+      [](const std::pair<const string, Entry>& a,
+         const std::pair<const string, Entry>& b) {
+        return a.second.last_used < b.second.last_used;
+      });
+  evicted->push_back(std::move(oldest->second.suffix_array));
+  entries_.erase(oldest);
+}
+
+}  // namespace chromeos_update_engine
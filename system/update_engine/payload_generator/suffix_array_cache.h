@@ -0,0 +1,98 @@
+//
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_SUFFIX_ARRAY_CACHE_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_SUFFIX_ARRAY_CACHE_H_
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+#include <base/synchronization/condition_variable.h>
+#include <base/synchronization/lock.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/payload_generator/bsdiff.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// Keeps the suffix arrays built to bsdiff the old data of a partition, keyed
+// by the old extents they were read from, so diffing against the same old
+// data again doesn't sort it again. All the suffix arrays alive, whether in
+// the cache or still used after they were evicted, and those being built are
+// kept within a memory budget: getting a new one first evicts the least
+// recently used ones, and then waits for the others to be released. A single
+// suffix array bigger than the budget is still built when no other exists.
+// This class is thread-safe.
+class SuffixArrayCache {
+ public:
+  explicit SuffixArrayCache(uint64_t memory_budget);
+  ~SuffixArrayCache();
+
+  // Returns the suffix array of |old_data|, which was read from the blocks
+  // |old_extents| of the partition, building it if it is not in the cache.
+  // If another thread is building the same one, waits for it. A suffix array
+  // built here holds its own copy of |old_data|, which is counted in the
+  // memory budget. The returned suffix arrays must be released before the
+  // cache is destroyed.
+  std::shared_ptr<const SuffixArray> Get(const std::vector<Extent>& old_extents,
+                                         const brillo::Blob& old_data);
+
+  // Statistics of the use of the cache.
+  uint64_t hits() const;
+  uint64_t builds() const;
+  uint64_t peak_memory_usage() const;
+
+ private:
+  struct Entry {
+    std::shared_ptr<const SuffixArray> suffix_array;
+    uint64_t last_used;
+  };
+
+  // Called when a suffix array of |bytes| is destroyed.
+  void Release(uint64_t bytes);
+
+  // Moves the least recently used entry of the cache to |evicted|.
+  void EvictOldest(std::vector<std::shared_ptr<const SuffixArray>>* evicted);
+
+  const uint64_t memory_budget_;
+
+  mutable base::Lock lock_;
+  // Signaled when a build finishes or a suffix array is released.
+  base::ConditionVariable changed_;
+
+  // The memory of the suffix arrays alive and being built.
+  uint64_t memory_usage_{0};
+  uint64_t peak_memory_usage_{0};
+
+  uint64_t hits_{0};
+  uint64_t builds_{0};
+  uint64_t last_used_{0};
+
+  // The keys of the suffix arrays being built.
+  std::set<std::string> building_;
+  std::map<std::string, Entry> entries_;
+
+  DISALLOW_COPY_AND_ASSIGN(SuffixArrayCache);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_SUFFIX_ARRAY_CACHE_H_
@@ -0,0 +1,111 @@
+//
+// Copyright (C) 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/suffix_array_cache.h"
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/payload_generator/extent_ranges.h"
+
+using std::shared_ptr;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+const size_t kDataSize = 8 * 1024;
+
+// The data of the blocks from |start_block|, as it would be read from the
+// partition.
+brillo::Blob DataAt(uint64_t start_block) {
+  brillo::Blob data(kDataSize);
+  for (size_t i = 0; i < data.size(); i++)
+    data[i] = (start_block * 31 + i * 7) ^ (i >> 8);
+  return data;
+}
+
+vector<Extent> ExtentsAt(uint64_t start_block) {
+  return {ExtentForRange(start_block, kDataSize / 4096)};
+}
+
+}  // namespace
+
+class SuffixArrayCacheTest : public ::testing::Test {
+ protected:
+  const uint64_t build_usage_ = SuffixArray::MemoryUsage(kDataSize, true);
+};
+
+TEST_F(SuffixArrayCacheTest, ReusesSameExtentsTest) {
+  SuffixArrayCache cache(4 * build_usage_);
+  shared_ptr<const SuffixArray> first = cache.Get(ExtentsAt(0), DataAt(0));
+  shared_ptr<const SuffixArray> second = cache.Get(ExtentsAt(0), DataAt(0));
+  EXPECT_EQ(first.get(), second.get());
+  shared_ptr<const SuffixArray> other = cache.Get(ExtentsAt(10), DataAt(10));
+  EXPECT_NE(first.get(), other.get());
+  EXPECT_EQ(DataAt(10), other->old_data());
+  EXPECT_EQ(2u, cache.builds());
+  EXPECT_EQ(1u, cache.hits());
+}
+
+TEST_F(SuffixArrayCacheTest, EvictsLeastRecentlyUsedTest) {
+  // Room to build one while holding another.
+  SuffixArrayCache cache(2 * build_usage_);
+  cache.Get(ExtentsAt(0), DataAt(0));
+  cache.Get(ExtentsAt(10), DataAt(10));
+  cache.Get(ExtentsAt(0), DataAt(0));
+  // Evicts the one at 10, which was used least recently.
+  cache.Get(ExtentsAt(20), DataAt(20));
+  cache.Get(ExtentsAt(0), DataAt(0));
+  EXPECT_EQ(3u, cache.builds());
+  EXPECT_EQ(2u, cache.hits());
+  EXPECT_LE(cache.peak_memory_usage(), 2 * build_usage_);
+}
+
+TEST_F(SuffixArrayCacheTest, OverBudgetTest) {
+  // A budget too small for any suffix array still builds one at a time.
+  SuffixArrayCache cache(1);
+  shared_ptr<const SuffixArray> first = cache.Get(ExtentsAt(0), DataAt(0));
+  first.reset();
+  shared_ptr<const SuffixArray> second = cache.Get(ExtentsAt(10), DataAt(10));
+  EXPECT_EQ(DataAt(10), second->old_data());
+  EXPECT_EQ(build_usage_, cache.peak_memory_usage());
+}
+
+TEST_F(SuffixArrayCacheTest, ThreadsStayWithinBudgetTest) {
+  SuffixArrayCache cache(3 * build_usage_);
+  vector<std::thread> threads;
+  for (int i = 0; i < 8; i++) {
+    threads.emplace_back([&cache, i] {
+      for (int j = 0; j < 20; j++) {
+        uint64_t start_block = 10 * ((i + j) % 6);
+        shared_ptr<const SuffixArray> suffix_array =
+            cache.Get(ExtentsAt(start_block), DataAt(start_block));
+        EXPECT_EQ(DataAt(start_block), suffix_array->old_data());
+      }
+    });
+  }
+  for (std::thread& thread : threads)
+    thread.join();
+  EXPECT_EQ(8u * 20, cache.builds() + cache.hits());
+  EXPECT_LE(cache.peak_memory_usage(), 3 * build_usage_);
+}
+
+}  // namespace chromeos_update_engine
@@ -420,6 +420,60 @@ ssize_t HandleError(int fd, const HttpRequest& request) {
   return written;
 }
 
+// Handles /file/<path> requests by returning the contents of the local file
+// /<path> in the requested range, as a payload server would. Returns the total
+// number of bytes delivered or -1 for error.
+ssize_t HandleFile(int fd, const HttpRequest& request) {
+  const string path = request.url.substr(strlen("/file"));
+  int file_fd = HANDLE_EINTR(open(path.c_str(), O_RDONLY));
+  if (file_fd < 0) {
+    PLOG(WARNING) << "Unable to open " << path;
+    return HandleError(fd, request);
+  }
+  struct stat stbuf;
+  CHECK_EQ(fstat(file_fd, &stbuf), 0);
+  const off_t total_length = stbuf.st_size;
+
+  const off_t start_offset = request.start_offset;
+  if (start_offset >= total_length) {
+    close(file_fd);
+    return WriteHeaders(fd, total_length, total_length,
+                        kHttpResponseReqRangeNotSat);
+  }
+  const off_t end_offset = (request.end_offset > 0 ?
+                            std::min(request.end_offset, total_length) :
+                            total_length);
+  if (end_offset < start_offset) {
+    close(file_fd);
+    return WriteHeaders(fd, 0, 0, kHttpResponseBadRequest);
+  }
+
+  ssize_t ret;
+  size_t written = 0;
+  if ((ret = WriteHeaders(fd, start_offset, end_offset,
+                          request.return_code)) < 0) {
+    close(file_fd);
+    return -1;
+  }
+  written += ret;
+
+  LOG(INFO) << "sending " << path << ": range=" << start_offset << "-"
+            << (end_offset - 1) << "/" << total_length;
+  char buf[64 * 1024];
+  off_t offset = start_offset;
+  while (offset < end_offset) {
+    const size_t chunk_size =
+        std::min(static_cast<off_t>(sizeof(buf)), end_offset - offset);
+    ssize_t bytes_read = HANDLE_EINTR(pread(file_fd, buf, chunk_size, offset));
+    if (bytes_read <= 0 || (ret = WriteString(fd, string(buf, bytes_read))) < 0)
+      break;
+    offset += bytes_read;
+    written += ret;
+  }
+  close(file_fd);
+  return offset == end_offset ? written : -1;
+}
+
 // Generate an error response if the requested offset is nonzero, up to a given
 // maximal number of successive failures.  The error generated is an "Internal
 // Server Error" (500).
@@ -539,6 +593,8 @@ void HandleConnection(int fd) {
     HandleEchoHeaders(fd, request);
   } else if (url == "/hang") {
     HandleHang(fd);
+  } else if (base::StartsWith(url, "/file/", base::CompareCase::SENSITIVE)) {
+    HandleFile(fd, request);
   } else {
     HandleDefault(fd, request);
   }
@@ -175,7 +175,9 @@
         'common/subprocess.cc',
         'common/terminator.cc',
         'common/utils.cc',
+        'payload_consumer/bspatch.cc',
         'payload_consumer/bzip_extent_writer.cc',
+        'payload_consumer/chunk_hash_verifier.cc',
         'payload_consumer/delta_performer.cc',
         'payload_consumer/download_action.cc',
         'payload_consumer/extent_writer.cc',
@@ -183,6 +185,7 @@
         'payload_consumer/file_writer.cc',
         'payload_consumer/filesystem_verifier_action.cc',
         'payload_consumer/install_plan.cc',
+        'payload_consumer/operation_applier.cc',
         'payload_consumer/payload_constants.cc',
         'payload_consumer/payload_verifier.cc',
         'payload_consumer/postinstall_runner_action.cc',
@@ -380,6 +383,7 @@
         'payload_generator/annotated_operation.cc',
         'payload_generator/blob_file_writer.cc',
         'payload_generator/block_mapping.cc',
+        'payload_generator/bsdiff.cc',
         'payload_generator/bzip.cc',
         'payload_generator/cycle_breaker.cc',
         'payload_generator/delta_diff_generator.cc',
@@ -395,6 +399,7 @@
         'payload_generator/payload_generation_config.cc',
         'payload_generator/payload_signer.cc',
         'payload_generator/raw_filesystem.cc',
+        'payload_generator/suffix_array_cache.cc',
         'payload_generator/tarjan.cc',
         'payload_generator/topological_sort.cc',
         'payload_generator/xz_chromeos.cc',
@@ -502,18 +507,22 @@
             'omaha_request_params_unittest.cc',
             'omaha_response_handler_action_unittest.cc',
             'p2p_manager_unittest.cc',
+            'payload_consumer/bspatch_unittest.cc',
             'payload_consumer/bzip_extent_writer_unittest.cc',
+            'payload_consumer/chunk_hash_verifier_unittest.cc',
             'payload_consumer/delta_performer_integration_test.cc',
             'payload_consumer/delta_performer_unittest.cc',
             'payload_consumer/download_action_unittest.cc',
             'payload_consumer/extent_writer_unittest.cc',
             'payload_consumer/file_writer_unittest.cc',
             'payload_consumer/filesystem_verifier_action_unittest.cc',
+            'payload_consumer/operation_applier_unittest.cc',
             'payload_consumer/postinstall_runner_action_unittest.cc',
             'payload_consumer/xz_extent_writer_unittest.cc',
             'payload_generator/ab_generator_unittest.cc',
             'payload_generator/blob_file_writer_unittest.cc',
             'payload_generator/block_mapping_unittest.cc',
+            'payload_generator/bsdiff_unittest.cc',
             'payload_generator/cycle_breaker_unittest.cc',
             'payload_generator/delta_diff_utils_unittest.cc',
             'payload_generator/ext2_filesystem_unittest.cc',
@@ -526,6 +535,7 @@
             'payload_generator/payload_file_unittest.cc',
             'payload_generator/payload_generation_config_unittest.cc',
             'payload_generator/payload_signer_unittest.cc',
+            'payload_generator/suffix_array_cache_unittest.cc',
             'payload_generator/tarjan_unittest.cc',
             'payload_generator/topological_sort_unittest.cc',
             'payload_generator/zip_unittest.cc',